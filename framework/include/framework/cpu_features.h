@@ -0,0 +1,26 @@
+#pragma once
+
+// Runtime detection of the SIMD instruction sets that optimized kernels may dispatch to.
+// Kernels are compiled for a specific instruction set with the CPU_TARGET_* attributes below, such that the
+// rest of the project can keep targeting the baseline ISA.
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CPU_FEATURES_X86 1
+#endif
+
+#if defined(CPU_FEATURES_X86) && (defined(__GNUC__) || defined(__clang__))
+#define CPU_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define CPU_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+// MSVC allows intrinsics of any instruction set without changing the compilation target.
+#define CPU_TARGET_SSE41
+#define CPU_TARGET_AVX2
+#endif
+
+struct CPUFeatures {
+    bool sse41 { false };
+    bool avx2 { false }; // Also implies FMA3 support.
+};
+
+// Detected once on first use; overrides (for testing/benchmarking the fallback paths) can be applied through setCPUFeatures.
+[[nodiscard]] const CPUFeatures& getCPUFeatures();
+void setCPUFeatures(const CPUFeatures& features);
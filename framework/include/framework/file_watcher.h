@@ -0,0 +1,40 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Watches a directory (including its sub directories at the time of construction) for files that are modified on a
+// background thread. Uses inotify on Linux and falls back to polling the modification times elsewhere.
+class FileWatcher {
+public:
+    FileWatcher(std::filesystem::path directory);
+    FileWatcher(const FileWatcher&) = delete;
+    ~FileWatcher();
+
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    struct FileChange {
+        std::filesystem::path filePath;
+        std::chrono::steady_clock::time_point time; // When the change was detected.
+    };
+    // Files that changed since the previous call (a file that is saved multiple times is reported once).
+    [[nodiscard]] std::vector<FileChange> takeChanges();
+
+private:
+    void addChange(const std::filesystem::path& filePath);
+#ifdef __linux__
+    void inotifyLoop(int inotifyFd);
+#endif
+    void pollingLoop();
+
+private:
+    std::filesystem::path m_directory;
+    std::mutex m_mutex;
+    std::vector<FileChange> m_changes;
+    std::atomic_bool m_stop { false };
+    std::thread m_thread;
+};
@@ -0,0 +1,84 @@
+#pragma once
+#include "opengl_includes.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Shadows the OpenGL state that is changed most often and filters out calls that would not change it. All code that
+// changes this state must go through the cache (or call invalidate() afterwards), otherwise the shadow copy goes stale.
+// Objects that are deleted must be forgotten (OpenGL unbinds deleted objects, and their names may be reused).
+//
+// There is one cache per thread because an OpenGL context can only be current on one thread at a time.
+class GLStateCache {
+public:
+    static GLStateCache& get();
+
+    void useProgram(GLuint program);
+    void bindVertexArray(GLuint vertexArray);
+    // Unit is a zero based index (not GL_TEXTURE0 + i).
+    void bindTexture(GLuint unit, GLenum target, GLuint texture);
+    // Bind to whichever unit is active (for creating or updating a texture).
+    void bindTextureToActiveUnit(GLenum target, GLuint texture);
+    void bindUniformBuffer(GLuint index, GLuint buffer);
+    void bindUniformBufferRange(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+
+    void setBlend(bool enabled);
+    void setBlendFunc(GLenum sourceFactor, GLenum destinationFactor);
+    void setDepthTest(bool enabled);
+    void setDepthWrite(bool enabled);
+    void setDepthFunc(GLenum func);
+    void setCullFace(bool enabled);
+    void setCullMode(GLenum mode);
+
+    void forgetProgram(GLuint program);
+    void forgetVertexArray(GLuint vertexArray);
+    void forgetTexture(GLuint texture);
+    void forgetBuffer(GLuint buffer);
+
+    // Forget all cached state (e.g. after third-party code such as Dear ImGui changed it).
+    void invalidate();
+
+    // When disabled every call is forwarded to OpenGL (for debugging state related issues).
+    void setEnabled(bool enabled);
+    [[nodiscard]] bool isEnabled() const;
+
+    struct Statistics {
+        uint64_t numCalls { 0 };
+        uint64_t numFilteredCalls { 0 }; // Calls that were not forwarded because they would not have changed anything.
+    };
+    [[nodiscard]] Statistics getStatistics() const;
+    void resetStatistics();
+
+private:
+    GLStateCache();
+
+    // Returns whether the call must be forwarded, and updates the cached value.
+    template <typename T>
+    bool update(T& cached, const T& value);
+
+private:
+    static constexpr GLuint unknown = 0xFFFFFFFF;
+    static constexpr size_t maxTextureUnits = 32;
+    static constexpr size_t maxUniformBufferBindings = 32;
+    static constexpr size_t numTextureTargets = 5; // See textureTargetIndex() in gl_state.cpp.
+
+    struct BufferRange {
+        GLuint buffer;
+        GLintptr offset;
+        GLsizeiptr size; // -1 for the whole buffer (glBindBufferBase).
+        bool operator==(const BufferRange&) const = default;
+    };
+
+    bool m_enabled { true };
+    Statistics m_statistics;
+
+    GLuint m_program;
+    GLuint m_vertexArray;
+    GLuint m_activeTextureUnit;
+    std::array<std::array<GLuint, numTextureTargets>, maxTextureUnits> m_textures;
+    std::array<BufferRange, maxUniformBufferBindings> m_uniformBuffers;
+    // Capabilities and enums use unknown as well.
+    GLuint m_blend, m_depthTest, m_depthWrite, m_cullFace;
+    std::array<GLuint, 2> m_blendFunc;
+    GLuint m_depthFunc, m_cullMode;
+};
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string_view>
+
+// 64-bit FNV-1a (http://www.isthe.com/chongo/tech/comp/fnv/). Not cryptographic, but fast, simple and usable at compile time.
+inline constexpr uint64_t fnv1aOffsetBasis = 0xcbf29ce484222325ull;
+
+[[nodiscard]] constexpr uint64_t fnv1a(std::string_view data, uint64_t hash = fnv1aOffsetBasis)
+{
+    for (char c : data) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// Variant for large binary blobs (e.g. image contents) that consumes 8 bytes per step; does not produce the same values as the byte-wise version.
+[[nodiscard]] inline uint64_t fnv1aWords(std::span<const std::byte> data, uint64_t hash = fnv1aOffsetBasis)
+{
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= data.size(); i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data.data() + i, sizeof(word));
+        hash ^= word;
+        hash *= 0x100000001b3ull;
+        hash ^= hash >> 32; // Mix the high bits back in since the multiplication only propagates upwards.
+    }
+    for (; i < data.size(); i++) {
+        hash ^= static_cast<uint8_t>(data[i]);
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
@@ -14,6 +14,8 @@ DISABLE_WARNINGS_POP()
 struct Image {
 public:
     explicit Image(const std::filesystem::path& filePath);
+    // Create a black image of the given size.
+    Image(int imageWidth, int imageHeight, int imageChannels);
 
 
     void writeBitmapToFile(const std::filesystem::path& filePath);
@@ -44,6 +46,9 @@ public:
     uint8_t* get_data() {
         return pixels.data();
     }
+    const uint8_t* get_data() const {
+        return pixels.data();
+    }
 
 private:
     std::vector<uint8_t> pixels;
@@ -0,0 +1,41 @@
+#pragma once
+#include "image.h"
+// Suppress warnings in third-party code.
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec2.hpp>
+DISABLE_WARNINGS_POP()
+#include <array>
+#include <span>
+#include <vector>
+
+// Resampling and format conversion of 8-bit images. All kernels dispatch at runtime to SSE4.1/AVX2
+// implementations when available and split the work over all cores in blocks of rows.
+
+enum class ResizeFilter {
+    Box, // Averages all covered pixels; nearest neighbour when upsampling.
+    Bilinear, // Tent filter (widened when downsampling).
+    Lanczos3 // Windowed sinc with 3 lobes; sharpest but may ring near hard edges.
+};
+
+// Separable resize of an image with any number of channels.
+[[nodiscard]] Image resizeImage(const Image& image, const glm::ivec2& newSize, ResizeFilter filter = ResizeFilter::Lanczos3);
+
+// Convert between 1 (grey), 3 (RGB) and 4 (RGBA) channels. Grey is replicated to RGB and
+// RGB is converted to grey using Rec. 709 luma weights; a missing alpha channel becomes opaque.
+[[nodiscard]] Image convertImageChannels(const Image& image, int channels);
+
+// Reorder/select channels: output channel i is copied from input channel sourceChannels[i],
+// or set to swizzleZero/swizzleOne. The output has as many channels as sourceChannels has entries (1 to 4).
+inline constexpr int swizzleZero = -1;
+inline constexpr int swizzleOne = -2;
+[[nodiscard]] Image swizzleImageChannels(const Image& image, std::span<const int> sourceChannels);
+
+// Convert to/from interleaved floats in the range [0, 1]. Values are clamped and rounded when converting back.
+[[nodiscard]] std::vector<float> imageToFloat(const Image& image);
+[[nodiscard]] Image imageFromFloat(std::span<const float> pixels, int width, int height, int channels);
+
+// Low level kernels operating on a contiguous range of values (used by the functions above).
+void convertU8ToFloat(std::span<const uint8_t> in, std::span<float> out);
+void convertFloatToU8(std::span<const float> in, std::span<uint8_t> out);
+void expandRGBToRGBA(std::span<const uint8_t> rgb, std::span<uint8_t> rgba);
@@ -0,0 +1,37 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+
+namespace detail {
+// Call worker(pContext) on the calling thread and on numHelpers threads of a pool that lives as long as the program,
+// and return once all calls have returned. Starting threads costs tens of microseconds each, which is more than the
+// work of many (per frame) loops, so they are started once. While the pool is in use (by another thread, or by a
+// nested parallelFor) the worker only runs on the calling thread.
+void runOnWorkerPool(int numHelpers, void (*worker)(void*), void* pContext);
+// Number of threads that can work on a loop (hardware threads, including the calling thread).
+[[nodiscard]] int getWorkerPoolSize();
+}
+
+// Split the range [0, count) into blocks of blockSize items and process them on all hardware threads
+// (including the calling thread). The function is called as func(begin, end) once per block.
+template <typename F>
+void parallelFor(int count, int blockSize, F&& func)
+{
+    if (count <= 0)
+        return;
+    blockSize = std::max(blockSize, 1);
+    const int numBlocks = (count + blockSize - 1) / blockSize;
+    if (numBlocks == 1) {
+        func(0, count);
+        return;
+    }
+    const int numThreads = std::min(numBlocks, detail::getWorkerPoolSize());
+
+    std::atomic_int nextBlock { 0 };
+    auto worker = [&]() {
+        for (int block = nextBlock++; block < numBlocks; block = nextBlock++)
+            func(block * blockSize, std::min((block + 1) * blockSize, count));
+    };
+    using Worker = decltype(worker);
+    detail::runOnWorkerPool(numThreads - 1, [](void* pWorker) { (*static_cast<Worker*>(pWorker))(); }, &worker);
+}
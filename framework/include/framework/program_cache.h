@@ -0,0 +1,41 @@
+#pragma once
+#include "opengl_includes.h"
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+
+// On-disk cache of linked shader programs (glGetProgramBinary/glProgramBinary). Entries are keyed by a hash of the
+// shader sources and the driver (vendor, renderer and version string), so a driver update invalidates the cache.
+// Drivers may still reject a binary (e.g. after an update that kept the version string), in which case the entry is
+// considered stale and the program is compiled from source again.
+class ProgramBinaryCache {
+public:
+    ProgramBinaryCache(std::filesystem::path directory);
+
+    // Hash of the driver identification; ShaderBuilder::submit() hashes the stage sources on top of it to form the key.
+    [[nodiscard]] uint64_t getDriverHash() const;
+
+    // Create a program from a cached binary; returns nothing on a cache miss or when the cached binary is rejected.
+    [[nodiscard]] std::optional<GLuint> load(uint64_t key);
+    // Store the binary of a linked program (which should have GL_PROGRAM_BINARY_RETRIEVABLE_HINT set before linking).
+    void store(uint64_t key, GLuint program);
+
+    [[nodiscard]] bool isEnabled() const;
+
+    struct Statistics {
+        int hits { 0 };
+        int misses { 0 };
+        int stale { 0 }; // Entries that existed but were rejected by the driver (also counted as misses).
+    };
+    [[nodiscard]] Statistics getStatistics() const;
+    void printStatistics() const;
+
+private:
+    [[nodiscard]] std::filesystem::path getEntryPath(uint64_t key) const;
+
+private:
+    std::filesystem::path m_directory;
+    uint64_t m_driverHash;
+    bool m_enabled;
+    Statistics m_statistics;
+};
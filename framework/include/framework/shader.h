@@ -1,6 +1,8 @@
 #pragma once
 #include "disable_all_warnings.h"
+#include "hash.h"
 #include "opengl_includes.h"
+#include "program_cache.h"
 DISABLE_WARNINGS_PUSH()
 #include <glm/mat3x3.hpp>
 #include <glm/mat4x4.hpp>
@@ -8,14 +10,38 @@ DISABLE_WARNINGS_PUSH()
 #include <glm/vec3.hpp>
 #include <glm/vec4.hpp>
 DISABLE_WARNINGS_POP()
+#include <cstdint>
 #include <exception>
 #include <filesystem>
+#include <functional>
+#include <string>
+#include <string_view>
 #include <vector>
 
 struct ShaderLoadingException : public std::runtime_error {
     using std::runtime_error::runtime_error;
 };
 
+// Name of a uniform (or uniform block) together with its hash. String literals are hashed at compile time such that
+// looking up a uniform does not involve any string processing at run time: shader.setUniform("mvpMatrix", ...).
+struct UniformName {
+    template <size_t N>
+    consteval UniformName(const char (&str)[N])
+        : name(str, N - 1)
+        , hash(fnv1a(name))
+    {
+    }
+    // Names that are only known at run time need to be converted explicitly.
+    constexpr explicit UniformName(std::string_view str)
+        : name(str)
+        , hash(fnv1a(str))
+    {
+    }
+
+    std::string_view name;
+    uint64_t hash;
+};
+
 class Shader {
 public:
     Shader();
@@ -29,7 +55,29 @@ public:
     void bind() const;
 
     // Bind the uniform define by the given name to the given buffer and location in its assigned block, 
-    void bindUniformBlock(const std::string& blockName, GLuint bindingLocation, GLuint uniformBlockBuffer) const;
+    void bindUniformBlock(UniformName blockName, GLuint bindingLocation, GLuint uniformBlockBuffer) const;
+    // Assign the block to a binding point without binding a buffer (e.g. for buffers that are bound by range).
+    void setUniformBlockBinding(UniformName blockName, GLuint bindingLocation) const;
+    // Whether the program has an active uniform block by this name.
+    [[nodiscard]] bool hasUniformBlock(UniformName blockName) const;
+
+    // Set the value of a uniform (the shader does not need to be bound). Setting a uniform that is not active in the
+    // program (not declared, or optimized away by the compiler) does nothing, just like a location of -1 in OpenGL.
+    void setUniform(UniformName name, bool value) const;
+    void setUniform(UniformName name, int value) const;
+    void setUniform(UniformName name, unsigned value) const;
+    void setUniform(UniformName name, float value) const;
+    void setUniform(UniformName name, const glm::vec2& value) const;
+    void setUniform(UniformName name, const glm::vec3& value) const;
+    void setUniform(UniformName name, const glm::vec4& value) const;
+    void setUniform(UniformName name, const glm::ivec2& value) const;
+    void setUniform(UniformName name, const glm::ivec3& value) const;
+    void setUniform(UniformName name, const glm::ivec4& value) const;
+    void setUniform(UniformName name, const glm::mat3& value) const;
+    void setUniform(UniformName name, const glm::mat4& value) const;
+
+    // Location of an active uniform from the table that was built at link time; -1 if there is no such uniform.
+    GLint findUniformLocation(UniformName name) const;
 
     // Query an attribute location by its name in the shader
     GLuint getAttributeLocation(const std::string& name) const;
@@ -41,23 +89,97 @@ private:
     friend class ShaderBuilder;
     Shader(GLuint program);
 
+    // Enumerate the active uniforms and uniform blocks of the program.
+    void reflect();
+
 private:
+    struct ActiveUniform {
+        uint64_t nameHash;
+        GLint location;
+    };
+    struct ActiveUniformBlock {
+        uint64_t nameHash;
+        GLuint index;
+    };
+
     GLuint m_program;
+    // Sorted by name hash.
+    std::vector<ActiveUniform> m_uniforms;
+    std::vector<ActiveUniformBlock> m_uniformBlocks;
 };
 
 class ShaderBuilder {
 public:
     ShaderBuilder() = default;
+    // Look up the linked program in the cache before compiling, and store it after linking on a cache miss.
+    ShaderBuilder(ProgramBinaryCache& programCache);
     ShaderBuilder(const ShaderBuilder&) = delete;
     ShaderBuilder(ShaderBuilder&&) = default;
-    ~ShaderBuilder();
+    ~ShaderBuilder() = default;
 
+    // Read the source of a stage; compilation is deferred to build() so that it can be skipped on a cache hit.
+    // Lines of the form #include "file" are replaced by the contents of that file (relative to the including file).
+    // Every file is included at most once per stage, as if it started with #pragma once.
     ShaderBuilder& addStage(GLuint shaderStage, std::filesystem::path shaderFile);
+    // Add "#define name value" to all stages (directly after their #version directive).
+    ShaderBuilder& addDefine(std::string_view name, std::string_view value = "1");
     Shader build();
 
+    // All files that the stages consist of (including the included files).
+    [[nodiscard]] std::vector<std::filesystem::path> getFiles() const;
+
 private:
-    void freeShaders();
+    friend class ShaderBatch;
+    // Program whose stages have been handed to the driver for compilation and linking, without checking the result.
+    struct PendingProgram {
+        GLuint program;
+        std::vector<GLuint> shaders; // Empty if the program was loaded from the cache.
+        std::vector<std::vector<std::filesystem::path>> stageFiles;
+        ProgramBinaryCache* pProgramCache;
+        uint64_t cacheKey;
+    };
+    PendingProgram submit() const;
+    // Check for compile/link errors (blocks until the driver is done) and store the program in the cache.
+    static Shader finish(PendingProgram&& pending);
+
+private:
+    struct Stage {
+        GLuint type;
+        std::vector<std::filesystem::path> files; // Main file followed by all included files (#line source string numbers).
+        std::string source; // With includes resolved.
+    };
+    std::vector<Stage> m_stages;
+    std::string m_defines;
+    ProgramBinaryCache* m_pProgramCache { nullptr };
+};
+
+// Compiles many programs at once. All stages of all programs are handed to the driver before any status is queried,
+// which lets drivers with GL_KHR_parallel_shader_compile (or the ARB variant) compile them on multiple threads. Their
+// completion is then polled, such that the total time is determined by the slowest program rather than by the sum.
+class ShaderBatch {
+public:
+    ShaderBatch();
+    ShaderBatch(const ShaderBatch&) = delete;
+    ~ShaderBatch();
+
+    ShaderBatch& operator=(const ShaderBatch&) = delete;
+
+    // Submit the program for compilation; the callback receives it once finish() has checked it.
+    void add(ShaderBuilder&& builder, std::function<void(Shader&&)> onFinished);
+    void add(ShaderBuilder&& builder, Shader& target);
+
+    // Returns whether the driver has finished all programs (without blocking). Always true if parallel compilation is not supported.
+    [[nodiscard]] bool isReady() const;
+    // Hand all programs to their callbacks in order of completion. If any program failed to compile or link then
+    // a ShaderLoadingException is thrown after all other programs have been handed out.
+    void finish();
+
+    [[nodiscard]] static bool isParallelCompileSupported();
 
 private:
-    std::vector<GLuint> m_shaders;
+    struct Entry {
+        ShaderBuilder::PendingProgram pending;
+        std::function<void(Shader&&)> onFinished;
+    };
+    std::vector<Entry> m_entries;
 };
@@ -0,0 +1,58 @@
+#pragma once
+#include "file_watcher.h"
+#include "shader.h"
+#include "shader_variants.h"
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Hot reloading of shaders: when a file in the watched directory changes, all programs that use it (directly or
+// through an #include) are recompiled as one ShaderBatch without blocking the render loop. The new programs replace
+// the old ones in update(), which should be called at the start of a frame. If any program fails to compile then
+// none of them are replaced and the previous programs stay in use.
+class ShaderReloader {
+public:
+    ShaderReloader(std::filesystem::path directory);
+
+    // The builder function is called again on every reload; the target is replaced with the new program.
+    void watch(std::function<ShaderBuilder()> createBuilder, Shader& target);
+    // All variants that have been compiled at the time of the reload are recompiled.
+    void watch(ShaderVariants& variants);
+
+    void update();
+
+    struct Statistics {
+        int numReloads { 0 };
+        int numFailures { 0 };
+        double lastLatencyMs { 0.0 }; // From detecting the file change until the new programs are in use.
+        std::string lastError; // Empty if the last reload succeeded.
+    };
+    [[nodiscard]] const Statistics& getStatistics() const;
+
+private:
+    void startReload(const std::vector<std::filesystem::path>& changedFiles);
+    void finishReload();
+
+private:
+    struct WatchedProgram {
+        std::function<ShaderBuilder()> createBuilder;
+        Shader* pTarget;
+    };
+    FileWatcher m_fileWatcher;
+    std::vector<WatchedProgram> m_programs;
+    std::vector<ShaderVariants*> m_variants;
+
+    std::vector<std::filesystem::path> m_changedFiles; // Changes that arrived while a reload was in progress.
+    std::optional<std::chrono::steady_clock::time_point> m_firstChangeTime;
+
+    // The reload that is currently in progress.
+    std::unique_ptr<ShaderBatch> m_pBatch;
+    std::vector<std::function<void()>> m_pendingSwaps;
+    std::chrono::steady_clock::time_point m_reloadStartTime;
+
+    Statistics m_statistics;
+};
@@ -0,0 +1,42 @@
+#pragma once
+#include "opengl_includes.h"
+#include "program_cache.h"
+#include "shader.h"
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Specialized versions (permutations) of a single shader program. Every feature corresponds to a preprocessor define
+// that is either present or absent, such that shaders can use #ifdef instead of branching on uniforms. Variants are
+// compiled on first use and cached by their feature mask, where bit i of the mask enables feature i.
+class ShaderVariants {
+public:
+    ShaderVariants() = default;
+    ShaderVariants(std::vector<std::string> features, ProgramBinaryCache* pProgramCache = nullptr);
+
+    ShaderVariants& addStage(GLuint shaderStage, std::filesystem::path shaderFile);
+
+    // Returns the variant with the given features enabled; throws ShaderLoadingException if it fails to compile.
+    const Shader& get(uint32_t featureMask);
+    // Submit the variants that have not been compiled yet to a batch; they become available after batch.finish().
+    void compile(std::span<const uint32_t> featureMasks, ShaderBatch& batch);
+    [[nodiscard]] size_t getNumCompiledVariants() const;
+    [[nodiscard]] std::vector<uint32_t> getCompiledVariants() const;
+
+    [[nodiscard]] ShaderBuilder createBuilder(uint32_t featureMask) const;
+    // Replace a variant by a new version of it (used for hot reloading).
+    void replace(uint32_t featureMask, Shader&& shader);
+
+private:
+    struct Stage {
+        GLuint type;
+        std::filesystem::path filePath;
+    };
+    std::vector<std::string> m_features;
+    std::vector<Stage> m_stages;
+    ProgramBinaryCache* m_pProgramCache { nullptr };
+    std::unordered_map<uint32_t, Shader> m_variants;
+};
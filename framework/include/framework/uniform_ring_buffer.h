@@ -0,0 +1,65 @@
+#pragma once
+#include "opengl_includes.h"
+#include <array>
+#include <cstddef>
+#include <vector>
+
+// A uniform buffer that is split into one region per frame in flight. Per-draw constants of a frame are appended
+// linearly to the region of the current frame and bound by offset (glBindBufferRange). A fence is inserted at the end
+// of every frame; before a region is reused the CPU waits for its fence, so data that the GPU may still read is never
+// overwritten.
+//
+// With OpenGL 4.4 the buffer is persistently (and coherently) mapped and written directly. Otherwise the data is
+// collected in system memory and copied into the region with glBufferSubData by flush().
+class UniformRingBuffer {
+public:
+    static constexpr size_t maxFramesInFlight = 3;
+
+    UniformRingBuffer(size_t frameSizeInBytes = 1024 * 1024);
+    UniformRingBuffer(const UniformRingBuffer&) = delete;
+    ~UniformRingBuffer();
+
+    UniformRingBuffer& operator=(const UniformRingBuffer&) = delete;
+
+    // Switch to the next region, waiting for the GPU to finish reading it if necessary.
+    void beginFrame();
+    // Insert the fence that protects the region of this frame.
+    void endFrame();
+
+    // Append data to the region of the current frame and return its offset within the buffer (aligned to
+    // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT). Throws std::runtime_error when the region is full.
+    size_t push(const void* pData, size_t sizeInBytes);
+    template <typename T>
+    size_t push(const T& data)
+    {
+        return push(&data, sizeof(T));
+    }
+    // Reserve space at an aligned offset in the region of the current frame, such that data can be gathered into it in
+    // place rather than assembled elsewhere and copied in. The pointer stays valid until the end of the frame, but the
+    // data must be written before the next flush(). Throws std::runtime_error when the region is full.
+    struct Allocation {
+        std::byte* pData;
+        size_t offset; // Offset within the buffer.
+    };
+    Allocation allocate(size_t sizeInBytes);
+    // Make everything that was pushed visible to the GPU; call before drawing with the pushed data.
+    void flush();
+
+    void bindRange(GLuint index, size_t offset, size_t sizeInBytes) const;
+
+    [[nodiscard]] bool isPersistentlyMapped() const;
+    // Bytes pushed during the current frame.
+    [[nodiscard]] size_t getFrameUsage() const;
+
+private:
+    size_t m_frameSize;
+    size_t m_alignment;
+    GLuint m_buffer;
+    std::byte* m_pMapped { nullptr }; // Persistent mapping of the whole buffer (OpenGL 4.4+).
+    std::vector<std::byte> m_staging; // Contents of the current region (OpenGL 4.1).
+
+    size_t m_frame { 0 }; // Region that is currently written.
+    std::array<GLsync, maxFramesInFlight> m_fences {};
+    size_t m_writeOffset { 0 }; // Relative to the start of the region.
+    size_t m_flushedOffset { 0 };
+};
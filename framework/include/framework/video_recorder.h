@@ -0,0 +1,64 @@
+#pragma once
+#include "disable_all_warnings.h"
+// Suppress warnings in third-party code.
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec2.hpp>
+DISABLE_WARNINGS_POP()
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+struct VideoRecordingException : public std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// Streams frames into an uncompressed YUV4MPEG2 (.y4m) file. Frames are handed over as RGBA8
+// pixels in OpenGL (bottom-up) row order; the RGB -> YUV 4:2:0 conversion and the file writes
+// happen on a background thread so that encoding never stalls the render loop.
+class VideoRecorder {
+public:
+    // Odd resolutions are cropped by one pixel because 4:2:0 chroma subsampling needs even sizes.
+    VideoRecorder(const std::filesystem::path& filePath, const glm::ivec2& resolution, int framesPerSecond);
+    VideoRecorder(const VideoRecorder&) = delete;
+    ~VideoRecorder(); // Writes all pending frames and closes the file.
+
+    VideoRecorder& operator=(const VideoRecorder&) = delete;
+
+    // Queue a frame of resolution.x * resolution.y RGBA8 pixels (the resolution passed to the constructor).
+    // Blocks when the encoder falls too far behind, such that no frame is ever dropped.
+    void pushFrame(std::vector<uint8_t>&& rgbaPixels);
+
+    [[nodiscard]] int getFramesPerSecond() const;
+    [[nodiscard]] uint64_t getNumFramesWritten() const;
+
+private:
+    void encodeLoop();
+
+private:
+    static constexpr size_t maxPendingFrames = 8;
+
+    std::ofstream m_file;
+    glm::ivec2 m_inputResolution;
+    glm::ivec2 m_outputResolution;
+    int m_framesPerSecond;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_frameAvailable;
+    std::condition_variable m_frameConsumed;
+    std::deque<std::vector<uint8_t>> m_pendingFrames;
+    uint64_t m_numFramesWritten { 0 };
+    bool m_stop { false };
+
+    std::thread m_encodeThread;
+};
+
+// Convert bottom-up RGBA8 pixels (with a stride of inputWidth pixels) into top-down planar YUV 4:2:0 (BT.601, studio range).
+// The output planes are width * height (Y) and (width / 2) * (height / 2) (U and V); width and height must be even.
+void convertRGBAToYUV420(std::span<const uint8_t> rgba, int inputWidth, int width, int height, std::span<uint8_t> yPlane, std::span<uint8_t> uPlane, std::span<uint8_t> vPlane);
@@ -6,12 +6,16 @@ DISABLE_WARNINGS_PUSH()
 #include <GLFW/glfw3.h>
 #include <glm/vec2.hpp>
 DISABLE_WARNINGS_POP()
+#include <array>
 #include <functional>
+#include <memory>
 #include <optional>
 #include <string_view>
 #include <vector>
 #include <filesystem>
 
+class VideoRecorder;
+
 enum class OpenGLVersion {
 	GL2,
 	GL3,
@@ -33,6 +37,15 @@ public:
 
 	void renderToImage(const std::filesystem::path& filePath, const bool flipY = false); // renders the output to an image
 
+	// Stream every frame (excluding the UI) to a .y4m video. Frames are read back asynchronously and encoded on
+	// a background thread; recording also works for windows that are not presentable.
+	void startRecording(const std::filesystem::path& filePath, int framesPerSecond = 60);
+	void stopRecording(); // Flushes all outstanding frames and closes the file.
+	[[nodiscard]] bool isRecording() const;
+	// Simulated time (in seconds) of the frame that is currently being recorded. Drive animations with this
+	// instead of the wall clock to get deterministic recordings that do not depend on the encoding speed.
+	[[nodiscard]] double getRecordingTime() const;
+
 	using KeyCallback = std::function<void(int key, int scancode, int action, int mods)>;
 	void registerKeyCallback(KeyCallback&&);
 	using CharCallback = std::function<void(unsigned unicodeCodePoint)>;
@@ -71,6 +84,9 @@ private:
 	static void scrollCallback(GLFWwindow* window, double xoffset, double yoffset);
 	static void windowSizeCallback(GLFWwindow* window, int width, int height);
 
+	void captureRecordingFrame();
+	void retireRecordingFrame(size_t readbackBuffer);
+
 private:
 	GLFWwindow* m_pWindow;
 	glm::ivec2 m_windowSize;
@@ -84,4 +100,11 @@ private:
 	std::vector<ScrollCallback> m_scrollCallbacks;
 	std::vector<MouseMoveCallback> m_mouseMoveCallbacks;
 	std::vector<WindowResizeCallback> m_windowResizeCallbacks;
+
+	// Ring of pixel pack buffers such that glReadPixels never waits for the GPU to finish the current frame.
+	static constexpr size_t numReadbackBuffers = 3;
+	std::unique_ptr<VideoRecorder> m_pVideoRecorder;
+	std::array<GLuint, numReadbackBuffers> m_readbackBuffers {};
+	glm::ivec2 m_recordingResolution { 0 };
+	uint64_t m_numFramesRecorded { 0 };
 };
@@ -0,0 +1,47 @@
+#include "cpu_features.h"
+#if defined(CPU_FEATURES_X86) && defined(_MSC_VER)
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+static CPUFeatures detectCPUFeatures()
+{
+    CPUFeatures features {};
+#if defined(CPU_FEATURES_X86) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    features.sse41 = __builtin_cpu_supports("sse4.1");
+    features.avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#elif defined(CPU_FEATURES_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    const int maxLeaf = info[0];
+    __cpuid(info, 1);
+    features.sse41 = (info[2] & (1 << 19)) != 0;
+    const bool fma = (info[2] & (1 << 12)) != 0;
+    // AVX state must be enabled by the operating system (OSXSAVE + XCR0).
+    const bool osAVX = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+    if (maxLeaf >= 7 && osAVX && fma) {
+        __cpuidex(info, 7, 0);
+        features.avx2 = (info[1] & (1 << 5)) != 0;
+    }
+#endif
+    return features;
+}
+
+static CPUFeatures& cpuFeatures()
+{
+    static CPUFeatures features = detectCPUFeatures();
+    return features;
+}
+
+const CPUFeatures& getCPUFeatures()
+{
+    return cpuFeatures();
+}
+
+void setCPUFeatures(const CPUFeatures& features)
+{
+    const CPUFeatures& detected = detectCPUFeatures();
+    // Never enable an instruction set that the processor does not support.
+    cpuFeatures() = CPUFeatures { features.sse41 && detected.sse41, features.avx2 && detected.avx2 };
+}
@@ -0,0 +1,103 @@
+#include "file_watcher.h"
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <utility>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// How often the background thread checks whether it should stop (inotify) or scans the directory (polling).
+static constexpr std::chrono::milliseconds pollInterval { 100 };
+
+FileWatcher::FileWatcher(std::filesystem::path directory)
+    : m_directory(std::move(directory))
+{
+#ifdef __linux__
+    if (const int inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC); inotifyFd != -1) {
+        m_thread = std::thread(&FileWatcher::inotifyLoop, this, inotifyFd);
+        return;
+    }
+    std::cerr << "Warning: inotify not available, polling " << m_directory << " for changes instead" << std::endl;
+#endif
+    m_thread = std::thread(&FileWatcher::pollingLoop, this);
+}
+
+FileWatcher::~FileWatcher()
+{
+    m_stop = true;
+    m_thread.join();
+}
+
+std::vector<FileWatcher::FileChange> FileWatcher::takeChanges()
+{
+    std::scoped_lock lock { m_mutex };
+    return std::exchange(m_changes, {});
+}
+
+void FileWatcher::addChange(const std::filesystem::path& filePath)
+{
+    std::scoped_lock lock { m_mutex };
+    if (std::none_of(std::begin(m_changes), std::end(m_changes), [&](const FileChange& change) { return change.filePath == filePath; }))
+        m_changes.push_back({ filePath, std::chrono::steady_clock::now() });
+}
+
+#ifdef __linux__
+void FileWatcher::inotifyLoop(int inotifyFd)
+{
+    // inotify is not recursive so every (sub) directory is watched separately.
+    std::unordered_map<int, std::filesystem::path> watchedDirectories;
+    const auto addWatch = [&](const std::filesystem::path& directory) {
+        // Editors commonly save by writing a temporary file and renaming it over the original (IN_MOVED_TO).
+        if (const int wd = inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO); wd != -1)
+            watchedDirectories[wd] = directory;
+    };
+    addWatch(m_directory);
+    std::error_code errorCode;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(m_directory, errorCode)) {
+        if (entry.is_directory())
+            addWatch(entry.path());
+    }
+
+    alignas(inotify_event) std::array<char, 4096> buffer;
+    while (!m_stop) {
+        pollfd pollFd { inotifyFd, POLLIN, 0 };
+        if (poll(&pollFd, 1, static_cast<int>(pollInterval.count())) <= 0)
+            continue;
+
+        const ssize_t length = read(inotifyFd, buffer.data(), buffer.size());
+        for (ssize_t offset = 0; offset < length;) {
+            const auto* pEvent = reinterpret_cast<const inotify_event*>(buffer.data() + offset);
+            if (pEvent->len > 0 && watchedDirectories.contains(pEvent->wd))
+                addChange(watchedDirectories[pEvent->wd] / pEvent->name);
+            offset += static_cast<ssize_t>(sizeof(inotify_event) + pEvent->len);
+        }
+    }
+    close(inotifyFd);
+}
+#endif
+
+void FileWatcher::pollingLoop()
+{
+    std::unordered_map<std::string, std::filesystem::file_time_type> modificationTimes;
+    bool firstScan = true;
+    while (!m_stop) {
+        std::error_code errorCode;
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(m_directory, errorCode)) {
+            if (!entry.is_regular_file(errorCode))
+                continue;
+            const auto modificationTime = entry.last_write_time(errorCode);
+            auto [iter, inserted] = modificationTimes.try_emplace(entry.path().string(), modificationTime);
+            if ((inserted && !firstScan) || iter->second != modificationTime) {
+                iter->second = modificationTime;
+                addChange(entry.path());
+            }
+        }
+        firstScan = false;
+        std::this_thread::sleep_for(pollInterval);
+    }
+}
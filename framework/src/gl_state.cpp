@@ -0,0 +1,222 @@
+#include "gl_state.h"
+#include <algorithm>
+
+static constexpr size_t invalidTarget = 0xFFFFFFFF;
+
+static size_t textureTargetIndex(GLenum target)
+{
+    switch (target) {
+    case GL_TEXTURE_2D:
+        return 0;
+    case GL_TEXTURE_2D_ARRAY:
+        return 1;
+    case GL_TEXTURE_3D:
+        return 2;
+    case GL_TEXTURE_CUBE_MAP:
+        return 3;
+    case GL_TEXTURE_BUFFER:
+        return 4;
+    default:
+        return invalidTarget;
+    }
+}
+
+GLStateCache& GLStateCache::get()
+{
+    thread_local GLStateCache instance;
+    return instance;
+}
+
+GLStateCache::GLStateCache()
+{
+    invalidate();
+}
+
+template <typename T>
+bool GLStateCache::update(T& cached, const T& value)
+{
+    m_statistics.numCalls++;
+    if (m_enabled && cached == value) {
+        m_statistics.numFilteredCalls++;
+        return false;
+    }
+    cached = value;
+    return true;
+}
+
+void GLStateCache::useProgram(GLuint program)
+{
+    if (update(m_program, program))
+        glUseProgram(program);
+}
+
+void GLStateCache::bindVertexArray(GLuint vertexArray)
+{
+    if (update(m_vertexArray, vertexArray))
+        glBindVertexArray(vertexArray);
+}
+
+void GLStateCache::bindTexture(GLuint unit, GLenum target, GLuint texture)
+{
+    const size_t targetIndex = textureTargetIndex(target);
+    if (unit >= maxTextureUnits || targetIndex == invalidTarget) {
+        // Not tracked: forward.
+        m_activeTextureUnit = unit;
+        m_statistics.numCalls++;
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(target, texture);
+        return;
+    }
+
+    // The active unit only needs to change if the binding does.
+    GLuint& cached = m_textures[unit][targetIndex];
+    m_statistics.numCalls++;
+    if (m_enabled && cached == texture) {
+        m_statistics.numFilteredCalls++;
+        return;
+    }
+    if (update(m_activeTextureUnit, unit))
+        glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(target, texture);
+    cached = texture;
+}
+
+void GLStateCache::bindTextureToActiveUnit(GLenum target, GLuint texture)
+{
+    if (m_activeTextureUnit != unknown) {
+        bindTexture(m_activeTextureUnit, target, texture);
+    } else {
+        // The active unit is unknown so we do not know which cached binding this call changes.
+        if (const size_t targetIndex = textureTargetIndex(target); targetIndex != invalidTarget) {
+            for (auto& unit : m_textures)
+                unit[targetIndex] = unknown;
+        }
+        m_statistics.numCalls++;
+        glBindTexture(target, texture);
+    }
+}
+
+void GLStateCache::bindUniformBuffer(GLuint index, GLuint buffer)
+{
+    if (index >= maxUniformBufferBindings) {
+        glBindBufferBase(GL_UNIFORM_BUFFER, index, buffer);
+    } else if (update(m_uniformBuffers[index], BufferRange { buffer, 0, -1 })) {
+        glBindBufferBase(GL_UNIFORM_BUFFER, index, buffer);
+    }
+}
+
+void GLStateCache::bindUniformBufferRange(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+    if (index >= maxUniformBufferBindings) {
+        glBindBufferRange(GL_UNIFORM_BUFFER, index, buffer, offset, size);
+    } else if (update(m_uniformBuffers[index], BufferRange { buffer, offset, size })) {
+        glBindBufferRange(GL_UNIFORM_BUFFER, index, buffer, offset, size);
+    }
+}
+
+static void setCapability(GLenum capability, bool enabled)
+{
+    if (enabled)
+        glEnable(capability);
+    else
+        glDisable(capability);
+}
+
+void GLStateCache::setBlend(bool enabled)
+{
+    if (update(m_blend, GLuint(enabled)))
+        setCapability(GL_BLEND, enabled);
+}
+
+void GLStateCache::setBlendFunc(GLenum sourceFactor, GLenum destinationFactor)
+{
+    if (update(m_blendFunc, std::array<GLuint, 2> { sourceFactor, destinationFactor }))
+        glBlendFunc(sourceFactor, destinationFactor);
+}
+
+void GLStateCache::setDepthTest(bool enabled)
+{
+    if (update(m_depthTest, GLuint(enabled)))
+        setCapability(GL_DEPTH_TEST, enabled);
+}
+
+void GLStateCache::setDepthWrite(bool enabled)
+{
+    if (update(m_depthWrite, GLuint(enabled)))
+        glDepthMask(enabled ? GL_TRUE : GL_FALSE);
+}
+
+void GLStateCache::setDepthFunc(GLenum func)
+{
+    if (update(m_depthFunc, GLuint(func)))
+        glDepthFunc(func);
+}
+
+void GLStateCache::setCullFace(bool enabled)
+{
+    if (update(m_cullFace, GLuint(enabled)))
+        setCapability(GL_CULL_FACE, enabled);
+}
+
+void GLStateCache::setCullMode(GLenum mode)
+{
+    if (update(m_cullMode, GLuint(mode)))
+        glCullFace(mode);
+}
+
+void GLStateCache::forgetProgram(GLuint program)
+{
+    if (m_program == program)
+        m_program = unknown;
+}
+
+void GLStateCache::forgetVertexArray(GLuint vertexArray)
+{
+    if (m_vertexArray == vertexArray)
+        m_vertexArray = unknown;
+}
+
+void GLStateCache::forgetTexture(GLuint texture)
+{
+    for (auto& unit : m_textures)
+        std::replace(std::begin(unit), std::end(unit), texture, unknown);
+}
+
+void GLStateCache::forgetBuffer(GLuint buffer)
+{
+    for (BufferRange& binding : m_uniformBuffers) {
+        if (binding.buffer == buffer)
+            binding.buffer = unknown;
+    }
+}
+
+void GLStateCache::invalidate()
+{
+    m_program = m_vertexArray = m_activeTextureUnit = unknown;
+    for (auto& unit : m_textures)
+        unit.fill(unknown);
+    m_uniformBuffers.fill(BufferRange { unknown, 0, 0 });
+    m_blend = m_depthTest = m_depthWrite = m_cullFace = unknown;
+    m_blendFunc.fill(unknown);
+    m_depthFunc = m_cullMode = unknown;
+}
+
+void GLStateCache::setEnabled(bool enabled)
+{
+    m_enabled = enabled;
+}
+
+bool GLStateCache::isEnabled() const
+{
+    return m_enabled;
+}
+
+GLStateCache::Statistics GLStateCache::getStatistics() const
+{
+    return m_statistics;
+}
+
+void GLStateCache::resetStatistics()
+{
+    m_statistics = {};
+}
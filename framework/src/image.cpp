@@ -39,3 +39,11 @@ Image::Image(const std::filesystem::path& filePath)
 
 	stbi_image_free(stbPixels);
 }
+
+Image::Image(int imageWidth, int imageHeight, int imageChannels)
+    : width(imageWidth)
+    , height(imageHeight)
+    , channels(imageChannels)
+    , pixels(size_t(imageWidth) * size_t(imageHeight) * size_t(imageChannels), 0)
+{
+}
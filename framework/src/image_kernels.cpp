@@ -0,0 +1,408 @@
+#include "image_kernels.h"
+#include "cpu_features.h"
+#include "parallel_for.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <numbers>
+#ifdef CPU_FEATURES_X86
+#include <immintrin.h>
+#endif
+
+// Number of rows that are processed by a thread at a time.
+static constexpr int rowBlockSize = 16;
+
+// ===== u8 <-> float =====
+
+static void convertU8ToFloatScalar(const uint8_t* pIn, float* pOut, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        pOut[i] = float(pIn[i]) * (1.0f / 255.0f);
+}
+
+static void convertFloatToU8Scalar(const float* pIn, uint8_t* pOut, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        pOut[i] = static_cast<uint8_t>(std::clamp(pIn[i], 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+#ifdef CPU_FEATURES_X86
+CPU_TARGET_SSE41 static size_t convertU8ToFloatSSE41(const uint8_t* pIn, float* pOut, size_t count)
+{
+    const __m128 scale = _mm_set1_ps(1.0f / 255.0f);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        int packed;
+        std::memcpy(&packed, pIn + i, sizeof(packed));
+        const __m128i values = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed));
+        _mm_storeu_ps(pOut + i, _mm_mul_ps(_mm_cvtepi32_ps(values), scale));
+    }
+    return i;
+}
+
+CPU_TARGET_AVX2 static size_t convertU8ToFloatAVX2(const uint8_t* pIn, float* pOut, size_t count)
+{
+    const __m256 scale = _mm256_set1_ps(1.0f / 255.0f);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i values = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pIn + i)));
+        _mm256_storeu_ps(pOut + i, _mm256_mul_ps(_mm256_cvtepi32_ps(values), scale));
+    }
+    return i;
+}
+
+CPU_TARGET_SSE41 static size_t convertFloatToU8SSE41(const float* pIn, uint8_t* pOut, size_t count)
+{
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), scale = _mm_set1_ps(255.0f), half = _mm_set1_ps(0.5f);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i words[2];
+        for (int j = 0; j < 2; j++) {
+            const __m128 value = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(pIn + i + 4 * j), zero), one);
+            words[j] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(value, scale), half));
+        }
+        const __m128i packed = _mm_packus_epi32(words[0], words[1]);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(pOut + i), _mm_packus_epi16(packed, packed));
+    }
+    return i;
+}
+
+CPU_TARGET_AVX2 static size_t convertFloatToU8AVX2(const float* pIn, uint8_t* pOut, size_t count)
+{
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f), scale = _mm256_set1_ps(255.0f), half = _mm256_set1_ps(0.5f);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m256 value0 = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(pIn + i), zero), one);
+        const __m256 value1 = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(pIn + i + 8), zero), one);
+        const __m256i words0 = _mm256_cvttps_epi32(_mm256_fmadd_ps(value0, scale, half));
+        const __m256i words1 = _mm256_cvttps_epi32(_mm256_fmadd_ps(value1, scale, half));
+        // Packing works per 128-bit lane, so restore the element order afterwards.
+        const __m256i shorts = _mm256_permute4x64_epi64(_mm256_packus_epi32(words0, words1), _MM_SHUFFLE(3, 1, 2, 0));
+        const __m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(shorts), _mm256_extracti128_si256(shorts, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pOut + i), bytes);
+    }
+    return i;
+}
+#endif
+
+void convertU8ToFloat(std::span<const uint8_t> in, std::span<float> out)
+{
+    assert(out.size() >= in.size());
+    size_t i = 0;
+#ifdef CPU_FEATURES_X86
+    if (getCPUFeatures().avx2)
+        i = convertU8ToFloatAVX2(in.data(), out.data(), in.size());
+    else if (getCPUFeatures().sse41)
+        i = convertU8ToFloatSSE41(in.data(), out.data(), in.size());
+#endif
+    convertU8ToFloatScalar(in.data() + i, out.data() + i, in.size() - i);
+}
+
+void convertFloatToU8(std::span<const float> in, std::span<uint8_t> out)
+{
+    assert(out.size() >= in.size());
+    size_t i = 0;
+#ifdef CPU_FEATURES_X86
+    if (getCPUFeatures().avx2)
+        i = convertFloatToU8AVX2(in.data(), out.data(), in.size());
+    else if (getCPUFeatures().sse41)
+        i = convertFloatToU8SSE41(in.data(), out.data(), in.size());
+#endif
+    convertFloatToU8Scalar(in.data() + i, out.data() + i, in.size() - i);
+}
+
+std::vector<float> imageToFloat(const Image& image)
+{
+    const size_t rowSize = size_t(image.width) * size_t(image.channels);
+    std::vector<float> out(rowSize * size_t(image.height));
+    parallelFor(image.height, rowBlockSize, [&](int begin, int end) {
+        const size_t offset = size_t(begin) * rowSize, count = size_t(end - begin) * rowSize;
+        convertU8ToFloat({ image.get_data() + offset, count }, { out.data() + offset, count });
+    });
+    return out;
+}
+
+Image imageFromFloat(std::span<const float> pixels, int width, int height, int channels)
+{
+    Image out { width, height, channels };
+    const size_t rowSize = size_t(width) * size_t(channels);
+    assert(pixels.size() >= rowSize * size_t(height));
+    parallelFor(height, rowBlockSize, [&](int begin, int end) {
+        const size_t offset = size_t(begin) * rowSize, count = size_t(end - begin) * rowSize;
+        convertFloatToU8({ pixels.data() + offset, count }, { out.get_data() + offset, count });
+    });
+    return out;
+}
+
+// ===== Channel conversion =====
+
+#ifdef CPU_FEATURES_X86
+CPU_TARGET_SSE41 static size_t expandRGBToRGBASSE41(const uint8_t* pIn, uint8_t* pOut, size_t numPixels)
+{
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i alpha = _mm_set1_epi32(int(0xFF000000));
+    size_t i = 0;
+    // Each iteration loads 16 bytes but only consumes 12 of them, so stay clear of the end of the input.
+    for (; i + 6 <= numPixels; i += 4) {
+        const __m128i rgb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pIn + 3 * i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pOut + 4 * i), _mm_or_si128(_mm_shuffle_epi8(rgb, shuffle), alpha));
+    }
+    return i;
+}
+#endif
+
+void expandRGBToRGBA(std::span<const uint8_t> rgb, std::span<uint8_t> rgba)
+{
+    const size_t numPixels = rgb.size() / 3;
+    assert(rgba.size() >= 4 * numPixels);
+    size_t i = 0;
+#ifdef CPU_FEATURES_X86
+    if (getCPUFeatures().sse41)
+        i = expandRGBToRGBASSE41(rgb.data(), rgba.data(), numPixels);
+#endif
+    for (; i < numPixels; i++) {
+        rgba[4 * i + 0] = rgb[3 * i + 0];
+        rgba[4 * i + 1] = rgb[3 * i + 1];
+        rgba[4 * i + 2] = rgb[3 * i + 2];
+        rgba[4 * i + 3] = 255;
+    }
+}
+
+Image swizzleImageChannels(const Image& image, std::span<const int> sourceChannels)
+{
+    assert(!sourceChannels.empty() && sourceChannels.size() <= 4);
+    const int outChannels = static_cast<int>(sourceChannels.size());
+    Image out { image.width, image.height, outChannels };
+    const uint8_t* pIn = image.get_data();
+    uint8_t* pOut = out.get_data();
+    parallelFor(image.height, rowBlockSize, [&](int begin, int end) {
+        for (size_t i = size_t(begin) * size_t(image.width); i < size_t(end) * size_t(image.width); i++) {
+            for (int c = 0; c < outChannels; c++) {
+                const int source = sourceChannels[size_t(c)];
+                assert(source < image.channels);
+                uint8_t value = 0;
+                if (source == swizzleOne)
+                    value = 255;
+                else if (source >= 0)
+                    value = pIn[i * size_t(image.channels) + size_t(source)];
+                pOut[i * size_t(outChannels) + size_t(c)] = value;
+            }
+        }
+    });
+    return out;
+}
+
+Image convertImageChannels(const Image& image, int channels)
+{
+    assert(channels == 1 || channels == 3 || channels == 4);
+    assert(image.channels == 1 || image.channels == 3 || image.channels == 4);
+    if (image.channels == channels)
+        return image;
+
+    if (image.channels == 3 && channels == 4) {
+        Image out { image.width, image.height, 4 };
+        const size_t rowPixels = size_t(image.width);
+        parallelFor(image.height, rowBlockSize, [&](int begin, int end) {
+            const size_t offset = size_t(begin) * rowPixels, count = size_t(end - begin) * rowPixels;
+            expandRGBToRGBA({ image.get_data() + 3 * offset, 3 * count }, { out.get_data() + 4 * offset, 4 * count });
+        });
+        return out;
+    } else if (channels == 1) {
+        // Rec. 709 luma in fixed point (weights sum to 256).
+        Image out { image.width, image.height, 1 };
+        const uint8_t* pIn = image.get_data();
+        uint8_t* pOut = out.get_data();
+        parallelFor(image.height, rowBlockSize, [&](int begin, int end) {
+            for (size_t i = size_t(begin) * size_t(image.width); i < size_t(end) * size_t(image.width); i++) {
+                const uint8_t* pPixel = pIn + i * size_t(image.channels);
+                pOut[i] = static_cast<uint8_t>((54 * pPixel[0] + 183 * pPixel[1] + 19 * pPixel[2] + 128) >> 8);
+            }
+        });
+        return out;
+    } else if (image.channels == 1) {
+        constexpr std::array<int, 4> greyToRGBA { 0, 0, 0, swizzleOne };
+        return swizzleImageChannels(image, std::span(greyToRGBA).first(size_t(channels)));
+    } else {
+        constexpr std::array<int, 3> dropAlpha { 0, 1, 2 };
+        return swizzleImageChannels(image, dropAlpha);
+    }
+}
+
+// ===== Resampling =====
+
+namespace {
+// The input pixels (and their weights) that contribute to one output pixel along one axis.
+struct FilterContributions {
+    std::vector<int> first; // Index of the first contributing input pixel (per output pixel).
+    std::vector<int> count; // Number of contributing input pixels (per output pixel).
+    std::vector<float> weights; // maxCount weights per output pixel.
+    int maxCount;
+};
+}
+
+static float filterSupport(ResizeFilter filter)
+{
+    switch (filter) {
+    case ResizeFilter::Box:
+        return 0.5f;
+    case ResizeFilter::Bilinear:
+        return 1.0f;
+    case ResizeFilter::Lanczos3:
+    default:
+        return 3.0f;
+    }
+}
+
+static float evaluateFilter(ResizeFilter filter, float x)
+{
+    x = std::abs(x);
+    switch (filter) {
+    case ResizeFilter::Box:
+        return x <= 0.5f ? 1.0f : 0.0f;
+    case ResizeFilter::Bilinear:
+        return std::max(1.0f - x, 0.0f);
+    case ResizeFilter::Lanczos3:
+    default: {
+        if (x < 1e-5f)
+            return 1.0f;
+        if (x >= 3.0f)
+            return 0.0f;
+        const float pix = std::numbers::pi_v<float> * x;
+        return 3.0f * std::sin(pix) * std::sin(pix / 3.0f) / (pix * pix);
+    }
+    }
+}
+
+static FilterContributions computeContributions(int inSize, int outSize, ResizeFilter filter)
+{
+    const float scale = float(outSize) / float(inSize);
+    // When downsampling the filter is stretched to cover all input pixels (prevents aliasing).
+    const float filterScale = std::max(1.0f / scale, 1.0f);
+    const float support = filterSupport(filter) * filterScale;
+
+    FilterContributions contributions;
+    contributions.maxCount = static_cast<int>(std::ceil(2.0f * support)) + 1;
+    contributions.first.resize(size_t(outSize));
+    contributions.count.resize(size_t(outSize));
+    contributions.weights.resize(size_t(outSize) * size_t(contributions.maxCount), 0.0f);
+
+    for (int i = 0; i < outSize; i++) {
+        const float center = (float(i) + 0.5f) / scale;
+        const int first = static_cast<int>(std::floor(center - support));
+        float* pWeights = &contributions.weights[size_t(i) * size_t(contributions.maxCount)];
+
+        // Edge pixels are clamped by folding their weights into the first/last valid input pixel.
+        const int clampedFirst = std::clamp(first, 0, inSize - 1);
+        int count = 0;
+        float totalWeight = 0.0f;
+        for (int j = first; j < first + contributions.maxCount; j++) {
+            const float weight = evaluateFilter(filter, (float(j) + 0.5f - center) / filterScale);
+            if (weight == 0.0f)
+                continue;
+            const int slot = std::clamp(j, 0, inSize - 1) - clampedFirst;
+            if (slot >= contributions.maxCount)
+                break;
+            pWeights[slot] += weight;
+            count = std::max(count, slot + 1);
+            totalWeight += weight;
+        }
+        for (int j = 0; j < count; j++)
+            pWeights[j] /= totalWeight;
+        contributions.first[size_t(i)] = clampedFirst;
+        contributions.count[size_t(i)] = count;
+    }
+    return contributions;
+}
+
+// out[x] = sum(weights[k] * rows[k][x])
+static void weightedRowSumScalar(const float* const* pRows, const float* pWeights, int numRows, float* pOut, size_t begin, size_t count)
+{
+    for (size_t x = begin; x < count; x++) {
+        float sum = 0.0f;
+        for (int k = 0; k < numRows; k++)
+            sum += pWeights[k] * pRows[k][x];
+        pOut[x] = sum;
+    }
+}
+
+#ifdef CPU_FEATURES_X86
+CPU_TARGET_SSE41 static size_t weightedRowSumSSE41(const float* const* pRows, const float* pWeights, int numRows, float* pOut, size_t count)
+{
+    size_t x = 0;
+    for (; x + 4 <= count; x += 4) {
+        __m128 sum = _mm_setzero_ps();
+        for (int k = 0; k < numRows; k++)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(pWeights[k]), _mm_loadu_ps(pRows[k] + x)));
+        _mm_storeu_ps(pOut + x, sum);
+    }
+    return x;
+}
+
+CPU_TARGET_AVX2 static size_t weightedRowSumAVX2(const float* const* pRows, const float* pWeights, int numRows, float* pOut, size_t count)
+{
+    size_t x = 0;
+    for (; x + 8 <= count; x += 8) {
+        __m256 sum = _mm256_setzero_ps();
+        for (int k = 0; k < numRows; k++)
+            sum = _mm256_fmadd_ps(_mm256_set1_ps(pWeights[k]), _mm256_loadu_ps(pRows[k] + x), sum);
+        _mm256_storeu_ps(pOut + x, sum);
+    }
+    return x;
+}
+#endif
+
+static void weightedRowSum(const float* const* pRows, const float* pWeights, int numRows, float* pOut, size_t count)
+{
+    size_t x = 0;
+#ifdef CPU_FEATURES_X86
+    if (getCPUFeatures().avx2)
+        x = weightedRowSumAVX2(pRows, pWeights, numRows, pOut, count);
+    else if (getCPUFeatures().sse41)
+        x = weightedRowSumSSE41(pRows, pWeights, numRows, pOut, count);
+#endif
+    weightedRowSumScalar(pRows, pWeights, numRows, pOut, x, count);
+}
+
+Image resizeImage(const Image& image, const glm::ivec2& newSize, ResizeFilter filter)
+{
+    assert(newSize.x > 0 && newSize.y > 0);
+    const size_t channels = size_t(image.channels);
+    const std::vector<float> input = imageToFloat(image);
+
+    // Horizontal pass: image.width x image.height -> newSize.x x image.height.
+    const FilterContributions horizontal = computeContributions(image.width, newSize.x, filter);
+    const size_t intermediateRowSize = size_t(newSize.x) * channels;
+    std::vector<float> intermediate(intermediateRowSize * size_t(image.height));
+    parallelFor(image.height, rowBlockSize, [&](int begin, int end) {
+        for (int y = begin; y < end; y++) {
+            const float* pInRow = input.data() + size_t(y) * size_t(image.width) * channels;
+            float* pOutRow = intermediate.data() + size_t(y) * intermediateRowSize;
+            for (int x = 0; x < newSize.x; x++) {
+                const float* pWeights = &horizontal.weights[size_t(x) * size_t(horizontal.maxCount)];
+                const float* pIn = pInRow + size_t(horizontal.first[size_t(x)]) * channels;
+                for (size_t c = 0; c < channels; c++) {
+                    float sum = 0.0f;
+                    for (int k = 0; k < horizontal.count[size_t(x)]; k++)
+                        sum += pWeights[k] * pIn[size_t(k) * channels + c];
+                    pOutRow[size_t(x) * channels + c] = sum;
+                }
+            }
+        }
+    });
+
+    // Vertical pass: whole rows are blended at once, which maps directly onto SIMD lanes.
+    const FilterContributions vertical = computeContributions(image.height, newSize.y, filter);
+    std::vector<float> output(intermediateRowSize * size_t(newSize.y));
+    parallelFor(newSize.y, rowBlockSize, [&](int begin, int end) {
+        std::vector<const float*> rows(size_t(vertical.maxCount));
+        for (int y = begin; y < end; y++) {
+            const int count = vertical.count[size_t(y)];
+            for (int k = 0; k < count; k++)
+                rows[size_t(k)] = intermediate.data() + size_t(vertical.first[size_t(y)] + k) * intermediateRowSize;
+            weightedRowSum(rows.data(), &vertical.weights[size_t(y) * size_t(vertical.maxCount)], count, output.data() + size_t(y) * intermediateRowSize, intermediateRowSize);
+        }
+    });
+
+    return imageFromFloat(output, newSize.x, newSize.y, image.channels);
+}
@@ -0,0 +1,119 @@
+#include "parallel_for.h"
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+class WorkerPool {
+public:
+    WorkerPool()
+    {
+        const int numHelpers = static_cast<int>(std::max(std::thread::hardware_concurrency(), 1u)) - 1;
+        for (int i = 0; i < numHelpers; i++)
+            m_threads.emplace_back([this, i]() { workerLoop(i); });
+    }
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard lock { m_mutex };
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        // The threads are joined by their (std::jthread) destructors.
+    }
+
+    // Returns false (without calling the worker) if the pool is in use.
+    bool tryRun(int numHelpers, void (*worker)(void*), void* pContext)
+    {
+        if (m_busy.exchange(true, std::memory_order_acquire))
+            return false;
+
+        {
+            std::lock_guard lock { m_mutex };
+            m_worker = worker;
+            m_pContext = pContext;
+            m_numHelpers = std::clamp(numHelpers, 0, static_cast<int>(m_threads.size()));
+            m_numRunning = m_numHelpers;
+            m_generation++;
+        }
+        m_wake.notify_all();
+        worker(pContext);
+        {
+            std::unique_lock lock { m_mutex };
+            m_done.wait(lock, [&]() { return m_numRunning == 0; });
+        }
+
+        m_busy.store(false, std::memory_order_release);
+        return true;
+    }
+
+    [[nodiscard]] int size() const
+    {
+        return static_cast<int>(m_threads.size()) + 1;
+    }
+
+private:
+    void workerLoop(int index)
+    {
+        uint64_t generation = 0;
+        std::unique_lock lock { m_mutex };
+        while (true) {
+            m_wake.wait(lock, [&]() { return m_stop || m_generation != generation; });
+            if (m_stop)
+                return;
+            // A job can only start after all helpers of the previous job finished, so no job is ever missed.
+            generation = m_generation;
+            if (index >= m_numHelpers)
+                continue;
+
+            const auto worker = m_worker;
+            void* pContext = m_pContext;
+            lock.unlock();
+            worker(pContext);
+            lock.lock();
+            if (--m_numRunning == 0)
+                m_done.notify_one();
+        }
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    bool m_stop { false };
+    uint64_t m_generation { 0 };
+    void (*m_worker)(void*) { nullptr };
+    void* m_pContext { nullptr };
+    int m_numHelpers { 0 };
+    int m_numRunning { 0 };
+    std::atomic_bool m_busy { false };
+    // Declared last such that the threads are joined before the state that they use is destroyed.
+    std::vector<std::jthread> m_threads;
+};
+
+WorkerPool& getWorkerPool()
+{
+    static WorkerPool pool;
+    return pool;
+}
+
+}
+
+namespace detail {
+
+void runOnWorkerPool(int numHelpers, void (*worker)(void*), void* pContext)
+{
+    if (numHelpers <= 0 || !getWorkerPool().tryRun(numHelpers, worker, pContext))
+        worker(pContext);
+}
+
+int getWorkerPoolSize()
+{
+    return getWorkerPool().size();
+}
+
+}
@@ -0,0 +1,141 @@
+#include "program_cache.h"
+#include "hash.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <fmt/format.h>
+DISABLE_WARNINGS_POP()
+#include <fstream>
+#include <iostream>
+#include <system_error>
+#include <vector>
+
+// File layout: header followed by the binary blob returned by glGetProgramBinary.
+struct ProgramBinaryHeader {
+    static constexpr uint32_t expectedMagic = 0x4E494250; // "PBIN"
+    uint32_t magic;
+    uint32_t binaryFormat;
+    uint64_t key;
+    uint64_t binarySize;
+};
+
+static std::string_view getString(GLenum name)
+{
+    const auto* pString = reinterpret_cast<const char*>(glGetString(name));
+    return pString ? std::string_view(pString) : std::string_view();
+}
+
+ProgramBinaryCache::ProgramBinaryCache(std::filesystem::path directory)
+    : m_directory(std::move(directory))
+{
+    m_driverHash = fnv1a(getString(GL_VENDOR));
+    m_driverHash = fnv1a(getString(GL_RENDERER), m_driverHash);
+    m_driverHash = fnv1a(getString(GL_VERSION), m_driverHash);
+
+    // Drivers without any program binary format cannot use the cache at all.
+    GLint numBinaryFormats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numBinaryFormats);
+    std::error_code errorCode;
+    std::filesystem::create_directories(m_directory, errorCode);
+    m_enabled = numBinaryFormats > 0 && !errorCode;
+    if (!m_enabled)
+        std::cerr << "Warning: program binary cache disabled (" << (errorCode ? errorCode.message() : "no binary formats supported") << ")" << std::endl;
+}
+
+uint64_t ProgramBinaryCache::getDriverHash() const
+{
+    return m_driverHash;
+}
+
+std::optional<GLuint> ProgramBinaryCache::load(uint64_t key)
+{
+    if (!m_enabled)
+        return {};
+
+    std::ifstream file { getEntryPath(key), std::ios::binary };
+    ProgramBinaryHeader header;
+    if (!file || !file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+        m_statistics.misses++;
+        return {};
+    }
+
+    std::vector<char> binary;
+    bool valid = header.magic == ProgramBinaryHeader::expectedMagic && header.key == key;
+    if (valid) {
+        binary.resize(size_t(header.binarySize));
+        valid = bool(file.read(binary.data(), std::streamsize(binary.size())));
+    }
+
+    GLuint program = 0;
+    if (valid) {
+        program = glCreateProgram();
+        glProgramBinary(program, GLenum(header.binaryFormat), binary.data(), GLsizei(binary.size()));
+        GLint linkSuccessful;
+        glGetProgramiv(program, GL_LINK_STATUS, &linkSuccessful);
+        valid = linkSuccessful == GL_TRUE;
+    }
+
+    if (!valid) {
+        if (program)
+            glDeleteProgram(program);
+        m_statistics.stale++;
+        m_statistics.misses++;
+        return {};
+    }
+    m_statistics.hits++;
+    return program;
+}
+
+void ProgramBinaryCache::store(uint64_t key, GLuint program)
+{
+    if (!m_enabled)
+        return;
+
+    GLint binarySize = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &binarySize);
+    if (binarySize <= 0)
+        return;
+
+    std::vector<char> binary(size_t(binarySize), 0);
+    GLenum binaryFormat;
+    glGetProgramBinary(program, binarySize, nullptr, &binaryFormat, binary.data());
+
+    // Write to a temporary file first such that a crash (or a second instance) never leaves a truncated entry behind.
+    const ProgramBinaryHeader header { ProgramBinaryHeader::expectedMagic, uint32_t(binaryFormat), key, uint64_t(binary.size()) };
+    const std::filesystem::path entryPath = getEntryPath(key);
+    std::filesystem::path temporaryPath = entryPath;
+    temporaryPath += ".tmp";
+    {
+        std::ofstream file { temporaryPath, std::ios::binary };
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(binary.data(), std::streamsize(binary.size()));
+        if (!file) {
+            std::cerr << "Warning: failed to write program binary " << temporaryPath << std::endl;
+            return;
+        }
+    }
+    std::error_code errorCode;
+    std::filesystem::rename(temporaryPath, entryPath, errorCode);
+}
+
+bool ProgramBinaryCache::isEnabled() const
+{
+    return m_enabled;
+}
+
+ProgramBinaryCache::Statistics ProgramBinaryCache::getStatistics() const
+{
+    return m_statistics;
+}
+
+void ProgramBinaryCache::printStatistics() const
+{
+    std::cout << "Program binary cache: " << m_statistics.hits << " hit(s), " << m_statistics.misses << " miss(es)";
+    if (m_statistics.stale > 0)
+        std::cout << " of which " << m_statistics.stale << " stale";
+    std::cout << std::endl;
+}
+
+std::filesystem::path ProgramBinaryCache::getEntryPath(uint64_t key) const
+{
+    return m_directory / fmt::format("{:016x}.bin", key);
+}
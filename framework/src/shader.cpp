@@ -1,23 +1,35 @@
 #include "shader.h"
+#include "gl_state.h"
 #include <framework/disable_all_warnings.h>
 DISABLE_WARNINGS_PUSH()
 #include <fmt/format.h>
 DISABLE_WARNINGS_POP()
+DISABLE_WARNINGS_PUSH()
+#include <GLFW/glfw3.h>
+#include <glm/gtc/type_ptr.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <fstream>
 #include <iostream>
+#include <optional>
 #include <sstream>
 #include <string>
+#include <thread>
 
 static constexpr GLuint invalid = 0xFFFFFFFF;
 
 static bool checkShaderErrors(GLuint shader);
 static bool checkProgramErrors(GLuint program);
 static std::string readFile(std::filesystem::path filePath);
+static std::string resolveIncludes(const std::filesystem::path& filePath, std::vector<std::filesystem::path>& files);
+static std::string injectDefines(const std::string& source, const std::string& defines);
 
 Shader::Shader(GLuint program)
     : m_program(program)
 {
+    reflect();
 }
 
 Shader::Shader()
@@ -26,6 +38,8 @@ Shader::Shader()
 }
 
 Shader::Shader(Shader&& other)
+    : m_uniforms(std::move(other.m_uniforms))
+    , m_uniformBlocks(std::move(other.m_uniformBlocks))
 {
     m_program = other.m_program;
     other.m_program = invalid;
@@ -33,37 +47,164 @@ Shader::Shader(Shader&& other)
 
 Shader::~Shader()
 {
-    if (m_program != invalid)
+    if (m_program != invalid) {
+        GLStateCache::get().forgetProgram(m_program);
         glDeleteProgram(m_program);
+    }
 }
 
 Shader& Shader::operator=(Shader&& other)
 {
-    if (m_program != invalid)
+    if (m_program != invalid) {
+        GLStateCache::get().forgetProgram(m_program);
         glDeleteProgram(m_program);
+    }
 
     m_program = other.m_program;
     other.m_program = invalid;
+    m_uniforms = std::move(other.m_uniforms);
+    m_uniformBlocks = std::move(other.m_uniformBlocks);
     return *this;
 }
 
 void Shader::bind() const
 {
     assert(m_program != invalid);
-    glUseProgram(m_program);
+    GLStateCache::get().useProgram(m_program);
 }
 
-void Shader::bindUniformBlock(const std::string& blockName, GLuint bindingLocation, GLuint uniformBlockBuffer) const
+void Shader::bindUniformBlock(UniformName blockName, GLuint bindingLocation, GLuint uniformBlockBuffer) const
 {
-    GLuint blockIdx = glGetUniformBlockIndex(m_program, blockName.data());
-    if (blockIdx != GL_INVALID_INDEX) {
-        glUniformBlockBinding(m_program, blockIdx, bindingLocation);
-        glBindBufferBase(GL_UNIFORM_BUFFER, bindingLocation, uniformBlockBuffer);
+    const auto iter = std::lower_bound(std::begin(m_uniformBlocks), std::end(m_uniformBlocks), blockName.hash,
+        [](const ActiveUniformBlock& block, uint64_t hash) { return block.nameHash < hash; });
+    if (iter != std::end(m_uniformBlocks) && iter->nameHash == blockName.hash) {
+        glUniformBlockBinding(m_program, iter->index, bindingLocation);
+        GLStateCache::get().bindUniformBuffer(bindingLocation, uniformBlockBuffer);
     } else {
-        std::cout << "Could not bind uniform block " << blockName << " invalid name" << std::endl;
+        std::cout << "Could not bind uniform block " << blockName.name << " invalid name" << std::endl;
     }
 }
 
+void Shader::setUniformBlockBinding(UniformName blockName, GLuint bindingLocation) const
+{
+    const auto iter = std::lower_bound(std::begin(m_uniformBlocks), std::end(m_uniformBlocks), blockName.hash,
+        [](const ActiveUniformBlock& block, uint64_t hash) { return block.nameHash < hash; });
+    if (iter != std::end(m_uniformBlocks) && iter->nameHash == blockName.hash)
+        glUniformBlockBinding(m_program, iter->index, bindingLocation);
+    else
+        std::cout << "Could not bind uniform block " << blockName.name << " invalid name" << std::endl;
+}
+
+bool Shader::hasUniformBlock(UniformName blockName) const
+{
+    const auto iter = std::lower_bound(std::begin(m_uniformBlocks), std::end(m_uniformBlocks), blockName.hash,
+        [](const ActiveUniformBlock& block, uint64_t hash) { return block.nameHash < hash; });
+    return iter != std::end(m_uniformBlocks) && iter->nameHash == blockName.hash;
+}
+
+GLint Shader::findUniformLocation(UniformName name) const
+{
+    const auto iter = std::lower_bound(std::begin(m_uniforms), std::end(m_uniforms), name.hash,
+        [](const ActiveUniform& uniform, uint64_t hash) { return uniform.nameHash < hash; });
+    return (iter != std::end(m_uniforms) && iter->nameHash == name.hash) ? iter->location : -1;
+}
+
+void Shader::setUniform(UniformName name, bool value) const
+{
+    glProgramUniform1i(m_program, findUniformLocation(name), value ? GL_TRUE : GL_FALSE);
+}
+
+void Shader::setUniform(UniformName name, int value) const
+{
+    glProgramUniform1i(m_program, findUniformLocation(name), value);
+}
+
+void Shader::setUniform(UniformName name, unsigned value) const
+{
+    glProgramUniform1ui(m_program, findUniformLocation(name), value);
+}
+
+void Shader::setUniform(UniformName name, float value) const
+{
+    glProgramUniform1f(m_program, findUniformLocation(name), value);
+}
+
+void Shader::setUniform(UniformName name, const glm::vec2& value) const
+{
+    glProgramUniform2fv(m_program, findUniformLocation(name), 1, glm::value_ptr(value));
+}
+
+void Shader::setUniform(UniformName name, const glm::vec3& value) const
+{
+    glProgramUniform3fv(m_program, findUniformLocation(name), 1, glm::value_ptr(value));
+}
+
+void Shader::setUniform(UniformName name, const glm::vec4& value) const
+{
+    glProgramUniform4fv(m_program, findUniformLocation(name), 1, glm::value_ptr(value));
+}
+
+void Shader::setUniform(UniformName name, const glm::ivec2& value) const
+{
+    glProgramUniform2iv(m_program, findUniformLocation(name), 1, glm::value_ptr(value));
+}
+
+void Shader::setUniform(UniformName name, const glm::ivec3& value) const
+{
+    glProgramUniform3iv(m_program, findUniformLocation(name), 1, glm::value_ptr(value));
+}
+
+void Shader::setUniform(UniformName name, const glm::ivec4& value) const
+{
+    glProgramUniform4iv(m_program, findUniformLocation(name), 1, glm::value_ptr(value));
+}
+
+void Shader::setUniform(UniformName name, const glm::mat3& value) const
+{
+    glProgramUniformMatrix3fv(m_program, findUniformLocation(name), 1, GL_FALSE, glm::value_ptr(value));
+}
+
+void Shader::setUniform(UniformName name, const glm::mat4& value) const
+{
+    glProgramUniformMatrix4fv(m_program, findUniformLocation(name), 1, GL_FALSE, glm::value_ptr(value));
+}
+
+void Shader::reflect()
+{
+    GLint maxNameLength = 0, numUniforms = 0;
+    glGetProgramiv(m_program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+    glGetProgramiv(m_program, GL_ACTIVE_UNIFORMS, &numUniforms);
+    std::string name(size_t(std::max(maxNameLength, 1)), '\0');
+    for (GLuint i = 0; i < GLuint(numUniforms); i++) {
+        GLsizei nameLength;
+        GLint arraySize;
+        GLenum type;
+        glGetActiveUniform(m_program, i, maxNameLength, &nameLength, &arraySize, &type, name.data());
+        std::string_view nameView { name.data(), size_t(nameLength) };
+        // Arrays are reported as "name[0]"; they can be addressed by their plain name as well (which refers to the first element).
+        if (nameView.ends_with("[0]"))
+            nameView.remove_suffix(3);
+        // Members of uniform blocks do not have a location.
+        if (const GLint location = glGetUniformLocation(m_program, name.c_str()); location != -1)
+            m_uniforms.push_back({ fnv1a(nameView), location });
+    }
+
+    GLint numUniformBlocks = 0;
+    glGetProgramiv(m_program, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxNameLength);
+    glGetProgramiv(m_program, GL_ACTIVE_UNIFORM_BLOCKS, &numUniformBlocks);
+    name.assign(size_t(std::max(maxNameLength, 1)), '\0');
+    for (GLuint i = 0; i < GLuint(numUniformBlocks); i++) {
+        GLsizei nameLength;
+        glGetActiveUniformBlockName(m_program, i, maxNameLength, &nameLength, name.data());
+        m_uniformBlocks.push_back({ fnv1a(std::string_view(name.data(), size_t(nameLength))), i });
+    }
+
+    std::sort(std::begin(m_uniforms), std::end(m_uniforms), [](const auto& lhs, const auto& rhs) { return lhs.nameHash < rhs.nameHash; });
+    std::sort(std::begin(m_uniformBlocks), std::end(m_uniformBlocks), [](const auto& lhs, const auto& rhs) { return lhs.nameHash < rhs.nameHash; });
+    // Two names with the same hash are astronomically unlikely with 64 bits, but would silently alias.
+    assert(std::adjacent_find(std::begin(m_uniforms), std::end(m_uniforms), [](const auto& lhs, const auto& rhs) { return lhs.nameHash == rhs.nameHash; }) == std::end(m_uniforms));
+}
+
 GLuint Shader::getAttributeLocation(const std::string& name) const
 {
     GLuint loc = glGetAttribLocation(m_program, name.c_str());
@@ -82,9 +223,9 @@ GLint Shader::getUniformLocation(const std::string& name) const
     return loc;
 }
 
-ShaderBuilder::~ShaderBuilder()
+ShaderBuilder::ShaderBuilder(ProgramBinaryCache& programCache)
+    : m_pProgramCache(&programCache)
 {
-    freeShaders();
 }
 
 ShaderBuilder& ShaderBuilder::addStage(GLuint shaderStage, std::filesystem::path shaderFile)
@@ -93,40 +234,196 @@ ShaderBuilder& ShaderBuilder::addStage(GLuint shaderStage, std::filesystem::path
         throw ShaderLoadingException(fmt::format("File {} does not exist", shaderFile.string().c_str()));
     }
 
-    const std::string shaderSource = readFile(shaderFile);
-    const GLuint shader = glCreateShader(shaderStage);
-    const char* shaderSourcePtr = shaderSource.c_str();
-    glShaderSource(shader, 1, &shaderSourcePtr, nullptr);
-    glCompileShader(shader);
-    if (!checkShaderErrors(shader)) {
-        glDeleteShader(shader);
-        throw ShaderLoadingException(fmt::format("Failed to compile shader {}", shaderFile.string().c_str()));
-    }
+    std::vector<std::filesystem::path> files;
+    std::string source = resolveIncludes(shaderFile, files);
+    m_stages.push_back({ shaderStage, std::move(files), std::move(source) });
+    return *this;
+}
 
-    m_shaders.push_back(shader);
+ShaderBuilder& ShaderBuilder::addDefine(std::string_view name, std::string_view value)
+{
+    m_defines += fmt::format("#define {} {}\n", name, value);
     return *this;
 }
 
 Shader ShaderBuilder::build()
 {
+    return finish(submit());
+}
+
+std::vector<std::filesystem::path> ShaderBuilder::getFiles() const
+{
+    std::vector<std::filesystem::path> out;
+    for (const Stage& stage : m_stages)
+        out.insert(std::end(out), std::begin(stage.files), std::end(stage.files));
+    return out;
+}
+
+ShaderBuilder::PendingProgram ShaderBuilder::submit() const
+{
+    PendingProgram out { 0, {}, {}, m_pProgramCache, 0 };
+    std::vector<std::string> sources;
+    for (const Stage& stage : m_stages) {
+        sources.push_back(injectDefines(stage.source, m_defines));
+        out.stageFiles.push_back(stage.files);
+    }
+
+    // The cache key covers everything that influences the binary: the driver and the type + preprocessed source of every stage.
+    if (m_pProgramCache) {
+        out.cacheKey = m_pProgramCache->getDriverHash();
+        for (size_t i = 0; i < m_stages.size(); i++) {
+            out.cacheKey = fnv1a(fmt::format("{}:", m_stages[i].type), out.cacheKey);
+            out.cacheKey = fnv1a(sources[i], out.cacheKey);
+        }
+        if (const std::optional<GLuint> cachedProgram = m_pProgramCache->load(out.cacheKey)) {
+            out.program = *cachedProgram;
+            return out;
+        }
+    }
+
+    // Linking does not have to wait for the compile results; errors are checked (and reported per stage) in finish().
+    for (size_t i = 0; i < m_stages.size(); i++) {
+        const GLuint shader = glCreateShader(m_stages[i].type);
+        const char* shaderSourcePtr = sources[i].c_str();
+        glShaderSource(shader, 1, &shaderSourcePtr, nullptr);
+        glCompileShader(shader);
+        out.shaders.push_back(shader);
+    }
+
     // Combine vertex and fragment shaders into a single shader program.
-    GLuint program = glCreateProgram();
-    for (GLuint shader : m_shaders)
-        glAttachShader(program, shader);
-    glLinkProgram(program);
-    freeShaders();
+    out.program = glCreateProgram();
+    if (m_pProgramCache)
+        glProgramParameteri(out.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    for (GLuint shader : out.shaders)
+        glAttachShader(out.program, shader);
+    glLinkProgram(out.program);
+    return out;
+}
+
+Shader ShaderBuilder::finish(PendingProgram&& pending)
+{
+    // Programs from the cache have already been validated by ProgramBinaryCache::load().
+    if (pending.shaders.empty())
+        return Shader(pending.program);
 
-    if (!checkProgramErrors(program)) {
+    const auto freeResources = [&]() {
+        for (GLuint shader : pending.shaders)
+            glDeleteShader(shader);
+        glDeleteProgram(pending.program);
+    };
+    for (size_t i = 0; i < pending.shaders.size(); i++) {
+        if (!checkShaderErrors(pending.shaders[i])) {
+            freeResources();
+            // Errors in included files are reported with the index of the file as source string number.
+            const auto& files = pending.stageFiles[i];
+            for (size_t file = 1; file < files.size(); file++)
+                std::cerr << "Source string " << file << ": " << files[file].string() << std::endl;
+            throw ShaderLoadingException(fmt::format("Failed to compile shader {}", files.front().string().c_str()));
+        }
+    }
+
+    if (!checkProgramErrors(pending.program)) {
+        freeResources();
         throw ShaderLoadingException("Shader program failed to link");
     }
+    for (GLuint shader : pending.shaders)
+        glDeleteShader(shader);
 
-    return Shader(program);
+    if (pending.pProgramCache)
+        pending.pProgramCache->store(pending.cacheKey, pending.program);
+    return Shader(pending.program);
 }
 
-void ShaderBuilder::freeShaders()
+// GL_KHR_parallel_shader_compile / GL_ARB_parallel_shader_compile are not part of the GLAD loader that we ship.
+static constexpr GLenum GL_MAX_SHADER_COMPILER_THREADS = 0x91B0;
+static constexpr GLenum GL_COMPLETION_STATUS = 0x91B1;
+using PFN_glMaxShaderCompilerThreads = void(APIENTRYP)(GLuint count);
+
+static bool hasExtension(std::string_view name)
 {
-    for (GLuint shader : m_shaders)
-        glDeleteShader(shader);
+    GLint numExtensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+    for (GLuint i = 0; i < GLuint(numExtensions); i++) {
+        if (name == reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i)))
+            return true;
+    }
+    return false;
+}
+
+bool ShaderBatch::isParallelCompileSupported()
+{
+    static const bool supported = hasExtension("GL_KHR_parallel_shader_compile") || hasExtension("GL_ARB_parallel_shader_compile");
+    return supported;
+}
+
+ShaderBatch::ShaderBatch()
+{
+    if (!isParallelCompileSupported())
+        return;
+    // Let the driver decide how many threads it uses (by default some drivers only use a single one).
+    auto pMaxShaderCompilerThreads = reinterpret_cast<PFN_glMaxShaderCompilerThreads>(glfwGetProcAddress("glMaxShaderCompilerThreadsKHR"));
+    if (!pMaxShaderCompilerThreads)
+        pMaxShaderCompilerThreads = reinterpret_cast<PFN_glMaxShaderCompilerThreads>(glfwGetProcAddress("glMaxShaderCompilerThreadsARB"));
+    if (pMaxShaderCompilerThreads)
+        pMaxShaderCompilerThreads(0xFFFFFFFF);
+}
+
+ShaderBatch::~ShaderBatch()
+{
+    // Programs that were never finished (e.g. because an exception was thrown).
+    for (Entry& entry : m_entries) {
+        for (GLuint shader : entry.pending.shaders)
+            glDeleteShader(shader);
+        glDeleteProgram(entry.pending.program);
+    }
+}
+
+void ShaderBatch::add(ShaderBuilder&& builder, std::function<void(Shader&&)> onFinished)
+{
+    m_entries.push_back({ builder.submit(), std::move(onFinished) });
+}
+
+void ShaderBatch::add(ShaderBuilder&& builder, Shader& target)
+{
+    add(std::move(builder), [&target](Shader&& shader) { target = std::move(shader); });
+}
+
+static bool isProgramComplete(GLuint program)
+{
+    GLint complete = GL_TRUE;
+    if (ShaderBatch::isParallelCompileSupported())
+        glGetProgramiv(program, GL_COMPLETION_STATUS, &complete);
+    return complete == GL_TRUE;
+}
+
+bool ShaderBatch::isReady() const
+{
+    return std::all_of(std::begin(m_entries), std::end(m_entries), [](const Entry& entry) { return isProgramComplete(entry.pending.program); });
+}
+
+void ShaderBatch::finish()
+{
+    std::optional<ShaderLoadingException> firstError;
+    while (!m_entries.empty()) {
+        // Finish whatever is done; the last remaining program is finished in a blocking fashion.
+        const auto iter = std::find_if(std::begin(m_entries), std::end(m_entries), [&](const Entry& entry) { return m_entries.size() == 1 || isProgramComplete(entry.pending.program); });
+        if (iter == std::end(m_entries)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        Entry entry = std::move(*iter);
+        m_entries.erase(iter);
+        try {
+            entry.onFinished(ShaderBuilder::finish(std::move(entry.pending)));
+        } catch (const ShaderLoadingException& e) {
+            std::cerr << e.what() << std::endl;
+            if (!firstError)
+                firstError = e;
+        }
+    }
+    if (firstError)
+        throw *firstError;
 }
 
 static std::string readFile(std::filesystem::path filePath)
@@ -138,6 +435,58 @@ static std::string readFile(std::filesystem::path filePath)
     return buffer.str();
 }
 
+static std::string resolveIncludes(const std::filesystem::path& filePath, std::vector<std::filesystem::path>& files)
+{
+    const size_t fileIndex = files.size();
+    files.push_back(filePath);
+
+    std::istringstream input { readFile(filePath) };
+    std::string out;
+    int lineNumber = 0;
+    for (std::string line; std::getline(input, line);) {
+        lineNumber++;
+        const size_t firstNonSpace = line.find_first_not_of(" \t");
+        if (firstNonSpace == std::string::npos || line.compare(firstNonSpace, 8, "#include") != 0) {
+            out += line;
+            out += '\n';
+            continue;
+        }
+
+        const size_t nameBegin = line.find('"', firstNonSpace);
+        const size_t nameEnd = nameBegin == std::string::npos ? std::string::npos : line.find('"', nameBegin + 1);
+        if (nameEnd == std::string::npos)
+            throw ShaderLoadingException(fmt::format("{}({}): expected #include \"file\"", filePath.string(), lineNumber));
+        const std::filesystem::path includePath = (filePath.parent_path() / line.substr(nameBegin + 1, nameEnd - nameBegin - 1)).lexically_normal();
+        if (!std::filesystem::exists(includePath))
+            throw ShaderLoadingException(fmt::format("{}({}): included file {} does not exist", filePath.string(), lineNumber, includePath.string()));
+
+        if (std::find(std::begin(files), std::end(files), includePath) == std::end(files)) {
+            out += fmt::format("#line 1 {}\n", files.size());
+            out += resolveIncludes(includePath, files);
+        }
+        // Continue with the correct line numbers of this file.
+        out += fmt::format("#line {} {}\n", lineNumber + 1, fileIndex);
+    }
+    return out;
+}
+
+static std::string injectDefines(const std::string& source, const std::string& defines)
+{
+    if (defines.empty())
+        return source;
+
+    // The #version directive must come before anything else (except comments).
+    const size_t versionPosition = source.find("#version");
+    size_t insertPosition = 0;
+    int lineNumber = 1;
+    if (versionPosition != std::string::npos) {
+        insertPosition = source.find('\n', versionPosition);
+        insertPosition = insertPosition == std::string::npos ? source.size() : insertPosition + 1;
+        lineNumber += static_cast<int>(std::count(std::begin(source), std::begin(source) + std::ptrdiff_t(insertPosition), '\n'));
+    }
+    return source.substr(0, insertPosition) + defines + fmt::format("#line {} 0\n", lineNumber) + source.substr(insertPosition);
+}
+
 static bool checkShaderErrors(GLuint shader)
 {
     // Check if the shader compiled successfully.
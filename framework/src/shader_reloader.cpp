@@ -0,0 +1,123 @@
+#include "shader_reloader.h"
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <system_error>
+#include <utility>
+
+static std::filesystem::path normalizePath(const std::filesystem::path& filePath)
+{
+    std::error_code errorCode;
+    const std::filesystem::path out = std::filesystem::weakly_canonical(filePath, errorCode);
+    return errorCode ? filePath.lexically_normal() : out;
+}
+
+static bool usesAnyOf(const ShaderBuilder& builder, const std::vector<std::filesystem::path>& changedFiles)
+{
+    const auto files = builder.getFiles();
+    return std::any_of(std::begin(files), std::end(files), [&](const std::filesystem::path& file) {
+        return std::find(std::begin(changedFiles), std::end(changedFiles), normalizePath(file)) != std::end(changedFiles);
+    });
+}
+
+ShaderReloader::ShaderReloader(std::filesystem::path directory)
+    : m_fileWatcher(std::move(directory))
+{
+}
+
+void ShaderReloader::watch(std::function<ShaderBuilder()> createBuilder, Shader& target)
+{
+    m_programs.push_back({ std::move(createBuilder), &target });
+}
+
+void ShaderReloader::watch(ShaderVariants& variants)
+{
+    m_variants.push_back(&variants);
+}
+
+void ShaderReloader::update()
+{
+    for (const FileWatcher::FileChange& change : m_fileWatcher.takeChanges()) {
+        const std::filesystem::path filePath = normalizePath(change.filePath);
+        if (std::find(std::begin(m_changedFiles), std::end(m_changedFiles), filePath) == std::end(m_changedFiles))
+            m_changedFiles.push_back(filePath);
+        if (!m_firstChangeTime)
+            m_firstChangeTime = change.time;
+    }
+
+    if (m_pBatch && m_pBatch->isReady())
+        finishReload();
+    if (!m_pBatch && !m_changedFiles.empty())
+        startReload(std::exchange(m_changedFiles, {}));
+}
+
+const ShaderReloader::Statistics& ShaderReloader::getStatistics() const
+{
+    return m_statistics;
+}
+
+void ShaderReloader::startReload(const std::vector<std::filesystem::path>& changedFiles)
+{
+    m_reloadStartTime = m_firstChangeTime.value_or(std::chrono::steady_clock::now());
+    m_firstChangeTime.reset();
+
+    // The new programs are not put in place until all of them have compiled successfully.
+    auto pBatch = std::make_unique<ShaderBatch>();
+    m_pendingSwaps.clear();
+    size_t numPrograms = 0;
+    try {
+        for (const WatchedProgram& program : m_programs) {
+            ShaderBuilder builder = program.createBuilder();
+            if (!usesAnyOf(builder, changedFiles))
+                continue;
+            numPrograms++;
+            pBatch->add(std::move(builder), [this, pTarget = program.pTarget](Shader&& shader) {
+                auto pShader = std::make_shared<Shader>(std::move(shader));
+                m_pendingSwaps.push_back([=]() { *pTarget = std::move(*pShader); });
+            });
+        }
+        for (ShaderVariants* pVariants : m_variants) {
+            for (uint32_t featureMask : pVariants->getCompiledVariants()) {
+                ShaderBuilder builder = pVariants->createBuilder(featureMask);
+                if (!usesAnyOf(builder, changedFiles))
+                    continue;
+                numPrograms++;
+                pBatch->add(std::move(builder), [this, pVariants, featureMask](Shader&& shader) {
+                    auto pShader = std::make_shared<Shader>(std::move(shader));
+                    m_pendingSwaps.push_back([=]() { pVariants->replace(featureMask, std::move(*pShader)); });
+                });
+            }
+        }
+    } catch (const std::exception& e) {
+        // Reading the sources failed (e.g. an #include of a file that does not exist).
+        std::cerr << "Shader reload failed: " << e.what() << std::endl;
+        m_statistics.numFailures++;
+        m_statistics.lastError = e.what();
+        return;
+    }
+    // Files that are not used by any watched program (e.g. a backup file written by an editor).
+    if (numPrograms > 0)
+        m_pBatch = std::move(pBatch);
+}
+
+void ShaderReloader::finishReload()
+{
+    auto pBatch = std::move(m_pBatch);
+    try {
+        pBatch->finish();
+    } catch (const ShaderLoadingException& e) {
+        std::cerr << "Shader reload failed, keeping the previous programs" << std::endl;
+        m_pendingSwaps.clear();
+        m_statistics.numFailures++;
+        m_statistics.lastError = e.what();
+        return;
+    }
+
+    for (const auto& swap : m_pendingSwaps)
+        swap();
+    m_pendingSwaps.clear();
+    m_statistics.numReloads++;
+    m_statistics.lastError.clear();
+    m_statistics.lastLatencyMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_reloadStartTime).count();
+    std::cout << "Reloaded shaders in " << m_statistics.lastLatencyMs << "ms" << std::endl;
+}
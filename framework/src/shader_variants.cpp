@@ -0,0 +1,60 @@
+#include "shader_variants.h"
+#include <cassert>
+
+ShaderVariants::ShaderVariants(std::vector<std::string> features, ProgramBinaryCache* pProgramCache)
+    : m_features(std::move(features))
+    , m_pProgramCache(pProgramCache)
+{
+    assert(m_features.size() <= 32);
+}
+
+ShaderVariants& ShaderVariants::addStage(GLuint shaderStage, std::filesystem::path shaderFile)
+{
+    m_stages.push_back({ shaderStage, std::move(shaderFile) });
+    return *this;
+}
+
+const Shader& ShaderVariants::get(uint32_t featureMask)
+{
+    if (auto iter = m_variants.find(featureMask); iter != std::end(m_variants))
+        return iter->second;
+    return m_variants.emplace(featureMask, createBuilder(featureMask).build()).first->second;
+}
+
+void ShaderVariants::compile(std::span<const uint32_t> featureMasks, ShaderBatch& batch)
+{
+    for (uint32_t featureMask : featureMasks) {
+        if (!m_variants.contains(featureMask))
+            batch.add(createBuilder(featureMask), [this, featureMask](Shader&& shader) { m_variants.emplace(featureMask, std::move(shader)); });
+    }
+}
+
+ShaderBuilder ShaderVariants::createBuilder(uint32_t featureMask) const
+{
+    ShaderBuilder builder = m_pProgramCache ? ShaderBuilder(*m_pProgramCache) : ShaderBuilder();
+    for (const Stage& stage : m_stages)
+        builder.addStage(stage.type, stage.filePath);
+    for (size_t i = 0; i < m_features.size(); i++) {
+        if (featureMask & (1u << i))
+            builder.addDefine(m_features[i]);
+    }
+    return builder;
+}
+
+size_t ShaderVariants::getNumCompiledVariants() const
+{
+    return m_variants.size();
+}
+
+std::vector<uint32_t> ShaderVariants::getCompiledVariants() const
+{
+    std::vector<uint32_t> out;
+    for (const auto& [featureMask, shader] : m_variants)
+        out.push_back(featureMask);
+    return out;
+}
+
+void ShaderVariants::replace(uint32_t featureMask, Shader&& shader)
+{
+    m_variants.insert_or_assign(featureMask, std::move(shader));
+}
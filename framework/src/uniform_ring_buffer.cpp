@@ -0,0 +1,109 @@
+#include "uniform_ring_buffer.h"
+#include "gl_state.h"
+#include <cstring>
+#include <stdexcept>
+
+UniformRingBuffer::UniformRingBuffer(size_t frameSizeInBytes)
+{
+    GLint alignment;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    m_alignment = static_cast<size_t>(alignment);
+    // Every region starts at an aligned offset.
+    m_frameSize = (frameSizeInBytes + m_alignment - 1) / m_alignment * m_alignment;
+    const auto bufferSize = static_cast<GLsizeiptr>(maxFramesInFlight * m_frameSize);
+
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+    if (GLAD_GL_VERSION_4_4) {
+        constexpr GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_UNIFORM_BUFFER, bufferSize, nullptr, flags);
+        m_pMapped = static_cast<std::byte*>(glMapBufferRange(GL_UNIFORM_BUFFER, 0, bufferSize, flags));
+    } else {
+        glBufferData(GL_UNIFORM_BUFFER, bufferSize, nullptr, GL_STREAM_DRAW);
+        m_staging.resize(m_frameSize);
+    }
+}
+
+UniformRingBuffer::~UniformRingBuffer()
+{
+    for (GLsync fence : m_fences) {
+        if (fence)
+            glDeleteSync(fence);
+    }
+    if (m_pMapped) {
+        glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+        glUnmapBuffer(GL_UNIFORM_BUFFER);
+    }
+    GLStateCache::get().forgetBuffer(m_buffer);
+    glDeleteBuffers(1, &m_buffer);
+}
+
+void UniformRingBuffer::beginFrame()
+{
+    m_frame = (m_frame + 1) % maxFramesInFlight;
+    m_writeOffset = m_flushedOffset = 0;
+
+    // The region was last used maxFramesInFlight frames ago, so this normally returns immediately.
+    if (GLsync& fence = m_fences[m_frame]; fence) {
+        GLbitfield waitFlags = 0;
+        while (true) {
+            const GLenum result = glClientWaitSync(fence, waitFlags, 1'000'000'000);
+            if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED)
+                break;
+            // Make sure the fence is actually submitted, otherwise we could wait forever.
+            waitFlags = GL_SYNC_FLUSH_COMMANDS_BIT;
+        }
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+}
+
+void UniformRingBuffer::endFrame()
+{
+    flush();
+    m_fences[m_frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+size_t UniformRingBuffer::push(const void* pData, size_t sizeInBytes)
+{
+    const Allocation allocation = allocate(sizeInBytes);
+    std::memcpy(allocation.pData, pData, sizeInBytes);
+    return allocation.offset;
+}
+
+UniformRingBuffer::Allocation UniformRingBuffer::allocate(size_t sizeInBytes)
+{
+    const size_t offset = (m_writeOffset + m_alignment - 1) / m_alignment * m_alignment;
+    if (offset + sizeInBytes > m_frameSize)
+        throw std::runtime_error("Uniform ring buffer region is full");
+
+    std::byte* pRegion = m_pMapped ? m_pMapped + m_frame * m_frameSize : m_staging.data();
+    m_writeOffset = offset + sizeInBytes;
+    return { pRegion + offset, m_frame * m_frameSize + offset };
+}
+
+void UniformRingBuffer::flush()
+{
+    // The persistent mapping is coherent: writes become visible to commands issued after them.
+    if (!m_pMapped && m_writeOffset > m_flushedOffset) {
+        glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, static_cast<GLintptr>(m_frame * m_frameSize + m_flushedOffset),
+            static_cast<GLsizeiptr>(m_writeOffset - m_flushedOffset), m_staging.data() + m_flushedOffset);
+    }
+    m_flushedOffset = m_writeOffset;
+}
+
+void UniformRingBuffer::bindRange(GLuint index, size_t offset, size_t sizeInBytes) const
+{
+    GLStateCache::get().bindUniformBufferRange(index, m_buffer, static_cast<GLintptr>(offset), static_cast<GLsizeiptr>(sizeInBytes));
+}
+
+bool UniformRingBuffer::isPersistentlyMapped() const
+{
+    return m_pMapped != nullptr;
+}
+
+size_t UniformRingBuffer::getFrameUsage() const
+{
+    return m_writeOffset;
+}
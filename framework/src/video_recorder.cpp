@@ -0,0 +1,202 @@
+#include "video_recorder.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <fmt/format.h>
+DISABLE_WARNINGS_POP()
+#include <cassert>
+#include <iostream>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define VIDEO_RECORDER_SSE2 1
+#endif
+
+// Fixed point BT.601 studio range coefficients (scaled by 256), see https://learn.microsoft.com/en-us/windows/win32/medfound/recommended-8-bit-yuv-formats-for-video-rendering
+static constexpr int yCoefficients[3] { 66, 129, 25 };
+static constexpr int uCoefficients[3] { -38, -74, 112 };
+static constexpr int vCoefficients[3] { 112, -94, -18 };
+
+static uint8_t weightedSum(const uint8_t* pixel, const int* coefficients, int offset)
+{
+    const int sum = coefficients[0] * pixel[0] + coefficients[1] * pixel[1] + coefficients[2] * pixel[2];
+    return static_cast<uint8_t>(((sum + 128) >> 8) + offset);
+}
+
+// Average a 2x2 block of RGBA pixels the same way as the SIMD path does (two rounded pairwise averages).
+static void averageBlock(const uint8_t* row0, const uint8_t* row1, uint8_t* out)
+{
+    for (int c = 0; c < 4; c++) {
+        const int left = (row0[c] + row1[c] + 1) >> 1;
+        const int right = (row0[4 + c] + row1[4 + c] + 1) >> 1;
+        out[c] = static_cast<uint8_t>((left + right + 1) >> 1);
+    }
+}
+
+#ifdef VIDEO_RECORDER_SSE2
+// Dot product of 4 RGBA8 pixels with the (16 bit) coefficients, returned as 4 x int32.
+static __m128i weightedSum4(__m128i pixels, __m128i coefficients)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 lo = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), coefficients));
+    const __m128 hi = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpackhi_epi8(pixels, zero), coefficients));
+    // madd leaves (R*cr + G*cg, B*cb + A*0) pairs; add them per pixel.
+    const __m128i rg = _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+    const __m128i ba = _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+    return _mm_add_epi32(rg, ba);
+}
+
+static __m128i toBytes(__m128i sum0, __m128i sum1, __m128i offset)
+{
+    const __m128i rounding = _mm_set1_epi32(128);
+    sum0 = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(sum0, rounding), 8), offset);
+    sum1 = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(sum1, rounding), 8), offset);
+    const __m128i words = _mm_packs_epi32(sum0, sum1);
+    return _mm_packus_epi16(words, words);
+}
+
+static __m128i coefficientVector(const int* c)
+{
+    return _mm_setr_epi16(short(c[0]), short(c[1]), short(c[2]), 0, short(c[0]), short(c[1]), short(c[2]), 0);
+}
+#endif
+
+void convertRGBAToYUV420(std::span<const uint8_t> rgba, int inputWidth, int width, int height, std::span<uint8_t> yPlane, std::span<uint8_t> uPlane, std::span<uint8_t> vPlane)
+{
+    assert(width % 2 == 0 && height % 2 == 0 && width <= inputWidth);
+    assert(rgba.size() >= size_t(inputWidth) * size_t(height) * 4);
+    assert(yPlane.size() >= size_t(width * height) && uPlane.size() >= size_t(width * height / 4) && vPlane.size() >= size_t(width * height / 4));
+
+    // OpenGL returns rows bottom-up while Y4M stores them top-down.
+    const auto inputRow = [&](int y) { return rgba.data() + size_t(height - 1 - y) * size_t(inputWidth) * 4; };
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t* pSrc = inputRow(y);
+        uint8_t* pDst = yPlane.data() + size_t(y) * size_t(width);
+        int x = 0;
+#ifdef VIDEO_RECORDER_SSE2
+        const __m128i coefficients = coefficientVector(yCoefficients);
+        const __m128i offset = _mm_set1_epi32(16);
+        for (; x + 8 <= width; x += 8) {
+            const __m128i pixels0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSrc + 4 * x));
+            const __m128i pixels1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSrc + 4 * x + 16));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(pDst + x), toBytes(weightedSum4(pixels0, coefficients), weightedSum4(pixels1, coefficients), offset));
+        }
+#endif
+        for (; x < width; x++)
+            pDst[x] = weightedSum(pSrc + 4 * x, yCoefficients, 16);
+    }
+
+    const int chromaWidth = width / 2;
+    for (int y = 0; y < height / 2; y++) {
+        const uint8_t* pRow0 = inputRow(2 * y);
+        const uint8_t* pRow1 = inputRow(2 * y + 1);
+        uint8_t* pU = uPlane.data() + size_t(y) * size_t(chromaWidth);
+        uint8_t* pV = vPlane.data() + size_t(y) * size_t(chromaWidth);
+        int x = 0;
+#ifdef VIDEO_RECORDER_SSE2
+        const __m128i uCoefficientVector = coefficientVector(uCoefficients);
+        const __m128i vCoefficientVector = coefficientVector(vCoefficients);
+        const __m128i offset = _mm_set1_epi32(128);
+        for (; x + 8 <= chromaWidth; x += 8) {
+            __m128i blocks[2];
+            for (int half = 0; half < 2; half++) {
+                const size_t byteOffset = size_t(8 * x + 32 * half);
+                const __m128i vertical0 = _mm_avg_epu8(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(pRow0 + byteOffset)),
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(pRow1 + byteOffset)));
+                const __m128i vertical1 = _mm_avg_epu8(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(pRow0 + byteOffset + 16)),
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(pRow1 + byteOffset + 16)));
+                const __m128 v0 = _mm_castsi128_ps(vertical0), v1 = _mm_castsi128_ps(vertical1);
+                blocks[half] = _mm_avg_epu8(
+                    _mm_castps_si128(_mm_shuffle_ps(v0, v1, _MM_SHUFFLE(2, 0, 2, 0))),
+                    _mm_castps_si128(_mm_shuffle_ps(v0, v1, _MM_SHUFFLE(3, 1, 3, 1))));
+            }
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(pU + x), toBytes(weightedSum4(blocks[0], uCoefficientVector), weightedSum4(blocks[1], uCoefficientVector), offset));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(pV + x), toBytes(weightedSum4(blocks[0], vCoefficientVector), weightedSum4(blocks[1], vCoefficientVector), offset));
+        }
+#endif
+        for (; x < chromaWidth; x++) {
+            uint8_t block[4];
+            averageBlock(pRow0 + 8 * x, pRow1 + 8 * x, block);
+            pU[x] = weightedSum(block, uCoefficients, 128);
+            pV[x] = weightedSum(block, vCoefficients, 128);
+        }
+    }
+}
+
+VideoRecorder::VideoRecorder(const std::filesystem::path& filePath, const glm::ivec2& resolution, int framesPerSecond)
+    : m_file(filePath, std::ios::binary)
+    , m_inputResolution(resolution)
+    , m_outputResolution(resolution.x & ~1, resolution.y & ~1)
+    , m_framesPerSecond(framesPerSecond)
+{
+    if (m_outputResolution.x <= 0 || m_outputResolution.y <= 0 || framesPerSecond <= 0)
+        throw VideoRecordingException(fmt::format("Invalid recording settings {}x{} @ {} fps", resolution.x, resolution.y, framesPerSecond));
+    if (!m_file)
+        throw VideoRecordingException(fmt::format("Could not open {} for writing", filePath.string()));
+
+    // Progressive frames, square pixels, JPEG/MPEG-1 chroma siting.
+    m_file << fmt::format("YUV4MPEG2 W{} H{} F{}:1 Ip A1:1 C420jpeg\n", m_outputResolution.x, m_outputResolution.y, framesPerSecond);
+    m_encodeThread = std::thread(&VideoRecorder::encodeLoop, this);
+}
+
+VideoRecorder::~VideoRecorder()
+{
+    {
+        std::lock_guard lock { m_mutex };
+        m_stop = true;
+    }
+    m_frameAvailable.notify_one();
+    m_encodeThread.join();
+}
+
+void VideoRecorder::pushFrame(std::vector<uint8_t>&& rgbaPixels)
+{
+    assert(rgbaPixels.size() == size_t(m_inputResolution.x) * size_t(m_inputResolution.y) * 4);
+
+    std::unique_lock lock { m_mutex };
+    m_frameConsumed.wait(lock, [&]() { return m_pendingFrames.size() < maxPendingFrames; });
+    m_pendingFrames.push_back(std::move(rgbaPixels));
+    lock.unlock();
+    m_frameAvailable.notify_one();
+}
+
+int VideoRecorder::getFramesPerSecond() const
+{
+    return m_framesPerSecond;
+}
+
+uint64_t VideoRecorder::getNumFramesWritten() const
+{
+    std::lock_guard lock { m_mutex };
+    return m_numFramesWritten;
+}
+
+void VideoRecorder::encodeLoop()
+{
+    const size_t lumaSize = size_t(m_outputResolution.x) * size_t(m_outputResolution.y);
+    std::vector<uint8_t> planes(lumaSize + lumaSize / 2);
+    const std::span<uint8_t> yPlane { planes.data(), lumaSize };
+    const std::span<uint8_t> uPlane { planes.data() + lumaSize, lumaSize / 4 };
+    const std::span<uint8_t> vPlane { planes.data() + lumaSize + lumaSize / 4, lumaSize / 4 };
+
+    while (true) {
+        std::unique_lock lock { m_mutex };
+        m_frameAvailable.wait(lock, [&]() { return m_stop || !m_pendingFrames.empty(); });
+        if (m_pendingFrames.empty())
+            return; // Stop was requested and all frames have been written.
+        std::vector<uint8_t> frame = std::move(m_pendingFrames.front());
+        m_pendingFrames.pop_front();
+        lock.unlock();
+        m_frameConsumed.notify_one();
+
+        convertRGBAToYUV420(frame, m_inputResolution.x, m_outputResolution.x, m_outputResolution.y, yPlane, uPlane, vPlane);
+        m_file << "FRAME\n";
+        m_file.write(reinterpret_cast<const char*>(planes.data()), static_cast<std::streamsize>(planes.size()));
+        if (!m_file)
+            std::cerr << "Failed to write video frame" << std::endl;
+
+        lock.lock();
+        m_numFramesWritten++;
+    }
+}
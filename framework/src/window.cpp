@@ -1,4 +1,5 @@
 #include "window.h"
+#include "gl_state.h"
 #include <imgui/imgui.h>
 #include <imgui/imgui_impl_glfw.h>
 #include <imgui/imgui_impl_opengl2.h>
@@ -7,6 +8,7 @@
 #include <imgui/imgui_impl_opengl3.h>
 #include <iostream>
 #include <stb/stb_image_write.h>
+#include "video_recorder.h"
 
 static void glfwErrorCallback(int error, const char* description)
 {
@@ -34,27 +36,28 @@ Window::Window(std::string_view title, const glm::ivec2& windowSize, OpenGLVersi
         exit(1);
     }
 
-    if (m_presentable) {
-        glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
-
-        if (glVersion == OpenGLVersion::GL3) {
-            glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-            glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-            glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-        } else if (glVersion == OpenGLVersion::GL41) {
-            glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-            glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
-            glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-            glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-        } else if (glVersion == OpenGLVersion::GL45) {
-            glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-            glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
-            glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-        }
+    // Hidden windows get the same context as visible ones so that they can be used for (offscreen) rendering and recording.
+    if (glVersion == OpenGLVersion::GL3) {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    } else if (glVersion == OpenGLVersion::GL41) {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    } else if (glVersion == OpenGLVersion::GL45) {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    }
 #ifndef NDEBUG // Automatically defined by CMake when compiling in Release/MinSizeRel mode.
-        glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
+    glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
 #endif
 
+    if (m_presentable) {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+
         // HighDPI awareness
         // https://decovar.dev/blog/2019/08/04/glfw-dear-imgui/#high-dpi
 #ifdef _WIN32
@@ -91,12 +94,13 @@ Window::Window(std::string_view title, const glm::ivec2& windowSize, OpenGLVersi
 
     glfwGetWindowSize(m_pWindow, &m_windowSize.x, &m_windowSize.y);
 
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+        glfwTerminate();
+        std::cerr << "Could not initialize GLEW" << std::endl;
+        exit(1);
+    }
+
     if (m_presentable) {
-        if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
-            glfwTerminate();
-            std::cerr << "Could not initialize GLEW" << std::endl;
-            exit(1);
-        }
         int glVersionMajor, glVersionMinor;
         glGetIntegerv(GL_MAJOR_VERSION, &glVersionMajor);
         glGetIntegerv(GL_MINOR_VERSION, &glVersionMinor);
@@ -163,6 +167,8 @@ Window::Window(std::string_view title, const glm::ivec2& windowSize, OpenGLVersi
 
 Window::~Window()
 {
+    stopRecording();
+
     if (m_presentable) {
         switch (m_glVersion) {
         case OpenGLVersion::GL2: {
@@ -221,6 +227,9 @@ void Window::updateInput()
 
 void Window::swapBuffers()
 {
+    // Capture before the UI is drawn on top.
+    if (m_pVideoRecorder)
+        captureRecordingFrame();
 
     if (m_presentable) {
         // Rendering of Dear ImGui ui.
@@ -238,6 +247,8 @@ void Window::swapBuffers()
             ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
         } break;
         };
+        // Dear ImGui changes OpenGL state behind the back of the state cache.
+        GLStateCache::get().invalidate();
     }
 
     glfwSwapBuffers(m_pWindow);
@@ -270,6 +281,83 @@ void Window::renderToImage (const std::filesystem::path& filePath, const bool fl
         }
 }
 
+void Window::startRecording(const std::filesystem::path& filePath, int framesPerSecond)
+{
+    stopRecording();
+
+    // The resolution is fixed for the duration of the recording; resizing the window while recording is not supported.
+    m_recordingResolution = getFrameBufferSize();
+    m_pVideoRecorder = std::make_unique<VideoRecorder>(filePath, m_recordingResolution, framesPerSecond);
+    m_numFramesRecorded = 0;
+
+    const auto frameSize = static_cast<GLsizeiptr>(4 * m_recordingResolution.x * m_recordingResolution.y);
+    glGenBuffers(static_cast<GLsizei>(m_readbackBuffers.size()), m_readbackBuffers.data());
+    for (GLuint readbackBuffer : m_readbackBuffers) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, frameSize, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void Window::stopRecording()
+{
+    if (!m_pVideoRecorder)
+        return;
+
+    // Retire the frames that are still in flight (oldest first).
+    const uint64_t firstPending = m_numFramesRecorded > numReadbackBuffers ? m_numFramesRecorded - numReadbackBuffers : 0;
+    for (uint64_t frame = firstPending; frame < m_numFramesRecorded; frame++)
+        retireRecordingFrame(frame % numReadbackBuffers);
+
+    glDeleteBuffers(static_cast<GLsizei>(m_readbackBuffers.size()), m_readbackBuffers.data());
+    m_readbackBuffers = {};
+    m_pVideoRecorder.reset(); // Waits for the encoder to write all frames.
+}
+
+bool Window::isRecording() const
+{
+    return m_pVideoRecorder != nullptr;
+}
+
+double Window::getRecordingTime() const
+{
+    if (!m_pVideoRecorder)
+        return 0.0;
+    return double(m_numFramesRecorded) / double(m_pVideoRecorder->getFramesPerSecond());
+}
+
+void Window::captureRecordingFrame()
+{
+    // The buffer in this slot was filled numReadbackBuffers frames ago, so mapping it will not stall the pipeline.
+    const size_t readbackBuffer = m_numFramesRecorded % numReadbackBuffers;
+    if (m_numFramesRecorded >= numReadbackBuffers)
+        retireRecordingFrame(readbackBuffer);
+
+    // Start an asynchronous copy of the back buffer; glReadPixels returns immediately when a pack buffer is bound.
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_readbackBuffers[readbackBuffer]);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, m_recordingResolution.x, m_recordingResolution.y, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    m_numFramesRecorded++;
+}
+
+void Window::retireRecordingFrame(size_t readbackBuffer)
+{
+    const size_t frameSize = size_t(4) * size_t(m_recordingResolution.x) * size_t(m_recordingResolution.y);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_readbackBuffers[readbackBuffer]);
+    const auto* pPixels = static_cast<const uint8_t*>(glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY));
+    if (pPixels) {
+        // Copy out and hand the frame to the encoder thread so the buffer can be reused right away.
+        std::vector<uint8_t> frame(pPixels, pPixels + frameSize);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        m_pVideoRecorder->pushFrame(std::move(frame));
+    } else {
+        std::cerr << "Failed to map pixel pack buffer while recording" << std::endl;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
 
 void Window::registerKeyCallback(KeyCallback&& callback)
 {
@@ -0,0 +1,39 @@
+#version 410
+// Lighting pass of the deferred path: lights every pixel of the G-buffer once.
+// Variants (see ShaderVariants):
+//  SHADOWS: diffuse lighting by the shadow casting directional light (see shaders/lighting.glsl)
+//  LIGHTS: diffuse lighting by the point and spot lights of the cluster of the pixel
+//  otherwise: the albedo
+
+#include "gbuffer.glsl"
+#include "lighting.glsl"
+
+uniform sampler2D gbufferAlbedoMetal;
+uniform sampler2D gbufferNormalRoughness;
+uniform sampler2D gbufferDepth;
+
+// From normalized device coordinates back to world space.
+uniform mat4 inverseViewProjection;
+
+layout(location = 0) out vec4 fragColor;
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gbufferDepth, pixel, 0).x;
+    // Nothing was drawn here; keep the background.
+    if (depth == 1.0)
+        discard;
+    // The depth is written such that forward rendered geometry (instances) is still occluded by the G-buffer.
+    gl_FragDepth = depth;
+
+    vec4 albedoMetal = texelFetch(gbufferAlbedoMetal, pixel, 0);
+    fragColor = vec4(albedoMetal.rgb, 1);
+
+#if defined(SHADOWS) || defined(LIGHTS)
+    vec3 normal = decodeNormal(texelFetch(gbufferNormalRoughness, pixel, 0).xy);
+    vec2 uv = gl_FragCoord.xy / vec2(textureSize(gbufferDepth, 0));
+    vec4 position = inverseViewProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    fragColor.rgb *= computeLighting(position.xyz / position.w, normal);
+#endif
+}
@@ -0,0 +1,8 @@
+#version 410
+
+// Single triangle that covers the screen, drawn without vertex attributes (see GBuffer::drawFullscreenTriangle()).
+void main()
+{
+    vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(position * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,16 @@
+// Must match the DrawData defined in src/draw_data.h
+struct DrawConstants
+{
+    mat4 mvpMatrix;
+    mat4 modelMatrix;
+    // Normals should be transformed differently than positions:
+    // https://paroj.github.io/gltut/Illumination/Tut09%20Normal%20Transformation.html
+    mat3 normalModelMatrix;
+};
+
+// Constants of the draws of one multi-draw call; a draw selects its entry with its draw index (a per-draw attribute,
+// see GeometryArena::multiDraw()). The size must match RenderQueue::maxDrawsPerBatch.
+layout(std140) uniform DrawData
+{
+    DrawConstants drawData[64];
+};
@@ -0,0 +1,27 @@
+// Lighting shared by the forward (shaders/shader_frag.glsl) and deferred (shaders/deferred_frag.glsl) paths.
+// Variants:
+//  SHADOWS: the directional light with cascaded shadows, and shadows of the spot lights (from the shadow atlas)
+//  LIGHTS: the point and spot lights of the cluster of the fragment
+
+#if defined(LIGHTS)
+#include "lights.glsl"
+#endif
+#if defined(SHADOWS)
+#include "shadow_cascades.glsl"
+#endif
+
+// Diffuse light at the (world space) position: ambient, the shadow casting directional light and the point and spot
+// lights of the cluster of the fragment.
+vec3 computeLighting(vec3 position, vec3 normal)
+{
+    const float ambient = 0.2;
+    vec3 result = vec3(ambient);
+#if defined(SHADOWS)
+    float diffuse = max(dot(normal, -lightDirection.xyz), 0.0);
+    result += (1.0 - ambient) * diffuse * sampleShadow(position, normal);
+#endif
+#if defined(LIGHTS)
+    result += evaluateLights(position, normal);
+#endif
+    return result;
+}
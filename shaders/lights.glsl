@@ -0,0 +1,101 @@
+struct Light // Must match GPULight in src/light.h
+{
+    vec4 positionRange; // xyz: position, w: range
+    vec4 directionCosOuter; // xyz: direction, w: cosine of the outer angle (-2 for point lights)
+    vec4 colorCosInner; // xyz: color, w: cosine of the inner angle (-1 for point lights)
+    mat4 shadowMatrix;
+    vec4 shadowTile; // xy: offset, z: size (in texture coordinates of the atlas), w: 1 if the light has shadows
+};
+
+// Clustered shading (see LightClusterGrid in src/light_clusters.h): every cluster of the view frustum lists the lights
+// that reach it, so a fragment only evaluates the lights of its own cluster.
+layout(std140) uniform LightClusters // Must match LightClustersData in src/light.cpp
+{
+    vec4 viewDepth; // The view depth of a world space position p is dot(viewDepth, vec4(p, 1)).
+    vec4 clusterScale; // xy: clusters per pixel, zw: depth slice scale and bias
+    ivec4 clusterGridSize; // xyz
+};
+
+uniform samplerBuffer lightData; // 8 texels per light
+uniform usamplerBuffer lightClusters; // Per cluster: offset and number of its lights in lightIndices
+uniform usamplerBuffer lightIndices;
+
+Light fetchLight(int index)
+{
+    Light light;
+    light.positionRange = texelFetch(lightData, 8 * index + 0);
+    light.directionCosOuter = texelFetch(lightData, 8 * index + 1);
+    light.colorCosInner = texelFetch(lightData, 8 * index + 2);
+    light.shadowMatrix = mat4(texelFetch(lightData, 8 * index + 3), texelFetch(lightData, 8 * index + 4),
+        texelFetch(lightData, 8 * index + 5), texelFetch(lightData, 8 * index + 6));
+    light.shadowTile = texelFetch(lightData, 8 * index + 7);
+    return light;
+}
+
+#if defined(SHADOWS)
+// Shadow maps of all lights, each in its own tile (see ShadowAtlas in src/shadow_atlas.h).
+uniform sampler2DShadow shadowAtlas;
+#endif
+
+// Fraction of the light that reaches the (world space) position.
+float sampleLightShadow(Light light, vec3 position, vec3 normal)
+{
+#if defined(SHADOWS)
+    if (light.shadowTile.w == 0.0)
+        return 1.0;
+
+    // Offset along the normal by about a texel to avoid self shadowing (acne); texels grow with the distance.
+    float atlasSize = float(textureSize(shadowAtlas, 0).x);
+    float cosOuter = light.directionCosOuter.w;
+    float tanOuter = sqrt(1.0 - cosOuter * cosOuter) / cosOuter;
+    float lightDistance = dot(position - light.positionRange.xyz, light.directionCosOuter.xyz);
+    float texelSize = 2.0 * tanOuter * lightDistance / (light.shadowTile.z * atlasSize);
+    vec4 shadowCoord = light.shadowMatrix * vec4(position + normal * (1.5 * texelSize), 1);
+    shadowCoord.xyz = shadowCoord.xyz / shadowCoord.w * 0.5 + 0.5;
+
+    // The filter footprint is kept inside of the tile such that it does not read the shadow maps of other lights.
+    float atlasTexel = 1.0 / atlasSize;
+    vec2 tileMin = light.shadowTile.xy + 1.5 * atlasTexel;
+    vec2 tileMax = light.shadowTile.xy + light.shadowTile.z - 1.5 * atlasTexel;
+    vec2 uv = clamp(light.shadowTile.xy + shadowCoord.xy * light.shadowTile.z, tileMin, tileMax);
+
+    // 3x3 percentage closer filtering on top of the hardware 2x2 filter.
+    float visibility = 0.0;
+    for (int y = -1; y <= 1; y++) {
+        for (int x = -1; x <= 1; x++)
+            visibility += texture(shadowAtlas, vec3(uv + vec2(x, y) * atlasTexel, shadowCoord.z));
+    }
+    return visibility / 9.0;
+#else
+    return 1.0;
+#endif
+}
+
+// Diffuse light of the lights that reach the cluster of the fragment at the (world space) position.
+vec3 evaluateLights(vec3 position, vec3 normal)
+{
+    float depth = dot(viewDepth, vec4(position, 1));
+    ivec3 cluster = ivec3(gl_FragCoord.xy * clusterScale.xy, floor(log(depth) * clusterScale.z + clusterScale.w));
+    cluster = clamp(cluster, ivec3(0), clusterGridSize.xyz - 1);
+    uvec2 offsetCount = texelFetch(lightClusters, cluster.x + clusterGridSize.x * (cluster.y + clusterGridSize.y * cluster.z)).xy;
+
+    vec3 result = vec3(0.0);
+    for (uint i = 0u; i < offsetCount.y; i++) {
+        Light light = fetchLight(int(texelFetch(lightIndices, int(offsetCount.x + i)).x));
+        vec3 toLight = light.positionRange.xyz - position;
+        float lightDistance = length(toLight);
+        float range = light.positionRange.w;
+        if (lightDistance >= range)
+            continue;
+        vec3 lightVector = toLight / lightDistance;
+
+        float diffuse = max(dot(normal, lightVector), 0.0);
+        float cone = smoothstep(light.directionCosOuter.w, light.colorCosInner.w, dot(-lightVector, light.directionCosOuter.xyz));
+        // Smooth falloff that reaches zero at the range.
+        float falloff = 1.0 - (lightDistance * lightDistance) / (range * range);
+        float intensity = diffuse * cone * falloff * falloff;
+        if (intensity > 0.0)
+            result += light.colorCosInner.rgb * intensity * sampleLightShadow(light, position, normal);
+    }
+    return result;
+}
@@ -0,0 +1,14 @@
+#define MAX_MATERIALS 256 // Must match MaterialBuffer::maxMaterials in src/material_buffer.h
+
+struct Material // Must match the GPUMaterial defined in src/material_buffer.h
+{
+    vec3 kd;
+	vec3 ks;
+	float shininess;
+	float transparency;
+};
+
+layout(std140) uniform Materials
+{
+    Material materials[MAX_MATERIALS];
+};
@@ -1,29 +1,47 @@
 #version 410
+// Variants (see ShaderVariants):
+//  HAS_TEXTURE: color from colorMap
+//  USE_MATERIAL: color from the material (when there is no texture)
+//  otherwise: visualize the normal
+//  SHADOWS: diffuse lighting by the shadow casting directional light (see shaders/shadow_cascades.glsl)
+//  LIGHTS: diffuse lighting by the point and spot lights of the cluster of the fragment (see shaders/lights.glsl)
+//  (with either of them the surface is lit, see shaders/lighting.glsl)
+//  GBUFFER: write the surface to the G-buffer instead of lighting it (see shaders/gbuffer.glsl); the lighting pass of
+//           the deferred path (shaders/deferred_frag.glsl) lights it
 
-layout(std140) uniform Material // Must match the GPUMaterial defined in src/mesh.h
-{
-    vec3 kd;
-	vec3 ks;
-	float shininess;
-	float transparency;
-};
+#include "gbuffer.glsl"
+#include "lighting.glsl"
+#include "material.glsl"
 
 uniform sampler2D colorMap;
-uniform bool hasTexCoords;
-uniform bool useMaterial;
 
 in vec3 fragPosition;
 in vec3 fragNormal;
 in vec2 fragTexCoord;
+flat in uint fragMaterialIndex;
 
 layout(location = 0) out vec4 fragColor;
+#if defined(GBUFFER)
+layout(location = 1) out vec4 fragNormalRoughness;
+#endif
 
 void main()
 {
     vec3 normal = normalize(fragNormal);
 
+#if defined(HAS_TEXTURE)
+    fragColor = vec4(texture(colorMap, fragTexCoord).rgb, 1);
+#elif defined(USE_MATERIAL)
+    fragColor = vec4(materials[fragMaterialIndex].kd, 1);
+#else
+    fragColor = vec4(normal, 1); // Output color value, change from (1, 0, 0) to something else
+#endif
 
-    if (hasTexCoords)       { fragColor = vec4(texture(colorMap, fragTexCoord).rgb, 1);}
-    else if (useMaterial)   { fragColor = vec4(kd, 1);}
-    else                    { fragColor = vec4(normal, 1); } // Output color value, change from (1, 0, 0) to something else
+#if defined(GBUFFER)
+    // The materials have no metalness; the roughness is the Beckmann equivalent of the Blinn-Phong exponent.
+    fragColor.a = 0.0;
+    fragNormalRoughness = vec4(encodeNormal(normal), sqrt(2.0 / (materials[fragMaterialIndex].shininess + 2.0)), 0.0);
+#elif defined(SHADOWS) || defined(LIGHTS)
+    fragColor.rgb *= computeLighting(fragPosition, normal);
+#endif
 }
@@ -1,24 +1,49 @@
 #version 410
+// Variants (see ShaderVariants):
+//  INSTANCED: the model matrix is a per-instance attribute (see InstanceData in src/instance_buffer.h) and
+//             the mvpMatrix of the first draw only contains the view and projection
 
-uniform mat4 mvpMatrix;
-uniform mat4 modelMatrix;
-// Normals should be transformed differently than positions:
-// https://paroj.github.io/gltut/Illumination/Tut09%20Normal%20Transformation.html
-uniform mat3 normalModelMatrix;
+#include "draw_data.glsl"
 
 layout(location = 0) in vec3 position;
 layout(location = 1) in vec3 normal;
 layout(location = 2) in vec2 texCoord;
+#if defined(INSTANCED)
+layout(location = 3) in vec4 instanceModelRow0;
+layout(location = 4) in vec4 instanceModelRow1;
+layout(location = 5) in vec4 instanceModelRow2;
+#else
+layout(location = 7) in uint drawIndex;
+#endif
+// Index into the material buffer (see shaders/material.glsl); per-instance when instanced and per-draw otherwise.
+layout(location = 6) in uint materialIndex;
 
 out vec3 fragPosition;
 out vec3 fragNormal;
 out vec2 fragTexCoord;
+flat out uint fragMaterialIndex;
+
+// The depth prepass (shaders/shadow_vert.glsl) and the passes after it must produce exactly the same depths.
+invariant gl_Position;
 
 void main()
 {
-    gl_Position = mvpMatrix * vec4(position, 1);
+#if defined(INSTANCED)
+    // The rows are transposed into columns.
+    mat4 instanceModelMatrix = transpose(mat4(instanceModelRow0, instanceModelRow1, instanceModelRow2, vec4(0, 0, 0, 1)));
+    vec4 worldPosition = instanceModelMatrix * vec4(position, 1);
+    gl_Position = drawData[0].mvpMatrix * worldPosition;
+
+    fragPosition      = worldPosition.xyz;
+    fragNormal        = transpose(inverse(mat3(instanceModelMatrix))) * normal;
+    fragTexCoord      = texCoord;
+    fragMaterialIndex = materialIndex;
+#else
+    gl_Position = drawData[drawIndex].mvpMatrix * vec4(position, 1);
     
-    fragPosition    = (modelMatrix * vec4(position, 1)).xyz;
-    fragNormal      = normalModelMatrix * normal;
+    fragPosition    = (drawData[drawIndex].modelMatrix * vec4(position, 1)).xyz;
+    fragNormal      = drawData[drawIndex].normalModelMatrix * normal;
     fragTexCoord    = texCoord;
+    fragMaterialIndex = materialIndex;
+#endif
 }
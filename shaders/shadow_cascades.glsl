@@ -0,0 +1,39 @@
+#define MAX_SHADOW_CASCADES 4 // Must match CascadedShadowMap::maxCascades in src/cascaded_shadow_map.h
+
+layout(std140) uniform ShadowCascades // Must match ShadowCascadesData in src/cascaded_shadow_map.cpp
+{
+    mat4 lightViewProjections[MAX_SHADOW_CASCADES];
+    vec4 cascadeEnds; // View distance at which every cascade ends.
+    vec4 cascadeTexelSizes; // World space size of a shadow map texel in every cascade.
+    vec4 lightDirection; // xyz: direction in which the light travels.
+    vec4 cameraPosition; // xyz
+    vec4 cameraForward; // xyz
+    int numCascades;
+};
+
+uniform sampler2DArrayShadow shadowMap;
+
+// Fraction of the light that reaches the (world space) position; 1 beyond the last cascade.
+float sampleShadow(vec3 position, vec3 normal)
+{
+    float viewDistance = dot(position - cameraPosition.xyz, cameraForward.xyz);
+    int cascade = 0;
+    while (cascade < numCascades && viewDistance > cascadeEnds[cascade])
+        cascade++;
+    if (cascade == numCascades)
+        return 1.0;
+
+    // Offset along the normal by about a texel to avoid self shadowing (acne) on surfaces at grazing angles.
+    vec3 offsetPosition = position + normal * (1.5 * cascadeTexelSizes[cascade]);
+    vec4 shadowCoord = lightViewProjections[cascade] * vec4(offsetPosition, 1);
+    shadowCoord.xyz = shadowCoord.xyz * 0.5 + 0.5;
+
+    // 3x3 percentage closer filtering on top of the hardware 2x2 filter.
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    float light = 0.0;
+    for (int y = -1; y <= 1; y++) {
+        for (int x = -1; x <= 1; x++)
+            light += texture(shadowMap, vec4(shadowCoord.xy + vec2(x, y) * texelSize, float(cascade), shadowCoord.z));
+    }
+    return light / 9.0;
+}
@@ -1,10 +1,14 @@
 #version 410
 
-uniform mat4 mvpMatrix;
+#include "draw_data.glsl"
 
 layout(location = 0) in vec3 position;
+layout(location = 7) in uint drawIndex;
+
+// Must match the depth of shaders/shader_vert.glsl exactly when used for the depth prepass.
+invariant gl_Position;
 
 void main()
 {
-    gl_Position = mvpMatrix * vec4(position, 1);
+    gl_Position = drawData[drawIndex].mvpMatrix * vec4(position, 1);
 }
@@ -0,0 +1,32 @@
+#version 410
+
+// Virtual texture feedback pass: writes the page (and mip level) that each fragment would sample.
+// Must match the decoding in analyzeVirtualTextureFeedback (src/virtual_texture.cpp).
+
+uniform vec2 vtPagesMip0;
+uniform vec2 vtUvScale;
+uniform int vtNumMips;
+uniform float vtPageSize;
+uniform float vtFeedbackBias;
+
+in vec3 fragPosition;
+in vec3 fragNormal;
+in vec2 fragTexCoord;
+
+layout(location = 0) out vec4 fragColor;
+
+void main()
+{
+    vec2 virtualUV = clamp(fragTexCoord, 0.0, 1.0) * vtUvScale;
+
+    // Same mip selection as the hardware, but in (virtual) texel space and corrected for the reduced feedback resolution.
+    vec2 texel = virtualUV * vtPagesMip0 * vtPageSize;
+    vec2 dx = dFdx(texel);
+    vec2 dy = dFdy(texel);
+    float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8)) + vtFeedbackBias;
+    int mip = int(clamp(floor(lod), 0.0, float(vtNumMips - 1)));
+
+    ivec2 numPages = max(ivec2(vtPagesMip0) >> mip, ivec2(1));
+    ivec2 page = clamp(ivec2(virtualUV * vec2(numPages)), ivec2(0), numPages - 1);
+    fragColor = vec4(page.x & 255, page.y & 255, (page.x >> 8) | ((page.y >> 8) << 4), mip) / 255.0;
+}
@@ -0,0 +1,46 @@
+#version 410
+
+// Samples a virtual texture through its indirection texture and physical page cache (see src/virtual_texture.h).
+
+uniform sampler2D vtCache;
+uniform sampler2D vtIndirection;
+uniform vec2 vtPagesMip0;
+uniform vec2 vtUvScale;
+uniform int vtNumMips;
+uniform float vtPageSize;
+uniform float vtBorder;
+uniform vec2 vtCacheSize;
+
+in vec3 fragPosition;
+in vec3 fragNormal;
+in vec2 fragTexCoord;
+
+layout(location = 0) out vec4 fragColor;
+
+vec4 sampleVirtualTexture(vec2 uv)
+{
+    vec2 virtualUV = clamp(uv, 0.0, 1.0) * vtUvScale;
+
+    vec2 texel = virtualUV * vtPagesMip0 * vtPageSize;
+    vec2 dx = dFdx(texel);
+    vec2 dy = dFdy(texel);
+    float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8));
+    int mip = int(clamp(floor(lod), 0.0, float(vtNumMips - 1)));
+
+    // The indirection entry points to the requested page or to its closest resident ancestor.
+    ivec2 numPages = max(ivec2(vtPagesMip0) >> mip, ivec2(1));
+    ivec2 page = clamp(ivec2(virtualUV * vec2(numPages)), ivec2(0), numPages - 1);
+    vec4 entry = texelFetch(vtIndirection, page, mip) * 255.0;
+    int residentMip = int(entry.b + 0.5);
+
+    vec2 residentPages = vec2(max(ivec2(vtPagesMip0) >> residentMip, ivec2(1)));
+    vec2 residentPage = min(floor(virtualUV * residentPages), residentPages - 1.0);
+    vec2 positionInPage = virtualUV * residentPages - residentPage;
+    vec2 cacheTexel = floor(entry.rg + 0.5) * (vtPageSize + 2.0 * vtBorder) + vtBorder + positionInPage * vtPageSize;
+    return textureLod(vtCache, cacheTexel / vtCacheSize, 0.0);
+}
+
+void main()
+{
+    fragColor = vec4(sampleVirtualTexture(fragTexCoord).rgb, 1);
+}
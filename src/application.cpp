@@ -1,6 +1,24 @@
 //#include "Image.h"
+#include "cascaded_shadow_map.h"
+#include "frustum_culler.h"
+#include "gbuffer.h"
+#include "geometry_arena.h"
+#include "gpu_timer.h"
+#include "instance_buffer.h"
+#include "light.h"
+#include "light_clusters.h"
+#include "material_buffer.h"
 #include "mesh.h"
+#include "occlusion_culler.h"
+#include "render_queue.h"
+#include "scene_graph.h"
+#include "shadow_atlas.h"
+#include "shadow_atlas_texture.h"
 #include "texture.h"
+#include "texture_atlas.h"
+#include "texture_registry.h"
+#include "texture_uploader.h"
+#include "virtual_texture.h"
 // Always include window first (because it includes glfw, which includes GL which needs to be included AFTER glew).
 // Can't wait for modules to fix this stuff...
 #include <framework/disable_all_warnings.h>
@@ -9,23 +27,39 @@ DISABLE_WARNINGS_PUSH()
 // Include glad before glfw3
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
-#include <glm/gtc/matrix_inverse.hpp>
+#include <glm/gtc/constants.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/mat4x4.hpp>
 #include <imgui/imgui.h>
 DISABLE_WARNINGS_POP()
+#include <framework/gl_state.h>
 #include <framework/shader.h>
+#include <framework/shader_reloader.h>
+#include <framework/shader_variants.h>
+#include <framework/uniform_ring_buffer.h>
 #include <framework/window.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <functional>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <span>
 #include <vector>
 
 class Application {
 public:
     Application()
         : m_window("Final Project", glm::ivec2(1024, 1024), OpenGLVersion::GL41)
-        , m_texture(RESOURCE_ROOT "resources/checkerboard.png")
+        , m_programCache("shader_cache")
+        , m_defaultShaders({ "HAS_TEXTURE", "USE_MATERIAL", "INSTANCED", "SHADOWS", "GBUFFER", "LIGHTS" }, &m_programCache)
+        , m_deferredShaders({ "SHADOWS", "LIGHTS" }, &m_programCache)
+        , m_texture(m_textureRegistry.loadAsync(RESOURCE_ROOT "resources/checkerboard.png", m_textureUploader))
     {
         m_window.registerKeyCallback([this](int key, int scancode, int action, int mods) {
             if (action == GLFW_PRESS)
@@ -41,27 +75,100 @@ public:
                 onMouseReleased(button, mods);
         });
 
-        m_meshes = GPUMesh::loadMeshGPU(RESOURCE_ROOT "resources/dragon.obj");
+        // Every mesh gets a node below the root of the scene; the world space bounds are filled in by the first update.
+        m_sceneRoot = addSceneNode({}, SceneGraph::invalidNode);
+        std::vector<Mesh> cpuMeshes = loadMesh(RESOURCE_ROOT "resources/dragon.obj");
+        // Meshes whose diffuse textures share an atlas page also share a texture binding, so the render queue can
+        // draw them without a texture change in between. The pages are uploaded before the meshes refer to them, such
+        // that their textures get no more mip levels than the atlas gutters protect.
+        const TextureAtlas textureAtlas = buildTextureAtlas(cpuMeshes);
+        for (const std::shared_ptr<Image>& pPage : textureAtlas.pages)
+            m_atlasTextures.push_back(m_textureRegistry.get(*pPage, textureAtlas.numMipLevels));
+        for (Mesh& cpuMesh : cpuMeshes) {
+            const auto meshIndex = static_cast<uint32_t>(m_meshes.size());
+            m_meshes.emplace_back(cpuMesh, m_geometryArena, m_materialBuffer, m_textureRegistry);
+            m_meshNodes.push_back(addSceneNode({}, m_sceneRoot, meshIndex));
+            m_meshWorldBounds.emplace_back();
+            m_meshDynamic.push_back(false);
+            m_frustumCuller.add(m_meshWorldBounds.back());
+            // Only cheap meshes are rasterized by the occlusion culler; ideally these would be simplified versions.
+            if (cpuMesh.triangles.size() <= maxOccluderTriangles)
+                m_occluders.push_back({ std::move(cpuMesh), meshIndex });
+        }
+
+        // Spot lights on a circle around the origin, pointing at it.
+        const std::array<glm::vec3, numSpotLights> lightColors { glm::vec3(1.0f, 0.6f, 0.3f), glm::vec3(0.3f, 0.6f, 1.0f), glm::vec3(0.4f, 1.0f, 0.4f), glm::vec3(1.0f, 0.3f, 0.8f) };
+        for (size_t i = 0; i < lightColors.size(); i++) {
+            Light light;
+            light.color = lightColors[i];
+            light.range = 6.0f;
+            placeLight(light, glm::two_pi<float>() * float(i) / float(lightColors.size()));
+            m_lights.push_back(light);
+        }
+        setNumPointLights(m_numPointLights);
 
+        const auto shaderBuildStart = std::chrono::high_resolution_clock::now();
         try {
-            ShaderBuilder defaultBuilder;
-            defaultBuilder.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/shader_vert.glsl");
-            defaultBuilder.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/shader_frag.glsl");
-            m_defaultShader = defaultBuilder.build();
+            // All programs are compiled as one batch so that the driver can compile them in parallel.
+            ShaderBatch shaderBatch;
+            m_defaultShaders.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/shader_vert.glsl");
+            m_defaultShaders.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/shader_frag.glsl");
+            // Variants are compiled on first use; compile the ones that the render loop can select up front (every
+            // combination of the lighting toggles in the forward path).
+            std::vector<uint32_t> defaultShaderVariants;
+            for (const uint32_t material : { 0u, HasTexture, UseMaterial }) {
+                for (const uint32_t lighting : { 0u, Shadows, Lights, Shadows | Lights })
+                    defaultShaderVariants.push_back(material | lighting);
+                defaultShaderVariants.push_back(material | WriteGBuffer);
+            }
+            m_defaultShaders.compile(defaultShaderVariants, shaderBatch);
+            m_deferredShaders.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/deferred_vert.glsl");
+            m_deferredShaders.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/deferred_frag.glsl");
+            const std::array<uint32_t, 4> deferredShaderVariants { 0u, DeferredShadows, DeferredLights, DeferredShadows | DeferredLights };
+            m_deferredShaders.compile(deferredShaderVariants, shaderBatch);
+
+            const auto createShadowBuilder = [this]() {
+                ShaderBuilder shadowBuilder { m_programCache };
+                shadowBuilder.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/shadow_vert.glsl");
+                shadowBuilder.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/shadow_frag.glsl");
+                return shadowBuilder;
+            };
+            shaderBatch.add(createShadowBuilder(), m_shadowShader);
+
+            const auto createVirtualTextureBuilder = [this]() {
+                ShaderBuilder virtualTextureBuilder { m_programCache };
+                virtualTextureBuilder.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/shader_vert.glsl");
+                virtualTextureBuilder.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/vt_frag.glsl");
+                return virtualTextureBuilder;
+            };
+            const auto createVirtualTextureFeedbackBuilder = [this]() {
+                ShaderBuilder feedbackBuilder { m_programCache };
+                feedbackBuilder.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/shader_vert.glsl");
+                feedbackBuilder.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/vt_feedback_frag.glsl");
+                return feedbackBuilder;
+            };
+            shaderBatch.add(createVirtualTextureBuilder(), m_virtualTextureShader);
+            shaderBatch.add(createVirtualTextureFeedbackBuilder(), m_virtualTextureFeedbackShader);
 
-            ShaderBuilder shadowBuilder;
-            shadowBuilder.addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/shadow_vert.glsl");
-            shadowBuilder.addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "Shaders/shadow_frag.glsl");
-            m_shadowShader = shadowBuilder.build();
+            // Recompile the programs when their source files are edited.
+            m_shaderReloader.watch(m_defaultShaders);
+            m_shaderReloader.watch(m_deferredShaders);
+            m_shaderReloader.watch(createShadowBuilder, m_shadowShader);
+            m_shaderReloader.watch(createVirtualTextureBuilder, m_virtualTextureShader);
+            m_shaderReloader.watch(createVirtualTextureFeedbackBuilder, m_virtualTextureFeedbackShader);
 
             // Any new shaders can be added below in similar fashion.
             // ==> Don't forget to reconfigure CMake when you do!
             //     Visual Studio: PROJECT => Generate Cache for ComputerGraphics
             //     VS Code: ctrl + shift + p => CMake: Configure => enter
             // ....
+
+            shaderBatch.finish();
         } catch (ShaderLoadingException e) {
             std::cerr << e.what() << std::endl;
         }
+        m_programCache.printStatistics();
+        std::cout << "Building shaders took " << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - shaderBuildStart).count() << "ms" << std::endl;
     }
 
     void update()
@@ -71,12 +178,85 @@ public:
             // This is your game loop
             // Put your real-time logic and rendering in here
             m_window.updateInput();
+            m_textureUploader.update();
+            m_shaderReloader.update();
+            m_materialBuffer.upload();
+            m_frameData.beginFrame();
+            // State changes of the previous frame.
+            const GLStateCache::Statistics stateStatistics = GLStateCache::get().getStatistics();
+            GLStateCache::get().resetStatistics();
 
             // Use ImGui for easy input/output of ints, floats, strings, etc...
             ImGui::Begin("Window");
             ImGui::InputInt("This is an integer input", &dummyInteger); // Use ImGui::DragInt or ImGui::DragFloat for larger range of numbers.
             ImGui::Text("Value is: %i", dummyInteger); // Use C printf formatting rules (%i is a signed integer)
             ImGui::Checkbox("Use material if no texture", &m_useMaterial);
+            ImGui::SliderFloat("Rotation speed", &m_rotationSpeed, -2.0f, 2.0f);
+            ImGui::Checkbox("Shadows", &m_useShadows);
+            ImGui::Checkbox("Clustered lights", &m_useLights);
+            if (ImGui::RadioButton("Forward shading", m_renderPath == RenderPath::Forward))
+                m_renderPath = RenderPath::Forward;
+            ImGui::SameLine();
+            if (ImGui::RadioButton("Deferred shading", m_renderPath == RenderPath::Deferred))
+                m_renderPath = RenderPath::Deferred;
+            ImGui::Checkbox("Depth prepass", &m_useDepthPrepass);
+            ImGui::Checkbox("Virtual texture (forward shading)", &m_useVirtualTexture);
+            if (m_pVirtualTexture) {
+                const VirtualTexture::Statistics virtualTextureStatistics = m_pVirtualTexture->getStatistics();
+                ImGui::Text("Virtual texture: %zu resident pages, %zu pending, %zu uploaded", virtualTextureStatistics.residentPages,
+                    virtualTextureStatistics.pendingRequests, virtualTextureStatistics.uploadsLastFrame);
+            }
+            // GPU times lag a few frames behind (see GPUTimer).
+            if (m_renderPath == RenderPath::Deferred)
+                ImGui::Text("Frame: %.2f ms, GPU geometry pass: %.2f ms, lighting pass: %.2f ms", 1000.0 / double(ImGui::GetIO().Framerate),
+                    double(m_opaqueTimer.getElapsedMs()), double(m_lightingTimer.getElapsedMs()));
+            else
+                ImGui::Text("Frame: %.2f ms, GPU opaque pass: %.2f ms", 1000.0 / double(ImGui::GetIO().Framerate), double(m_opaqueTimer.getElapsedMs()));
+            if (ImGui::SliderFloat3("Light direction", glm::value_ptr(m_lightDirection), -1.0f, 1.0f) && glm::length(m_lightDirection) < 1e-3f)
+                m_lightDirection = glm::vec3(0, -1, 0);
+            ImGui::Checkbox("Animate first spot light", &m_animateLight);
+            if (ImGui::SliderInt("Point lights", &m_numPointLights, 0, 4096))
+                setNumPointLights(m_numPointLights);
+            ImGui::SliderInt("Instances", &m_numInstances, 0, 10000);
+            if (ImGui::Button(m_window.isRecording() ? "Stop recording" : "Record video (recording.y4m)")) {
+                if (m_window.isRecording())
+                    m_window.stopRecording();
+                else
+                    m_window.startRecording("recording.y4m", 60);
+            }
+            ImGui::Text("Textures: %zu (%.1f MiB)", m_textureRegistry.getNumTextures(), double(m_textureRegistry.getTotalSizeInBytes()) / (1024.0 * 1024.0));
+            const ShaderReloader::Statistics& reloadStatistics = m_shaderReloader.getStatistics();
+            if (reloadStatistics.lastError.empty())
+                ImGui::Text("Shader reloads: %d (last took %.1f ms)", reloadStatistics.numReloads, reloadStatistics.lastLatencyMs);
+            else
+                ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.3f, 1.0f), "Shader reload failed: %s", reloadStatistics.lastError.c_str());
+            const RenderQueue::Statistics& queueStatistics = m_renderQueue.getStatistics();
+            ImGui::Text("Draws: %d (%d calls), program binds: %d, transform binds: %d, state changes saved (estimate): %d",
+                queueStatistics.numDraws, queueStatistics.numDrawCalls, queueStatistics.programBinds, queueStatistics.transformBinds, queueStatistics.estimatedSkippedStateChanges);
+            const SceneGraphStatistics& sceneStatistics = m_sceneGraph.getStatistics();
+            ImGui::Text("Scene graph: %zu nodes, %zu updated (%.3f ms)", m_sceneGraph.getNumNodes(), sceneStatistics.numUpdatedNodes, sceneStatistics.updateTimeMs);
+            ImGui::Text("Visible meshes: %zu/%zu", m_visibleMeshes.size(), m_meshes.size());
+            const CascadedShadowMap::Statistics& shadowStatistics = m_shadowMap.getStatistics();
+            ImGui::Text("Shadow cascades: %d static passes, %d dynamic passes", shadowStatistics.staticPasses, shadowStatistics.dynamicPasses);
+            const ShadowAtlas::Statistics& atlasStatistics = m_shadowAtlas.getStatistics();
+            const LightClusterStatistics& clusterStatistics = m_lightClusters.getStatistics();
+            ImGui::Text("Light clusters: %zu lights, %zu indices, up to %d per cluster, %d full (%.2f ms)", clusterStatistics.numLights,
+                clusterStatistics.numLightIndices, clusterStatistics.maxLightsInCluster, clusterStatistics.numFullClusters, double(clusterStatistics.buildTimeMs));
+            ImGui::Text("Shadow atlas: %d tiles (%.0f%% used), %d rendered, %d pending, %d allocated, %d evicted", atlasStatistics.numTiles,
+                100.0 * double(m_shadowAtlas.getAllocator().getUsage()), atlasStatistics.numScheduled, atlasStatistics.numPending, atlasStatistics.numAllocations, atlasStatistics.numEvictions);
+            ImGui::Checkbox("Occlusion culling", &m_useOcclusionCulling);
+            const OcclusionCullerStatistics& occlusionStatistics = m_occlusionCuller.getStatistics();
+            ImGui::Text("Occluded: %zu/%zu, %zu occluder triangles (%.2f ms)", occlusionStatistics.numOccluded, occlusionStatistics.numTested,
+                occlusionStatistics.numOccluderTriangles, occlusionStatistics.rasterizeTimeMs);
+            const GeometryArenaStatistics arenaStatistics = m_geometryArena.getStatistics();
+            ImGui::Text("Geometry: %u/%u vertices, %u/%u indices, fragmentation %.0f%%/%.0f%%, %d grows", arenaStatistics.usedVertices, arenaStatistics.vertexCapacity,
+                arenaStatistics.usedIndices, arenaStatistics.indexCapacity, 100.0 * double(arenaStatistics.vertexFragmentation), 100.0 * double(arenaStatistics.indexFragmentation),
+                arenaStatistics.numGrows);
+            bool stateCacheEnabled = GLStateCache::get().isEnabled();
+            if (ImGui::Checkbox("Filter redundant state changes", &stateCacheEnabled))
+                GLStateCache::get().setEnabled(stateCacheEnabled);
+            ImGui::Text("State changes: %llu, filtered: %llu", (unsigned long long)stateStatistics.numCalls, (unsigned long long)stateStatistics.numFilteredCalls);
+            ImGui::Text("Streaming: %zu texture(s), %.1f KiB this frame", m_textureUploader.getNumPendingTextures(), double(m_textureUploader.getBytesUploadedLastFrame()) / 1024.0);
             ImGui::End();
 
             // Clear the screen
@@ -84,36 +264,370 @@ public:
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
             // ...
-            glEnable(GL_DEPTH_TEST);
-
-            const glm::mat4 mvpMatrix = m_projectionMatrix * m_viewMatrix * m_modelMatrix;
-            // Normals should be transformed differently than positions (ignoring translations + dealing with scaling):
-            // https://paroj.github.io/gltut/Illumination/Tut09%20Normal%20Transformation.html
-            const glm::mat3 normalModelMatrix = glm::inverseTranspose(glm::mat3(m_modelMatrix));
-
-            for (GPUMesh& mesh : m_meshes) {
-                m_defaultShader.bind();
-                glUniformMatrix4fv(m_defaultShader.getUniformLocation("mvpMatrix"), 1, GL_FALSE, glm::value_ptr(mvpMatrix));
-                //Uncomment this line when you use the modelMatrix (or fragmentPosition)
-                //glUniformMatrix4fv(m_defaultShader.getUniformLocation("modelMatrix"), 1, GL_FALSE, glm::value_ptr(m_modelMatrix));
-                glUniformMatrix3fv(m_defaultShader.getUniformLocation("normalModelMatrix"), 1, GL_FALSE, glm::value_ptr(normalModelMatrix));
-                if (mesh.hasTextureCoords()) {
-                    m_texture.bind(GL_TEXTURE0);
-                    glUniform1i(m_defaultShader.getUniformLocation("colorMap"), 0);
-                    glUniform1i(m_defaultShader.getUniformLocation("hasTexCoords"), GL_TRUE);
-                    glUniform1i(m_defaultShader.getUniformLocation("useMaterial"), GL_FALSE);
-                } else {
-                    glUniform1i(m_defaultShader.getUniformLocation("hasTexCoords"), GL_FALSE);
-                    glUniform1i(m_defaultShader.getUniformLocation("useMaterial"), m_useMaterial);
+            GLStateCache::get().setDepthTest(true);
+
+            const auto frameTime = std::chrono::high_resolution_clock::now();
+            updateScene(std::chrono::duration<float>(frameTime - m_previousFrameTime).count());
+            m_previousFrameTime = frameTime;
+            if (m_useShadows)
+                renderShadows();
+            // The shadows of the spot lights are only sampled by the clustered lights.
+            if (m_useShadows && m_useLights) {
+                updateLightShadows();
+            } else {
+                // Release all tiles; casters that move in the meantime are not tracked.
+                m_shadowAtlas.update({});
+            }
+            if (m_useLights)
+                updateLights();
+
+            // Only meshes that intersect the view frustum are drawn.
+            m_frustumCuller.cull(Frustum::fromMatrix(m_projectionMatrix * m_viewMatrix), m_visibleMeshes);
+            if (m_useOcclusionCulling) {
+                // Of those, skip the meshes that are hidden behind the occluders.
+                m_occlusionCuller.beginFrame(m_projectionMatrix * m_viewMatrix);
+                for (const Occluder& occluder : m_occluders)
+                    m_occlusionCuller.addOccluder(occluder.mesh, m_sceneGraph.getWorldMatrix(m_meshNodes[occluder.meshIndex]));
+                m_occlusionCuller.rasterize();
+                m_occlusionCuller.removeOccluded(m_meshWorldBounds, m_visibleMeshes);
+            }
+            // The transforms of all visible meshes are computed in one batch, straight into the frame data.
+            const uint32_t firstTransform = addTransforms(m_projectionMatrix * m_viewMatrix, m_visibleMeshes);
+            const uint32_t lighting = getLightingFeatures();
+            if (lighting != 0) {
+                // Each binds only what the variant uses.
+                for (const Shader* pShader : { &m_defaultShaders.get(lighting), &m_defaultShaders.get(HasTexture | lighting),
+                         &m_defaultShaders.get(UseMaterial | lighting), &m_deferredShaders.get(getDeferredLightingFeatures()) }) {
+                    m_shadowMap.bind(*pShader);
+                    m_lightBuffer.bind(*pShader);
+                    m_shadowAtlasTexture.bind(*pShader);
                 }
-                mesh.draw(m_defaultShader);
             }
 
+            const bool deferred = m_renderPath == RenderPath::Deferred;
+            // Textured meshes sample the virtual texture instead of their own texture.
+            const bool useVirtualTexture = m_useVirtualTexture && !deferred;
+            if (useVirtualTexture)
+                updateVirtualTexture(firstTransform);
+            m_opaqueTimer.begin();
+            if (deferred) {
+                m_gbuffer.resize(m_window.getFrameBufferSize());
+                m_gbuffer.beginGeometryPass();
+            }
+            if (m_useDepthPrepass)
+                renderDepthPrepass(firstTransform);
+            for (size_t i = 0; i < m_visibleMeshes.size(); i++) {
+                const uint32_t meshIndex = m_visibleMeshes[i];
+                const GPUMesh& mesh = m_meshes[meshIndex];
+                // Pick the shader variant instead of branching on uniforms inside the shader.
+                uint32_t features = 0;
+                if (mesh.hasTextureCoords())
+                    features = HasTexture;
+                else if (m_useMaterial)
+                    features = UseMaterial;
+                if (deferred)
+                    features |= WriteGBuffer;
+                else
+                    features |= lighting;
+                const bool virtualTextured = useVirtualTexture && mesh.hasTextureCoords();
+                const Shader& shader = virtualTextured ? m_virtualTextureShader : m_defaultShaders.get(features);
+
+                // Meshes whose material has a texture use it, others fall back to the checkerboard.
+                const Texture* pTexture = nullptr;
+                if (mesh.hasTextureCoords() && !virtualTextured)
+                    pTexture = mesh.getKdTexture() ? mesh.getKdTexture().get() : m_texture.get();
+
+                const uint32_t transform = firstTransform + uint32_t(i);
+                const AxisAlignedBox& bounds = m_meshWorldBounds[meshIndex];
+                const float viewDistance = -(m_viewMatrix * glm::vec4(0.5f * (bounds.lower + bounds.upper), 1.0f)).z;
+                m_renderQueue.submit(RenderPass::Opaque, shader, mesh, pTexture, transform, viewDistance / m_farPlane);
+            }
+            // Draws are sorted such that only the state that differs between consecutive draws is changed.
+            m_renderQueue.execute();
+            if (m_useDepthPrepass) {
+                GLStateCache::get().setDepthFunc(GL_LESS);
+                GLStateCache::get().setDepthWrite(true);
+            }
+            if (deferred) {
+                m_gbuffer.endGeometryPass();
+                m_opaqueTimer.end();
+                m_lightingTimer.begin();
+                renderDeferredLighting();
+                m_lightingTimer.end();
+            } else {
+                m_opaqueTimer.end();
+            }
+
+            // Instances are always forward shaded (unlit); they are depth tested against the lit G-buffer pixels.
+            if (m_numInstances > 0)
+                drawInstances();
+            m_renderQueue.endFrame();
+            m_frameData.endFrame();
+
             // Processes input and swaps the window buffer
             m_window.swapBuffers();
         }
     }
 
+    SceneGraph::NodeHandle addSceneNode(const Transform& localTransform, SceneGraph::NodeHandle parent, uint32_t meshIndex = noMesh)
+    {
+        const SceneGraph::NodeHandle node = m_sceneGraph.addNode(localTransform, parent);
+        m_nodeMeshes.resize(size_t(node) + 1, noMesh);
+        m_nodeMeshes[node] = meshIndex;
+        return node;
+    }
+
+    void updateScene(float deltaTime)
+    {
+        // Nodes that are not touched keep their world matrix and are skipped by the update.
+        if (m_rotationSpeed != 0.0f) {
+            Transform rootTransform;
+            m_rootAngle += m_rotationSpeed * deltaTime;
+            rootTransform.rotation = glm::angleAxis(m_rootAngle, glm::vec3(0, 1, 0));
+            m_sceneGraph.setLocalTransform(m_sceneRoot, rootTransform);
+        }
+        m_sceneGraph.updateWorldMatrices();
+        // Only the first light moves, such that the other tiles of the shadow atlas stay cached.
+        if (m_animateLight) {
+            m_lightAngle += 0.5f * deltaTime;
+            placeLight(m_lights[0], m_lightAngle);
+        }
+
+        // Only the bounds of meshes that actually moved are recomputed. Meshes that moved this frame are dynamic
+        // shadow casters; when a mesh starts or stops moving the cached static shadow casters are out of date.
+        std::vector<bool> moved(m_meshes.size(), false);
+        for (const SceneGraph::NodeHandle node : m_sceneGraph.getUpdatedNodes()) {
+            const uint32_t meshIndex = m_nodeMeshes[node];
+            if (meshIndex == noMesh)
+                continue;
+            m_meshWorldBounds[meshIndex] = transformBounds(m_meshes[meshIndex].getBounds(), m_sceneGraph.getWorldMatrix(node));
+            m_frustumCuller.update(meshIndex, m_meshWorldBounds[meshIndex]);
+            moved[meshIndex] = true;
+        }
+        if (moved != m_meshDynamic) {
+            m_meshDynamic = moved;
+            m_shadowMap.invalidateStaticCasters();
+        }
+    }
+
+    // Compute the transforms of the meshes in one batch; returns the first of meshIndices.size() consecutive transforms.
+    uint32_t addTransforms(const glm::mat4& viewProjectionMatrix, std::span<const uint32_t> meshIndices)
+    {
+        m_batchModelMatrices.clear();
+        m_batchRigid.clear();
+        for (const uint32_t meshIndex : meshIndices) {
+            m_batchModelMatrices.push_back(m_sceneGraph.getWorldMatrix(m_meshNodes[meshIndex]));
+            m_batchRigid.push_back(m_sceneGraph.isRigid(m_meshNodes[meshIndex]));
+        }
+        return m_renderQueue.addTransforms(viewProjectionMatrix, m_batchModelMatrices, m_batchRigid);
+    }
+
+    // Fill the depth buffer with the visible meshes (with the transforms starting at firstTransform), such that the
+    // following pass only shades the closest surface of every pixel. The depth test is left at GL_LEQUAL without depth
+    // writes; the caller restores it after the pass. Both passes compute the same positions (gl_Position is invariant).
+    void renderDepthPrepass(uint32_t firstTransform)
+    {
+        for (size_t i = 0; i < m_visibleMeshes.size(); i++) {
+            const uint32_t meshIndex = m_visibleMeshes[i];
+            const AxisAlignedBox& bounds = m_meshWorldBounds[meshIndex];
+            const float viewDistance = -(m_viewMatrix * glm::vec4(0.5f * (bounds.lower + bounds.upper), 1.0f)).z;
+            m_renderQueue.submit(RenderPass::DepthPrepass, m_shadowShader, m_meshes[meshIndex], nullptr, firstTransform + uint32_t(i), viewDistance / m_farPlane);
+        }
+        // The depth-only shader has no outputs, which leaves the color undefined.
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        GLStateCache::get().setDepthWrite(true);
+        m_renderQueue.execute();
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        GLStateCache::get().setDepthFunc(GL_LEQUAL);
+        GLStateCache::get().setDepthWrite(false);
+    }
+
+    // Render the page feedback of the textured meshes (read back by VirtualTexture::update() a frame later), stream in
+    // the pages that they need and prepare the sampling shader.
+    void updateVirtualTexture(uint32_t firstTransform)
+    {
+        // The checkerboard is small, but it takes the same paths as the textures that do not fit in GPU memory.
+        if (!m_pVirtualTexture)
+            m_pVirtualTexture = std::make_unique<VirtualTexture>(Image(RESOURCE_ROOT "resources/checkerboard.png"));
+
+        m_pVirtualTexture->beginFeedbackPass(m_window.getFrameBufferSize());
+        m_pVirtualTexture->setUniforms(m_virtualTextureFeedbackShader);
+        for (size_t i = 0; i < m_visibleMeshes.size(); i++) {
+            const GPUMesh& mesh = m_meshes[m_visibleMeshes[i]];
+            if (mesh.hasTextureCoords())
+                m_renderQueue.submit(RenderPass::Opaque, m_virtualTextureFeedbackShader, mesh, nullptr, firstTransform + uint32_t(i), 0.0f);
+        }
+        m_renderQueue.execute();
+        m_pVirtualTexture->endFeedbackPass();
+
+        m_pVirtualTexture->update();
+        m_pVirtualTexture->setUniforms(m_virtualTextureShader);
+    }
+
+    // Light every pixel of the G-buffer into the default framebuffer, including its depth.
+    void renderDeferredLighting()
+    {
+        const Shader& shader = m_deferredShaders.get(getDeferredLightingFeatures());
+        shader.bind();
+        m_gbuffer.bind(shader);
+        shader.setUniform("inverseViewProjection", glm::inverse(m_projectionMatrix * m_viewMatrix));
+        GLStateCache::get().setDepthFunc(GL_ALWAYS);
+        GLStateCache::get().setDepthWrite(true);
+        m_gbuffer.drawFullscreenTriangle();
+        GLStateCache::get().setDepthFunc(GL_LESS);
+    }
+
+    void renderShadows()
+    {
+        m_shadowMap.update(m_viewMatrix, m_projectionMatrix, m_nearPlane, m_farPlane, glm::normalize(m_lightDirection));
+        for (int cascade = 0; cascade < m_shadowMap.getNumCascades(); cascade++) {
+            const glm::mat4& lightViewProjection = m_shadowMap.getLightViewProjection(cascade);
+            // Casters are culled per cascade; the frustum extends towards the light to include casters outside of it.
+            m_frustumCuller.cull(Frustum::fromMatrix(lightViewProjection), m_shadowCasters);
+            const auto drawCasters = [&](bool dynamic) {
+                m_shadowCasterBatch.clear();
+                for (const uint32_t meshIndex : m_shadowCasters) {
+                    if (m_meshDynamic[meshIndex] == dynamic)
+                        m_shadowCasterBatch.push_back(meshIndex);
+                }
+                drawShadowCasters(lightViewProjection, m_shadowCasterBatch);
+            };
+
+            if (m_shadowMap.needsStaticPass(cascade)) {
+                m_shadowMap.beginStaticPass(cascade);
+                drawCasters(false);
+            }
+            m_shadowMap.beginDynamicPass(cascade);
+            drawCasters(true);
+        }
+        m_shadowMap.endPasses();
+    }
+
+    // Render the tiles of the shadow atlas that are out of date (within the per-frame budget).
+    void updateLightShadows()
+    {
+        m_lightCasters.resize(m_lights.size());
+        m_previousLights.resize(m_lights.size());
+        m_shadowRequests.clear();
+        for (uint32_t lightId = 0; lightId < uint32_t(m_lights.size()); lightId++) {
+            const Light& light = m_lights[lightId];
+            if (light.type != LightType::Spot || !light.castsShadows)
+                continue;
+            // The casters changed when one of them moved, or when one entered or left the frustum of the light.
+            m_frustumCuller.cull(Frustum::fromMatrix(light.getShadowViewProjection()), m_shadowCasters);
+            const bool castersChanged = m_shadowCasters != m_lightCasters[lightId]
+                || std::any_of(std::begin(m_shadowCasters), std::end(m_shadowCasters), [&](uint32_t meshIndex) { return m_meshDynamic[meshIndex]; });
+            m_lightCasters[lightId].swap(m_shadowCasters);
+            m_shadowRequests.push_back({ lightId, light.getScreenImportance(m_viewMatrix, m_projectionMatrix), light != m_previousLights[lightId], castersChanged });
+            m_previousLights[lightId] = light;
+        }
+
+        m_shadowAtlas.update(m_shadowRequests);
+        for (const uint32_t lightId : m_shadowAtlas.getScheduledLights()) {
+            m_shadowAtlasTexture.beginTile(*m_shadowAtlas.getTile(lightId));
+            drawShadowCasters(m_lights[lightId].getShadowViewProjection(), m_lightCasters[lightId]);
+        }
+        m_shadowAtlasTexture.endTiles();
+    }
+
+    // Feature bits of the lit variants of m_defaultShaders and m_deferredShaders that the lighting toggles select.
+    uint32_t getLightingFeatures() const
+    {
+        return (m_useShadows ? Shadows : 0u) | (m_useLights ? Lights : 0u);
+    }
+    uint32_t getDeferredLightingFeatures() const
+    {
+        return (m_useShadows ? DeferredShadows : 0u) | (m_useLights ? DeferredLights : 0u);
+    }
+
+    // Assign the lights to the clusters of the view frustum and upload them for clustered shading.
+    void updateLights()
+    {
+        m_gpuLights.clear();
+        m_lightSpheres.clear();
+        for (uint32_t lightId = 0; lightId < uint32_t(m_lights.size()); lightId++) {
+            const Light& light = m_lights[lightId];
+            m_gpuLights.emplace_back(light, m_shadowAtlas.getTile(lightId), m_shadowAtlasTexture.getSize());
+            m_lightSpheres.emplace_back(light.position, light.range);
+        }
+        m_lightClusters.build(m_viewMatrix, m_projectionMatrix, m_nearPlane, m_farPlane, m_lightSpheres);
+        m_lightBuffer.upload(m_gpuLights, m_lightClusters, m_viewMatrix, m_window.getFrameBufferSize());
+    }
+
+    // Replace the point lights (which follow the spot lights in m_lights) by randomly placed ones around the origin.
+    void setNumPointLights(int numPointLights)
+    {
+        m_lights.resize(numSpotLights);
+        std::mt19937 random { 42 };
+        std::uniform_real_distribution<float> distribution { 0.0f, 1.0f };
+        for (int i = 0; i < numPointLights; i++) {
+            Light light;
+            light.type = LightType::Point;
+            light.position = glm::vec3(12.0f * distribution(random) - 6.0f, 2.0f * distribution(random), 12.0f * distribution(random) - 6.0f);
+            light.color = 0.5f * glm::vec3(distribution(random), distribution(random), distribution(random));
+            light.range = 0.3f + 0.5f * distribution(random);
+            light.castsShadows = false;
+            m_lights.push_back(light);
+        }
+    }
+
+    // Draw the meshes into the bound shadow map (or atlas tile).
+    void drawShadowCasters(const glm::mat4& lightViewProjection, std::span<const uint32_t> meshIndices)
+    {
+        const uint32_t firstTransform = addTransforms(lightViewProjection, meshIndices);
+        for (size_t i = 0; i < meshIndices.size(); i++)
+            m_renderQueue.submit(RenderPass::Shadow, m_shadowShader, m_meshes[meshIndices[i]], nullptr, firstTransform + uint32_t(i), 0.0f);
+        m_renderQueue.execute();
+    }
+
+    // Place the spot light on a circle around the origin, pointing at it.
+    static void placeLight(Light& light, float angle)
+    {
+        light.position = glm::vec3(2.0f * std::cos(angle), 2.0f, 2.0f * std::sin(angle));
+        light.direction = glm::normalize(-light.position);
+    }
+
+    void drawInstances()
+    {
+        // All instances are uploaded with a single buffer update and drawn with one call per mesh. Every mesh uses its
+        // own range of instances because the material index is a per-instance attribute.
+        m_instanceBuffer.clear();
+        const int gridSize = static_cast<int>(std::ceil(std::sqrt(float(m_numInstances))));
+        const float spacing = 1.5f;
+        for (const GPUMesh& mesh : m_meshes) {
+            for (int i = 0; i < m_numInstances; i++) {
+                const glm::vec2 gridPosition = spacing * (glm::vec2(i % gridSize, i / gridSize) - 0.5f * float(gridSize - 1));
+                m_instanceBuffer.add(glm::translate(m_sceneGraph.getWorldMatrix(m_sceneRoot), glm::vec3(gridPosition.x, 0.0f, gridPosition.y)), mesh.getMaterialIndex());
+            }
+        }
+        m_instanceBuffer.upload();
+        // The model matrices come from the instances, so the "model view projection" matrix is just the view projection.
+        // Only the first entry of the DrawData array is used, but the whole array has to be backed by the bound range.
+        const UniformRingBuffer::Allocation drawData = m_frameData.allocate(RenderQueue::drawDataBlockSize);
+        const DrawData viewProjection(m_projectionMatrix * m_viewMatrix, glm::mat4(1.0f), glm::mat3(1.0f));
+        std::memcpy(drawData.pData, &viewProjection, sizeof(DrawData));
+        m_frameData.flush();
+        m_frameData.bindRange(RenderQueue::drawDataBinding, drawData.offset, RenderQueue::drawDataBlockSize);
+
+        uint32_t firstInstance = 0;
+        for (const GPUMesh& mesh : m_meshes) {
+            uint32_t features = Instanced;
+            if (mesh.hasTextureCoords())
+                features |= HasTexture;
+            else if (m_useMaterial)
+                features |= UseMaterial;
+            const Shader& shader = m_defaultShaders.get(features);
+            shader.bind();
+            shader.setUniformBlockBinding("DrawData", RenderQueue::drawDataBinding);
+            if (mesh.hasTextureCoords()) {
+                (mesh.getKdTexture() ? mesh.getKdTexture() : m_texture)->bind(GL_TEXTURE0);
+                shader.setUniform("colorMap", 0);
+            }
+            mesh.drawInstanced(shader, m_instanceBuffer, firstInstance, uint32_t(m_numInstances));
+            firstInstance += uint32_t(m_numInstances);
+        }
+    }
+
     // In here you can handle key presses
     // key - Integer that corresponds to numbers in https://www.glfw.org/docs/latest/group__keys.html
     // mods - Any modifier keys pressed, like shift or control
@@ -154,19 +668,119 @@ public:
 
 private:
     Window m_window;
+    ProgramBinaryCache m_programCache;
 
     // Shader for default rendering and for depth rendering
-    Shader m_defaultShader;
+    // Feature bits of m_defaultShaders (same order as the defines passed to its constructor).
+    static constexpr uint32_t HasTexture = 1u << 0;
+    static constexpr uint32_t UseMaterial = 1u << 1;
+    static constexpr uint32_t Instanced = 1u << 2;
+    static constexpr uint32_t Shadows = 1u << 3;
+    static constexpr uint32_t WriteGBuffer = 1u << 4;
+    static constexpr uint32_t Lights = 1u << 5;
+    ShaderVariants m_defaultShaders;
+    // Lighting pass of the deferred path.
+    static constexpr uint32_t DeferredShadows = 1u << 0;
+    static constexpr uint32_t DeferredLights = 1u << 1;
+    ShaderVariants m_deferredShaders;
     Shader m_shadowShader;
+    ShaderReloader m_shaderReloader { RESOURCE_ROOT "shaders" };
 
+    // Must be declared before m_texture, which is loaded through them in the constructor.
+    TextureUploader m_textureUploader;
+    TextureRegistry m_textureRegistry;
+    // Hold the vertices, indices and materials of all meshes; must outlive them.
+    GeometryArena m_geometryArena;
+    MaterialBuffer m_materialBuffer;
     std::vector<GPUMesh> m_meshes;
-    Texture m_texture;
+    // World space bounds of m_meshes (same indices) and the meshes that were visible in the last frame.
+    std::vector<AxisAlignedBox> m_meshWorldBounds;
+    FrustumCuller m_frustumCuller;
+    std::vector<uint32_t> m_visibleMeshes;
+    // Inputs of the batched transform computations (see addTransforms()).
+    std::vector<glm::mat4> m_batchModelMatrices;
+    std::vector<uint8_t> m_batchRigid;
+    // CPU copies of the meshes that are rasterized as occluders.
+    static constexpr size_t maxOccluderTriangles = 4096;
+    struct Occluder {
+        Mesh mesh;
+        uint32_t meshIndex;
+    };
+    std::vector<Occluder> m_occluders;
+    OcclusionCuller m_occlusionCuller;
+    bool m_useOcclusionCulling { true };
+    std::shared_ptr<Texture> m_texture;
+    std::vector<std::shared_ptr<Texture>> m_atlasTextures;
+    // Alternative for the textures of the textured meshes (in the forward path); created on first use.
+    bool m_useVirtualTexture { false };
+    std::unique_ptr<VirtualTexture> m_pVirtualTexture;
+    Shader m_virtualTextureShader;
+    Shader m_virtualTextureFeedbackShader;
     bool m_useMaterial { true };
 
+    // Per-draw constants of the frames in flight; must be declared before the render queue.
+    UniformRingBuffer m_frameData;
+    RenderQueue m_renderQueue { m_frameData };
+    // Copies of the meshes drawn in a grid around the origin with instancing.
+    int m_numInstances { 0 };
+    InstanceBuffer m_instanceBuffer;
+
     // Projection and view matrices for you to fill in and use
-    glm::mat4 m_projectionMatrix = glm::perspective(glm::radians(80.0f), 1.0f, 0.1f, 30.0f);
+    float m_nearPlane { 0.1f };
+    float m_farPlane { 30.0f };
+    glm::mat4 m_projectionMatrix = glm::perspective(glm::radians(80.0f), 1.0f, m_nearPlane, m_farPlane);
     glm::mat4 m_viewMatrix = glm::lookAt(glm::vec3(-1, 1, -1), glm::vec3(0), glm::vec3(0, 1, 0));
-    glm::mat4 m_modelMatrix { 1.0f };
+
+    // Placement of all meshes: every mesh has a node (m_meshNodes, same indices) below the root.
+    static constexpr uint32_t noMesh = std::numeric_limits<uint32_t>::max();
+    SceneGraph m_sceneGraph;
+    SceneGraph::NodeHandle m_sceneRoot;
+    std::vector<SceneGraph::NodeHandle> m_meshNodes;
+    std::vector<uint32_t> m_nodeMeshes; // Indexed by node handle; noMesh for nodes without a mesh.
+    float m_rotationSpeed { 0.0f }; // Of the root, in radians per second.
+    float m_rootAngle { 0.0f };
+    std::chrono::high_resolution_clock::time_point m_previousFrameTime = std::chrono::high_resolution_clock::now();
+    // Meshes that moved in the last frame; they are rendered into the shadow map every frame, the others are cached.
+    std::vector<bool> m_meshDynamic;
+
+    // Shadows of a directional light, cast by all meshes.
+    CascadedShadowMap m_shadowMap;
+    std::vector<uint32_t> m_shadowCasters;
+    std::vector<uint32_t> m_shadowCasterBatch;
+    glm::vec3 m_lightDirection { -0.4f, -1.0f, -0.3f };
+    bool m_useShadows { true };
+
+    // Spot lights (the first numSpotLights) and point lights; the light id is the index. The shadow maps of the spot
+    // lights share an atlas, whose tiles are rendered again only when the light or its casters (m_lightCasters, same
+    // indices) changed since the previous frame.
+    static constexpr size_t numSpotLights = 4;
+    std::vector<Light> m_lights;
+    std::vector<Light> m_previousLights;
+    std::vector<std::vector<uint32_t>> m_lightCasters;
+    ShadowAtlas m_shadowAtlas;
+    ShadowAtlasTexture m_shadowAtlasTexture { m_shadowAtlas.getAllocator().getAtlasSize() };
+    std::vector<ShadowRequest> m_shadowRequests;
+    // All lights are shaded with clustered forward shading (or in the lighting pass of the deferred path).
+    bool m_useLights { true };
+    LightClusterGrid m_lightClusters;
+    LightBuffer m_lightBuffer;
+    std::vector<GPULight> m_gpuLights;
+    std::vector<glm::vec4> m_lightSpheres;
+    int m_numPointLights { 256 };
+    bool m_animateLight { false };
+    float m_lightAngle { 0.0f };
+
+    // The opaque meshes are either lit while they are drawn (forward), or drawn into the G-buffer and lit afterwards
+    // in a single fullscreen pass (deferred). Both can start with a depth prepass; the GPU timers allow comparing them.
+    enum class RenderPath {
+        Forward,
+        Deferred
+    };
+    RenderPath m_renderPath { RenderPath::Forward };
+    bool m_useDepthPrepass { false };
+    GBuffer m_gbuffer { m_window.getFrameBufferSize() };
+    GPUTimer m_opaqueTimer;
+    GPUTimer m_lightingTimer;
 };
 
 int main()
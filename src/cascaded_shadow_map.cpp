@@ -0,0 +1,246 @@
+#include "cascaded_shadow_map.h"
+#include <framework/gl_state.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/vec4.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <stdexcept>
+
+// Uniform block ShadowCascades in shaders/shadow_cascades.glsl (std140).
+struct ShadowCascadesData {
+    glm::mat4 lightViewProjections[CascadedShadowMap::maxCascades];
+    glm::vec4 cascadeEnds;
+    glm::vec4 cascadeTexelSizes;
+    glm::vec4 lightDirection;
+    glm::vec4 cameraPosition;
+    glm::vec4 cameraForward;
+    int32_t numCascades;
+    int32_t padding[3];
+};
+
+static GLuint createDepthTextureArray(int resolution, int numLayers, bool compare)
+{
+    GLuint texture;
+    glGenTextures(1, &texture);
+    GLStateCache::get().bindTextureToActiveUnit(GL_TEXTURE_2D_ARRAY, texture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT32F, resolution, resolution, numLayers, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    if (compare) {
+        // Depth comparison with bilinear filtering results in 2x2 percentage closer filtering in hardware.
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    } else {
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+    return texture;
+}
+
+static GLuint createLayerFramebuffer(GLuint textureArray, int layer)
+{
+    GLuint framebuffer;
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, textureArray, 0, layer);
+    // Depth only.
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+        throw std::runtime_error("Shadow map framebuffer is incomplete");
+    return framebuffer;
+}
+
+CascadedShadowMap::CascadedShadowMap(const CascadedShadowMapSettings& settings)
+    : m_settings(settings)
+{
+    m_settings.numCascades = std::clamp(settings.numCascades, 1, maxCascades);
+    m_lightViewProjections.fill(glm::mat4(1.0f));
+    m_shadowMap = createDepthTextureArray(m_settings.resolution, m_settings.numCascades, true);
+    m_staticCache = createDepthTextureArray(m_settings.resolution, m_settings.numCascades, false);
+    for (int cascade = 0; cascade < m_settings.numCascades; cascade++) {
+        m_shadowMapFramebuffers[size_t(cascade)] = createLayerFramebuffer(m_shadowMap, cascade);
+        m_staticCacheFramebuffers[size_t(cascade)] = createLayerFramebuffer(m_staticCache, cascade);
+    }
+
+    glGenBuffers(1, &m_uniformBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, m_uniformBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(ShadowCascadesData), nullptr, GL_DYNAMIC_DRAW);
+}
+
+CascadedShadowMap::~CascadedShadowMap()
+{
+    glDeleteFramebuffers(m_settings.numCascades, m_shadowMapFramebuffers.data());
+    glDeleteFramebuffers(m_settings.numCascades, m_staticCacheFramebuffers.data());
+    GLStateCache::get().forgetTexture(m_shadowMap);
+    GLStateCache::get().forgetTexture(m_staticCache);
+    glDeleteTextures(1, &m_shadowMap);
+    glDeleteTextures(1, &m_staticCache);
+    GLStateCache::get().forgetBuffer(m_uniformBuffer);
+    glDeleteBuffers(1, &m_uniformBuffer);
+}
+
+void CascadedShadowMap::update(const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix, float nearPlane, float farPlane, const glm::vec3& lightDirection)
+{
+    m_statistics = {};
+
+    // Corners of the view frustum on the near and far plane. The view distance changes linearly along the edges
+    // between them, so the corners of a slice are found by interpolation.
+    const glm::mat4 inverseViewProjection = glm::inverse(projectionMatrix * viewMatrix);
+    std::array<glm::vec3, 4> nearCorners, farCorners;
+    for (int i = 0; i < 4; i++) {
+        const glm::vec2 ndc { (i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f };
+        const glm::vec4 nearCorner = inverseViewProjection * glm::vec4(ndc, -1.0f, 1.0f);
+        const glm::vec4 farCorner = inverseViewProjection * glm::vec4(ndc, 1.0f, 1.0f);
+        nearCorners[size_t(i)] = glm::vec3(nearCorner) / nearCorner.w;
+        farCorners[size_t(i)] = glm::vec3(farCorner) / farCorner.w;
+    }
+
+    // The light only rotates the scene; the cascades are placed by the (snapped) orthographic projection such that
+    // moving the camera moves them in whole texels.
+    const glm::vec3 up = std::abs(lightDirection.y) > 0.99f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+    const glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), lightDirection, up);
+
+    const glm::mat4 inverseView = glm::inverse(viewMatrix);
+    ShadowCascadesData data {};
+    data.lightDirection = glm::vec4(glm::normalize(lightDirection), 0.0f);
+    data.cameraPosition = inverseView[3];
+    data.cameraForward = -inverseView[2];
+    data.numCascades = m_settings.numCascades;
+
+    const float shadowDistance = std::min(m_settings.maxDistance, farPlane);
+    float sliceBegin = nearPlane;
+    for (int cascade = 0; cascade < m_settings.numCascades; cascade++) {
+        const float fraction = float(cascade + 1) / float(m_settings.numCascades);
+        const float logarithmicSplit = nearPlane * std::pow(shadowDistance / nearPlane, fraction);
+        const float uniformSplit = nearPlane + (shadowDistance - nearPlane) * fraction;
+        const float sliceEnd = glm::mix(uniformSplit, logarithmicSplit, m_settings.splitLambda);
+
+        std::array<glm::vec3, 8> sliceCorners;
+        for (size_t i = 0; i < 4; i++) {
+            sliceCorners[i] = glm::mix(nearCorners[i], farCorners[i], (sliceBegin - nearPlane) / (farPlane - nearPlane));
+            sliceCorners[i + 4] = glm::mix(nearCorners[i], farCorners[i], (sliceEnd - nearPlane) / (farPlane - nearPlane));
+        }
+        glm::vec3 center { 0.0f };
+        for (const glm::vec3& corner : sliceCorners)
+            center += corner / 8.0f;
+        float radius = 0.0f;
+        for (const glm::vec3& corner : sliceCorners)
+            radius = std::max(radius, glm::distance(corner, center));
+        // The radius only depends on the shape of the slice, but rounding makes sure that it is exactly the same
+        // from frame to frame.
+        radius = std::ceil(radius * 16.0f) / 16.0f;
+
+        const float texelSize = 2.0f * radius / float(m_settings.resolution);
+        glm::vec3 lightSpaceCenter = glm::vec3(lightView * glm::vec4(center, 1.0f));
+        lightSpaceCenter = glm::floor(lightSpaceCenter / texelSize) * texelSize;
+        // Looking along -z in light space: casters up to casterDistance in front of the slice are included.
+        const glm::mat4 lightProjection = glm::ortho(
+            lightSpaceCenter.x - radius, lightSpaceCenter.x + radius, lightSpaceCenter.y - radius, lightSpaceCenter.y + radius,
+            -lightSpaceCenter.z - radius - m_settings.casterDistance, -lightSpaceCenter.z + radius);
+
+        const glm::mat4 lightViewProjection = lightProjection * lightView;
+        if (lightViewProjection != m_lightViewProjections[size_t(cascade)]) {
+            m_lightViewProjections[size_t(cascade)] = lightViewProjection;
+            m_staticCacheValid[size_t(cascade)] = false;
+        }
+        data.lightViewProjections[cascade] = lightViewProjection;
+        data.cascadeEnds[cascade] = sliceEnd;
+        data.cascadeTexelSizes[cascade] = texelSize;
+        sliceBegin = sliceEnd;
+    }
+
+    glBindBuffer(GL_UNIFORM_BUFFER, m_uniformBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(data), &data);
+}
+
+void CascadedShadowMap::invalidateStaticCasters()
+{
+    m_staticCacheValid.fill(false);
+}
+
+int CascadedShadowMap::getNumCascades() const
+{
+    return m_settings.numCascades;
+}
+
+const glm::mat4& CascadedShadowMap::getLightViewProjection(int cascade) const
+{
+    assert(cascade >= 0 && cascade < m_settings.numCascades);
+    return m_lightViewProjections[size_t(cascade)];
+}
+
+bool CascadedShadowMap::needsStaticPass(int cascade) const
+{
+    assert(cascade >= 0 && cascade < m_settings.numCascades);
+    return !m_staticCacheValid[size_t(cascade)];
+}
+
+void CascadedShadowMap::beginStaticPass(int cascade)
+{
+    assert(cascade >= 0 && cascade < m_settings.numCascades);
+    beginPass(m_staticCacheFramebuffers[size_t(cascade)]);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    m_staticCacheValid[size_t(cascade)] = true;
+    m_statistics.staticPasses++;
+}
+
+void CascadedShadowMap::beginDynamicPass(int cascade)
+{
+    assert(cascade >= 0 && cascade < m_settings.numCascades);
+    assert(m_staticCacheValid[size_t(cascade)]);
+    beginPass(m_shadowMapFramebuffers[size_t(cascade)]);
+    // Both layers have the same size and format, so this is a plain copy.
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_staticCacheFramebuffers[size_t(cascade)]);
+    const GLint resolution = m_settings.resolution;
+    glBlitFramebuffer(0, 0, resolution, resolution, 0, 0, resolution, resolution, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    m_statistics.dynamicPasses++;
+}
+
+void CascadedShadowMap::beginPass(GLuint framebuffer)
+{
+    // Only the viewport from before the first pass has to be restored.
+    if (!m_inPasses)
+        glGetIntegerv(GL_VIEWPORT, m_previousViewport);
+    m_inPasses = true;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, m_settings.resolution, m_settings.resolution);
+    GLStateCache::get().setDepthTest(true);
+    GLStateCache::get().setDepthWrite(true);
+    // Slope scaled bias against self shadowing; the shaders add a normal offset on top of this.
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(2.0f, 4.0f);
+}
+
+void CascadedShadowMap::endPasses()
+{
+    if (!m_inPasses)
+        return;
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(m_previousViewport[0], m_previousViewport[1], m_previousViewport[2], m_previousViewport[3]);
+    m_inPasses = false;
+}
+
+void CascadedShadowMap::bind(const Shader& shader) const
+{
+    // Only variants that receive shadows have the block.
+    if (!shader.hasUniformBlock("ShadowCascades"))
+        return;
+    shader.bindUniformBlock("ShadowCascades", bindingPoint, m_uniformBuffer);
+    shader.setUniform("shadowMap", int(textureUnit));
+    GLStateCache::get().bindTexture(textureUnit, GL_TEXTURE_2D_ARRAY, m_shadowMap);
+}
+
+const CascadedShadowMap::Statistics& CascadedShadowMap::getStatistics() const
+{
+    return m_statistics;
+}
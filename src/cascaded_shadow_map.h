@@ -0,0 +1,96 @@
+#pragma once
+#include <framework/disable_all_warnings.h>
+#include <framework/opengl_includes.h>
+#include <framework/shader.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <array>
+
+struct CascadedShadowMapSettings {
+    int numCascades { 4 }; // At most CascadedShadowMap::maxCascades.
+    int resolution { 2048 };
+    // Shadows end at this view distance (or at the far plane if that is closer).
+    float maxDistance { 30.0f };
+    // Blend between logarithmic (1) and uniform (0) split distances (Zhang et al., "Parallel-Split Shadow Maps").
+    float splitLambda { 0.75f };
+    // How far casters outside of a cascade may lie towards the light and still cast a shadow into it.
+    float casterDistance { 20.0f };
+};
+
+// Cascaded shadow maps for a directional light, rendered into the layers of a depth texture array (one per cascade).
+// Every cascade encloses the bounding sphere of its slice of the view frustum and is snapped to whole shadow map
+// texels, such that the shadow edges do not shimmer when the camera moves or rotates.
+//
+// Static and dynamic casters are rendered separately. Static casters are rendered into a second texture array that
+// is kept for as long as the light view projection matrix of the cascade stays the same (which, thanks to the
+// snapping, only changes when the camera moves by a texel or the light changes). Every frame the cached static depth
+// is copied into the shadow map and only the dynamic casters are rendered on top of it:
+//
+//   if (shadowMap.needsStaticPass(cascade)) {
+//       shadowMap.beginStaticPass(cascade);
+//       ... draw static casters with getLightViewProjection(cascade) ...
+//   }
+//   shadowMap.beginDynamicPass(cascade);
+//   ... draw dynamic casters ...
+//   shadowMap.endPasses();
+//
+// Shaders read the shadow map through the ShadowCascades block and shadowMap sampler of shaders/shadow_cascades.glsl.
+class CascadedShadowMap {
+public:
+    static constexpr int maxCascades = 4; // Must match MAX_SHADOW_CASCADES in shaders/shadow_cascades.glsl.
+    static constexpr GLuint bindingPoint = 2;
+    static constexpr GLuint textureUnit = 1;
+
+    CascadedShadowMap(const CascadedShadowMapSettings& settings = {});
+    CascadedShadowMap(const CascadedShadowMap&) = delete;
+    ~CascadedShadowMap();
+
+    CascadedShadowMap& operator=(const CascadedShadowMap&) = delete;
+
+    // Fit the cascades to the view frustum of the camera; the light direction points from the light into the scene.
+    // Cascades whose light view projection matrix changed lose their cached static casters.
+    void update(const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix, float nearPlane, float farPlane, const glm::vec3& lightDirection);
+    // Static casters were added, removed or moved: render them again in all cascades.
+    void invalidateStaticCasters();
+
+    [[nodiscard]] int getNumCascades() const;
+    // Matrix to render the casters of the cascade with (and to cull them with, see Frustum::fromMatrix()).
+    [[nodiscard]] const glm::mat4& getLightViewProjection(int cascade) const;
+
+    [[nodiscard]] bool needsStaticPass(int cascade) const;
+    // Render into the static caster cache of the cascade.
+    void beginStaticPass(int cascade);
+    // Copy the cached static casters into the shadow map and render into it.
+    void beginDynamicPass(int cascade);
+    // Restore the default framebuffer and the previous viewport.
+    void endPasses();
+
+    // Bind the shadow map to the "ShadowCascades" block and "shadowMap" sampler of the shader (if it has them).
+    void bind(const Shader& shader) const;
+
+    struct Statistics {
+        int staticPasses { 0 }; // Cascades whose static casters were rendered this frame.
+        int dynamicPasses { 0 };
+    };
+    // Statistics since the most recent call to update().
+    [[nodiscard]] const Statistics& getStatistics() const;
+
+private:
+    void beginPass(GLuint framebuffer);
+
+private:
+    CascadedShadowMapSettings m_settings;
+    GLuint m_shadowMap; // Depth texture array that is sampled by the shaders.
+    GLuint m_staticCache; // Depth texture array with only the static casters.
+    std::array<GLuint, maxCascades> m_shadowMapFramebuffers;
+    std::array<GLuint, maxCascades> m_staticCacheFramebuffers;
+    GLuint m_uniformBuffer;
+
+    std::array<glm::mat4, maxCascades> m_lightViewProjections;
+    std::array<bool, maxCascades> m_staticCacheValid {};
+    bool m_inPasses { false };
+    GLint m_previousViewport[4];
+    Statistics m_statistics;
+};
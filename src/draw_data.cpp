@@ -0,0 +1,146 @@
+#include "draw_data.h"
+#include <framework/cpu_features.h>
+#include <framework/parallel_for.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/geometric.hpp>
+DISABLE_WARNINGS_POP()
+#include <cassert>
+#ifdef CPU_FEATURES_X86
+#include <immintrin.h>
+#endif
+
+// Batches smaller than this are processed on the calling thread.
+static constexpr int drawDataBlockSize = 1024;
+
+static_assert(offsetof(DrawData, modelMatrix) == 64 && offsetof(DrawData, normalModelMatrix) == 128, "DrawData must follow the std140 layout");
+// DrawData is also the element of a std140 array, whose stride is the struct size rounded up to a multiple of 16 bytes.
+static_assert(sizeof(DrawData) == 176, "DrawData must follow the std140 array layout");
+
+DrawData::DrawData(const glm::mat4& mvp, const glm::mat4& model, const glm::mat3& normalModel)
+    : mvpMatrix(mvp)
+    , modelMatrix(model)
+    , normalModelMatrix { glm::vec4(normalModel[0], 0.0f), glm::vec4(normalModel[1], 0.0f), glm::vec4(normalModel[2], 0.0f) }
+{
+}
+
+// The inverse transpose of a 3x3 matrix with columns c0, c1, c2 is its cofactor matrix divided by the determinant, and
+// the columns of the cofactor matrix are cross(c1, c2), cross(c2, c0) and cross(c0, c1).
+#ifdef CPU_FEATURES_X86
+static inline __m128 crossSSE(__m128 a, __m128 b)
+{
+    const __m128 aYZX = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+    const __m128 bYZX = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+    const __m128 result = _mm_sub_ps(_mm_mul_ps(a, bYZX), _mm_mul_ps(aYZX, b));
+    return _mm_shuffle_ps(result, result, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+// Columns of an affine matrix have w = 0, so the normal matrix columns are stored with w = 0 as std140 expects.
+static inline void storeNormalMatrixSSE(__m128 column0, __m128 column1, __m128 column2, bool rigid, float* pDestination)
+{
+    if (rigid) {
+        _mm_storeu_ps(pDestination + 0, column0);
+        _mm_storeu_ps(pDestination + 4, column1);
+        _mm_storeu_ps(pDestination + 8, column2);
+        return;
+    }
+
+    const __m128 cofactor0 = crossSSE(column1, column2), cofactor1 = crossSSE(column2, column0), cofactor2 = crossSSE(column0, column1);
+    __m128 determinant = _mm_mul_ps(column0, cofactor0);
+    determinant = _mm_add_ps(determinant, _mm_movehl_ps(determinant, determinant));
+    determinant = _mm_add_ss(determinant, _mm_shuffle_ps(determinant, determinant, _MM_SHUFFLE(1, 1, 1, 1)));
+    const __m128 inverseDeterminant = _mm_div_ps(_mm_set1_ps(1.0f), _mm_shuffle_ps(determinant, determinant, 0));
+    _mm_storeu_ps(pDestination + 0, _mm_mul_ps(cofactor0, inverseDeterminant));
+    _mm_storeu_ps(pDestination + 4, _mm_mul_ps(cofactor1, inverseDeterminant));
+    _mm_storeu_ps(pDestination + 8, _mm_mul_ps(cofactor2, inverseDeterminant));
+}
+
+// SSE is part of x86-64, so this kernel does not need a feature check.
+static void computeDrawDataSSE(const glm::mat4& viewProjectionMatrix, const glm::mat4* pModelMatrices, const uint8_t* pRigid, size_t count, std::byte* pDestination, size_t stride)
+{
+    const __m128 viewProjection0 = _mm_loadu_ps(&viewProjectionMatrix[0][0]), viewProjection1 = _mm_loadu_ps(&viewProjectionMatrix[1][0]);
+    const __m128 viewProjection2 = _mm_loadu_ps(&viewProjectionMatrix[2][0]), viewProjection3 = _mm_loadu_ps(&viewProjectionMatrix[3][0]);
+    for (size_t i = 0; i < count; i++, pDestination += stride) {
+        float* pDrawData = reinterpret_cast<float*>(pDestination);
+        const float* pModel = &pModelMatrices[i][0][0];
+        __m128 columns[4];
+        for (int column = 0; column < 4; column++) {
+            columns[column] = _mm_loadu_ps(pModel + 4 * column);
+            // Every column of the product is a linear combination of the columns of the view projection matrix.
+            __m128 mvpColumn = _mm_mul_ps(viewProjection0, _mm_shuffle_ps(columns[column], columns[column], _MM_SHUFFLE(0, 0, 0, 0)));
+            mvpColumn = _mm_add_ps(mvpColumn, _mm_mul_ps(viewProjection1, _mm_shuffle_ps(columns[column], columns[column], _MM_SHUFFLE(1, 1, 1, 1))));
+            mvpColumn = _mm_add_ps(mvpColumn, _mm_mul_ps(viewProjection2, _mm_shuffle_ps(columns[column], columns[column], _MM_SHUFFLE(2, 2, 2, 2))));
+            mvpColumn = _mm_add_ps(mvpColumn, _mm_mul_ps(viewProjection3, _mm_shuffle_ps(columns[column], columns[column], _MM_SHUFFLE(3, 3, 3, 3))));
+            _mm_storeu_ps(pDrawData + 4 * column, mvpColumn);
+            _mm_storeu_ps(pDrawData + 16 + 4 * column, columns[column]);
+        }
+        storeNormalMatrixSSE(columns[0], columns[1], columns[2], pRigid[i], pDrawData + 32);
+    }
+}
+
+// Processes two columns of the model view projection matrix per 256-bit register.
+CPU_TARGET_AVX2 static void computeDrawDataAVX2(const glm::mat4& viewProjectionMatrix, const glm::mat4* pModelMatrices, const uint8_t* pRigid, size_t count, std::byte* pDestination, size_t stride)
+{
+    // Both halves hold the same column of the view projection matrix.
+    const __m256 viewProjection0 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(&viewProjectionMatrix[0][0]));
+    const __m256 viewProjection1 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(&viewProjectionMatrix[1][0]));
+    const __m256 viewProjection2 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(&viewProjectionMatrix[2][0]));
+    const __m256 viewProjection3 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(&viewProjectionMatrix[3][0]));
+    for (size_t i = 0; i < count; i++, pDestination += stride) {
+        float* pDrawData = reinterpret_cast<float*>(pDestination);
+        const float* pModel = &pModelMatrices[i][0][0];
+        const __m256 columns01 = _mm256_loadu_ps(pModel), columns23 = _mm256_loadu_ps(pModel + 8);
+        for (int half = 0; half < 2; half++) {
+            const __m256 columns = half == 0 ? columns01 : columns23;
+            // _mm256_permute_ps broadcasts an element within each 128-bit half, i.e. within each column.
+            __m256 mvpColumns = _mm256_mul_ps(viewProjection0, _mm256_permute_ps(columns, _MM_SHUFFLE(0, 0, 0, 0)));
+            mvpColumns = _mm256_fmadd_ps(viewProjection1, _mm256_permute_ps(columns, _MM_SHUFFLE(1, 1, 1, 1)), mvpColumns);
+            mvpColumns = _mm256_fmadd_ps(viewProjection2, _mm256_permute_ps(columns, _MM_SHUFFLE(2, 2, 2, 2)), mvpColumns);
+            mvpColumns = _mm256_fmadd_ps(viewProjection3, _mm256_permute_ps(columns, _MM_SHUFFLE(3, 3, 3, 3)), mvpColumns);
+            _mm256_storeu_ps(pDrawData + 8 * half, mvpColumns);
+            _mm256_storeu_ps(pDrawData + 16 + 8 * half, columns);
+        }
+        storeNormalMatrixSSE(_mm256_castps256_ps128(columns01), _mm256_extractf128_ps(columns01, 1), _mm256_castps256_ps128(columns23), pRigid[i], pDrawData + 32);
+    }
+}
+#endif
+
+void computeDrawDataScalar(const glm::mat4& viewProjectionMatrix, std::span<const glm::mat4> modelMatrices, std::span<const uint8_t> rigid,
+    std::byte* pDestination, size_t stride)
+{
+    assert(rigid.size() == modelMatrices.size());
+    for (size_t i = 0; i < modelMatrices.size(); i++, pDestination += stride) {
+        const glm::mat4& modelMatrix = modelMatrices[i];
+        glm::mat3 normalModelMatrix { modelMatrix };
+        if (!rigid[i]) {
+            const glm::mat3 cofactors { glm::cross(normalModelMatrix[1], normalModelMatrix[2]), glm::cross(normalModelMatrix[2], normalModelMatrix[0]),
+                glm::cross(normalModelMatrix[0], normalModelMatrix[1]) };
+            normalModelMatrix = cofactors / glm::dot(normalModelMatrix[0], cofactors[0]);
+        }
+        *reinterpret_cast<DrawData*>(pDestination) = DrawData(viewProjectionMatrix * modelMatrix, modelMatrix, normalModelMatrix);
+    }
+}
+
+void computeDrawData(const glm::mat4& viewProjectionMatrix, std::span<const glm::mat4> modelMatrices, std::span<const uint8_t> rigid,
+    std::byte* pDestination, size_t stride)
+{
+    assert(rigid.size() == modelMatrices.size());
+    assert(stride >= sizeof(DrawData));
+    const auto computeRange = [&](int begin, int end) {
+        const auto first = size_t(begin), count = size_t(end - begin);
+        std::byte* pFirstDestination = pDestination + first * stride;
+#ifdef CPU_FEATURES_X86
+        if (getCPUFeatures().avx2)
+            computeDrawDataAVX2(viewProjectionMatrix, modelMatrices.data() + first, rigid.data() + first, count, pFirstDestination, stride);
+        else
+            computeDrawDataSSE(viewProjectionMatrix, modelMatrices.data() + first, rigid.data() + first, count, pFirstDestination, stride);
+#else
+        computeDrawDataScalar(viewProjectionMatrix, modelMatrices.subspan(first, count), rigid.subspan(first, count), pFirstDestination, stride);
+#endif
+    };
+
+    const int count = static_cast<int>(modelMatrices.size());
+    if (count <= drawDataBlockSize)
+        computeRange(0, count);
+    else
+        parallelFor(count, drawDataBlockSize, computeRange);
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/mat3x3.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/vec4.hpp>
+DISABLE_WARNINGS_POP()
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// Per-draw constants (an element of the uniform block DrawData in shaders/draw_data.glsl), laid out according to std140.
+struct DrawData {
+    DrawData() = default;
+    DrawData(const glm::mat4& mvp, const glm::mat4& model, const glm::mat3& normalModel);
+
+    glm::mat4 mvpMatrix;
+    glm::mat4 modelMatrix;
+    glm::vec4 normalModelMatrix[3]; // A std140 mat3 consists of three vec4 columns.
+};
+
+// Compute the DrawData of many objects at once and write it straight to its destination (for example the transforms of
+// the RenderQueue); consecutive objects are stride bytes apart. The model matrices must
+// be affine. Objects flagged as rigid (rotation and translation only) use the upper 3x3 part of the model matrix as
+// normal matrix; the others use its inverse transpose, computed from the cofactor matrix. Dispatches to AVX2 or SSE.
+void computeDrawData(const glm::mat4& viewProjectionMatrix, std::span<const glm::mat4> modelMatrices, std::span<const uint8_t> rigid,
+    std::byte* pDestination, size_t stride);
+// Portable single threaded version of computeDrawData(): the fallback on other architectures, and the reference that the
+// SIMD kernels are tested against.
+void computeDrawDataScalar(const glm::mat4& viewProjectionMatrix, std::span<const glm::mat4> modelMatrices, std::span<const uint8_t> rigid,
+    std::byte* pDestination, size_t stride);
@@ -0,0 +1,141 @@
+#include "frustum_culler.h"
+#include <framework/cpu_features.h>
+#include <framework/parallel_for.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/geometric.hpp>
+DISABLE_WARNINGS_POP()
+#include <bit>
+#include <cassert>
+#include <cmath>
+#ifdef CPU_FEATURES_X86
+#include <immintrin.h>
+#endif
+
+// Sets smaller than this are culled on the calling thread; larger sets are split into blocks of this size.
+// Multiple of 8 such that every block except the last one consists of full AVX2 iterations.
+static constexpr int cullBlockSize = 4096;
+
+Frustum Frustum::fromMatrix(const glm::mat4& viewProjectionMatrix)
+{
+    // glm is column major: row i consists of the i-th element of each column.
+    const auto row = [&](int i) { return glm::vec4(viewProjectionMatrix[0][i], viewProjectionMatrix[1][i], viewProjectionMatrix[2][i], viewProjectionMatrix[3][i]); };
+    const glm::vec4 row0 = row(0), row1 = row(1), row2 = row(2), row3 = row(3);
+
+    Frustum frustum;
+    frustum.planes = { row3 + row0, row3 - row0, row3 + row1, row3 - row1, row3 + row2, row3 - row2 };
+    for (glm::vec4& plane : frustum.planes)
+        plane /= glm::length(glm::vec3(plane));
+    return frustum;
+}
+
+AxisAlignedBox transformBounds(const AxisAlignedBox& bounds, const glm::mat4& matrix)
+{
+    const glm::vec3 center = 0.5f * (bounds.lower + bounds.upper);
+    const glm::vec3 extent = 0.5f * (bounds.upper - bounds.lower);
+    const glm::vec3 transformedCenter = glm::vec3(matrix * glm::vec4(center, 1.0f));
+    glm::vec3 transformedExtent { 0.0f };
+    for (int column = 0; column < 3; column++)
+        transformedExtent += glm::abs(glm::vec3(matrix[column])) * extent[column];
+    return { transformedCenter - transformedExtent, transformedCenter + transformedExtent };
+}
+
+uint32_t FrustumCuller::add(const AxisAlignedBox& worldBounds)
+{
+    for (auto* pArray : { &m_centerX, &m_centerY, &m_centerZ, &m_extentX, &m_extentY, &m_extentZ })
+        pArray->push_back(0.0f);
+    const auto object = static_cast<uint32_t>(m_centerX.size() - 1);
+    update(object, worldBounds);
+    return object;
+}
+
+void FrustumCuller::update(uint32_t object, const AxisAlignedBox& worldBounds)
+{
+    assert(object < m_centerX.size());
+    const glm::vec3 center = 0.5f * (worldBounds.lower + worldBounds.upper);
+    const glm::vec3 extent = 0.5f * (worldBounds.upper - worldBounds.lower);
+    m_centerX[object] = center.x;
+    m_centerY[object] = center.y;
+    m_centerZ[object] = center.z;
+    m_extentX[object] = extent.x;
+    m_extentY[object] = extent.y;
+    m_extentZ[object] = extent.z;
+}
+
+void FrustumCuller::clear()
+{
+    for (auto* pArray : { &m_centerX, &m_centerY, &m_centerZ, &m_extentX, &m_extentY, &m_extentZ })
+        pArray->clear();
+}
+
+size_t FrustumCuller::getNumObjects() const
+{
+    return m_centerX.size();
+}
+
+void FrustumCuller::cull(const Frustum& frustum, std::vector<uint32_t>& visibleObjects) const
+{
+    visibleObjects.clear();
+    const int numObjects = static_cast<int>(getNumObjects());
+    if (numObjects <= cullBlockSize) {
+        cullRange(frustum, 0, uint32_t(numObjects), visibleObjects);
+        return;
+    }
+
+    // Every block writes to its own list; concatenating them in block order keeps the indices sorted.
+    m_blockResults.resize(size_t((numObjects + cullBlockSize - 1) / cullBlockSize));
+    parallelFor(numObjects, cullBlockSize, [&](int begin, int end) {
+        std::vector<uint32_t>& blockResult = m_blockResults[size_t(begin / cullBlockSize)];
+        blockResult.clear();
+        cullRange(frustum, uint32_t(begin), uint32_t(end), blockResult);
+    });
+    for (const std::vector<uint32_t>& blockResult : m_blockResults)
+        visibleObjects.insert(std::end(visibleObjects), std::begin(blockResult), std::end(blockResult));
+}
+
+// A box is outside a plane if even its corner furthest along the plane normal is outside:
+//   dot(normal, center) + w + dot(abs(normal), extent) < 0
+#ifdef CPU_FEATURES_X86
+CPU_TARGET_AVX2 static uint32_t cullRangeAVX2(const Frustum& frustum, const float* pCenterX, const float* pCenterY, const float* pCenterZ,
+    const float* pExtentX, const float* pExtentY, const float* pExtentZ, uint32_t begin, uint32_t end, std::vector<uint32_t>& visibleObjects)
+{
+    uint32_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        const __m256 centerX = _mm256_loadu_ps(pCenterX + i), centerY = _mm256_loadu_ps(pCenterY + i), centerZ = _mm256_loadu_ps(pCenterZ + i);
+        const __m256 extentX = _mm256_loadu_ps(pExtentX + i), extentY = _mm256_loadu_ps(pExtentY + i), extentZ = _mm256_loadu_ps(pExtentZ + i);
+
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (const glm::vec4& plane : frustum.planes) {
+            __m256 distance = _mm256_fmadd_ps(_mm256_set1_ps(plane.x), centerX, _mm256_set1_ps(plane.w));
+            distance = _mm256_fmadd_ps(_mm256_set1_ps(plane.y), centerY, distance);
+            distance = _mm256_fmadd_ps(_mm256_set1_ps(plane.z), centerZ, distance);
+            distance = _mm256_fmadd_ps(_mm256_set1_ps(std::abs(plane.x)), extentX, distance);
+            distance = _mm256_fmadd_ps(_mm256_set1_ps(std::abs(plane.y)), extentY, distance);
+            distance = _mm256_fmadd_ps(_mm256_set1_ps(std::abs(plane.z)), extentZ, distance);
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, _mm256_setzero_ps(), _CMP_GE_OQ));
+        }
+
+        for (auto mask = static_cast<uint32_t>(_mm256_movemask_ps(inside)); mask != 0; mask &= mask - 1)
+            visibleObjects.push_back(i + uint32_t(std::countr_zero(mask)));
+    }
+    return i;
+}
+#endif
+
+void FrustumCuller::cullRange(const Frustum& frustum, uint32_t begin, uint32_t end, std::vector<uint32_t>& visibleObjects) const
+{
+    uint32_t i = begin;
+#ifdef CPU_FEATURES_X86
+    if (getCPUFeatures().avx2)
+        i = cullRangeAVX2(frustum, m_centerX.data(), m_centerY.data(), m_centerZ.data(), m_extentX.data(), m_extentY.data(), m_extentZ.data(), begin, end, visibleObjects);
+#endif
+    for (; i < end; i++) {
+        bool inside = true;
+        for (const glm::vec4& plane : frustum.planes) {
+            const float distance = plane.x * m_centerX[i] + plane.y * m_centerY[i] + plane.z * m_centerZ[i] + plane.w
+                + std::abs(plane.x) * m_extentX[i] + std::abs(plane.y) * m_extentY[i] + std::abs(plane.z) * m_extentZ[i];
+            inside &= distance >= 0.0f;
+        }
+        if (inside)
+            visibleObjects.push_back(i);
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include "mesh.h"
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/mat4x4.hpp>
+#include <glm/vec4.hpp>
+DISABLE_WARNINGS_POP()
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// The six planes (left, right, bottom, top, near, far) of a view frustum. A point p is inside a plane if
+// dot(plane.xyz, p) + plane.w >= 0; the plane normals are normalized.
+struct Frustum {
+    std::array<glm::vec4, 6> planes;
+
+    // Extract the planes from a (perspective or orthographic) view projection matrix with OpenGL clip space
+    // conventions (Gribb & Hartmann, "Fast Extraction of Viewing Frustum Planes from the World-View-Projection Matrix").
+    static Frustum fromMatrix(const glm::mat4& viewProjectionMatrix);
+};
+
+// Axis aligned box that encloses the given box after transformation (Arvo, "Transforming Axis-Aligned Bounding Boxes").
+[[nodiscard]] AxisAlignedBox transformBounds(const AxisAlignedBox& bounds, const glm::mat4& matrix);
+
+// Keeps the world space bounds of all renderable objects as arrays of centers and half extents (structure of arrays)
+// and tests them against a frustum, 8 objects at a time with AVX2. Large sets are split across threads. The same set
+// of objects can be culled against any number of views (camera, shadow maps, minimap, ...).
+class FrustumCuller {
+public:
+    // Returns the index of the object (indices are consecutive, starting at 0).
+    uint32_t add(const AxisAlignedBox& worldBounds);
+    void update(uint32_t object, const AxisAlignedBox& worldBounds);
+    void clear();
+    [[nodiscard]] size_t getNumObjects() const;
+
+    // Replace the contents of visibleObjects by the indices (in increasing order) of all objects whose bounds
+    // intersect the frustum. The test is conservative: boxes near a frustum corner may be reported as visible.
+    void cull(const Frustum& frustum, std::vector<uint32_t>& visibleObjects) const;
+
+private:
+    void cullRange(const Frustum& frustum, uint32_t begin, uint32_t end, std::vector<uint32_t>& visibleObjects) const;
+
+private:
+    std::vector<float> m_centerX, m_centerY, m_centerZ;
+    std::vector<float> m_extentX, m_extentY, m_extentZ;
+
+    // Per-block results of a multi-threaded cull (reused to avoid allocations).
+    mutable std::vector<std::vector<uint32_t>> m_blockResults;
+};
@@ -0,0 +1,107 @@
+#include "gbuffer.h"
+#include <framework/disable_all_warnings.h>
+#include <framework/gl_state.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+DISABLE_WARNINGS_POP()
+#include <array>
+#include <stdexcept>
+
+GBuffer::GBuffer(const glm::ivec2& size)
+    : m_size(glm::max(size, glm::ivec2(1)))
+{
+    glGenTextures(1, &m_albedoMetalTexture);
+    glGenTextures(1, &m_normalRoughnessTexture);
+    glGenTextures(1, &m_depthTexture);
+    glGenFramebuffers(1, &m_framebuffer);
+    glGenVertexArrays(1, &m_emptyVertexArray);
+    allocate();
+}
+
+GBuffer::~GBuffer()
+{
+    GLStateCache::get().forgetVertexArray(m_emptyVertexArray);
+    glDeleteVertexArrays(1, &m_emptyVertexArray);
+    glDeleteFramebuffers(1, &m_framebuffer);
+    for (const GLuint texture : { m_albedoMetalTexture, m_normalRoughnessTexture, m_depthTexture }) {
+        GLStateCache::get().forgetTexture(texture);
+        glDeleteTextures(1, &texture);
+    }
+}
+
+void GBuffer::resize(const glm::ivec2& size)
+{
+    // A minimized window has an empty framebuffer, but a framebuffer with empty attachments is incomplete.
+    const glm::ivec2 clampedSize = glm::max(size, glm::ivec2(1));
+    if (clampedSize == m_size)
+        return;
+    m_size = clampedSize;
+    allocate();
+}
+
+void GBuffer::allocate()
+{
+    // Every pixel maps to exactly one texel (read with texelFetch), so there is no filtering.
+    const auto allocateTexture = [this](GLuint texture, GLenum internalFormat, GLenum format, GLenum type) {
+        GLStateCache::get().bindTextureToActiveUnit(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, static_cast<GLint>(internalFormat), m_size.x, m_size.y, 0, format, type, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    };
+    allocateTexture(m_albedoMetalTexture, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+    // 10 bits per component are plenty for an octahedral normal and much cheaper than floating point.
+    allocateTexture(m_normalRoughnessTexture, GL_RGB10_A2, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV);
+    allocateTexture(m_depthTexture, GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_albedoMetalTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, m_normalRoughnessTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_depthTexture, 0);
+    const std::array<GLenum, 2> drawBuffers { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(GLsizei(drawBuffers.size()), drawBuffers.data());
+    const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+        throw std::runtime_error("G-buffer framebuffer is incomplete");
+}
+
+void GBuffer::beginGeometryPass()
+{
+    glGetIntegerv(GL_VIEWPORT, m_previousViewport);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glViewport(0, 0, m_size.x, m_size.y);
+    GLStateCache::get().setDepthTest(true);
+    GLStateCache::get().setDepthWrite(true);
+    // Pixels that are not covered keep depth 1, which the lighting pass skips.
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void GBuffer::endGeometryPass()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(m_previousViewport[0], m_previousViewport[1], m_previousViewport[2], m_previousViewport[3]);
+}
+
+void GBuffer::bind(const Shader& shader) const
+{
+    shader.setUniform("gbufferAlbedoMetal", int(albedoMetalTextureUnit));
+    shader.setUniform("gbufferNormalRoughness", int(normalRoughnessTextureUnit));
+    shader.setUniform("gbufferDepth", int(depthTextureUnit));
+    GLStateCache::get().bindTexture(albedoMetalTextureUnit, GL_TEXTURE_2D, m_albedoMetalTexture);
+    GLStateCache::get().bindTexture(normalRoughnessTextureUnit, GL_TEXTURE_2D, m_normalRoughnessTexture);
+    GLStateCache::get().bindTexture(depthTextureUnit, GL_TEXTURE_2D, m_depthTexture);
+}
+
+void GBuffer::drawFullscreenTriangle() const
+{
+    GLStateCache::get().bindVertexArray(m_emptyVertexArray);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+const glm::ivec2& GBuffer::getSize() const
+{
+    return m_size;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <framework/disable_all_warnings.h>
+#include <framework/opengl_includes.h>
+#include <framework/shader.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec2.hpp>
+DISABLE_WARNINGS_POP()
+
+// Render targets of the deferred path: the geometry pass writes the surface attributes of every pixel, after which a
+// single fullscreen pass lights every pixel once (independent of the overdraw of the geometry pass):
+//
+//   gbuffer.resize(window.getFrameBufferSize());
+//   gbuffer.beginGeometryPass();
+//   ... draw the meshes with the GBUFFER variant of shaders/shader_frag.glsl ...
+//   gbuffer.endGeometryPass();
+//   gbuffer.bind(lightingShader);
+//   gbuffer.drawFullscreenTriangle();
+//
+// Layout (see shaders/gbuffer.glsl):
+//   RGBA8:      albedo (rgb), metalness (a)
+//   RGB10_A2:   octahedral encoded normal (rg), roughness (b)
+//   DEPTH32F:   depth, from which the lighting pass reconstructs the position
+class GBuffer {
+public:
+    static constexpr GLuint albedoMetalTextureUnit = 6;
+    static constexpr GLuint normalRoughnessTextureUnit = 7;
+    static constexpr GLuint depthTextureUnit = 8;
+
+    GBuffer(const glm::ivec2& size);
+    GBuffer(const GBuffer&) = delete;
+    ~GBuffer();
+
+    GBuffer& operator=(const GBuffer&) = delete;
+
+    // Reallocate the render targets if the size changed (their contents are lost). The size is clamped to at least 1x1.
+    void resize(const glm::ivec2& size);
+
+    // Bind and clear the render targets; the previous viewport is restored by endGeometryPass().
+    void beginGeometryPass();
+    // Restore the default framebuffer and the previous viewport.
+    void endGeometryPass();
+
+    // Bind the render targets to the gbuffer samplers of the shader (see shaders/deferred_frag.glsl).
+    void bind(const Shader& shader) const;
+    // Draw a single triangle that covers the viewport, without any vertex attributes.
+    void drawFullscreenTriangle() const;
+
+    [[nodiscard]] const glm::ivec2& getSize() const;
+
+private:
+    void allocate();
+
+private:
+    glm::ivec2 m_size;
+    GLuint m_albedoMetalTexture;
+    GLuint m_normalRoughnessTexture;
+    GLuint m_depthTexture;
+    GLuint m_framebuffer;
+    // Core profiles require a vertex array for every draw, even without attributes.
+    GLuint m_emptyVertexArray;
+
+    GLint m_previousViewport[4];
+};
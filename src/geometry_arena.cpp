@@ -0,0 +1,318 @@
+#include "geometry_arena.h"
+#include <framework/gl_state.h>
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <utility>
+
+FreeListAllocator::FreeListAllocator(uint32_t capacity)
+    : m_capacity(capacity)
+{
+    if (capacity > 0)
+        m_freeRanges.push_back({ 0, capacity });
+}
+
+std::optional<uint32_t> FreeListAllocator::allocate(uint32_t size)
+{
+    auto iter = std::find_if(std::begin(m_freeRanges), std::end(m_freeRanges), [=](const Range& range) { return range.size >= size; });
+    if (iter == std::end(m_freeRanges))
+        return {};
+
+    const uint32_t offset = iter->offset;
+    iter->offset += size;
+    iter->size -= size;
+    if (iter->size == 0)
+        m_freeRanges.erase(iter);
+    return offset;
+}
+
+void FreeListAllocator::free(uint32_t offset, uint32_t size)
+{
+    if (size == 0)
+        return;
+    assert(offset + size <= m_capacity);
+
+    // Insert sorted by offset and merge with the neighbouring free ranges if they touch.
+    auto next = std::lower_bound(std::begin(m_freeRanges), std::end(m_freeRanges), offset, [](const Range& range, uint32_t rangeOffset) { return range.offset < rangeOffset; });
+    if (next != std::begin(m_freeRanges)) {
+        if (auto prev = std::prev(next); prev->offset + prev->size == offset) {
+            prev->size += size;
+            if (next != std::end(m_freeRanges) && prev->offset + prev->size == next->offset) {
+                prev->size += next->size;
+                m_freeRanges.erase(next);
+            }
+            return;
+        }
+    }
+    if (next != std::end(m_freeRanges) && offset + size == next->offset) {
+        next->offset = offset;
+        next->size += size;
+        return;
+    }
+    m_freeRanges.insert(next, { offset, size });
+}
+
+void FreeListAllocator::grow(uint32_t newCapacity)
+{
+    assert(newCapacity >= m_capacity);
+    const uint32_t oldCapacity = std::exchange(m_capacity, newCapacity);
+    free(oldCapacity, newCapacity - oldCapacity);
+}
+
+uint32_t FreeListAllocator::getCapacity() const
+{
+    return m_capacity;
+}
+
+uint32_t FreeListAllocator::getNumFreeElements() const
+{
+    uint32_t numFree = 0;
+    for (const Range& range : m_freeRanges)
+        numFree += range.size;
+    return numFree;
+}
+
+uint32_t FreeListAllocator::getLargestFreeRange() const
+{
+    uint32_t largest = 0;
+    for (const Range& range : m_freeRanges)
+        largest = std::max(largest, range.size);
+    return largest;
+}
+
+size_t FreeListAllocator::getNumFreeRanges() const
+{
+    return m_freeRanges.size();
+}
+
+GeometryArena::GeometryArena(uint32_t initialVertexCapacity, uint32_t initialIndexCapacity)
+    : m_vertexAllocator(initialVertexCapacity)
+    , m_indexAllocator(initialIndexCapacity)
+{
+    // Data is uploaded through GL_COPY_WRITE_BUFFER such that the element array binding of whichever vertex array is
+    // bound is not changed.
+    glGenBuffers(1, &m_vbo);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_vbo);
+    glBufferData(GL_COPY_WRITE_BUFFER, static_cast<GLsizeiptr>(size_t(initialVertexCapacity) * sizeof(Vertex)), nullptr, GL_STATIC_DRAW);
+    glGenBuffers(1, &m_ibo);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_ibo);
+    glBufferData(GL_COPY_WRITE_BUFFER, static_cast<GLsizeiptr>(size_t(initialIndexCapacity) * sizeof(GLuint)), nullptr, GL_STATIC_DRAW);
+
+    // Never empty such that the per-draw attributes always point to valid memory.
+    m_perDrawBufferSize = sizeof(PerDrawAttributes);
+    glGenBuffers(1, &m_perDrawBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_perDrawBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, static_cast<GLsizeiptr>(m_perDrawBufferSize), nullptr, GL_STREAM_DRAW);
+
+    glGenVertexArrays(1, &m_vao);
+    setupVertexArray();
+
+    glGenBuffers(1, &m_indirectBuffer);
+}
+
+GeometryArena::~GeometryArena()
+{
+    GLStateCache::get().forgetVertexArray(m_vao);
+    glDeleteVertexArrays(1, &m_vao);
+    glDeleteBuffers(1, &m_vbo);
+    glDeleteBuffers(1, &m_ibo);
+    glDeleteBuffers(1, &m_indirectBuffer);
+    glDeleteBuffers(1, &m_perDrawBuffer);
+}
+
+GeometryRange GeometryArena::allocate(std::span<const Vertex> vertices, std::span<const glm::uvec3> triangles)
+{
+    GeometryRange range;
+    range.numVertices = static_cast<uint32_t>(vertices.size());
+    range.numIndices = static_cast<uint32_t>(3 * triangles.size());
+
+    // Grow (at least doubling to amortize the copies) until the range fits.
+    auto baseVertex = m_vertexAllocator.allocate(range.numVertices);
+    while (!baseVertex) {
+        const uint32_t oldCapacity = m_vertexAllocator.getCapacity();
+        const uint32_t newCapacity = std::max(2 * oldCapacity, oldCapacity + range.numVertices);
+        growBuffer(m_vbo, size_t(oldCapacity) * sizeof(Vertex), size_t(newCapacity) * sizeof(Vertex));
+        m_vertexAllocator.grow(newCapacity);
+        baseVertex = m_vertexAllocator.allocate(range.numVertices);
+    }
+    auto firstIndex = m_indexAllocator.allocate(range.numIndices);
+    while (!firstIndex) {
+        const uint32_t oldCapacity = m_indexAllocator.getCapacity();
+        const uint32_t newCapacity = std::max(2 * oldCapacity, oldCapacity + range.numIndices);
+        growBuffer(m_ibo, size_t(oldCapacity) * sizeof(GLuint), size_t(newCapacity) * sizeof(GLuint));
+        m_indexAllocator.grow(newCapacity);
+        firstIndex = m_indexAllocator.allocate(range.numIndices);
+    }
+    range.baseVertex = *baseVertex;
+    range.firstIndex = *firstIndex;
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_vbo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, static_cast<GLintptr>(size_t(range.baseVertex) * sizeof(Vertex)), static_cast<GLsizeiptr>(vertices.size_bytes()), vertices.data());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_ibo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, static_cast<GLintptr>(size_t(range.firstIndex) * sizeof(GLuint)), static_cast<GLsizeiptr>(triangles.size_bytes()), triangles.data());
+    return range;
+}
+
+void GeometryArena::free(const GeometryRange& range)
+{
+    m_vertexAllocator.free(range.baseVertex, range.numVertices);
+    m_indexAllocator.free(range.firstIndex, range.numIndices);
+}
+
+void GeometryArena::bind() const
+{
+    GLStateCache::get().bindVertexArray(m_vao);
+}
+
+void GeometryArena::draw(const GeometryRange& range) const
+{
+    const void* pIndexOffset = reinterpret_cast<const void*>(size_t(range.firstIndex) * sizeof(GLuint));
+    glDrawElementsBaseVertex(GL_TRIANGLES, static_cast<GLsizei>(range.numIndices), GL_UNSIGNED_INT, pIndexOffset, static_cast<GLint>(range.baseVertex));
+}
+
+int GeometryArena::multiDraw(std::span<const GeometryRange> ranges, std::span<const uint32_t> materialIndices)
+{
+    assert(ranges.size() == materialIndices.size());
+    if (ranges.empty())
+        return 0;
+    // Instanced draws point the material index attribute to their instance buffer.
+    if (m_pAttachedInstances) {
+        attachPerDrawAttributes();
+        m_pAttachedInstances = nullptr;
+    }
+
+    if (GLAD_GL_VERSION_4_3) {
+        // The base instance of each command selects its entry of the per-draw attributes.
+        m_perDraw.clear();
+        m_commands.clear();
+        for (size_t i = 0; i < ranges.size(); i++) {
+            m_perDraw.push_back({ static_cast<uint32_t>(i), materialIndices[i] });
+            m_commands.push_back({ ranges[i].numIndices, 1, ranges[i].firstIndex, static_cast<GLint>(ranges[i].baseVertex), static_cast<GLuint>(i) });
+        }
+
+        // Orphan the buffers so that the driver does not have to wait for the previous multi-draw to finish reading them.
+        // The buffer objects stay the same, so the vertex array does not need to be updated.
+        const size_t perDrawSizeInBytes = m_perDraw.size() * sizeof(PerDrawAttributes);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_perDrawBuffer);
+        m_perDrawBufferSize = std::max(m_perDrawBufferSize, perDrawSizeInBytes);
+        glBufferData(GL_COPY_WRITE_BUFFER, static_cast<GLsizeiptr>(m_perDrawBufferSize), nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, 0, static_cast<GLsizeiptr>(perDrawSizeInBytes), m_perDraw.data());
+        // A single draw has base instance 0 and does not need the indirect buffer.
+        if (ranges.size() == 1) {
+            draw(ranges.front());
+            return 1;
+        }
+
+        const size_t sizeInBytes = m_commands.size() * sizeof(DrawElementsIndirectCommand);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_indirectBuffer);
+        m_indirectBufferSize = std::max(m_indirectBufferSize, sizeInBytes);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, static_cast<GLsizeiptr>(m_indirectBufferSize), nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, static_cast<GLsizeiptr>(sizeInBytes), m_commands.data());
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, static_cast<GLsizei>(m_commands.size()), 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        return 1;
+    } else {
+        // glMultiDrawElementsBaseVertex cannot give the draws different attribute values, so draw them one by one and
+        // pass the per-draw values as the current values of the (disabled) attributes. Nothing else changes in between.
+        for (size_t i = 0; i < ranges.size(); i++) {
+            glVertexAttribI1ui(drawIndexLocation, static_cast<GLuint>(i));
+            glVertexAttribI1ui(materialIndexLocation, materialIndices[i]);
+            draw(ranges[i]);
+        }
+        return static_cast<int>(ranges.size());
+    }
+}
+
+void GeometryArena::drawInstanced(const GeometryRange& range, const InstanceBuffer& instances, uint32_t firstInstance, uint32_t numInstances)
+{
+    const void* pIndexOffset = reinterpret_cast<const void*>(size_t(range.firstIndex) * sizeof(GLuint));
+    if (GLAD_GL_VERSION_4_2) {
+        // The first instance is passed to the draw call so the attributes only need to be set up once.
+        if (m_pAttachedInstances != &instances || m_attachedFirstInstance != 0) {
+            instances.attach(0);
+            m_pAttachedInstances = &instances;
+            m_attachedFirstInstance = 0;
+        }
+        glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, static_cast<GLsizei>(range.numIndices), GL_UNSIGNED_INT, pIndexOffset,
+            static_cast<GLsizei>(numInstances), static_cast<GLint>(range.baseVertex), firstInstance);
+    } else {
+        // OpenGL 4.1 has no base instance, offset the attribute pointers instead.
+        if (m_pAttachedInstances != &instances || m_attachedFirstInstance != firstInstance) {
+            instances.attach(firstInstance);
+            m_pAttachedInstances = &instances;
+            m_attachedFirstInstance = firstInstance;
+        }
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, static_cast<GLsizei>(range.numIndices), GL_UNSIGNED_INT, pIndexOffset,
+            static_cast<GLsizei>(numInstances), static_cast<GLint>(range.baseVertex));
+    }
+}
+
+GeometryArenaStatistics GeometryArena::getStatistics() const
+{
+    const auto fragmentation = [](const FreeListAllocator& allocator) {
+        const uint32_t numFree = allocator.getNumFreeElements();
+        return numFree == 0 ? 0.0f : 1.0f - float(allocator.getLargestFreeRange()) / float(numFree);
+    };
+
+    GeometryArenaStatistics statistics;
+    statistics.vertexCapacity = m_vertexAllocator.getCapacity();
+    statistics.usedVertices = statistics.vertexCapacity - m_vertexAllocator.getNumFreeElements();
+    statistics.indexCapacity = m_indexAllocator.getCapacity();
+    statistics.usedIndices = statistics.indexCapacity - m_indexAllocator.getNumFreeElements();
+    statistics.numFreeVertexRanges = m_vertexAllocator.getNumFreeRanges();
+    statistics.numFreeIndexRanges = m_indexAllocator.getNumFreeRanges();
+    statistics.vertexFragmentation = fragmentation(m_vertexAllocator);
+    statistics.indexFragmentation = fragmentation(m_indexAllocator);
+    statistics.numGrows = m_numGrows;
+    return statistics;
+}
+
+void GeometryArena::growBuffer(GLuint& buffer, size_t oldSizeInBytes, size_t newSizeInBytes)
+{
+    GLuint newBuffer;
+    glGenBuffers(1, &newBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, static_cast<GLsizeiptr>(newSizeInBytes), nullptr, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, static_cast<GLsizeiptr>(oldSizeInBytes));
+    glDeleteBuffers(1, &buffer);
+    buffer = newBuffer;
+
+    m_numGrows++;
+    setupVertexArray();
+}
+
+void GeometryArena::setupVertexArray()
+{
+    GLStateCache::get().bindVertexArray(m_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo);
+
+    // Tell OpenGL that we will be using vertex attributes 0, 1 and 2.
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
+    // We tell OpenGL what each vertex looks like and how they are mapped to the shader (location = ...).
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texCoord));
+
+    attachPerDrawAttributes();
+    m_pAttachedInstances = nullptr;
+}
+
+void GeometryArena::attachPerDrawAttributes()
+{
+    if (GLAD_GL_VERSION_4_3) {
+        glBindBuffer(GL_ARRAY_BUFFER, m_perDrawBuffer);
+        glEnableVertexAttribArray(drawIndexLocation);
+        glVertexAttribIPointer(drawIndexLocation, 1, GL_UNSIGNED_INT, sizeof(PerDrawAttributes), (void*)offsetof(PerDrawAttributes, drawIndex));
+        glVertexAttribDivisor(drawIndexLocation, 1);
+        glEnableVertexAttribArray(materialIndexLocation);
+        glVertexAttribIPointer(materialIndexLocation, 1, GL_UNSIGNED_INT, sizeof(PerDrawAttributes), (void*)offsetof(PerDrawAttributes, materialIndex));
+        glVertexAttribDivisor(materialIndexLocation, 1);
+    } else {
+        glDisableVertexAttribArray(drawIndexLocation);
+        glDisableVertexAttribArray(materialIndexLocation);
+    }
+}
@@ -0,0 +1,132 @@
+#pragma once
+#include "instance_buffer.h"
+#include <framework/disable_all_warnings.h>
+#include <framework/mesh.h>
+#include <framework/opengl_includes.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+// First-fit allocator of ranges of [0, capacity). Free ranges are kept sorted by offset and adjacent free ranges are
+// merged when a range is freed. Sizes and offsets are in elements (not bytes).
+class FreeListAllocator {
+public:
+    FreeListAllocator(uint32_t capacity);
+
+    // Returns the offset of the range, or nothing if there is no free range that is large enough.
+    std::optional<uint32_t> allocate(uint32_t size);
+    void free(uint32_t offset, uint32_t size);
+    // Appends [capacity, newCapacity) to the free ranges.
+    void grow(uint32_t newCapacity);
+
+    [[nodiscard]] uint32_t getCapacity() const;
+    [[nodiscard]] uint32_t getNumFreeElements() const;
+    [[nodiscard]] uint32_t getLargestFreeRange() const;
+    [[nodiscard]] size_t getNumFreeRanges() const;
+
+private:
+    struct Range {
+        uint32_t offset, size;
+    };
+    uint32_t m_capacity;
+    std::vector<Range> m_freeRanges;
+};
+
+// Location of one mesh inside a GeometryArena. Indices are relative to baseVertex.
+struct GeometryRange {
+    uint32_t baseVertex { 0 };
+    uint32_t numVertices { 0 };
+    uint32_t firstIndex { 0 };
+    uint32_t numIndices { 0 };
+};
+
+struct GeometryArenaStatistics {
+    uint32_t vertexCapacity { 0 }, usedVertices { 0 };
+    uint32_t indexCapacity { 0 }, usedIndices { 0 };
+    size_t numFreeVertexRanges { 0 }, numFreeIndexRanges { 0 };
+    // 1 - (largest free range / total free space): 0 when all free space is contiguous.
+    float vertexFragmentation { 0.0f }, indexFragmentation { 0.0f };
+    int numGrows { 0 };
+};
+
+// Stores the vertices and indices of many meshes in one vertex buffer and one index buffer that share a single vertex
+// array object, such that switching between meshes does not require any state changes and meshes can be drawn with a
+// single multi-draw call. Space is sub-allocated with a free list; the buffers grow (by copying) when they are full.
+//
+// All meshes use the Vertex format of framework/mesh.h; a second vertex format would require a second arena.
+class GeometryArena {
+public:
+    // Locations of the per-draw attributes: the index of the draw within its multi-draw call (uint drawIndex in
+    // shaders/shader_vert.glsl) and its material index, which shares the location of the per-instance material index.
+    static constexpr GLuint drawIndexLocation = 7;
+    static constexpr GLuint materialIndexLocation = InstanceBuffer::firstAttributeLocation + 3;
+
+    GeometryArena(uint32_t initialVertexCapacity = 1 << 20, uint32_t initialIndexCapacity = 3 << 20);
+    GeometryArena(const GeometryArena&) = delete;
+    ~GeometryArena();
+
+    GeometryArena& operator=(const GeometryArena&) = delete;
+
+    GeometryRange allocate(std::span<const Vertex> vertices, std::span<const glm::uvec3> triangles);
+    void free(const GeometryRange& range);
+
+    // Bind the vertex array (shared by all meshes in the arena).
+    void bind() const;
+    // Draw all ranges with one glMultiDrawElementsIndirect call; the i-th range is drawn with draw index attribute i and
+    // material index attribute materialIndices[i] such that the shader can select per-draw data. Before OpenGL 4.3 the
+    // ranges are drawn one by one with the per-draw values as the current attribute values. The vertex array must be
+    // bound. Returns the number of draw calls that were made.
+    int multiDraw(std::span<const GeometryRange> ranges, std::span<const uint32_t> materialIndices);
+    // Draw instances [firstInstance, firstInstance + numInstances) of the (uploaded) instance buffer. The vertex array
+    // must be bound.
+    void drawInstanced(const GeometryRange& range, const InstanceBuffer& instances, uint32_t firstInstance, uint32_t numInstances);
+
+    [[nodiscard]] GeometryArenaStatistics getStatistics() const;
+
+private:
+    // Reallocate a buffer and copy its contents over; the vertex array is updated to point to the new buffer.
+    void growBuffer(GLuint& buffer, size_t oldSizeInBytes, size_t newSizeInBytes);
+    void setupVertexArray();
+    // Point the per-draw attributes of the vertex array to the per-draw buffer (OpenGL 4.3+), or disable them such that
+    // their current values are used.
+    void attachPerDrawAttributes();
+    void draw(const GeometryRange& range) const;
+
+private:
+    struct DrawElementsIndirectCommand {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+    struct PerDrawAttributes {
+        uint32_t drawIndex;
+        uint32_t materialIndex;
+    };
+
+    FreeListAllocator m_vertexAllocator, m_indexAllocator;
+    GLuint m_vbo { 0 }, m_ibo { 0 }, m_vao { 0 };
+    int m_numGrows { 0 };
+
+    // Instance buffer (and first instance) that the instance attributes of the vertex array point to; nullptr when the
+    // material index attribute is a per-draw attribute.
+    const InstanceBuffer* m_pAttachedInstances { nullptr };
+    uint32_t m_attachedFirstInstance { 0 };
+
+    GLuint m_perDrawBuffer { 0 };
+    size_t m_perDrawBufferSize { 0 };
+    std::vector<PerDrawAttributes> m_perDraw;
+
+    GLuint m_indirectBuffer { 0 };
+    size_t m_indirectBufferSize { 0 };
+    std::vector<DrawElementsIndirectCommand> m_commands;
+    // Arguments of glMultiDrawElementsBaseVertex.
+    std::vector<GLsizei> m_counts;
+    std::vector<const void*> m_indexOffsets;
+    std::vector<GLint> m_baseVertices;
+};
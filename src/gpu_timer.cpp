@@ -0,0 +1,54 @@
+#include "gpu_timer.h"
+
+GPUTimer::GPUTimer()
+{
+    glGenQueries(GLsizei(m_queries.size()), m_queries.data());
+}
+
+GPUTimer::~GPUTimer()
+{
+    glDeleteQueries(GLsizei(m_queries.size()), m_queries.data());
+}
+
+void GPUTimer::begin()
+{
+    collectResults();
+    // Still not available after numQueries frames; wait for it rather than losing the measurement.
+    if (m_pending[m_current]) {
+        GLuint64 elapsedNs = 0;
+        glGetQueryObjectui64v(m_queries[m_current], GL_QUERY_RESULT, &elapsedNs);
+        m_elapsedMs = float(double(elapsedNs) * 1e-6);
+        m_pending[m_current] = false;
+    }
+    glBeginQuery(GL_TIME_ELAPSED, m_queries[m_current]);
+}
+
+void GPUTimer::end()
+{
+    glEndQuery(GL_TIME_ELAPSED);
+    m_pending[m_current] = true;
+    m_current = (m_current + 1) % numQueries;
+}
+
+float GPUTimer::getElapsedMs() const
+{
+    return m_elapsedMs;
+}
+
+void GPUTimer::collectResults()
+{
+    // Queries complete in order, so stop at the first one that is not available (starting with the oldest).
+    for (size_t i = 0; i < numQueries; i++) {
+        const size_t query = (m_current + i) % numQueries;
+        if (!m_pending[query])
+            continue;
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(m_queries[query], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return;
+        GLuint64 elapsedNs = 0;
+        glGetQueryObjectui64v(m_queries[query], GL_QUERY_RESULT, &elapsedNs);
+        m_elapsedMs = float(double(elapsedNs) * 1e-6);
+        m_pending[query] = false;
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <framework/opengl_includes.h>
+#include <array>
+#include <cstddef>
+
+// Measures the GPU time of the commands between begin() and end() with GL_TIME_ELAPSED queries. Results are read a few
+// frames later, once they are available, such that the CPU never waits for the GPU. Only one timer can be active at a
+// time (timer queries do not nest).
+class GPUTimer {
+public:
+    GPUTimer();
+    GPUTimer(const GPUTimer&) = delete;
+    ~GPUTimer();
+
+    GPUTimer& operator=(const GPUTimer&) = delete;
+
+    void begin();
+    void end();
+
+    // The most recent measurement that is available (0 before the first one).
+    [[nodiscard]] float getElapsedMs() const;
+
+private:
+    void collectResults();
+
+private:
+    // Queries in flight; a frame reuses the query of numQueries frames ago.
+    static constexpr size_t numQueries = 4;
+    std::array<GLuint, numQueries> m_queries;
+    std::array<bool, numQueries> m_pending {};
+    size_t m_current { 0 };
+    float m_elapsedMs { 0.0f };
+};
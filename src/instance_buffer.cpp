@@ -0,0 +1,65 @@
+#include "instance_buffer.h"
+DISABLE_WARNINGS_PUSH()
+#include <glm/matrix.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <cstddef>
+
+InstanceBuffer::InstanceBuffer()
+{
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, static_cast<GLsizeiptr>(m_capacity * sizeof(InstanceData)), nullptr, GL_STREAM_DRAW);
+}
+
+InstanceBuffer::~InstanceBuffer()
+{
+    glDeleteBuffers(1, &m_buffer);
+}
+
+uint32_t InstanceBuffer::add(const glm::mat4& modelMatrix, uint32_t materialIndex)
+{
+    // glm is column major: row i consists of the i-th element of each column.
+    const glm::mat4 transposed = glm::transpose(modelMatrix);
+    m_instances.push_back({ { transposed[0], transposed[1], transposed[2] }, materialIndex });
+    return static_cast<uint32_t>(m_instances.size() - 1);
+}
+
+void InstanceBuffer::upload()
+{
+    if (m_instances.empty())
+        return;
+
+    // Orphan the previous contents (which may still be in use by the previous frame) and upload all instances at once.
+    // The buffer object stays the same, so vertex arrays that it is attached to do not need to be updated.
+    m_capacity = std::max(m_capacity, m_instances.size());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, static_cast<GLsizeiptr>(m_capacity * sizeof(InstanceData)), nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, 0, static_cast<GLsizeiptr>(m_instances.size() * sizeof(InstanceData)), m_instances.data());
+}
+
+void InstanceBuffer::clear()
+{
+    m_instances.clear();
+}
+
+uint32_t InstanceBuffer::getNumInstances() const
+{
+    return static_cast<uint32_t>(m_instances.size());
+}
+
+void InstanceBuffer::attach(uint32_t firstInstance) const
+{
+    const size_t offset = size_t(firstInstance) * sizeof(InstanceData);
+    glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+    for (GLuint row = 0; row < 3; row++) {
+        const GLuint location = firstAttributeLocation + row;
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(offset + offsetof(InstanceData, modelRows) + row * sizeof(glm::vec4)));
+        glVertexAttribDivisor(location, 1);
+    }
+    const GLuint materialLocation = firstAttributeLocation + 3;
+    glEnableVertexAttribArray(materialLocation);
+    glVertexAttribIPointer(materialLocation, 1, GL_UNSIGNED_INT, sizeof(InstanceData), (void*)(offset + offsetof(InstanceData, materialIndex)));
+    glVertexAttribDivisor(materialLocation, 1);
+}
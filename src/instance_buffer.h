@@ -0,0 +1,46 @@
+#pragma once
+#include <framework/disable_all_warnings.h>
+#include <framework/opengl_includes.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/mat4x4.hpp>
+#include <glm/vec4.hpp>
+DISABLE_WARNINGS_POP()
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// Per-instance vertex attributes (locations 3 to 6, see the INSTANCED variant of shaders/shader_vert.glsl).
+struct InstanceData {
+    // First three rows of the (affine) model matrix; the last row is always (0, 0, 0, 1).
+    std::array<glm::vec4, 3> modelRows;
+    uint32_t materialIndex;
+};
+
+// Collects the per-instance data of all instanced draws of a frame such that it can be uploaded with a single buffer
+// update. Each instanced draw uses a consecutive range of instances (see GPUMesh::drawInstanced()).
+class InstanceBuffer {
+public:
+    static constexpr GLuint firstAttributeLocation = 3;
+
+    InstanceBuffer();
+    InstanceBuffer(const InstanceBuffer&) = delete;
+    ~InstanceBuffer();
+
+    InstanceBuffer& operator=(const InstanceBuffer&) = delete;
+
+    // Returns the index of the instance. The model matrix must be affine.
+    uint32_t add(const glm::mat4& modelMatrix, uint32_t materialIndex = 0);
+    // Upload all instances that were added since the last call to clear().
+    void upload();
+    void clear();
+
+    [[nodiscard]] uint32_t getNumInstances() const;
+
+    // Point the instance attributes of the bound vertex array to this buffer, starting at the given instance.
+    void attach(uint32_t firstInstance) const;
+
+private:
+    GLuint m_buffer;
+    size_t m_capacity { 1 }; // In instances; never empty such that attached attributes always point to valid memory.
+    std::vector<InstanceData> m_instances;
+};
@@ -0,0 +1,139 @@
+#include "light.h"
+#include "frustum_culler.h"
+#include <framework/gl_state.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/geometric.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+
+// Uniform block LightClusters in shaders/lights.glsl (std140).
+struct LightClustersData {
+    glm::vec4 viewDepth; // The view depth of a world space position p is dot(viewDepth, vec4(p, 1)).
+    glm::vec4 clusterScale; // xy: clusters per pixel, zw: depth slice scale and bias (LightClusterGrid::getDepthSliceScaleBias())
+    glm::ivec4 gridSize; // xyz
+};
+
+static void createTextureBuffer(GLenum format, GLuint& buffer, GLuint& texture)
+{
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+    glGenTextures(1, &texture);
+    GLStateCache::get().bindTextureToActiveUnit(GL_TEXTURE_BUFFER, texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+}
+
+static void deleteTextureBuffer(GLuint buffer, GLuint texture)
+{
+    GLStateCache::get().forgetTexture(texture);
+    glDeleteTextures(1, &texture);
+    GLStateCache::get().forgetBuffer(buffer);
+    glDeleteBuffers(1, &buffer);
+}
+
+static void uploadTextureBuffer(GLuint buffer, const void* pData, size_t size)
+{
+    // Reallocating the storage every frame lets the driver hand out fresh memory instead of waiting for the GPU to
+    // finish reading the previous contents. Empty buffers keep a few bytes because zero sized storage is not allowed.
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    if (size > 0)
+        glBufferData(GL_TEXTURE_BUFFER, static_cast<GLsizeiptr>(size), pData, GL_STREAM_DRAW);
+    else
+        glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+}
+
+glm::mat4 Light::getShadowViewProjection() const
+{
+    assert(type == LightType::Spot);
+    const glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+    // The near plane trades depth precision against clipping casters close to the light.
+    const float nearPlane = std::max(0.01f * range, 0.05f);
+    return glm::perspective(2.0f * outerAngle, 1.0f, nearPlane, range) * glm::lookAt(position, position + direction, up);
+}
+
+float Light::getScreenImportance(const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix) const
+{
+    const Frustum frustum = Frustum::fromMatrix(projectionMatrix * viewMatrix);
+    for (const glm::vec4& plane : frustum.planes) {
+        if (glm::dot(glm::vec3(plane), position) + plane.w < -range)
+            return 0.0f;
+    }
+
+    const float distance = glm::length(glm::vec3(viewMatrix * glm::vec4(position, 1.0f)));
+    if (distance <= range)
+        return 1.0f;
+    // Projected radius of the sphere relative to half of the screen height.
+    return std::min(range * projectionMatrix[1][1] / distance, 1.0f);
+}
+
+static_assert(sizeof(GPULight) == 8 * sizeof(glm::vec4), "GPULight must match the texels per light in shaders/lights.glsl");
+
+GPULight::GPULight(const Light& light, const std::optional<AtlasTile>& optShadowTile, int atlasSize)
+    : positionRange(light.position, light.range)
+    , directionCosOuter(glm::normalize(light.direction), std::cos(light.outerAngle))
+    , colorCosInner(light.color, std::cos(light.innerAngle))
+    , shadowMatrix(1.0f)
+    , shadowTile(0.0f)
+{
+    if (light.type == LightType::Point) {
+        // The cone factor smoothstep(cosOuter, cosInner, cosAngle) is then 1 in all directions.
+        directionCosOuter.w = -2.0f;
+        colorCosInner.w = -1.0f;
+    } else if (light.castsShadows && optShadowTile) {
+        shadowMatrix = light.getShadowViewProjection();
+        shadowTile = glm::vec4(glm::vec2(optShadowTile->offset), float(optShadowTile->size), float(atlasSize)) / float(atlasSize);
+    }
+}
+
+LightBuffer::LightBuffer()
+{
+    createTextureBuffer(GL_RGBA32F, m_lightDataBuffer, m_lightDataTexture);
+    createTextureBuffer(GL_RG32UI, m_clustersBuffer, m_clustersTexture);
+    createTextureBuffer(GL_R16UI, m_lightIndicesBuffer, m_lightIndicesTexture);
+
+    glGenBuffers(1, &m_uniformBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, m_uniformBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(LightClustersData), nullptr, GL_DYNAMIC_DRAW);
+}
+
+LightBuffer::~LightBuffer()
+{
+    deleteTextureBuffer(m_lightDataBuffer, m_lightDataTexture);
+    deleteTextureBuffer(m_clustersBuffer, m_clustersTexture);
+    deleteTextureBuffer(m_lightIndicesBuffer, m_lightIndicesTexture);
+    GLStateCache::get().forgetBuffer(m_uniformBuffer);
+    glDeleteBuffers(1, &m_uniformBuffer);
+}
+
+void LightBuffer::upload(std::span<const GPULight> lights, const LightClusterGrid& clusters, const glm::mat4& viewMatrix, const glm::ivec2& framebufferSize)
+{
+    uploadTextureBuffer(m_lightDataBuffer, lights.data(), lights.size_bytes());
+    uploadTextureBuffer(m_clustersBuffer, clusters.getClusters().data(), clusters.getClusters().size_bytes());
+    uploadTextureBuffer(m_lightIndicesBuffer, clusters.getLightIndices().data(), clusters.getLightIndices().size_bytes());
+
+    const glm::ivec3 gridSize = clusters.getGridSize();
+    LightClustersData data {};
+    data.viewDepth = -glm::vec4(viewMatrix[0][2], viewMatrix[1][2], viewMatrix[2][2], viewMatrix[3][2]);
+    data.clusterScale = glm::vec4(glm::vec2(gridSize.x, gridSize.y) / glm::vec2(glm::max(framebufferSize, 1)), clusters.getDepthSliceScaleBias());
+    data.gridSize = glm::ivec4(gridSize, 0);
+    glBindBuffer(GL_UNIFORM_BUFFER, m_uniformBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(data), &data);
+}
+
+void LightBuffer::bind(const Shader& shader) const
+{
+    // Only variants that are lit have the block.
+    if (!shader.hasUniformBlock("LightClusters"))
+        return;
+    shader.bindUniformBlock("LightClusters", bindingPoint, m_uniformBuffer);
+    shader.setUniform("lightData", int(lightDataTextureUnit));
+    shader.setUniform("lightClusters", int(clustersTextureUnit));
+    shader.setUniform("lightIndices", int(lightIndicesTextureUnit));
+    GLStateCache::get().bindTexture(lightDataTextureUnit, GL_TEXTURE_BUFFER, m_lightDataTexture);
+    GLStateCache::get().bindTexture(clustersTextureUnit, GL_TEXTURE_BUFFER, m_clustersTexture);
+    GLStateCache::get().bindTexture(lightIndicesTextureUnit, GL_TEXTURE_BUFFER, m_lightIndicesTexture);
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include "light_clusters.h"
+#include "shadow_atlas.h"
+#include <framework/disable_all_warnings.h>
+#include <framework/opengl_includes.h>
+#include <framework/shader.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/mat4x4.hpp>
+#include <glm/trigonometric.hpp>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+DISABLE_WARNINGS_POP()
+#include <optional>
+#include <span>
+
+enum class LightType {
+    Point,
+    Spot
+};
+
+// Point or spot light whose intensity falls off with distance up to its range; the intensity of a spot light also falls
+// off between the inner and outer cone angle. Only spot lights cast shadows.
+struct Light {
+    LightType type { LightType::Spot };
+    glm::vec3 position { 0.0f };
+    glm::vec3 direction { 0.0f, -1.0f, 0.0f }; // Normalized; spot lights only.
+    glm::vec3 color { 1.0f };
+    float range { 10.0f };
+    float innerAngle { glm::radians(20.0f) }; // Half angles of the cone.
+    float outerAngle { glm::radians(30.0f) };
+    bool castsShadows { true };
+
+    bool operator==(const Light&) const = default;
+
+    // Perspective projection that encloses the cone of a spot light, to render (and cull) the shadow casters with.
+    [[nodiscard]] glm::mat4 getShadowViewProjection() const;
+    // Fraction of the screen height covered by the sphere of influence of the light: 1 when the camera is inside of
+    // it, 0 when it is outside of the view frustum.
+    [[nodiscard]] float getScreenImportance(const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix) const;
+};
+
+// Light as stored in the lightData texture buffer of shaders/lights.glsl (8 RGBA32F texels).
+struct GPULight {
+    GPULight() = default;
+    // The shadow tile is optional: lights without one are not shadowed.
+    GPULight(const Light& light, const std::optional<AtlasTile>& optShadowTile, int atlasSize);
+
+    glm::vec4 positionRange; // xyz: position, w: range
+    glm::vec4 directionCosOuter; // xyz: direction, w: cosine of the outer angle (-2 for point lights)
+    glm::vec4 colorCosInner; // xyz: color, w: cosine of the inner angle (-1 for point lights)
+    glm::mat4 shadowMatrix;
+    glm::vec4 shadowTile; // xy: offset, z: size (in texture coordinates of the atlas), w: 1 if the light has shadows
+};
+
+// Uploads the lights and their assignment to clusters (see LightClusterGrid) for clustered forward shading: the lights,
+// the offset and count of every cluster and the light indices each go into a texture buffer, and the parameters to
+// find the cluster of a fragment into the "LightClusters" uniform block of shaders/lights.glsl.
+class LightBuffer {
+public:
+    static constexpr GLuint bindingPoint = 3;
+    // Texture units of the lightData, lightClusters and lightIndices samplers.
+    static constexpr GLuint lightDataTextureUnit = 3;
+    static constexpr GLuint clustersTextureUnit = 4;
+    static constexpr GLuint lightIndicesTextureUnit = 5;
+
+    LightBuffer();
+    LightBuffer(const LightBuffer&) = delete;
+    ~LightBuffer();
+
+    LightBuffer& operator=(const LightBuffer&) = delete;
+
+    // Replace the lights and clusters (call once per frame, after building the clusters with the same view).
+    void upload(std::span<const GPULight> lights, const LightClusterGrid& clusters, const glm::mat4& viewMatrix, const glm::ivec2& framebufferSize);
+    // Bind the buffers to the "LightClusters" block and light samplers of the shader (if it has them).
+    void bind(const Shader& shader) const;
+
+private:
+    GLuint m_lightDataBuffer, m_clustersBuffer, m_lightIndicesBuffer;
+    GLuint m_lightDataTexture, m_clustersTexture, m_lightIndicesTexture;
+    GLuint m_uniformBuffer;
+};
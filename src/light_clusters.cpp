@@ -0,0 +1,289 @@
+#include "light_clusters.h"
+#include <framework/cpu_features.h>
+#include <framework/parallel_for.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/matrix.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#ifdef CPU_FEATURES_X86
+#include <immintrin.h>
+#endif
+
+// Append the indices of the spheres that intersect the box to hits. A sphere intersects the box if the squared distance
+// from its center to the box is at most its squared radius; per axis, the distance is the amount by which the center
+// lies below the lower or above the upper bound. The count must be a multiple of 8.
+#ifdef CPU_FEATURES_X86
+// SSE is part of x86-64, so this kernel does not need a feature check.
+static void intersectSpheresSSE(const float* pX, const float* pY, const float* pZ, const float* pRadiusSquared, size_t count,
+    const glm::vec3& lower, const glm::vec3& upper, std::vector<uint32_t>& hits)
+{
+    const __m128 lowerX = _mm_set1_ps(lower.x), lowerY = _mm_set1_ps(lower.y), lowerZ = _mm_set1_ps(lower.z);
+    const __m128 upperX = _mm_set1_ps(upper.x), upperY = _mm_set1_ps(upper.y), upperZ = _mm_set1_ps(upper.z);
+    const __m128 zero = _mm_setzero_ps();
+    for (size_t i = 0; i < count; i += 4) {
+        const __m128 x = _mm_loadu_ps(pX + i), y = _mm_loadu_ps(pY + i), z = _mm_loadu_ps(pZ + i);
+        const __m128 distanceX = _mm_max_ps(_mm_max_ps(_mm_sub_ps(lowerX, x), _mm_sub_ps(x, upperX)), zero);
+        const __m128 distanceY = _mm_max_ps(_mm_max_ps(_mm_sub_ps(lowerY, y), _mm_sub_ps(y, upperY)), zero);
+        const __m128 distanceZ = _mm_max_ps(_mm_max_ps(_mm_sub_ps(lowerZ, z), _mm_sub_ps(z, upperZ)), zero);
+        const __m128 distanceSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(distanceX, distanceX), _mm_mul_ps(distanceY, distanceY)), _mm_mul_ps(distanceZ, distanceZ));
+        for (auto mask = unsigned(_mm_movemask_ps(_mm_cmple_ps(distanceSquared, _mm_loadu_ps(pRadiusSquared + i)))); mask; mask &= mask - 1)
+            hits.push_back(uint32_t(i) + uint32_t(std::countr_zero(mask)));
+    }
+}
+
+CPU_TARGET_AVX2 static void intersectSpheresAVX2(const float* pX, const float* pY, const float* pZ, const float* pRadiusSquared, size_t count,
+    const glm::vec3& lower, const glm::vec3& upper, std::vector<uint32_t>& hits)
+{
+    const __m256 lowerX = _mm256_set1_ps(lower.x), lowerY = _mm256_set1_ps(lower.y), lowerZ = _mm256_set1_ps(lower.z);
+    const __m256 upperX = _mm256_set1_ps(upper.x), upperY = _mm256_set1_ps(upper.y), upperZ = _mm256_set1_ps(upper.z);
+    const __m256 zero = _mm256_setzero_ps();
+    for (size_t i = 0; i < count; i += 8) {
+        const __m256 x = _mm256_loadu_ps(pX + i), y = _mm256_loadu_ps(pY + i), z = _mm256_loadu_ps(pZ + i);
+        const __m256 distanceX = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(lowerX, x), _mm256_sub_ps(x, upperX)), zero);
+        const __m256 distanceY = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(lowerY, y), _mm256_sub_ps(y, upperY)), zero);
+        const __m256 distanceZ = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(lowerZ, z), _mm256_sub_ps(z, upperZ)), zero);
+        __m256 distanceSquared = _mm256_mul_ps(distanceX, distanceX);
+        distanceSquared = _mm256_fmadd_ps(distanceY, distanceY, distanceSquared);
+        distanceSquared = _mm256_fmadd_ps(distanceZ, distanceZ, distanceSquared);
+        const __m256 inside = _mm256_cmp_ps(distanceSquared, _mm256_loadu_ps(pRadiusSquared + i), _CMP_LE_OQ);
+        for (auto mask = unsigned(_mm256_movemask_ps(inside)); mask; mask &= mask - 1)
+            hits.push_back(uint32_t(i) + uint32_t(std::countr_zero(mask)));
+    }
+}
+#else
+static void intersectSpheresScalar(const float* pX, const float* pY, const float* pZ, const float* pRadiusSquared, size_t count,
+    const glm::vec3& lower, const glm::vec3& upper, std::vector<uint32_t>& hits)
+{
+    for (size_t i = 0; i < count; i++) {
+        const glm::vec3 center { pX[i], pY[i], pZ[i] };
+        const glm::vec3 distance = glm::max(glm::max(lower - center, center - upper), 0.0f);
+        if (distance.x * distance.x + distance.y * distance.y + distance.z * distance.z <= pRadiusSquared[i])
+            hits.push_back(uint32_t(i));
+    }
+}
+#endif
+
+static void intersectSpheres(const float* pX, const float* pY, const float* pZ, const float* pRadiusSquared, size_t count,
+    const glm::vec3& lower, const glm::vec3& upper, std::vector<uint32_t>& hits)
+{
+    hits.clear();
+#ifdef CPU_FEATURES_X86
+    if (getCPUFeatures().avx2)
+        intersectSpheresAVX2(pX, pY, pZ, pRadiusSquared, count, lower, upper, hits);
+    else
+        intersectSpheresSSE(pX, pY, pZ, pRadiusSquared, count, lower, upper, hits);
+#else
+    intersectSpheresScalar(pX, pY, pZ, pRadiusSquared, count, lower, upper, hits);
+#endif
+}
+
+void LightClusterGrid::SphereSet::clear()
+{
+    x.clear();
+    y.clear();
+    z.clear();
+    radiusSquared.clear();
+    lights.clear();
+}
+
+void LightClusterGrid::SphereSet::push(float sphereX, float sphereY, float sphereZ, float sphereRadiusSquared, uint16_t light)
+{
+    x.push_back(sphereX);
+    y.push_back(sphereY);
+    z.push_back(sphereZ);
+    radiusSquared.push_back(sphereRadiusSquared);
+    lights.push_back(light);
+}
+
+void LightClusterGrid::SphereSet::pad()
+{
+    // A negative squared radius never passes the test.
+    while (x.size() % 8 != 0) {
+        x.push_back(0.0f);
+        y.push_back(0.0f);
+        z.push_back(0.0f);
+        radiusSquared.push_back(-1.0f);
+    }
+}
+
+size_t LightClusterGrid::SphereSet::size() const
+{
+    return lights.size();
+}
+
+LightClusterGrid::LightClusterGrid(const LightClusterSettings& settings)
+    : m_settings(settings)
+    , m_sliceScratch(size_t(settings.gridSize.z))
+    , m_clusters(size_t(settings.gridSize.x * settings.gridSize.y * settings.gridSize.z), glm::uvec2(0))
+{
+    assert(glm::all(glm::greaterThan(settings.gridSize, glm::ivec3(0))) && settings.maxLightsPerCluster > 0);
+}
+
+void LightClusterGrid::build(const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix, float nearPlane, float farPlane, std::span<const glm::vec4> lightSpheres)
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+    if (projectionMatrix != m_projectionMatrix || nearPlane != m_nearPlane || farPlane != m_farPlane)
+        updateClusterBounds(projectionMatrix, nearPlane, farPlane);
+
+    m_viewLights.clear();
+    const size_t numLights = std::min(lightSpheres.size(), maxLights);
+    for (size_t i = 0; i < numLights; i++) {
+        const glm::vec4& sphere = lightSpheres[i];
+        const glm::vec4 center = viewMatrix * glm::vec4(glm::vec3(sphere), 1.0f);
+        m_viewLights.push(center.x, center.y, center.z, sphere.w * sphere.w, uint16_t(i));
+    }
+
+    // Every slice writes its own clusters and index list; the lists are concatenated afterwards.
+    parallelFor(m_settings.gridSize.z, 1, [&](int begin, int end) {
+        for (int slice = begin; slice < end; slice++)
+            buildSlice(slice);
+    });
+
+    m_lightIndices.clear();
+    const size_t clustersPerSlice = size_t(m_settings.gridSize.x * m_settings.gridSize.y);
+    for (size_t slice = 0; slice < m_sliceScratch.size(); slice++) {
+        const auto offset = uint32_t(m_lightIndices.size());
+        for (size_t cluster = slice * clustersPerSlice; cluster < (slice + 1) * clustersPerSlice; cluster++)
+            m_clusters[cluster].x += offset;
+        const std::vector<uint16_t>& sliceIndices = m_sliceScratch[slice].lightIndices;
+        m_lightIndices.insert(std::end(m_lightIndices), std::begin(sliceIndices), std::end(sliceIndices));
+    }
+
+    m_statistics = {};
+    m_statistics.numLights = numLights;
+    m_statistics.numLightIndices = m_lightIndices.size();
+    for (const SliceScratch& scratch : m_sliceScratch) {
+        m_statistics.maxLightsInCluster = std::max(m_statistics.maxLightsInCluster, scratch.maxLightsInCluster);
+        m_statistics.numFullClusters += scratch.numFullClusters;
+    }
+    m_statistics.buildTimeMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void LightClusterGrid::updateClusterBounds(const glm::mat4& projectionMatrix, float nearPlane, float farPlane)
+{
+    m_projectionMatrix = projectionMatrix;
+    m_nearPlane = nearPlane;
+    m_farPlane = farPlane;
+
+    const glm::ivec3 gridSize = m_settings.gridSize;
+    m_sliceDepths.resize(size_t(gridSize.z + 1));
+    for (int slice = 0; slice <= gridSize.z; slice++)
+        m_sliceDepths[size_t(slice)] = nearPlane * std::pow(farPlane / nearPlane, float(slice) / float(gridSize.z));
+
+    // A cluster is bounded by the rays through the corners of its screen tile (points on the near plane) and by the
+    // depths at which its slice begins and ends.
+    const glm::mat4 inverseProjection = glm::inverse(projectionMatrix);
+    const auto cornerRay = [&](int x, int y) {
+        const glm::vec2 ndc = 2.0f * glm::vec2(x, y) / glm::vec2(gridSize.x, gridSize.y) - 1.0f;
+        const glm::vec4 nearPoint = inverseProjection * glm::vec4(ndc, -1.0f, 1.0f);
+        const glm::vec3 ray = glm::vec3(nearPoint) / nearPoint.w;
+        return ray / -ray.z; // At view depth 1.
+    };
+
+    const size_t numClusters = size_t(gridSize.x * gridSize.y * gridSize.z), numRows = size_t(gridSize.y * gridSize.z);
+    m_clusterLower.assign(numClusters, glm::vec3(std::numeric_limits<float>::max()));
+    m_clusterUpper.assign(numClusters, glm::vec3(std::numeric_limits<float>::lowest()));
+    m_rowLower.assign(numRows, glm::vec3(std::numeric_limits<float>::max()));
+    m_rowUpper.assign(numRows, glm::vec3(std::numeric_limits<float>::lowest()));
+    for (int slice = 0; slice < gridSize.z; slice++) {
+        for (int y = 0; y < gridSize.y; y++) {
+            const size_t row = size_t(y + gridSize.y * slice);
+            for (int x = 0; x < gridSize.x; x++) {
+                const size_t cluster = size_t(x) + size_t(gridSize.x) * row;
+                for (int corner = 0; corner < 4; corner++) {
+                    const glm::vec3 ray = cornerRay(x + (corner & 1), y + (corner >> 1));
+                    for (const float depth : { m_sliceDepths[size_t(slice)], m_sliceDepths[size_t(slice + 1)] }) {
+                        m_clusterLower[cluster] = glm::min(m_clusterLower[cluster], ray * depth);
+                        m_clusterUpper[cluster] = glm::max(m_clusterUpper[cluster], ray * depth);
+                    }
+                }
+                m_rowLower[row] = glm::min(m_rowLower[row], m_clusterLower[cluster]);
+                m_rowUpper[row] = glm::max(m_rowUpper[row], m_clusterUpper[cluster]);
+            }
+        }
+    }
+}
+
+void LightClusterGrid::buildSlice(int slice)
+{
+    SliceScratch& scratch = m_sliceScratch[size_t(slice)];
+    const glm::ivec3 gridSize = m_settings.gridSize;
+    const size_t maxLightsPerCluster = size_t(m_settings.maxLightsPerCluster);
+
+    // Lights whose sphere overlaps the depth range of the slice.
+    const float sliceBegin = m_sliceDepths[size_t(slice)], sliceEnd = m_sliceDepths[size_t(slice + 1)];
+    scratch.sliceLights.clear();
+    for (size_t i = 0; i < m_viewLights.size(); i++) {
+        const float depth = -m_viewLights.z[i];
+        const float distance = std::max(std::max(sliceBegin - depth, depth - sliceEnd), 0.0f);
+        if (distance * distance <= m_viewLights.radiusSquared[i])
+            scratch.sliceLights.push(m_viewLights.x[i], m_viewLights.y[i], m_viewLights.z[i], m_viewLights.radiusSquared[i], m_viewLights.lights[i]);
+    }
+    scratch.sliceLights.pad();
+
+    scratch.lightIndices.clear();
+    scratch.maxLightsInCluster = 0;
+    scratch.numFullClusters = 0;
+    for (int y = 0; y < gridSize.y; y++) {
+        const size_t row = size_t(y + gridSize.y * slice);
+        glm::uvec2* pClusters = &m_clusters[size_t(gridSize.x) * row];
+
+        const SphereSet& sliceLights = scratch.sliceLights;
+        intersectSpheres(sliceLights.x.data(), sliceLights.y.data(), sliceLights.z.data(), sliceLights.radiusSquared.data(), sliceLights.x.size(),
+            m_rowLower[row], m_rowUpper[row], scratch.hits);
+        if (scratch.hits.empty()) {
+            std::fill(pClusters, pClusters + gridSize.x, glm::uvec2(0));
+            continue;
+        }
+        scratch.rowLights.clear();
+        for (const uint32_t hit : scratch.hits)
+            scratch.rowLights.push(sliceLights.x[hit], sliceLights.y[hit], sliceLights.z[hit], sliceLights.radiusSquared[hit], sliceLights.lights[hit]);
+        scratch.rowLights.pad();
+
+        const SphereSet& rowLights = scratch.rowLights;
+        for (int x = 0; x < gridSize.x; x++) {
+            const size_t cluster = size_t(x) + size_t(gridSize.x) * row;
+            intersectSpheres(rowLights.x.data(), rowLights.y.data(), rowLights.z.data(), rowLights.radiusSquared.data(), rowLights.x.size(),
+                m_clusterLower[cluster], m_clusterUpper[cluster], scratch.hits);
+            // The hits are in increasing order, so the first lights are kept when the cluster is full.
+            const size_t count = std::min(scratch.hits.size(), maxLightsPerCluster);
+            scratch.maxLightsInCluster = std::max(scratch.maxLightsInCluster, int(scratch.hits.size()));
+            scratch.numFullClusters += scratch.hits.size() > maxLightsPerCluster ? 1 : 0;
+            pClusters[x] = glm::uvec2(scratch.lightIndices.size(), count);
+            for (size_t i = 0; i < count; i++)
+                scratch.lightIndices.push_back(rowLights.lights[scratch.hits[i]]);
+        }
+    }
+}
+
+const glm::ivec3& LightClusterGrid::getGridSize() const
+{
+    return m_settings.gridSize;
+}
+
+std::span<const glm::uvec2> LightClusterGrid::getClusters() const
+{
+    return m_clusters;
+}
+
+std::span<const uint16_t> LightClusterGrid::getLightIndices() const
+{
+    return m_lightIndices;
+}
+
+glm::vec2 LightClusterGrid::getDepthSliceScaleBias() const
+{
+    const float scale = float(m_settings.gridSize.z) / std::log(m_farPlane / m_nearPlane);
+    return glm::vec2(scale, -std::log(m_nearPlane) * scale);
+}
+
+const LightClusterStatistics& LightClusterGrid::getStatistics() const
+{
+    return m_statistics;
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/mat4x4.hpp>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+DISABLE_WARNINGS_POP()
+#include <cstdint>
+#include <span>
+#include <vector>
+
+struct LightClusterSettings {
+    // Clusters along the x and y axis of the screen and along the view direction (depth slices).
+    glm::ivec3 gridSize { 16, 16, 24 };
+    // Bounds the work per fragment; lights beyond this are dropped from the cluster (the first lights are kept).
+    int maxLightsPerCluster { 64 };
+};
+
+struct LightClusterStatistics {
+    size_t numLights { 0 };
+    size_t numLightIndices { 0 };
+    int maxLightsInCluster { 0 }; // Before dropping the lights beyond maxLightsPerCluster.
+    int numFullClusters { 0 }; // Clusters that dropped lights.
+    float buildTimeMs { 0.0f };
+};
+
+// Divides the view frustum into a grid of clusters (screen tiles that are split into exponentially growing depth
+// slices, Olsson et al., "Clustered Deferred and Forward Shading") and lists the lights that reach every cluster, such
+// that a fragment only evaluates the lights of its own cluster. The lists are stored back to back as 16-bit light
+// indices.
+//
+// Lights are assigned per depth slice on all threads: the lights within the depth range of the slice are tested
+// against the bounds of every row of clusters, and the remainder against every cluster of the row, 8 lights at a time
+// with AVX2 (4 with SSE). The cluster bounds are computed only when the projection changes.
+//
+// This class does not use OpenGL; LightBuffer uploads the result.
+class LightClusterGrid {
+public:
+    static constexpr size_t maxLights = 65536; // Light indices are stored as 16 bits.
+
+    LightClusterGrid(const LightClusterSettings& settings = {});
+
+    // Assign the lights to the clusters. Lights are given by their world space sphere of influence (xyz: center,
+    // w: radius); lights beyond maxLights are ignored. The projection must be a perspective projection.
+    void build(const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix, float nearPlane, float farPlane, std::span<const glm::vec4> lightSpheres);
+
+    [[nodiscard]] const glm::ivec3& getGridSize() const;
+    // Per cluster (at index x + gridSize.x * (y + gridSize.y * z)): offset and number of its lights in getLightIndices().
+    [[nodiscard]] std::span<const glm::uvec2> getClusters() const;
+    [[nodiscard]] std::span<const uint16_t> getLightIndices() const;
+    // The depth slice of a point at view depth d (distance along the view direction) is floor(log(d) * x + y).
+    [[nodiscard]] glm::vec2 getDepthSliceScaleBias() const;
+
+    [[nodiscard]] const LightClusterStatistics& getStatistics() const;
+
+private:
+    void updateClusterBounds(const glm::mat4& projectionMatrix, float nearPlane, float farPlane);
+    void buildSlice(int slice);
+
+private:
+    // Bounding spheres in view space (structure of arrays), padded to a multiple of 8 with spheres that intersect nothing.
+    struct SphereSet {
+        std::vector<float> x, y, z, radiusSquared;
+        std::vector<uint16_t> lights;
+
+        void clear();
+        void push(float sphereX, float sphereY, float sphereZ, float sphereRadiusSquared, uint16_t light);
+        void pad();
+        [[nodiscard]] size_t size() const;
+    };
+    // Reused between builds to avoid allocations.
+    struct SliceScratch {
+        SphereSet sliceLights, rowLights;
+        std::vector<uint32_t> hits;
+        std::vector<uint16_t> lightIndices; // Of all clusters of the slice (offsets are relative to the slice).
+        int maxLightsInCluster { 0 };
+        int numFullClusters { 0 };
+    };
+
+    LightClusterSettings m_settings;
+    // The projection that the cluster bounds were computed for.
+    glm::mat4 m_projectionMatrix { 0.0f };
+    float m_nearPlane { 0.0f }, m_farPlane { 0.0f };
+    // View space bounds of the clusters (same indices as m_clusters) and of the rows (index y + gridSize.y * z).
+    std::vector<glm::vec3> m_clusterLower, m_clusterUpper, m_rowLower, m_rowUpper;
+    std::vector<float> m_sliceDepths; // gridSize.z + 1 view depths at which the slices begin and end.
+
+    SphereSet m_viewLights;
+    std::vector<SliceScratch> m_sliceScratch;
+    std::vector<glm::uvec2> m_clusters;
+    std::vector<uint16_t> m_lightIndices;
+    LightClusterStatistics m_statistics;
+};
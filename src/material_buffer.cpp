@@ -0,0 +1,75 @@
+#include "material_buffer.h"
+#include <framework/gl_state.h>
+#include <cassert>
+#include <stdexcept>
+
+GPUMaterial::GPUMaterial(const Material& material) :
+    kd(material.kd),
+    ks(material.ks),
+    shininess(material.shininess),
+    transparency(material.transparency)
+{}
+
+MaterialBuffer::MaterialBuffer()
+{
+    static_assert(sizeof(GPUMaterial) % 16 == 0, "std140 array elements are aligned to 16 bytes");
+    // The whole array is allocated up front because its size is fixed in the shader.
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+    glBufferData(GL_UNIFORM_BUFFER, static_cast<GLsizeiptr>(maxMaterials * sizeof(GPUMaterial)), nullptr, GL_DYNAMIC_DRAW);
+}
+
+MaterialBuffer::~MaterialBuffer()
+{
+    GLStateCache::get().forgetBuffer(m_buffer);
+    glDeleteBuffers(1, &m_buffer);
+}
+
+uint32_t MaterialBuffer::add(const GPUMaterial& material)
+{
+    m_dirty = true;
+    if (!m_freeIndices.empty()) {
+        const uint32_t index = m_freeIndices.back();
+        m_freeIndices.pop_back();
+        m_materials[index] = material;
+        return index;
+    }
+    if (m_materials.size() == maxMaterials)
+        throw std::runtime_error("Material buffer is full");
+    m_materials.push_back(material);
+    return static_cast<uint32_t>(m_materials.size() - 1);
+}
+
+void MaterialBuffer::update(uint32_t index, const GPUMaterial& material)
+{
+    assert(index < m_materials.size());
+    m_materials[index] = material;
+    m_dirty = true;
+}
+
+void MaterialBuffer::remove(uint32_t index)
+{
+    assert(index < m_materials.size());
+    m_freeIndices.push_back(index);
+}
+
+void MaterialBuffer::upload()
+{
+    if (!m_dirty)
+        return;
+    glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, static_cast<GLsizeiptr>(m_materials.size() * sizeof(GPUMaterial)), m_materials.data());
+    m_dirty = false;
+}
+
+void MaterialBuffer::bind(const Shader& shader) const
+{
+    // Variants that do not read the material do not have the block.
+    if (shader.hasUniformBlock("Materials"))
+        shader.bindUniformBlock("Materials", bindingPoint, m_buffer);
+}
+
+size_t MaterialBuffer::getNumMaterials() const
+{
+    return m_materials.size() - m_freeIndices.size();
+}
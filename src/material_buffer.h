@@ -0,0 +1,54 @@
+#pragma once
+#include <framework/disable_all_warnings.h>
+#include <framework/mesh.h>
+#include <framework/opengl_includes.h>
+#include <framework/shader.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <cstdint>
+#include <vector>
+
+// Alignment directives are to comply with std140 alignment requirements (https://www.khronos.org/opengl/wiki/Interface_Block_(GLSL)#Memory_layout)
+struct GPUMaterial {
+    GPUMaterial() = default;
+    GPUMaterial(const Material& material);
+
+    alignas(16) glm::vec3 kd{ 1.0f };
+	alignas(16) glm::vec3 ks{ 0.0f };
+	float shininess{ 1.0f };
+	float transparency{ 1.0f };
+};
+
+// Stores the materials of all meshes in a single std140 array (uniform block "Materials" in shaders/material.glsl).
+// Draws select their material by index (the per-draw or per-instance materialIndex attribute) such that
+// switching materials does not require binding another buffer; the block is bound once per program per frame.
+class MaterialBuffer {
+public:
+    static constexpr size_t maxMaterials = 256; // Must match MAX_MATERIALS in shaders/material.glsl.
+    static constexpr GLuint bindingPoint = 0;
+
+    MaterialBuffer();
+    MaterialBuffer(const MaterialBuffer&) = delete;
+    ~MaterialBuffer();
+
+    MaterialBuffer& operator=(const MaterialBuffer&) = delete;
+
+    // Returns the index of the material. Throws std::runtime_error when all maxMaterials slots are in use.
+    uint32_t add(const GPUMaterial& material);
+    void update(uint32_t index, const GPUMaterial& material);
+    void remove(uint32_t index);
+
+    // Upload the materials if any of them changed since the previous upload (call once per frame).
+    void upload();
+    // Bind the buffer to the "Materials" block of the shader (if it has one).
+    void bind(const Shader& shader) const;
+
+    [[nodiscard]] size_t getNumMaterials() const;
+
+private:
+    GLuint m_buffer;
+    std::vector<GPUMaterial> m_materials;
+    std::vector<uint32_t> m_freeIndices;
+    bool m_dirty { false };
+};
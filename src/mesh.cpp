@@ -1,4 +1,5 @@
 #include "mesh.h"
+#include "texture_registry.h"
 #include <framework/disable_all_warnings.h>
 DISABLE_WARNINGS_PUSH()
 #include <fmt/format.h>
@@ -6,53 +7,28 @@ DISABLE_WARNINGS_POP()
 #include <iostream>
 #include <vector>
 
-GPUMaterial::GPUMaterial(const Material& material) :
-    kd(material.kd),
-    ks(material.ks),
-    shininess(material.shininess),
-    transparency(material.transparency)
-{}
-
-GPUMesh::GPUMesh(const Mesh& cpuMesh)
+GPUMesh::GPUMesh(const Mesh& cpuMesh, GeometryArena& geometryArena, MaterialBuffer& materialBuffer, TextureRegistry& textureRegistry)
 {
-    // Create uniform buffer to store mesh material (https://learnopengl.com/Advanced-OpenGL/Advanced-GLSL)
-    GPUMaterial gpuMaterial(cpuMesh.material);
-    glGenBuffers(1, &m_uboMaterial);
-    glBindBuffer(GL_UNIFORM_BUFFER, m_uboMaterial);
-    glBufferData(GL_UNIFORM_BUFFER, sizeof(GPUMaterial), &gpuMaterial, GL_STATIC_READ);
+    // The material is stored in the shared material buffer (https://learnopengl.com/Advanced-OpenGL/Advanced-GLSL)
+    m_pMaterialBuffer = &materialBuffer;
+    m_materialIndex = materialBuffer.add(GPUMaterial(cpuMesh.material));
 
     // Figure out if this mesh has texture coordinates
     m_hasTextureCoords = static_cast<bool>(cpuMesh.material.kdTexture);
-
-    // Create VAO and bind it so subsequent creations of VBO and IBO are bound to this VAO
-    glGenVertexArrays(1, &m_vao);
-    glBindVertexArray(m_vao);
-
-    // Create vertex buffer object (VBO)
-    glGenBuffers(1, &m_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
-    glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(cpuMesh.vertices.size() * sizeof(decltype(cpuMesh.vertices)::value_type)), cpuMesh.vertices.data(), GL_STATIC_DRAW);
-
-    // Create index buffer object (IBO)
-    glGenBuffers(1, &m_ibo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, static_cast<GLsizeiptr>(cpuMesh.triangles.size() * sizeof(decltype(cpuMesh.triangles)::value_type)), cpuMesh.triangles.data(), GL_STATIC_DRAW);
-
-    // Tell OpenGL that we will be using vertex attributes 0, 1 and 2.
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glEnableVertexAttribArray(2);
-    // We tell OpenGL what each vertex looks like and how they are mapped to the shader (location = ...).
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texCoord));
-    // Reuse all attributes for each instance
-    glVertexAttribDivisor(0, 0);
-    glVertexAttribDivisor(1, 0);
-    glVertexAttribDivisor(2, 0);
-
-    // Each triangle has 3 vertices.
-    m_numIndices = static_cast<GLsizei>(3 * cpuMesh.triangles.size());
+    if (cpuMesh.material.kdTexture)
+        m_kdTexture = textureRegistry.get(*cpuMesh.material.kdTexture);
+
+    // The vertices and indices are stored in the shared buffers of the arena.
+    m_pGeometryArena = &geometryArena;
+    m_geometryRange = geometryArena.allocate(cpuMesh.vertices, cpuMesh.triangles);
+
+    if (!cpuMesh.vertices.empty()) {
+        m_bounds = { cpuMesh.vertices.front().position, cpuMesh.vertices.front().position };
+        for (const Vertex& vertex : cpuMesh.vertices) {
+            m_bounds.lower = glm::min(m_bounds.lower, vertex.position);
+            m_bounds.upper = glm::max(m_bounds.upper, vertex.position);
+        }
+    }
 }
 
 GPUMesh::GPUMesh(GPUMesh&& other)
@@ -71,14 +47,14 @@ GPUMesh& GPUMesh::operator=(GPUMesh&& other)
     return *this;
 }
 
-std::vector<GPUMesh> GPUMesh::loadMeshGPU(std::filesystem::path filePath, bool normalize) {
+std::vector<GPUMesh> GPUMesh::loadMeshGPU(std::filesystem::path filePath, GeometryArena& geometryArena, MaterialBuffer& materialBuffer, TextureRegistry& textureRegistry, bool normalize) {
     if (!std::filesystem::exists(filePath))
         throw MeshLoadingException(fmt::format("File {} does not exist", filePath.string().c_str()));
 
     // Generate GPU-side meshes for all sub-meshes
     std::vector<Mesh> subMeshes = loadMesh(filePath, normalize);
     std::vector<GPUMesh> gpuMeshes;
-    for (const Mesh& mesh : subMeshes) { gpuMeshes.emplace_back(mesh); }
+    for (const Mesh& mesh : subMeshes) { gpuMeshes.emplace_back(mesh, geometryArena, materialBuffer, textureRegistry); }
     
     return gpuMeshes;
 }
@@ -88,43 +64,77 @@ bool GPUMesh::hasTextureCoords() const
     return m_hasTextureCoords;
 }
 
+const std::shared_ptr<Texture>& GPUMesh::getKdTexture() const
+{
+    return m_kdTexture;
+}
+
+const AxisAlignedBox& GPUMesh::getBounds() const
+{
+    return m_bounds;
+}
+
+GeometryArena& GPUMesh::getGeometryArena() const
+{
+    return *m_pGeometryArena;
+}
+
+const GeometryRange& GPUMesh::getGeometryRange() const
+{
+    return m_geometryRange;
+}
+
+MaterialBuffer& GPUMesh::getMaterialBuffer() const
+{
+    return *m_pMaterialBuffer;
+}
+
+uint32_t GPUMesh::getMaterialIndex() const
+{
+    return m_materialIndex;
+}
+
 void GPUMesh::draw(const Shader& drawingShader)
 {
-    // Bind material data uniform (we assume that the uniform buffer objects is always called 'Material')
-    // Yes, we could define the binding inside the shader itself, but that would break on OpenGL versions below 4.2
-    drawingShader.bindUniformBlock("Material", 0, m_uboMaterial);
-    
-    // Draw the mesh's triangles
-    glBindVertexArray(m_vao);
-    glDrawElements(GL_TRIANGLES, m_numIndices, GL_UNSIGNED_INT, nullptr);
+    // The material index is a per-draw attribute.
+    m_pMaterialBuffer->bind(drawingShader);
+    bindVertexArray();
+    m_pGeometryArena->multiDraw({ &m_geometryRange, 1 }, { &m_materialIndex, 1 });
+}
+
+void GPUMesh::drawInstanced(const Shader& drawingShader, const InstanceBuffer& instances, uint32_t firstInstance, uint32_t numInstances) const
+{
+    // The material index is a per-instance attribute.
+    m_pMaterialBuffer->bind(drawingShader);
+    bindVertexArray();
+    m_pGeometryArena->drawInstanced(m_geometryRange, instances, firstInstance, numInstances);
+}
+
+void GPUMesh::bindVertexArray() const
+{
+    m_pGeometryArena->bind();
 }
 
 void GPUMesh::moveInto(GPUMesh&& other)
 {
     freeGpuMemory();
-    m_numIndices = other.m_numIndices;
+    m_pGeometryArena = other.m_pGeometryArena;
+    m_geometryRange = other.m_geometryRange;
+    m_bounds = other.m_bounds;
     m_hasTextureCoords = other.m_hasTextureCoords;
-    m_ibo = other.m_ibo;
-    m_vbo = other.m_vbo;
-    m_vao = other.m_vao;
-    m_uboMaterial = other.m_uboMaterial;
+    m_pMaterialBuffer = other.m_pMaterialBuffer;
+    m_materialIndex = other.m_materialIndex;
+    m_kdTexture = std::move(other.m_kdTexture);
 
-    other.m_numIndices = 0;
+    other.m_pGeometryArena = nullptr;
     other.m_hasTextureCoords = other.m_hasTextureCoords;
-    other.m_ibo = INVALID;
-    other.m_vbo = INVALID;
-    other.m_vao = INVALID;
-    other.m_uboMaterial = INVALID;
+    other.m_pMaterialBuffer = nullptr;
 }
 
 void GPUMesh::freeGpuMemory()
 {
-    if (m_vao != INVALID)
-        glDeleteVertexArrays(1, &m_vao);
-    if (m_vbo != INVALID)
-        glDeleteBuffers(1, &m_vbo);
-    if (m_ibo != INVALID)
-        glDeleteBuffers(1, &m_ibo);
-    if (m_uboMaterial != INVALID)
-        glDeleteBuffers(1, &m_uboMaterial);
+    if (m_pGeometryArena)
+        m_pGeometryArena->free(m_geometryRange);
+    if (m_pMaterialBuffer)
+        m_pMaterialBuffer->remove(m_materialIndex);
 }
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "geometry_arena.h"
+#include "material_buffer.h"
 #include <framework/disable_all_warnings.h>
 #include <framework/mesh.h>
 #include <framework/shader.h>
@@ -10,24 +12,28 @@ DISABLE_WARNINGS_POP()
 #include <exception>
 #include <filesystem>
 #include <framework/opengl_includes.h>
+#include <memory>
+
+class GeometryArena;
+class Texture;
+class TextureRegistry;
 
 struct MeshLoadingException : public std::runtime_error {
     using std::runtime_error::runtime_error;
 };
 
-// Alignment directives are to comply with std140 alignment requirements (https://www.khronos.org/opengl/wiki/Interface_Block_(GLSL)#Memory_layout)
-struct GPUMaterial {
-    GPUMaterial(const Material& material);
-
-    alignas(16) glm::vec3 kd{ 1.0f };
-	alignas(16) glm::vec3 ks{ 0.0f };
-	float shininess{ 1.0f };
-	float transparency{ 1.0f };
+// Object space bounds of a mesh.
+struct AxisAlignedBox {
+    glm::vec3 lower { 0.0f };
+    glm::vec3 upper { 0.0f };
 };
 
+// Handle to the vertices and indices of a mesh in a GeometryArena and its material in a MaterialBuffer (which must both
+// outlive the mesh), and to its diffuse texture.
 class GPUMesh {
 public:
-    GPUMesh(const Mesh& cpuMesh);
+    // The diffuse texture (if any) is shared with all other meshes that use the same image.
+    GPUMesh(const Mesh& cpuMesh, GeometryArena& geometryArena, MaterialBuffer& materialBuffer, TextureRegistry& textureRegistry);
     // Cannot copy a GPU mesh because it would require reference counting of GPU resources.
     GPUMesh(const GPUMesh&) = delete;
     GPUMesh(GPUMesh&&);
@@ -35,28 +41,43 @@ public:
 
     // Generate a number of GPU meshes from a particular model file.
     // Multiple meshes may be generated if there are multiple sub-meshes in the file
-    static std::vector<GPUMesh> loadMeshGPU(std::filesystem::path filePath, bool normalize = false);
+    static std::vector<GPUMesh> loadMeshGPU(std::filesystem::path filePath, GeometryArena& geometryArena, MaterialBuffer& materialBuffer, TextureRegistry& textureRegistry, bool normalize = false);
 
     // Cannot copy a GPU mesh because it would require reference counting of GPU resources.
     GPUMesh& operator=(const GPUMesh&) = delete;
     GPUMesh& operator=(GPUMesh&&);
 
     bool hasTextureCoords() const;
+    // Diffuse texture of the material; nullptr if the mesh does not have one.
+    const std::shared_ptr<Texture>& getKdTexture() const;
+
+    const AxisAlignedBox& getBounds() const;
+    // Meshes in the same arena share their vertex array and can be drawn with GeometryArena::multiDraw().
+    GeometryArena& getGeometryArena() const;
+    const GeometryRange& getGeometryRange() const;
+    MaterialBuffer& getMaterialBuffer() const;
+    // Index of the material in the material buffer (passed to the shader as per-draw or per-instance attribute).
+    uint32_t getMaterialIndex() const;
 
-    // Bind VAO and call glDrawElements.
+    // Bind VAO and draw the mesh with its material index as per-draw attribute (see GeometryArena::multiDraw()).
     void draw(const Shader& drawingShader);
 
+    // Draw instances [firstInstance, firstInstance + numInstances) of the instance buffer, which must have been uploaded.
+    // Requires a shader that reads the per-instance attributes (INSTANCED variant of shaders/shader_vert.glsl).
+    void drawInstanced(const Shader& drawingShader, const InstanceBuffer& instances, uint32_t firstInstance, uint32_t numInstances) const;
+
+    void bindVertexArray() const;
+
 private:
     void moveInto(GPUMesh&&);
     void freeGpuMemory();
 
 private:
-    static constexpr GLuint INVALID = 0xFFFFFFFF;
-
-    GLsizei m_numIndices { 0 };
+    GeometryArena* m_pGeometryArena { nullptr };
+    GeometryRange m_geometryRange;
+    AxisAlignedBox m_bounds;
     bool m_hasTextureCoords { false };
-    GLuint m_ibo { INVALID };
-    GLuint m_vbo { INVALID };
-    GLuint m_vao { INVALID };
-    GLuint m_uboMaterial { INVALID };
+    MaterialBuffer* m_pMaterialBuffer { nullptr };
+    uint32_t m_materialIndex { 0 };
+    std::shared_ptr<Texture> m_kdTexture;
 };
@@ -0,0 +1,274 @@
+#include "occlusion_culler.h"
+#include <framework/cpu_features.h>
+#include <framework/parallel_for.h>
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#ifdef CPU_FEATURES_X86
+#include <immintrin.h>
+#endif
+
+// Bounding box corners closer than this (in clip space w) are treated as intersecting the near plane.
+static constexpr float minW = 1e-6f;
+// Objects are tested against at most maxTestTexels^2 texels of the depth pyramid (a coarser level is chosen until the
+// texel range spans at most maxTestTexels texels per axis).
+static constexpr int maxTestTexels = 4;
+
+OcclusionCuller::OcclusionCuller(const OcclusionCullerSettings& settings)
+    : m_settings(settings)
+{
+    m_settings.resolution.x = (std::max(settings.resolution.x, 1) + 7) / 8 * 8;
+    m_settings.resolution.y = std::max(settings.resolution.y, 1);
+
+    glm::ivec2 size = m_settings.resolution;
+    m_levelSizes.push_back(size);
+    while (size.x > 1 || size.y > 1) {
+        size = glm::max((size + 1) / 2, glm::ivec2(1));
+        m_levelSizes.push_back(size);
+    }
+    m_levels.resize(m_levelSizes.size());
+    for (size_t level = 0; level < m_levels.size(); level++)
+        m_levels[level].resize(size_t(m_levelSizes[level].x) * size_t(m_levelSizes[level].y), 1.0f);
+}
+
+void OcclusionCuller::beginFrame(const glm::mat4& viewProjectionMatrix)
+{
+    m_viewProjectionMatrix = viewProjectionMatrix;
+    m_triangles.clear();
+    m_statistics = {};
+}
+
+void OcclusionCuller::addOccluder(const Mesh& occluder, const glm::mat4& modelMatrix)
+{
+    const glm::mat4 matrix = m_viewProjectionMatrix * modelMatrix;
+    m_clipSpaceVertices.clear();
+    for (const Vertex& vertex : occluder.vertices)
+        m_clipSpaceVertices.push_back(matrix * glm::vec4(vertex.position, 1.0f));
+
+    const glm::vec2 screenScale = 0.5f * glm::vec2(m_settings.resolution);
+    const auto toScreen = [&](const glm::vec4& clip) {
+        const glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        return glm::vec3((glm::vec2(ndc) + 1.0f) * screenScale, 0.5f * ndc.z + 0.5f);
+    };
+
+    // Only the near plane is clipped against; the other planes are handled by clamping to the screen.
+    for (const glm::uvec3& triangle : occluder.triangles) {
+        const std::array<glm::vec4, 3> clip { m_clipSpaceVertices[triangle.x], m_clipSpaceVertices[triangle.y], m_clipSpaceVertices[triangle.z] };
+        // Signed distance to the near plane (z = -w in OpenGL clip space). It has to be linear in clip space for the
+        // intersections to be correct; in front of the near plane w > 0 holds as well.
+        std::array<float, 3> distances;
+        for (size_t i = 0; i < 3; i++)
+            distances[i] = clip[i].z + clip[i].w;
+
+        if (distances[0] >= 0.0f && distances[1] >= 0.0f && distances[2] >= 0.0f) {
+            setupTriangle(toScreen(clip[0]), toScreen(clip[1]), toScreen(clip[2]));
+        } else if (distances[0] >= 0.0f || distances[1] >= 0.0f || distances[2] >= 0.0f) {
+            // Sutherland-Hodgman against the near plane results in a triangle or a quad.
+            std::array<glm::vec3, 4> polygon;
+            size_t numVertices = 0;
+            for (size_t i = 0; i < 3; i++) {
+                const size_t j = (i + 1) % 3;
+                if (distances[i] >= 0.0f)
+                    polygon[numVertices++] = toScreen(clip[i]);
+                if ((distances[i] >= 0.0f) != (distances[j] >= 0.0f)) {
+                    const float t = distances[i] / (distances[i] - distances[j]);
+                    polygon[numVertices++] = toScreen(glm::mix(clip[i], clip[j], t));
+                }
+            }
+            for (size_t i = 2; i < numVertices; i++)
+                setupTriangle(polygon[0], polygon[i - 1], polygon[i]);
+        }
+    }
+}
+
+void OcclusionCuller::setupTriangle(const glm::vec3& v0, const glm::vec3& v1In, const glm::vec3& v2In)
+{
+    // Counter clockwise such that the edge functions are positive inside.
+    float area = (v1In.x - v0.x) * (v2In.y - v0.y) - (v1In.y - v0.y) * (v2In.x - v0.x);
+    if (std::abs(area) < 1e-8f)
+        return;
+    const glm::vec3 v1 = area > 0.0f ? v1In : v2In;
+    const glm::vec3 v2 = area > 0.0f ? v2In : v1In;
+    area = std::abs(area);
+
+    ScreenTriangle triangle;
+    triangle.minX = std::max(0, static_cast<int>(std::floor(std::min({ v0.x, v1.x, v2.x }))));
+    triangle.maxX = std::min(m_settings.resolution.x - 1, static_cast<int>(std::floor(std::max({ v0.x, v1.x, v2.x }))));
+    triangle.minY = std::max(0, static_cast<int>(std::floor(std::min({ v0.y, v1.y, v2.y }))));
+    triangle.maxY = std::min(m_settings.resolution.y - 1, static_cast<int>(std::floor(std::max({ v0.y, v1.y, v2.y }))));
+    if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+        return;
+
+    // Edge i is opposite to vertex i, such that edge i divided by the area is the barycentric coordinate of vertex i.
+    const auto edge = [](const glm::vec3& a, const glm::vec3& b) { return glm::vec3(a.y - b.y, b.x - a.x, a.x * b.y - a.y * b.x); };
+    const glm::vec3 edges[3] = { edge(v1, v2), edge(v2, v0), edge(v0, v1) };
+    triangle.edgeA = { edges[0].x, edges[1].x, edges[2].x };
+    triangle.edgeB = { edges[0].y, edges[1].y, edges[2].y };
+    triangle.edgeC = { edges[0].z, edges[1].z, edges[2].z };
+    const glm::vec3 depths = glm::vec3(v0.z, v1.z, v2.z) / area;
+    triangle.depthA = glm::dot(triangle.edgeA, depths);
+    triangle.depthB = glm::dot(triangle.edgeB, depths);
+    triangle.depthC = glm::dot(triangle.edgeC, depths);
+    m_triangles.push_back(triangle);
+}
+
+void OcclusionCuller::rasterize()
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+    std::fill(std::begin(m_levels[0]), std::end(m_levels[0]), 1.0f);
+    // Every worker owns a block of rows, so no synchronization is needed between them.
+    parallelFor(m_settings.resolution.y, m_settings.rowsPerBlock, [&](int beginRow, int endRow) { rasterizeRows(beginRow, endRow); });
+    buildPyramid();
+    m_statistics.numOccluderTriangles = m_triangles.size();
+    m_statistics.rasterizeTimeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// Depth test (less) and write of the pixels [beginX, endX) of a row. The edge functions and the depth plane have been
+// evaluated for the row already (the C terms include b * y).
+static void rasterizeSpanScalar(const glm::vec3& edgeA, const glm::vec3& edgeRow, float depthA, float depthRow, int beginX, int endX, float* pRow)
+{
+    for (int x = beginX; x < endX; x++) {
+        const float px = float(x) + 0.5f;
+        const glm::vec3 edges = edgeA * px + edgeRow;
+        if (edges.x >= 0.0f && edges.y >= 0.0f && edges.z >= 0.0f)
+            pRow[x] = std::min(pRow[x], depthA * px + depthRow);
+    }
+}
+
+#ifdef CPU_FEATURES_X86
+// beginX must be a multiple of 8 and the row must extend to a multiple of 8 beyond endX.
+CPU_TARGET_AVX2 static void rasterizeSpanAVX2(const glm::vec3& edgeA, const glm::vec3& edgeRow, float depthA, float depthRow, int beginX, int endX, float* pRow)
+{
+    const __m256 laneOffsets = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+    const __m256 a0 = _mm256_set1_ps(edgeA.x), a1 = _mm256_set1_ps(edgeA.y), a2 = _mm256_set1_ps(edgeA.z);
+    const __m256 c0 = _mm256_set1_ps(edgeRow.x), c1 = _mm256_set1_ps(edgeRow.y), c2 = _mm256_set1_ps(edgeRow.z);
+    const __m256 zA = _mm256_set1_ps(depthA), zC = _mm256_set1_ps(depthRow), zero = _mm256_setzero_ps();
+    for (int x = beginX; x < endX; x += 8) {
+        const __m256 px = _mm256_add_ps(_mm256_set1_ps(float(x)), laneOffsets);
+        // Pixels outside of the bounding box are outside of (at least) one of the edges as well.
+        __m256 inside = _mm256_cmp_ps(_mm256_fmadd_ps(a0, px, c0), zero, _CMP_GE_OQ);
+        inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_fmadd_ps(a1, px, c1), zero, _CMP_GE_OQ));
+        inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_fmadd_ps(a2, px, c2), zero, _CMP_GE_OQ));
+        const __m256 depth = _mm256_fmadd_ps(zA, px, zC);
+        const __m256 old = _mm256_loadu_ps(pRow + x);
+        _mm256_storeu_ps(pRow + x, _mm256_blendv_ps(old, _mm256_min_ps(old, depth), inside));
+    }
+}
+#endif
+
+void OcclusionCuller::rasterizeRows(int beginRow, int endRow)
+{
+    const int width = m_settings.resolution.x;
+#ifdef CPU_FEATURES_X86
+    const bool avx2 = getCPUFeatures().avx2;
+#endif
+    for (const ScreenTriangle& triangle : m_triangles) {
+        const int minY = std::max(triangle.minY, beginRow), maxY = std::min(triangle.maxY, endRow - 1);
+        for (int y = minY; y <= maxY; y++) {
+            const float py = float(y) + 0.5f;
+            const glm::vec3 edgeRow = triangle.edgeB * py + triangle.edgeC;
+            const float depthRow = triangle.depthB * py + triangle.depthC;
+            float* pRow = m_levels[0].data() + size_t(y) * size_t(width);
+#ifdef CPU_FEATURES_X86
+            if (avx2) {
+                rasterizeSpanAVX2(triangle.edgeA, edgeRow, triangle.depthA, depthRow, triangle.minX & ~7, triangle.maxX + 1, pRow);
+                continue;
+            }
+#endif
+            rasterizeSpanScalar(triangle.edgeA, edgeRow, triangle.depthA, depthRow, triangle.minX, triangle.maxX + 1, pRow);
+        }
+    }
+}
+
+void OcclusionCuller::buildPyramid()
+{
+    for (size_t level = 1; level < m_levels.size(); level++) {
+        const glm::ivec2 sourceSize = m_levelSizes[level - 1], size = m_levelSizes[level];
+        const std::vector<float>& source = m_levels[level - 1];
+        std::vector<float>& destination = m_levels[level];
+        for (int y = 0; y < size.y; y++) {
+            const int y0 = std::min(2 * y, sourceSize.y - 1), y1 = std::min(2 * y + 1, sourceSize.y - 1);
+            for (int x = 0; x < size.x; x++) {
+                const int x0 = std::min(2 * x, sourceSize.x - 1), x1 = std::min(2 * x + 1, sourceSize.x - 1);
+                destination[size_t(y * size.x + x)] = std::max(
+                    std::max(source[size_t(y0 * sourceSize.x + x0)], source[size_t(y0 * sourceSize.x + x1)]),
+                    std::max(source[size_t(y1 * sourceSize.x + x0)], source[size_t(y1 * sourceSize.x + x1)]));
+            }
+        }
+    }
+}
+
+bool OcclusionCuller::isVisible(const AxisAlignedBox& worldBounds) const
+{
+    glm::vec2 screenMin { std::numeric_limits<float>::max() }, screenMax { std::numeric_limits<float>::lowest() };
+    float minDepth = std::numeric_limits<float>::max();
+    for (int corner = 0; corner < 8; corner++) {
+        const glm::vec3 position { (corner & 1) ? worldBounds.upper.x : worldBounds.lower.x,
+            (corner & 2) ? worldBounds.upper.y : worldBounds.lower.y,
+            (corner & 4) ? worldBounds.upper.z : worldBounds.lower.z };
+        const glm::vec4 clip = m_viewProjectionMatrix * glm::vec4(position, 1.0f);
+        // The box intersects the near plane; it may cover the whole screen.
+        if (clip.w < minW || clip.z < -clip.w)
+            return true;
+        const glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        const glm::vec2 screen = (glm::vec2(ndc) + 1.0f) * 0.5f * glm::vec2(m_settings.resolution);
+        screenMin = glm::min(screenMin, screen);
+        screenMax = glm::max(screenMax, screen);
+        minDepth = std::min(minDepth, 0.5f * ndc.z + 0.5f);
+    }
+
+    const glm::ivec2 resolution = m_settings.resolution;
+    glm::ivec2 minPixel = glm::max(glm::ivec2(glm::floor(screenMin)), glm::ivec2(0));
+    glm::ivec2 maxPixel = glm::min(glm::ivec2(glm::floor(screenMax)), resolution - 1);
+    // Outside of the screen (frustum culling will reject it).
+    if (minPixel.x > maxPixel.x || minPixel.y > maxPixel.y)
+        return true;
+
+    // Pick the finest level at which the rectangle covers only a few texels.
+    int level = 0;
+    while (level + 1 < getNumLevels() && glm::any(glm::greaterThan(maxPixel - minPixel, glm::ivec2(maxTestTexels - 1)))) {
+        minPixel /= 2;
+        maxPixel /= 2;
+        level++;
+    }
+
+    const glm::ivec2 size = m_levelSizes[size_t(level)];
+    const std::vector<float>& depths = m_levels[size_t(level)];
+    for (int y = minPixel.y; y <= maxPixel.y; y++) {
+        for (int x = minPixel.x; x <= maxPixel.x; x++) {
+            if (minDepth <= depths[size_t(y * size.x + x)])
+                return true;
+        }
+    }
+    return false;
+}
+
+void OcclusionCuller::removeOccluded(std::span<const AxisAlignedBox> worldBounds, std::vector<uint32_t>& objects)
+{
+    m_statistics.numTested += objects.size();
+    const size_t numErased = std::erase_if(objects, [&](uint32_t object) { return !isVisible(worldBounds[object]); });
+    m_statistics.numOccluded += numErased;
+}
+
+glm::ivec2 OcclusionCuller::getResolution() const
+{
+    return m_settings.resolution;
+}
+
+std::span<const float> OcclusionCuller::getDepthLevel(int level) const
+{
+    return m_levels[size_t(level)];
+}
+
+int OcclusionCuller::getNumLevels() const
+{
+    return static_cast<int>(m_levels.size());
+}
+
+const OcclusionCullerStatistics& OcclusionCuller::getStatistics() const
+{
+    return m_statistics;
+}
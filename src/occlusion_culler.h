@@ -0,0 +1,82 @@
+#pragma once
+#include "mesh.h"
+#include <framework/disable_all_warnings.h>
+#include <framework/mesh.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/mat4x4.hpp>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <cstdint>
+#include <span>
+#include <vector>
+
+struct OcclusionCullerSettings {
+    // Resolution of the depth buffer; the width is rounded up to a multiple of 8 (one AVX2 register).
+    glm::ivec2 resolution { 256, 128 };
+    // Rows that are rasterized by one worker at a time.
+    int rowsPerBlock { 8 };
+};
+
+struct OcclusionCullerStatistics {
+    size_t numOccluderTriangles { 0 }; // After clipping against the near plane.
+    double rasterizeTimeMs { 0.0 }; // Including building the depth pyramid.
+    size_t numTested { 0 };
+    size_t numOccluded { 0 };
+};
+
+// Software occlusion culling that runs entirely on the CPU (no OpenGL), in the spirit of masked occlusion culling
+// (Hasselgren et al., "Masked Software Occlusion Culling"):
+//  1. Simplified occluder meshes are transformed, clipped and rasterized into a low resolution depth buffer. Rows are
+//     distributed over worker threads and 8 pixels are processed at a time with AVX2 (scalar fallback otherwise).
+//  2. A hierarchical depth pyramid is built in which every texel stores the maximum (furthest) depth of its children.
+//  3. The bounding box of an object is projected to the screen; the object is occluded when its nearest depth lies
+//     behind the furthest occluder depth in a few pyramid texels that cover its screen rectangle.
+//
+// Occluders are sampled at pixel centers, so they should lie inside the real geometry. Depth is window space depth
+// ([0, 1], OpenGL conventions).
+class OcclusionCuller {
+public:
+    OcclusionCuller(const OcclusionCullerSettings& settings = {});
+
+    // Start a new frame: clears the depth buffer and the occluders.
+    void beginFrame(const glm::mat4& viewProjectionMatrix);
+    void addOccluder(const Mesh& occluder, const glm::mat4& modelMatrix);
+    // Rasterize all occluders that were added this frame and build the depth pyramid.
+    void rasterize();
+
+    // Whether any part of the (world space) box may be visible.
+    [[nodiscard]] bool isVisible(const AxisAlignedBox& worldBounds) const;
+    // Remove the objects that are occluded from the list; the list contains indices into worldBounds.
+    void removeOccluded(std::span<const AxisAlignedBox> worldBounds, std::vector<uint32_t>& objects);
+
+    [[nodiscard]] glm::ivec2 getResolution() const;
+    // Depth buffer (level 0) or a level of the depth pyramid, row by row starting at the bottom.
+    [[nodiscard]] std::span<const float> getDepthLevel(int level) const;
+    [[nodiscard]] int getNumLevels() const;
+    [[nodiscard]] const OcclusionCullerStatistics& getStatistics() const;
+
+private:
+    // Triangle in window coordinates with its edge functions E(x, y) = a * x + b * y + c (>= 0 inside) and depth
+    // plane z(x, y) = a * x + b * y + c; the bounds are clamped to the screen.
+    struct ScreenTriangle {
+        glm::vec3 edgeA, edgeB, edgeC;
+        float depthA, depthB, depthC;
+        int minX, maxX, minY, maxY;
+    };
+
+    void setupTriangle(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2);
+    void rasterizeRows(int beginRow, int endRow);
+    void buildPyramid();
+
+private:
+    OcclusionCullerSettings m_settings;
+    glm::mat4 m_viewProjectionMatrix { 1.0f };
+    std::vector<glm::vec4> m_clipSpaceVertices; // Scratch buffer of addOccluder().
+    std::vector<ScreenTriangle> m_triangles;
+
+    std::vector<glm::ivec2> m_levelSizes;
+    std::vector<std::vector<float>> m_levels; // Level 0 is the depth buffer.
+
+    OcclusionCullerStatistics m_statistics;
+};
@@ -0,0 +1,185 @@
+#include "render_queue.h"
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstring>
+#include <unordered_set>
+#include <utility>
+
+static constexpr uint32_t programBits = 12, materialBits = 16, textureBits = 12, depthBits = 20;
+
+RenderQueue::RenderQueue(UniformRingBuffer& frameData)
+    : m_frameData(frameData)
+{
+}
+
+uint32_t RenderQueue::addTransform(const glm::mat4& mvpMatrix, const glm::mat4& modelMatrix, const glm::mat3& normalModelMatrix)
+{
+    m_transforms.emplace_back(mvpMatrix, modelMatrix, normalModelMatrix);
+    return static_cast<uint32_t>(m_transforms.size() - 1);
+}
+
+uint32_t RenderQueue::addTransforms(const glm::mat4& viewProjectionMatrix, std::span<const glm::mat4> modelMatrices, std::span<const uint8_t> rigid)
+{
+    const size_t first = m_transforms.size();
+    m_transforms.resize(first + modelMatrices.size());
+    computeDrawData(viewProjectionMatrix, modelMatrices, rigid, reinterpret_cast<std::byte*>(m_transforms.data() + first), sizeof(DrawData));
+    return static_cast<uint32_t>(first);
+}
+
+void RenderQueue::submit(RenderPass pass, const Shader& shader, const GPUMesh& mesh, const Texture* pTexture, uint32_t transform, float depth)
+{
+    assert(transform < m_transforms.size());
+    const uint32_t program = getId(m_programIds, &shader, (1u << programBits) - 1);
+    // All materials live in one buffer, so the material index identifies the material.
+    const uint32_t material = std::min(mesh.getMaterialIndex(), (1u << materialBits) - 1);
+    const uint32_t texture = pTexture ? getId(m_textureIds, pTexture, (1u << textureBits) - 1) : 0;
+    m_sortEntries.push_back({ makeSortKey(pass, program, material, texture, depth), static_cast<uint32_t>(m_packets.size()) });
+    m_packets.push_back({ &shader, &mesh, pTexture, transform });
+}
+
+uint64_t RenderQueue::makeSortKey(RenderPass pass, uint32_t program, uint32_t material, uint32_t texture, float depth)
+{
+    const uint64_t quantizedDepth = static_cast<uint64_t>(std::clamp(depth, 0.0f, 1.0f) * float((1u << depthBits) - 1));
+    const uint64_t state = (uint64_t(program) << (materialBits + textureBits)) | (uint64_t(material) << textureBits) | uint64_t(texture);
+    const uint64_t key = uint64_t(pass) << 60;
+    if (pass == RenderPass::Transparent) {
+        // Blending requires back-to-front order, which takes precedence over minimizing state changes.
+        const uint64_t invertedDepth = ((1u << depthBits) - 1) - quantizedDepth;
+        return key | (invertedDepth << 40) | state;
+    } else {
+        return key | (state << depthBits) | quantizedDepth;
+    }
+}
+
+uint32_t RenderQueue::getId(std::unordered_map<const void*, uint32_t>& ids, const void* pObject, uint32_t maxId)
+{
+    // Identifiers start at 1 (0 means "no texture"). Objects beyond maxId share an id, which only reduces the grouping.
+    const auto [iter, inserted] = ids.try_emplace(pObject, std::min(static_cast<uint32_t>(ids.size()) + 1, maxId));
+    return iter->second;
+}
+
+template <typename T>
+static void radixSortByKey(std::vector<T>& entries, std::vector<T>& scratch)
+{
+    scratch.resize(entries.size());
+    for (int shift = 0; shift < 64; shift += 8) {
+        std::array<size_t, 256> offsets {};
+        for (const T& entry : entries)
+            offsets[(entry.key >> shift) & 0xFF]++;
+        // All keys have the same digit: this pass would not change the order.
+        if (std::find(std::begin(offsets), std::end(offsets), entries.size()) != std::end(offsets))
+            continue;
+
+        size_t offset = 0;
+        for (size_t& bucket : offsets)
+            offset += std::exchange(bucket, offset);
+        for (const T& entry : entries)
+            scratch[offsets[(entry.key >> shift) & 0xFF]++] = entry;
+        std::swap(entries, scratch);
+    }
+}
+
+void RenderQueue::execute()
+{
+    radixSortByKey(m_sortEntries, m_sortScratch);
+
+    // Split the sorted draws into batches of consecutive draws that do not require any state change in between.
+    m_batches.clear();
+    const Texture* pBatchTexture = nullptr;
+    for (uint32_t i = 0; i < m_sortEntries.size(); i++) {
+        const DrawPacket& packet = m_packets[m_sortEntries[i].packet];
+        bool newBatch = m_batches.empty() || m_batches.back().numDraws == maxDrawsPerBatch || (packet.pTexture && packet.pTexture != pBatchTexture);
+        if (!newBatch) {
+            // The material index is a per-draw attribute, so draws with different materials can share a batch.
+            const DrawPacket& previous = m_packets[m_sortEntries[i - 1].packet];
+            newBatch = packet.pShader != previous.pShader || &packet.pMesh->getGeometryArena() != &previous.pMesh->getGeometryArena();
+        }
+        if (newBatch)
+            m_batches.push_back({ i, 0, 0 });
+        m_batches.back().numDraws++;
+        if (packet.pTexture)
+            pBatchTexture = packet.pTexture;
+    }
+
+    // Copy the transforms of each batch into the frame data as one DrawData array, indexed by the draw index. The
+    // whole array is bound for every batch; the last allocation covers a whole array such that the bound ranges (which
+    // extend into the next batches) never go past it.
+    for (Batch& batch : m_batches) {
+        const size_t sizeInBytes = &batch == &m_batches.back() ? drawDataBlockSize : batch.numDraws * sizeof(DrawData);
+        const UniformRingBuffer::Allocation allocation = m_frameData.allocate(sizeInBytes);
+        for (uint32_t i = 0; i < batch.numDraws; i++) {
+            const DrawPacket& packet = m_packets[m_sortEntries[batch.firstEntry + i].packet];
+            std::memcpy(allocation.pData + i * sizeof(DrawData), &m_transforms[packet.transform], sizeof(DrawData));
+        }
+        batch.drawDataOffset = allocation.offset;
+    }
+    m_frameData.flush();
+
+    m_statistics = {};
+    const Shader* pCurrentShader = nullptr;
+    GeometryArena* pCurrentArena = nullptr;
+    const Texture* pCurrentTexture = nullptr;
+    // Programs whose uniform block bindings and sampler have been set up this frame.
+    std::unordered_set<const Shader*> initializedPrograms;
+    for (const Batch& batch : m_batches) {
+        // All draws of the batch share the state of its first draw.
+        const DrawPacket& packet = m_packets[m_sortEntries[batch.firstEntry].packet];
+        const Shader& shader = *packet.pShader;
+        GeometryArena& arena = packet.pMesh->getGeometryArena();
+
+        if (packet.pShader != pCurrentShader) {
+            shader.bind();
+            pCurrentShader = packet.pShader;
+            m_statistics.programBinds++;
+            // Uniform block bindings and sampler units are part of the program state.
+            if (auto [iter, inserted] = initializedPrograms.insert(packet.pShader); inserted) {
+                shader.setUniform("colorMap", 0);
+                shader.setUniformBlockBinding("DrawData", drawDataBinding);
+                packet.pMesh->getMaterialBuffer().bind(shader);
+            }
+        }
+        if (&arena != pCurrentArena) {
+            arena.bind();
+            pCurrentArena = &arena;
+            m_statistics.vertexArrayBinds++;
+        }
+        if (packet.pTexture && packet.pTexture != pCurrentTexture) {
+            packet.pTexture->bind(GL_TEXTURE0);
+            pCurrentTexture = packet.pTexture;
+            m_statistics.textureBinds++;
+        }
+        m_frameData.bindRange(drawDataBinding, batch.drawDataOffset, drawDataBlockSize);
+        m_statistics.transformBinds++;
+
+        m_batchRanges.clear();
+        m_batchMaterials.clear();
+        for (uint32_t i = 0; i < batch.numDraws; i++) {
+            const GPUMesh& mesh = *m_packets[m_sortEntries[batch.firstEntry + i].packet].pMesh;
+            m_batchRanges.push_back(mesh.getGeometryRange());
+            m_batchMaterials.push_back(mesh.getMaterialIndex());
+        }
+        m_statistics.numDrawCalls += arena.multiDraw(m_batchRanges, m_batchMaterials);
+        m_statistics.numDraws += static_cast<int>(batch.numDraws);
+    }
+
+    // An immediate draw loop binds the program, uploads the transform, binds the material and vertex array (and texture) for every draw.
+    const int numTexturedDraws = static_cast<int>(std::count_if(std::begin(m_packets), std::end(m_packets), [](const DrawPacket& packet) { return packet.pTexture != nullptr; }));
+    const int immediateStateChanges = 4 * m_statistics.numDraws + numTexturedDraws;
+    m_statistics.estimatedSkippedStateChanges = immediateStateChanges - (m_statistics.programBinds + m_statistics.transformBinds + m_statistics.vertexArrayBinds + m_statistics.textureBinds);
+
+    m_packets.clear();
+    m_sortEntries.clear();
+    m_programIds.clear();
+    m_textureIds.clear();
+}
+
+void RenderQueue::endFrame()
+{
+    m_transforms.clear();
+}
+
+const RenderQueue::Statistics& RenderQueue::getStatistics() const
+{
+    return m_statistics;
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include "draw_data.h"
+#include "mesh.h"
+#include "texture.h"
+#include <framework/disable_all_warnings.h>
+#include <framework/shader.h>
+#include <framework/uniform_ring_buffer.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/mat3x3.hpp>
+#include <glm/mat4x4.hpp>
+DISABLE_WARNINGS_POP()
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+enum class RenderPass : uint8_t {
+    Shadow = 0,
+    Opaque = 1,
+    Transparent = 2,
+    DepthPrepass = 3 // Depth only, drawn before the opaque pass (executed separately from it).
+};
+
+// Collects the draws of a frame and executes them ordered by a 64-bit sort key such that draws sharing the same
+// program/material/texture are adjacent, and only the state that differs between consecutive draws is changed. Runs
+// of draws that do not need any state change in between (up to maxDrawsPerBatch) are merged into a single
+// GeometryArena::multiDraw() call; their transforms are written to the frame data as one DrawData array, from which
+// each draw selects its own with its draw index. The material index is a per-draw attribute, so the material field of
+// the sort key only groups draws and never splits a batch.
+//
+// Sort key layout (most significant bits first):
+//   opaque/shadow/depth prepass: pass (4) | program (12) | material (16) | texture (12) | depth (20), front-to-back within a state
+//   transparent:                 pass (4) | inverted depth (20) | program (12) | material (16) | texture (12), back-to-front
+class RenderQueue {
+public:
+    // Binding point of the DrawData uniform block (the materials use MaterialBuffer::bindingPoint).
+    static constexpr GLuint drawDataBinding = 1;
+    // Size of the DrawData array in shaders/draw_data.glsl. A DrawData range is always bound with the size of the whole
+    // array, which has to fit in the minimum GL_MAX_UNIFORM_BLOCK_SIZE (16 KiB).
+    static constexpr uint32_t maxDrawsPerBatch = 64;
+    static constexpr size_t drawDataBlockSize = maxDrawsPerBatch * sizeof(DrawData);
+
+    // Per-draw constants are written to the ring buffer, which must outlive the queue.
+    RenderQueue(UniformRingBuffer& frameData);
+
+    // Per-draw transformation; it is copied into the DrawData array of every batch that draws with it. Transforms are
+    // kept in system memory rather than computed into the frame data: the DrawData array of a batch has to be
+    // contiguous in sorted order (it is indexed by the draw index), which the order of the transforms is not, and the
+    // frame data may be write-combined memory that must not be read back.
+    uint32_t addTransform(const glm::mat4& mvpMatrix, const glm::mat4& modelMatrix, const glm::mat3& normalModelMatrix);
+    // Transformations of many objects at once, computed with computeDrawData(). Returns the first of
+    // modelMatrices.size() consecutive transforms.
+    uint32_t addTransforms(const glm::mat4& viewProjectionMatrix, std::span<const glm::mat4> modelMatrices, std::span<const uint8_t> rigid);
+    // The shader, mesh and texture must stay alive until execute(). The texture (if any) is bound to unit 0 and
+    // assigned to the "colorMap" sampler. Depth is the normalized view distance in [0, 1].
+    void submit(RenderPass pass, const Shader& shader, const GPUMesh& mesh, const Texture* pTexture, uint32_t transform, float depth);
+
+    // Sort and draw everything that was submitted, then clear the queue. Transforms stay valid until endFrame(), so
+    // several passes of a frame (e.g. a depth prepass and the opaque pass) can draw with the same transforms.
+    void execute();
+    // Release the transforms of the frame.
+    void endFrame();
+
+    struct Statistics {
+        int numDraws { 0 };
+        int numDrawCalls { 0 }; // Draws of consecutive meshes that share all state are merged into one multi-draw call.
+        int programBinds { 0 };
+        int textureBinds { 0 };
+        int vertexArrayBinds { 0 };
+        int transformBinds { 0 }; // Binds of a DrawData array in the frame data ring buffer (one per batch).
+        // Estimate (not a measurement) of the binds and uploads saved compared with an immediate draw loop, which is
+        // assumed to perform 4 per draw and 1 more per textured draw. GLStateCache::getStatistics() has the measured
+        // number of calls that were filtered.
+        int estimatedSkippedStateChanges { 0 };
+    };
+    // Statistics of the most recent call to execute().
+    [[nodiscard]] const Statistics& getStatistics() const;
+
+private:
+    [[nodiscard]] static uint64_t makeSortKey(RenderPass pass, uint32_t program, uint32_t material, uint32_t texture, float depth);
+    // Small (per frame) identifiers for the sort key fields.
+    [[nodiscard]] uint32_t getId(std::unordered_map<const void*, uint32_t>& ids, const void* pObject, uint32_t maxId);
+
+private:
+    struct DrawPacket {
+        const Shader* pShader;
+        const GPUMesh* pMesh;
+        const Texture* pTexture;
+        uint32_t transform;
+    };
+    struct SortEntry {
+        uint64_t key;
+        uint32_t packet;
+    };
+    // Sorted draws [firstEntry, firstEntry + numDraws) that are drawn with one multi-draw call.
+    struct Batch {
+        uint32_t firstEntry, numDraws;
+        size_t drawDataOffset; // Offset of the DrawData array in m_frameData.
+    };
+
+    UniformRingBuffer& m_frameData;
+    std::vector<DrawData> m_transforms;
+    std::vector<DrawPacket> m_packets;
+    std::vector<SortEntry> m_sortEntries, m_sortScratch;
+    std::vector<Batch> m_batches;
+    std::vector<GeometryRange> m_batchRanges;
+    std::vector<uint32_t> m_batchMaterials;
+    std::unordered_map<const void*, uint32_t> m_programIds, m_textureIds;
+    Statistics m_statistics;
+};
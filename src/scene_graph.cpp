@@ -0,0 +1,241 @@
+#include "scene_graph.h"
+#include <framework/cpu_features.h>
+#include <framework/parallel_for.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/gtc/quaternion.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#ifdef CPU_FEATURES_X86
+#include <immintrin.h>
+#endif
+
+// Subtrees that have to be updated and are larger than this are split across threads; smaller subtrees are grouped into
+// blocks of up to this many nodes.
+static constexpr uint32_t updateBlockSize = 4096;
+
+glm::mat4 Transform::toMatrix() const
+{
+    const glm::mat3 rotationMatrix = glm::mat3_cast(rotation);
+    return glm::mat4(
+        glm::vec4(rotationMatrix[0] * scale.x, 0.0f),
+        glm::vec4(rotationMatrix[1] * scale.y, 0.0f),
+        glm::vec4(rotationMatrix[2] * scale.z, 0.0f),
+        glm::vec4(translation, 1.0f));
+}
+
+// world = parent * local.toMatrix(), using that the last row of the local matrix is (0, 0, 0, 1).
+static void composeWorldMatrix(const glm::mat4& parent, const Transform& local, glm::mat4& world)
+{
+    const glm::mat3 rotationMatrix = glm::mat3_cast(local.rotation);
+#ifdef CPU_FEATURES_X86
+    // SSE is part of x86-64, so this does not need a feature check. Every column of the result is a linear combination
+    // of the columns of the parent.
+    const __m128 parent0 = _mm_loadu_ps(&parent[0][0]), parent1 = _mm_loadu_ps(&parent[1][0]), parent2 = _mm_loadu_ps(&parent[2][0]);
+    const auto combine = [&](const glm::vec3& weights, __m128 sum) {
+        sum = _mm_add_ps(sum, _mm_mul_ps(parent0, _mm_set1_ps(weights.x)));
+        sum = _mm_add_ps(sum, _mm_mul_ps(parent1, _mm_set1_ps(weights.y)));
+        return _mm_add_ps(sum, _mm_mul_ps(parent2, _mm_set1_ps(weights.z)));
+    };
+    for (int column = 0; column < 3; column++)
+        _mm_storeu_ps(&world[column][0], combine(rotationMatrix[column] * local.scale[column], _mm_setzero_ps()));
+    _mm_storeu_ps(&world[3][0], combine(local.translation, _mm_loadu_ps(&parent[3][0])));
+#else
+    const glm::mat3 parentLinear { parent };
+    for (int column = 0; column < 3; column++)
+        world[column] = glm::vec4(parentLinear * (rotationMatrix[column] * local.scale[column]), parent[column].w * 0.0f);
+    world[3] = parent * glm::vec4(local.translation, 1.0f);
+#endif
+}
+
+SceneGraph::NodeHandle SceneGraph::addNode(const Transform& localTransform, NodeHandle parent)
+{
+    const auto numNodes = static_cast<uint32_t>(m_parents.size());
+    uint32_t parentIndex = invalidNode;
+    uint32_t index = numNodes;
+    if (parent != invalidNode) {
+        assert(parent < m_indices.size());
+        parentIndex = m_indices[parent];
+        // Directly after the last node in the subtree of the parent.
+        index = parentIndex + m_subtreeSizes[parentIndex];
+    }
+
+    const auto handle = static_cast<NodeHandle>(m_indices.size());
+    const auto insert = [index](auto& array, auto value) { array.insert(std::begin(array) + index, value); };
+    insert(m_localTransforms, localTransform);
+    insert(m_parents, parentIndex);
+    insert(m_subtreeSizes, 1u);
+    insert(m_worldMatrices, glm::mat4(1.0f));
+    insert(m_rigid, uint8_t(1));
+    insert(m_dirty, uint8_t(0));
+    insert(m_dirtyDescendants, uint8_t(0));
+    insert(m_updateIds, 0u);
+    insert(m_handles, handle);
+    m_indices.push_back(index);
+
+    // All nodes after the new node moved by one, as did their parents if those come after it as well.
+    for (uint32_t i = index + 1; i <= numNodes; i++) {
+        if (m_parents[i] != invalidNode && m_parents[i] >= index)
+            m_parents[i]++;
+        m_indices[m_handles[i]] = i;
+    }
+    for (uint32_t ancestor = parentIndex; ancestor != invalidNode; ancestor = m_parents[ancestor])
+        m_subtreeSizes[ancestor]++;
+
+    markDirty(index);
+    return handle;
+}
+
+void SceneGraph::setLocalTransform(NodeHandle node, const Transform& localTransform)
+{
+    assert(node < m_indices.size());
+    const uint32_t index = m_indices[node];
+    m_localTransforms[index] = localTransform;
+    markDirty(index);
+}
+
+const Transform& SceneGraph::getLocalTransform(NodeHandle node) const
+{
+    assert(node < m_indices.size());
+    return m_localTransforms[m_indices[node]];
+}
+
+SceneGraph::NodeHandle SceneGraph::getParent(NodeHandle node) const
+{
+    assert(node < m_indices.size());
+    const uint32_t parentIndex = m_parents[m_indices[node]];
+    return parentIndex == invalidNode ? invalidNode : m_handles[parentIndex];
+}
+
+size_t SceneGraph::getNumNodes() const
+{
+    return m_parents.size();
+}
+
+void SceneGraph::markDirty(uint32_t index)
+{
+    m_dirty[index] = 1;
+    // If an ancestor is marked already then so are all ancestors above it.
+    for (uint32_t ancestor = m_parents[index]; ancestor != invalidNode && !m_dirtyDescendants[ancestor]; ancestor = m_parents[ancestor])
+        m_dirtyDescendants[ancestor] = 1;
+}
+
+bool SceneGraph::needsUpdate(uint32_t index) const
+{
+    const uint32_t parent = m_parents[index];
+    return (parent != invalidNode && m_updateIds[parent] == m_updateId) || m_dirty[index] || m_dirtyDescendants[index];
+}
+
+void SceneGraph::updateBlock(UpdateBlock& block)
+{
+    block.updatedNodes.clear();
+    block.numSkippedNodes = 0;
+    for (uint32_t i = block.begin; i < block.end;) {
+        const uint32_t parent = m_parents[i];
+        const bool parentUpdated = parent != invalidNode && m_updateIds[parent] == m_updateId;
+        if (!parentUpdated && !m_dirty[i] && !m_dirtyDescendants[i]) {
+            block.numSkippedNodes += m_subtreeSizes[i];
+            i += m_subtreeSizes[i];
+            continue;
+        }
+
+        if (parentUpdated || m_dirty[i]) {
+            // The parent precedes the node, so its world matrix is up to date.
+            const Transform& localTransform = m_localTransforms[i];
+            const bool rigidLocal = localTransform.scale == glm::vec3(1.0f);
+            if (parent == invalidNode) {
+                m_worldMatrices[i] = localTransform.toMatrix();
+                m_rigid[i] = rigidLocal;
+            } else {
+                composeWorldMatrix(m_worldMatrices[parent], localTransform, m_worldMatrices[i]);
+                m_rigid[i] = rigidLocal && m_rigid[parent];
+            }
+            m_updateIds[i] = m_updateId;
+            block.updatedNodes.push_back(m_handles[i]);
+        }
+        m_dirty[i] = m_dirtyDescendants[i] = 0;
+        i++;
+    }
+}
+
+void SceneGraph::updateWorldMatrices()
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+    m_statistics = {};
+    if (++m_updateId == 0) {
+        // Wrapped around: forget all previous updates (0 is never used).
+        std::fill(std::begin(m_updateIds), std::end(m_updateIds), 0u);
+        m_updateId = 1;
+    }
+
+    // Split the nodes into blocks of whole subtrees, which only depend on nodes before them. Subtrees that have to be
+    // updated and are too large for one block are split: their root is updated right away and their children go into
+    // the following blocks.
+    const auto numNodes = static_cast<uint32_t>(m_parents.size());
+    size_t numBlocks = 0;
+    const auto addBlock = [&](uint32_t begin, uint32_t end) -> UpdateBlock& {
+        if (numBlocks == m_updateBlocks.size())
+            m_updateBlocks.emplace_back();
+        UpdateBlock& block = m_updateBlocks[numBlocks++];
+        block.begin = begin;
+        block.end = end;
+        block.updated = false;
+        return block;
+    };
+    for (uint32_t i = 0; i < numNodes;) {
+        const uint32_t subtreeSize = m_subtreeSizes[i];
+        if (subtreeSize > updateBlockSize && needsUpdate(i)) {
+            UpdateBlock& block = addBlock(i, i + 1);
+            updateBlock(block);
+            block.updated = true;
+            i++;
+            continue;
+        }
+        UpdateBlock* pPrevious = numBlocks > 0 ? &m_updateBlocks[numBlocks - 1] : nullptr;
+        if (pPrevious && !pPrevious->updated && pPrevious->end - pPrevious->begin + subtreeSize <= updateBlockSize)
+            pPrevious->end += subtreeSize;
+        else
+            addBlock(i, i + subtreeSize);
+        i += subtreeSize;
+    }
+
+    parallelFor(int(numBlocks), 1, [&](int begin, int end) {
+        for (int block = begin; block < end; block++) {
+            if (!m_updateBlocks[size_t(block)].updated)
+                updateBlock(m_updateBlocks[size_t(block)]);
+        }
+    });
+
+    // The blocks are in depth first order, and so are the nodes within every block.
+    m_updatedNodes.clear();
+    for (size_t block = 0; block < numBlocks; block++) {
+        const std::vector<NodeHandle>& updatedNodes = m_updateBlocks[block].updatedNodes;
+        m_updatedNodes.insert(std::end(m_updatedNodes), std::begin(updatedNodes), std::end(updatedNodes));
+        m_statistics.numSkippedNodes += m_updateBlocks[block].numSkippedNodes;
+    }
+    m_statistics.numUpdatedNodes = m_updatedNodes.size();
+    m_statistics.updateTimeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+const glm::mat4& SceneGraph::getWorldMatrix(NodeHandle node) const
+{
+    assert(node < m_indices.size());
+    return m_worldMatrices[m_indices[node]];
+}
+
+bool SceneGraph::isRigid(NodeHandle node) const
+{
+    assert(node < m_indices.size());
+    return m_rigid[m_indices[node]];
+}
+
+std::span<const SceneGraph::NodeHandle> SceneGraph::getUpdatedNodes() const
+{
+    return m_updatedNodes;
+}
+
+const SceneGraphStatistics& SceneGraph::getStatistics() const
+{
+    return m_statistics;
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/gtc/quaternion.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
+
+// Local transformation of a node relative to its parent: scale, then rotate, then translate.
+struct Transform {
+    glm::vec3 translation { 0.0f };
+    glm::quat rotation { 1.0f, 0.0f, 0.0f, 0.0f };
+    glm::vec3 scale { 1.0f };
+
+    [[nodiscard]] glm::mat4 toMatrix() const;
+};
+
+struct SceneGraphStatistics {
+    size_t numUpdatedNodes { 0 }; // World matrices recomputed by the most recent update.
+    size_t numSkippedNodes { 0 }; // Nodes in clean subtrees that were skipped over.
+    double updateTimeMs { 0.0 };
+};
+
+// Transformation hierarchy stored as flat arrays in depth first order: the parent of a node always comes before it and
+// every subtree occupies a consecutive range of indices. The world matrices are updated in a single linear pass in
+// which every parent is finished before its children are reached; subtrees without changes are skipped as a whole.
+// Large hierarchies are split into blocks of whole subtrees that are updated on all threads.
+//
+// Nodes are identified by stable handles; their indices change when nodes are inserted before them. Adding nodes in
+// depth first order (children directly after their parent) appends to the arrays, anything else has to move nodes.
+class SceneGraph {
+public:
+    using NodeHandle = uint32_t;
+    static constexpr NodeHandle invalidNode = std::numeric_limits<NodeHandle>::max();
+
+    // Add a node as the last child of the parent, or as a new root if the parent is invalidNode.
+    NodeHandle addNode(const Transform& localTransform, NodeHandle parent = invalidNode);
+    void setLocalTransform(NodeHandle node, const Transform& localTransform);
+    [[nodiscard]] const Transform& getLocalTransform(NodeHandle node) const;
+    [[nodiscard]] NodeHandle getParent(NodeHandle node) const;
+    [[nodiscard]] size_t getNumNodes() const;
+
+    // Recompute the world matrices of all nodes whose local transform (or that of an ancestor) has changed.
+    void updateWorldMatrices();
+    // World matrix as of the most recent update.
+    [[nodiscard]] const glm::mat4& getWorldMatrix(NodeHandle node) const;
+    // Whether the world matrix is a rotation and translation only (no node on the path from the root is scaled), such
+    // that its upper 3x3 part is its own inverse transpose.
+    [[nodiscard]] bool isRigid(NodeHandle node) const;
+    // Nodes whose world matrix changed in the most recent update, in depth first order. Use this to update copies of
+    // the world matrices (or of bounds derived from them) without looking at every node.
+    [[nodiscard]] std::span<const NodeHandle> getUpdatedNodes() const;
+    [[nodiscard]] const SceneGraphStatistics& getStatistics() const;
+
+private:
+    // Consecutive nodes that are updated by one thread: whole subtrees, or the root of a large subtree (which is updated
+    // before its children, which follow in other blocks).
+    struct UpdateBlock {
+        uint32_t begin, end;
+        bool updated; // Updated while splitting the nodes into blocks.
+        std::vector<NodeHandle> updatedNodes;
+        size_t numSkippedNodes;
+    };
+
+    void markDirty(uint32_t index);
+    [[nodiscard]] bool needsUpdate(uint32_t index) const;
+    void updateBlock(UpdateBlock& block);
+
+private:
+    // Indexed by node index (depth first order).
+    std::vector<Transform> m_localTransforms;
+    std::vector<uint32_t> m_parents; // Index of the parent, or invalidNode for roots.
+    std::vector<uint32_t> m_subtreeSizes; // Number of nodes in the subtree, including the node itself.
+    std::vector<glm::mat4> m_worldMatrices;
+    std::vector<uint8_t> m_rigid;
+    std::vector<uint8_t> m_dirty; // The local transform changed since the last update.
+    std::vector<uint8_t> m_dirtyDescendants; // Some node in the subtree (excluding the node itself) is dirty.
+    std::vector<uint32_t> m_updateIds; // The update that last recomputed the world matrix (see m_updateId).
+    std::vector<NodeHandle> m_handles;
+
+    std::vector<uint32_t> m_indices; // Indexed by handle.
+    uint32_t m_updateId { 0 }; // Incremented by every update, such that no flags have to be reset afterwards.
+    std::vector<UpdateBlock> m_updateBlocks; // Reused between updates to avoid allocations.
+    std::vector<NodeHandle> m_updatedNodes;
+    SceneGraphStatistics m_statistics;
+};
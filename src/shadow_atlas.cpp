@@ -0,0 +1,282 @@
+#include "shadow_atlas.h"
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+// Nodes within a level are numbered in Morton (Z) order, such that the children of node i are nodes 4i to 4i+3 of the
+// next level and the parent of node i is node i/4 of the previous level.
+static uint32_t spreadBits(uint32_t value)
+{
+    value &= 0x0000FFFF;
+    value = (value | (value << 8)) & 0x00FF00FF;
+    value = (value | (value << 4)) & 0x0F0F0F0F;
+    value = (value | (value << 2)) & 0x33333333;
+    value = (value | (value << 1)) & 0x55555555;
+    return value;
+}
+
+static uint32_t compactBits(uint32_t value)
+{
+    value &= 0x55555555;
+    value = (value | (value >> 1)) & 0x33333333;
+    value = (value | (value >> 2)) & 0x0F0F0F0F;
+    value = (value | (value >> 4)) & 0x00FF00FF;
+    value = (value | (value >> 8)) & 0x0000FFFF;
+    return value;
+}
+
+QuadtreeAllocator::QuadtreeAllocator(int atlasSize, int minTileSize)
+    : m_atlasSize(atlasSize)
+    , m_numLevels(std::countr_zero(unsigned(atlasSize / minTileSize)) + 1)
+    , m_freeNodes(size_t(m_numLevels))
+{
+    assert(std::has_single_bit(unsigned(atlasSize)) && std::has_single_bit(unsigned(minTileSize)) && minTileSize <= atlasSize);
+    assert(m_numLevels <= 16); // Morton indices of the last level must fit in 32 bits.
+    m_freeNodes[0].insert(0);
+}
+
+std::optional<AtlasTile> QuadtreeAllocator::allocate(int size)
+{
+    const int level = getLevel(size);
+    if (level < 0)
+        return {};
+    const auto optNode = allocateNode(level);
+    if (!optNode)
+        return {};
+
+    const AtlasTile tile = getTile(level, *optNode);
+    m_allocatedArea += int64_t(tile.size) * tile.size;
+    return tile;
+}
+
+void QuadtreeAllocator::free(const AtlasTile& tile)
+{
+    int level = getLevel(tile.size);
+    assert(level >= 0 && getTile(level, 0).size == tile.size);
+    uint32_t node = spreadBits(uint32_t(tile.offset.x / tile.size)) | (spreadBits(uint32_t(tile.offset.y / tile.size)) << 1);
+    m_allocatedArea -= int64_t(tile.size) * tile.size;
+
+    // Merge with the siblings for as long as all of them are free.
+    for (; level > 0; level--, node /= 4) {
+        auto& freeNodes = m_freeNodes[size_t(level)];
+        const uint32_t firstSibling = node & ~3u;
+        bool siblingsFree = true;
+        for (uint32_t sibling = firstSibling; sibling < firstSibling + 4 && siblingsFree; sibling++)
+            siblingsFree = sibling == node || freeNodes.contains(sibling);
+        if (!siblingsFree)
+            break;
+        for (uint32_t sibling = firstSibling; sibling < firstSibling + 4; sibling++)
+            freeNodes.erase(sibling);
+    }
+    [[maybe_unused]] const bool inserted = m_freeNodes[size_t(level)].insert(node).second;
+    assert(inserted); // Tile was freed twice.
+}
+
+int QuadtreeAllocator::getAtlasSize() const
+{
+    return m_atlasSize;
+}
+
+int QuadtreeAllocator::getMinTileSize() const
+{
+    return m_atlasSize >> (m_numLevels - 1);
+}
+
+int QuadtreeAllocator::getLargestFreeTile() const
+{
+    for (int level = 0; level < m_numLevels; level++) {
+        if (!m_freeNodes[size_t(level)].empty())
+            return m_atlasSize >> level;
+    }
+    return 0;
+}
+
+float QuadtreeAllocator::getUsage() const
+{
+    return float(double(m_allocatedArea) / (double(m_atlasSize) * double(m_atlasSize)));
+}
+
+int QuadtreeAllocator::getLevel(int size) const
+{
+    const int tileSize = std::max(int(std::bit_ceil(unsigned(std::max(size, 1)))), getMinTileSize());
+    if (tileSize > m_atlasSize)
+        return -1;
+    return std::countr_zero(unsigned(m_atlasSize / tileSize));
+}
+
+std::optional<uint32_t> QuadtreeAllocator::allocateNode(int level)
+{
+    auto& freeNodes = m_freeNodes[size_t(level)];
+    if (!freeNodes.empty())
+        return freeNodes.extract(freeNodes.begin()).value();
+    if (level == 0)
+        return {};
+
+    // Split a free node of the level above; the first child is returned and the other three become free.
+    const auto optParent = allocateNode(level - 1);
+    if (!optParent)
+        return {};
+    const uint32_t firstChild = *optParent * 4;
+    for (uint32_t child = firstChild + 1; child < firstChild + 4; child++)
+        freeNodes.insert(child);
+    return firstChild;
+}
+
+AtlasTile QuadtreeAllocator::getTile(int level, uint32_t node) const
+{
+    const int size = m_atlasSize >> level;
+    return AtlasTile { .offset = glm::ivec2(compactBits(node), compactBits(node >> 1)) * size, .size = size };
+}
+
+ShadowAtlas::ShadowAtlas(const ShadowAtlasSettings& settings)
+    : m_settings(settings)
+    , m_allocator(settings.atlasSize, settings.minTileSize)
+{
+    assert(settings.maxTileSize >= settings.minTileSize && settings.maxTileSize <= settings.atlasSize);
+}
+
+void ShadowAtlas::update(std::span<const ShadowRequest> requests)
+{
+    m_statistics = {};
+    m_scheduledLights.clear();
+    m_updateIndex++;
+
+    for (const ShadowRequest& request : requests) {
+        LightState& state = m_lights[request.lightId];
+        state.lastRequest = m_updateIndex;
+        state.importance = request.importance;
+        state.dirty |= request.lightChanged || request.castersChanged;
+    }
+
+    // Lights that were not requested (removed or switched off) lose their tile.
+    std::erase_if(m_lights, [&](const auto& idAndState) {
+        const LightState& state = idAndState.second;
+        if (state.lastRequest == m_updateIndex)
+            return false;
+        if (state.tile)
+            m_allocator.free(*state.tile);
+        return true;
+    });
+
+    // Most important lights first; the light id breaks ties such that the order does not depend on the hash map.
+    std::vector<uint32_t> lightsByImportance;
+    lightsByImportance.reserve(m_lights.size());
+    for (const auto& [lightId, state] : m_lights)
+        lightsByImportance.push_back(lightId);
+    std::sort(std::begin(lightsByImportance), std::end(lightsByImportance), [&](uint32_t lhs, uint32_t rhs) {
+        const float lhsImportance = m_lights[lhs].importance, rhsImportance = m_lights[rhs].importance;
+        return lhsImportance > rhsImportance || (lhsImportance == rhsImportance && lhs < rhs);
+    });
+
+    // Release tiles that are too small, or much too large (the factor of two in between avoids resizing back and forth
+    // when the importance of a light hovers around a power of two).
+    std::vector<std::optional<AtlasTile>> previousTiles(lightsByImportance.size());
+    for (size_t i = 0; i < lightsByImportance.size(); i++) {
+        LightState& state = m_lights[lightsByImportance[i]];
+        const int desiredSize = getDesiredTileSize(state.importance);
+        if (state.tile && (desiredSize > state.tile->size || desiredSize < state.tile->size / 2)) {
+            m_allocator.free(*state.tile);
+            previousTiles[i] = state.tile;
+            state.tile.reset();
+        }
+    }
+
+    // Allocate tiles in order of importance. When the atlas is full, lights that are less important than the current
+    // one are evicted (least important first); only when there is nothing left to evict the tile is made smaller.
+    for (size_t i = 0; i < lightsByImportance.size(); i++) {
+        LightState& state = m_lights[lightsByImportance[i]];
+        const int desiredSize = getDesiredTileSize(state.importance);
+        if (state.tile || desiredSize == 0)
+            continue;
+
+        size_t evictionCandidate = lightsByImportance.size();
+        for (int size = desiredSize; size >= m_settings.minTileSize && !state.tile; size /= 2) {
+            state.tile = m_allocator.allocate(size);
+            while (!state.tile && evictionCandidate > i + 1) {
+                LightState& candidate = m_lights[lightsByImportance[--evictionCandidate]];
+                if (!candidate.tile)
+                    continue;
+                m_allocator.free(*candidate.tile);
+                candidate.tile.reset();
+                candidate.contentValid = false;
+                m_statistics.numEvictions++;
+                state.tile = m_allocator.allocate(size);
+            }
+        }
+        if (!state.tile)
+            continue;
+
+        // A light may get its previous tile back when it could not grow.
+        if (state.tile != previousTiles[i]) {
+            state.contentValid = false;
+            m_statistics.numAllocations++;
+        }
+    }
+
+    // Schedule the tiles that need to be rendered: tiles without valid contents first, then by importance. The
+    // importance is scaled by the number of updates that a tile has been waiting, such that the tiles of less
+    // important lights are not postponed forever.
+    std::vector<std::pair<float, uint32_t>> candidates;
+    for (uint32_t lightId : lightsByImportance) {
+        LightState& state = m_lights[lightId];
+        if (!state.tile)
+            continue;
+        m_statistics.numTiles++;
+        if (!state.dirty && state.contentValid)
+            continue;
+        const float priority = state.contentValid ? state.importance * float(1 + state.dirtyFrames) : std::numeric_limits<float>::max();
+        candidates.emplace_back(priority, lightId);
+    }
+    // Stable, such that tiles without valid contents stay in order of importance.
+    std::stable_sort(std::begin(candidates), std::end(candidates), [](const auto& lhs, const auto& rhs) { return lhs.first > rhs.first; });
+
+    const size_t numScheduled = std::min(candidates.size(), size_t(std::max(m_settings.maxUpdatesPerFrame, 0)));
+    for (size_t i = 0; i < candidates.size(); i++) {
+        LightState& state = m_lights[candidates[i].second];
+        if (i < numScheduled) {
+            m_scheduledLights.push_back(candidates[i].second);
+            state.contentValid = true;
+            state.dirty = false;
+            state.dirtyFrames = 0;
+        } else {
+            state.dirtyFrames++;
+        }
+    }
+    m_statistics.numScheduled = int(numScheduled);
+    m_statistics.numPending = int(candidates.size() - numScheduled);
+}
+
+std::span<const uint32_t> ShadowAtlas::getScheduledLights() const
+{
+    return m_scheduledLights;
+}
+
+std::optional<AtlasTile> ShadowAtlas::getTile(uint32_t lightId) const
+{
+    const auto iter = m_lights.find(lightId);
+    if (iter == std::end(m_lights) || !iter->second.contentValid)
+        return {};
+    return iter->second.tile;
+}
+
+const QuadtreeAllocator& ShadowAtlas::getAllocator() const
+{
+    return m_allocator;
+}
+
+const ShadowAtlas::Statistics& ShadowAtlas::getStatistics() const
+{
+    return m_statistics;
+}
+
+int ShadowAtlas::getDesiredTileSize(float importance) const
+{
+    if (!(importance > 0.0f))
+        return 0;
+    // The importance is the fraction of the screen covered by the light, which gets the largest tile when it covers
+    // the whole screen.
+    const float size = std::ceil(std::min(importance, 1.0f) * float(m_settings.maxTileSize));
+    return std::clamp(int(std::bit_ceil(unsigned(size))), m_settings.minTileSize, m_settings.maxTileSize);
+}
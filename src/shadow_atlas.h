@@ -0,0 +1,118 @@
+#pragma once
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec2.hpp>
+DISABLE_WARNINGS_POP()
+#include <cstdint>
+#include <optional>
+#include <set>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+// Square region of the atlas; the size is a power of two and the offset a multiple of the size.
+struct AtlasTile {
+    glm::ivec2 offset;
+    int size;
+
+    bool operator==(const AtlasTile&) const = default;
+};
+
+// Quadtree (two dimensional buddy) allocator of square power of two tiles in a square atlas. A tile is allocated by
+// splitting a free tile of the next larger size into four; when all four children of a tile are free again they are
+// merged back. Free tiles are handed out in Morton order, which keeps the allocated tiles packed together.
+class QuadtreeAllocator {
+public:
+    // The atlas size and the minimum tile size must be powers of two.
+    QuadtreeAllocator(int atlasSize, int minTileSize);
+
+    // The size is rounded up to a power of two of at least the minimum tile size.
+    [[nodiscard]] std::optional<AtlasTile> allocate(int size);
+    void free(const AtlasTile& tile);
+
+    [[nodiscard]] int getAtlasSize() const;
+    [[nodiscard]] int getMinTileSize() const;
+    // Size of the largest tile that can currently be allocated (0 if the atlas is full).
+    [[nodiscard]] int getLargestFreeTile() const;
+    // Fraction of the atlas that is allocated.
+    [[nodiscard]] float getUsage() const;
+
+private:
+    [[nodiscard]] int getLevel(int size) const;
+    [[nodiscard]] std::optional<uint32_t> allocateNode(int level);
+    [[nodiscard]] AtlasTile getTile(int level, uint32_t node) const;
+
+private:
+    int m_atlasSize;
+    int m_numLevels; // Level 0 is the whole atlas, the last level consists of tiles of the minimum size.
+    // Per level: the free nodes (Morton indices within the level).
+    std::vector<std::set<uint32_t>> m_freeNodes;
+    int64_t m_allocatedArea { 0 };
+};
+
+struct ShadowAtlasSettings {
+    int atlasSize { 4096 };
+    int minTileSize { 64 };
+    int maxTileSize { 1024 };
+    // Tiles that are rendered per frame at most; the remaining dirty tiles wait for later frames.
+    int maxUpdatesPerFrame { 4 };
+};
+
+// Shadow map request of a light for the current frame.
+struct ShadowRequest {
+    uint32_t lightId;
+    // Fraction of the screen that the light affects (see Light::getScreenImportance()); 0 means no shadows needed.
+    float importance;
+    bool lightChanged; // The light moved, rotated or changed its range or cone since the previous frame.
+    bool castersChanged; // Any shadow caster within reach of the light moved.
+};
+
+// Assigns tiles of a shared shadow map atlas to lights and decides which tiles to render each frame. Tiles are sized
+// by the importance of the light on screen; when the atlas is full the least important lights lose their tiles. Only
+// tiles whose light or casters changed (or that are new) are re-rendered, and at most maxUpdatesPerFrame of those per
+// frame: tiles without valid contents go first, then the others by importance and waiting time.
+//
+// This class only does the bookkeeping (no OpenGL), rendering the scheduled tiles is left to the caller.
+class ShadowAtlas {
+public:
+    ShadowAtlas(const ShadowAtlasSettings& settings = {});
+
+    // Assign tiles for this frame and schedule the tiles that are rendered this frame. Lights that are not part of
+    // the requests lose their tile. Scheduled tiles are assumed to be rendered before the next update.
+    void update(std::span<const ShadowRequest> requests);
+
+    // Lights whose tile has to be rendered this frame.
+    [[nodiscard]] std::span<const uint32_t> getScheduledLights() const;
+    // Tile of the light if it has one with valid contents (rendered at least once since it was allocated).
+    [[nodiscard]] std::optional<AtlasTile> getTile(uint32_t lightId) const;
+    [[nodiscard]] const QuadtreeAllocator& getAllocator() const;
+
+    struct Statistics {
+        int numTiles { 0 }; // Lights that have a tile.
+        int numAllocations { 0 }; // Tiles allocated (new or resized) by the last update.
+        int numEvictions { 0 }; // Tiles taken away by the last update to make room for more important lights.
+        int numScheduled { 0 };
+        int numPending { 0 }; // Dirty tiles that did not fit in the update budget.
+    };
+    [[nodiscard]] const Statistics& getStatistics() const;
+
+private:
+    [[nodiscard]] int getDesiredTileSize(float importance) const;
+
+private:
+    struct LightState {
+        std::optional<AtlasTile> tile;
+        float importance { 0.0f };
+        bool contentValid { false };
+        bool dirty { true };
+        uint32_t dirtyFrames { 0 }; // Updates for which the tile has been waiting to be rendered.
+        uint64_t lastRequest { 0 }; // Update in which the light was last requested.
+    };
+
+    ShadowAtlasSettings m_settings;
+    QuadtreeAllocator m_allocator;
+    std::unordered_map<uint32_t, LightState> m_lights;
+    std::vector<uint32_t> m_scheduledLights;
+    uint64_t m_updateIndex { 0 };
+    Statistics m_statistics;
+};
@@ -0,0 +1,42 @@
+#pragma once
+#include "shadow_atlas.h"
+#include <framework/opengl_includes.h>
+#include <framework/shader.h>
+
+// Depth texture that holds the shadow maps of all lights (as tiles assigned by ShadowAtlas):
+//
+//   for (uint32_t lightId : atlas.getScheduledLights()) {
+//       atlasTexture.beginTile(*atlas.getTile(lightId));
+//       ... draw the casters of the light ...
+//   }
+//   atlasTexture.endTiles();
+//
+// Shaders read the atlas through the shadowAtlas sampler of shaders/lights.glsl.
+class ShadowAtlasTexture {
+public:
+    static constexpr GLuint textureUnit = 2;
+
+    ShadowAtlasTexture(int size);
+    ShadowAtlasTexture(const ShadowAtlasTexture&) = delete;
+    ~ShadowAtlasTexture();
+
+    ShadowAtlasTexture& operator=(const ShadowAtlasTexture&) = delete;
+
+    // Clear the tile and restrict rendering to it; the rest of the atlas is left untouched.
+    void beginTile(const AtlasTile& tile);
+    // Restore the default framebuffer and the previous viewport.
+    void endTiles();
+
+    // Bind the atlas to the "shadowAtlas" sampler of the shader (if it has one).
+    void bind(const Shader& shader) const;
+
+    [[nodiscard]] int getSize() const;
+
+private:
+    int m_size;
+    GLuint m_texture;
+    GLuint m_framebuffer;
+
+    bool m_inTiles { false };
+    GLint m_previousViewport[4];
+};
@@ -3,19 +3,67 @@
 DISABLE_WARNINGS_PUSH()
 #include <fmt/format.h>
 DISABLE_WARNINGS_POP()
+#include <framework/gl_state.h>
 #include <framework/image.h>
+#include <framework/image_kernels.h>
 
+#include <algorithm>
 #include <iostream>
+#include <utility>
 
 Texture::Texture(std::filesystem::path filePath)
-{
     // Load image from disk to CPU memory.
     // Image class is defined in <framework/image.h>
-    Image cpuTexture { filePath };
+    : Texture(Image { filePath })
+{
+}
+
+int computeNumMipLevels(const glm::ivec2& size)
+{
+    int numLevels = 1;
+    for (int maxSize = std::max(size.x, size.y); maxSize > 1; maxSize /= 2)
+        numLevels++;
+    return numLevels;
+}
+
+Texture::Texture(const Image& image, int numLevels)
+{
+    Image cpuTexture = image;
+    // RGB rows are generally not 4-byte aligned which forces the driver to unpack them one by one; upload as RGBA instead.
+    if (cpuTexture.channels == 3)
+        cpuTexture = convertImageChannels(cpuTexture, 4);
+
+    const glm::ivec2 size { cpuTexture.width, cpuTexture.height };
+    const int fullChainLevels = computeNumMipLevels(size);
+    *this = Texture(size, cpuTexture.channels, numLevels > 0 ? std::min(numLevels, fullChainLevels) : fullChainLevels);
+    setSubImage(0, glm::ivec2(0), size, cpuTexture.get_data());
+
+    // Generate mip-maps
+    glGenerateMipmap(GL_TEXTURE_2D);
+}
+
+Texture::Texture(const glm::ivec2& size, int channels, int numLevels)
+    : m_channels(channels)
+{
+    // Define GPU texture parameters based on number of image channels
+    GLenum internalFormat, format;
+    switch (channels) {
+        case 1:
+            internalFormat = GL_R8;
+            format = GL_RED;
+            break;
+        case 4:
+            internalFormat = GL_RGBA8;
+            format = GL_RGBA;
+            break;
+        default:
+            std::cerr << "Number of channels read for texture is not supported" << std::endl;
+            throw std::exception();
+    }
 
     // Create a texture on the GPU and bind it for parameter setting
     glGenTextures(1, &m_texture);
-    glBindTexture(GL_TEXTURE_2D, m_texture);
+    GLStateCache::get().bindTextureToActiveUnit(GL_TEXTURE_2D, m_texture);
 
     // Set behavior for when texture coordinates are outside the [0, 1] range (wrap around).
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -25,40 +73,68 @@ Texture::Texture(std::filesystem::path filePath)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    // Define GPU texture parameters and upload corresponding data based on number of image channels
-    switch (cpuTexture.channels) {
-        case 1:
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, cpuTexture.width, cpuTexture.height, 0, GL_RED, GL_UNSIGNED_BYTE, cpuTexture.get_data());
-            break;
-        case 3:
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, cpuTexture.width, cpuTexture.height, 0, GL_RGB, GL_UNSIGNED_BYTE, cpuTexture.get_data());
-            break;
-        case 4:
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, cpuTexture.width, cpuTexture.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, cpuTexture.get_data());
-            break;
-        default:
-            std::cerr << "Number of channels read for texture is not supported" << std::endl;
-            throw std::exception();
+    // Immutable storage (OpenGL 4.2+) lets the driver allocate all mip levels up front and skip completeness checks.
+    if (GLAD_GL_VERSION_4_2) {
+        glTexStorage2D(GL_TEXTURE_2D, numLevels, internalFormat, size.x, size.y);
+    } else {
+        for (int level = 0; level < numLevels; level++) {
+            const glm::ivec2 levelSize = glm::max(size >> level, 1);
+            glTexImage2D(GL_TEXTURE_2D, level, static_cast<GLint>(internalFormat), levelSize.x, levelSize.y, 0, format, GL_UNSIGNED_BYTE, nullptr);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
     }
 
-    // Generate mip-maps
-    glGenerateMipmap(GL_TEXTURE_2D);
+    for (int level = 0; level < numLevels; level++) {
+        const glm::ivec2 levelSize = glm::max(size >> level, 1);
+        m_sizeInBytes += size_t(levelSize.x) * size_t(levelSize.y) * size_t(channels);
+    }
 }
 
 Texture::Texture(Texture&& other)
     : m_texture(other.m_texture)
+    , m_channels(other.m_channels)
+    , m_sizeInBytes(other.m_sizeInBytes)
 {
     other.m_texture = INVALID;
 }
 
+Texture& Texture::operator=(Texture&& other)
+{
+    if (m_texture != INVALID) {
+        GLStateCache::get().forgetTexture(m_texture);
+        glDeleteTextures(1, &m_texture);
+    }
+    m_texture = std::exchange(other.m_texture, INVALID);
+    m_channels = other.m_channels;
+    m_sizeInBytes = other.m_sizeInBytes;
+    return *this;
+}
+
 Texture::~Texture()
 {
-    if (m_texture != INVALID)
+    if (m_texture != INVALID) {
+        GLStateCache::get().forgetTexture(m_texture);
         glDeleteTextures(1, &m_texture);
+    }
+}
+
+void Texture::bind(GLint textureSlot) const
+{
+    GLStateCache::get().bindTexture(GLuint(textureSlot - GL_TEXTURE0), GL_TEXTURE_2D, m_texture);
+}
+
+void Texture::setSubImage(int level, const glm::ivec2& offset, const glm::ivec2& size, const void* pPixels)
+{
+    GLStateCache::get().bindTextureToActiveUnit(GL_TEXTURE_2D, m_texture);
+    // Single channel rows are tightly packed (not padded to 4 bytes).
+    if (m_channels == 1)
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, level, offset.x, offset.y, size.x, size.y, m_channels == 1 ? GL_RED : GL_RGBA, GL_UNSIGNED_BYTE, pPixels);
+    if (m_channels == 1)
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 }
 
-void Texture::bind(GLint textureSlot)
+size_t Texture::getSizeInBytes() const
 {
-    glActiveTexture(textureSlot);
-    glBindTexture(GL_TEXTURE_2D, m_texture);
+    return m_sizeInBytes;
 }
@@ -1,29 +1,47 @@
 #pragma once
 #include <framework/disable_all_warnings.h>
 DISABLE_WARNINGS_PUSH()
+#include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
 DISABLE_WARNINGS_POP()
 #include <exception>
 #include <filesystem>
 #include <framework/opengl_includes.h>
 
+struct Image;
+
 struct ImageLoadingException : public std::runtime_error {
     using std::runtime_error::runtime_error;
 };
 
+// Number of levels in a full mip chain (down to 1x1) of an image of the given size.
+[[nodiscard]] int computeNumMipLevels(const glm::ivec2& size);
+
 class Texture {
 public:
     Texture(std::filesystem::path filePath);
+    // Upload the image with a mip chain of at most numLevels levels (0: a full chain).
+    Texture(const Image& image, int numLevels = 0);
+    // Allocate (immutable) storage for a texture with 1 or 4 channels without uploading any contents.
+    Texture(const glm::ivec2& size, int channels, int numLevels);
     Texture(const Texture&) = delete;
     Texture(Texture&&);
     ~Texture();
 
     Texture& operator=(const Texture&) = delete;
-    Texture& operator=(Texture&&) = default;
+    Texture& operator=(Texture&&);
+
+    void bind(GLint textureSlot) const;
+    // Upload a rectangle of one mip level (binds the texture to the active texture unit). If a GL_PIXEL_UNPACK_BUFFER
+    // is bound then pPixels is interpreted as an offset into that buffer. Rows are tightly packed.
+    void setSubImage(int level, const glm::ivec2& offset, const glm::ivec2& size, const void* pPixels);
 
-    void bind(GLint textureSlot);
+    // GPU memory used by the texture (including mip-maps).
+    [[nodiscard]] size_t getSizeInBytes() const;
 
 private:
     static constexpr GLuint INVALID = 0xFFFFFFFF;
     GLuint m_texture { INVALID };
+    int m_channels { 0 };
+    size_t m_sizeInBytes { 0 };
 };
@@ -0,0 +1,210 @@
+#include "texture_atlas.h"
+#include <framework/image_kernels.h>
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+
+SkylinePacker::SkylinePacker(const glm::ivec2& size)
+    : m_size(size)
+    , m_skyline({ Segment { 0, 0, size.x } })
+{
+}
+
+std::optional<int> SkylinePacker::fitAt(size_t segment, const glm::ivec2& rectSize) const
+{
+    const int x = m_skyline[segment].x;
+    if (x + rectSize.x > m_size.x)
+        return {};
+
+    // The rectangle rests on the highest segment that it spans.
+    int y = 0;
+    for (int remaining = rectSize.x; remaining > 0; segment++) {
+        y = std::max(y, m_skyline[segment].y);
+        if (y + rectSize.y > m_size.y)
+            return {};
+        remaining -= m_skyline[segment].width;
+    }
+    return y;
+}
+
+std::optional<glm::ivec2> SkylinePacker::insert(const glm::ivec2& rectSize)
+{
+    // Find the position where the top of the rectangle ends up lowest (ties: leftmost).
+    size_t bestSegment = m_skyline.size();
+    glm::ivec2 bestPosition {};
+    int bestTop = std::numeric_limits<int>::max();
+    for (size_t segment = 0; segment < m_skyline.size(); segment++) {
+        if (const std::optional<int> y = fitAt(segment, rectSize); y && *y + rectSize.y < bestTop) {
+            bestSegment = segment;
+            bestPosition = glm::ivec2(m_skyline[segment].x, *y);
+            bestTop = *y + rectSize.y;
+        }
+    }
+    if (bestSegment == m_skyline.size())
+        return {};
+
+    // Raise the skyline under the rectangle: insert the new segment and shrink/remove the ones it covers.
+    m_skyline.insert(m_skyline.begin() + std::ptrdiff_t(bestSegment), Segment { bestPosition.x, bestTop, rectSize.x });
+    const int right = bestPosition.x + rectSize.x;
+    for (size_t i = bestSegment + 1; i < m_skyline.size();) {
+        Segment& next = m_skyline[i];
+        if (next.x >= right)
+            break;
+        const int overlap = right - next.x;
+        if (overlap >= next.width) {
+            m_skyline.erase(m_skyline.begin() + std::ptrdiff_t(i));
+        } else {
+            next.x += overlap;
+            next.width -= overlap;
+            break;
+        }
+    }
+    // Merge neighbouring segments at the same height.
+    for (size_t i = 0; i + 1 < m_skyline.size();) {
+        if (m_skyline[i].y == m_skyline[i + 1].y) {
+            m_skyline[i].width += m_skyline[i + 1].width;
+            m_skyline.erase(m_skyline.begin() + std::ptrdiff_t(i + 1));
+        } else {
+            i++;
+        }
+    }
+
+    m_usedArea += int64_t(rectSize.x) * int64_t(rectSize.y);
+    return bestPosition;
+}
+
+glm::ivec2 SkylinePacker::getSize() const
+{
+    return m_size;
+}
+
+float SkylinePacker::getOccupancy() const
+{
+    return float(double(m_usedArea) / (double(m_size.x) * double(m_size.y)));
+}
+
+static int alignUp(int value, int alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static bool hasTilingTexCoords(const Mesh& mesh)
+{
+    // Texture coordinates outside of [0, 1] rely on GL_REPEAT which cannot be emulated inside an atlas.
+    constexpr float epsilon = 1e-4f;
+    return std::any_of(std::begin(mesh.vertices), std::end(mesh.vertices), [](const Vertex& vertex) {
+        return glm::any(glm::lessThan(vertex.texCoord, glm::vec2(-epsilon))) || glm::any(glm::greaterThan(vertex.texCoord, glm::vec2(1.0f + epsilon)));
+    });
+}
+
+// Copy the image into the page and replicate its edge pixels into the surrounding gutter: gutter pixels to the left
+// and top, and up to the end of the (aligned) padded rectangle to the right and bottom.
+static void blitWithGutter(const Image& image, Image& page, const glm::ivec2& position, int gutter, const glm::ivec2& paddedSize)
+{
+    assert(image.channels == 4 && page.channels == 4);
+    const uint8_t* pSrc = image.get_data();
+    uint8_t* pDst = page.get_data();
+    const int right = paddedSize.x - gutter - image.width;
+    for (int y = -gutter; y < paddedSize.y - gutter; y++) {
+        const int srcY = std::clamp(y, 0, image.height - 1);
+        uint8_t* pDstRow = pDst + 4 * (size_t(position.y + y) * size_t(page.width) + size_t(position.x));
+        const uint8_t* pSrcRow = pSrc + 4 * size_t(srcY) * size_t(image.width);
+        std::memcpy(pDstRow, pSrcRow, 4 * size_t(image.width));
+        for (int x = 1; x <= gutter; x++)
+            std::memcpy(pDstRow - 4 * x, pSrcRow, 4);
+        for (int x = 0; x < right; x++)
+            std::memcpy(pDstRow + 4 * (image.width + x), pSrcRow + 4 * (image.width - 1), 4);
+    }
+}
+
+TextureAtlas buildTextureAtlas(std::span<Mesh> meshes, const TextureAtlasSettings& settings)
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+    assert(settings.numMipLevels >= 1);
+    // One texel of gutter, at the same alignment, in the coarsest mip level that must be free of bleeding.
+    const int gutter = 1 << (settings.numMipLevels - 1);
+    const int alignment = gutter;
+
+    // Gather the distinct textures that can be packed; a texture used with tiling coordinates anywhere stays separate.
+    const glm::ivec2 maxImageSize = settings.pageSize - 2 * gutter;
+    std::unordered_set<const Image*> excluded;
+    for (const Mesh& mesh : meshes) {
+        const Image* pImage = mesh.material.kdTexture.get();
+        if (pImage && (hasTilingTexCoords(mesh) || pImage->width > maxImageSize.x || pImage->height > maxImageSize.y))
+            excluded.insert(pImage);
+    }
+    std::vector<std::shared_ptr<Image>> images;
+    for (const Mesh& mesh : meshes) {
+        const auto& pImage = mesh.material.kdTexture;
+        if (pImage && !excluded.contains(pImage.get()) && std::find(std::begin(images), std::end(images), pImage) == std::end(images))
+            images.push_back(pImage);
+    }
+
+    // Packing tall rectangles first leaves a flatter skyline and thus less wasted space.
+    std::sort(std::begin(images), std::end(images), [](const auto& lhs, const auto& rhs) {
+        return std::tie(lhs->height, lhs->width) > std::tie(rhs->height, rhs->width);
+    });
+
+    struct Placement {
+        size_t page;
+        glm::ivec2 position; // Of the image itself (excluding gutter).
+    };
+    TextureAtlas atlas;
+    atlas.numMipLevels = settings.numMipLevels;
+    std::vector<SkylinePacker> packers;
+    std::unordered_map<const Image*, Placement> placements;
+    int64_t packedArea = 0;
+    for (const auto& pImage : images) {
+        const glm::ivec2 paddedSize { alignUp(pImage->width + 2 * gutter, alignment), alignUp(pImage->height + 2 * gutter, alignment) };
+        std::optional<Placement> placement;
+        for (size_t page = 0; page < packers.size() && !placement; page++) {
+            if (const auto position = packers[page].insert(paddedSize))
+                placement = Placement { page, *position + gutter };
+        }
+        if (!placement) {
+            packers.emplace_back(settings.pageSize);
+            atlas.pages.push_back(std::make_shared<Image>(settings.pageSize.x, settings.pageSize.y, 4));
+            const auto position = packers.back().insert(paddedSize);
+            assert(position);
+            placement = Placement { packers.size() - 1, *position + gutter };
+        }
+
+        const Image rgba = convertImageChannels(*pImage, 4);
+        blitWithGutter(rgba, *atlas.pages[placement->page], placement->position, gutter, paddedSize);
+        placements[pImage.get()] = *placement;
+        packedArea += int64_t(pImage->width) * int64_t(pImage->height);
+    }
+
+    // Point the materials to their page and move the texture coordinates into the packed rectangle.
+    const glm::vec2 pageSize { settings.pageSize };
+    for (Mesh& mesh : meshes) {
+        const auto iter = mesh.material.kdTexture ? placements.find(mesh.material.kdTexture.get()) : std::end(placements);
+        if (iter == std::end(placements)) {
+            atlas.statistics.numSkippedMeshes += mesh.material.kdTexture ? 1 : 0;
+            continue;
+        }
+        const auto& [page, position] = iter->second;
+        const glm::vec2 imageSize { mesh.material.kdTexture->width, mesh.material.kdTexture->height };
+        for (Vertex& vertex : mesh.vertices)
+            vertex.texCoord = (glm::vec2(position) + glm::clamp(vertex.texCoord, 0.0f, 1.0f) * imageSize) / pageSize;
+        mesh.material.kdTexture = atlas.pages[page];
+    }
+
+    auto& statistics = atlas.statistics;
+    statistics.numImages = static_cast<int>(images.size());
+    statistics.numPages = static_cast<int>(atlas.pages.size());
+    if (!atlas.pages.empty())
+        statistics.efficiency = float(double(packedArea) / (double(pageSize.x) * double(pageSize.y) * double(atlas.pages.size())));
+    statistics.buildTimeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+    std::cout << "Texture atlas: packed " << statistics.numImages << " textures into " << statistics.numPages << " page(s) of "
+              << settings.pageSize.x << "x" << settings.pageSize.y << " (" << statistics.efficiency * 100.0f << "% efficiency, "
+              << statistics.numSkippedMeshes << " mesh(es) skipped) in " << statistics.buildTimeMs << "ms" << std::endl;
+    return atlas;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <framework/disable_all_warnings.h>
+#include <framework/image.h>
+#include <framework/mesh.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec2.hpp>
+DISABLE_WARNINGS_POP()
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+// Packs rectangles into a fixed size area using the skyline bottom-left heuristic
+// (see "A Thousand Ways to Pack the Bin", Jukka Jylänki).
+class SkylinePacker {
+public:
+    SkylinePacker(const glm::ivec2& size);
+
+    // Returns the position of the top-left corner of the rectangle, or nothing if it does not fit.
+    std::optional<glm::ivec2> insert(const glm::ivec2& rectSize);
+
+    [[nodiscard]] glm::ivec2 getSize() const;
+    [[nodiscard]] float getOccupancy() const; // Fraction of the area covered by inserted rectangles.
+
+private:
+    // Lowest position at which a rectangle of the given width can be placed starting at the given segment.
+    std::optional<int> fitAt(size_t segment, const glm::ivec2& rectSize) const;
+
+private:
+    struct Segment {
+        int x, y, width;
+    };
+    glm::ivec2 m_size;
+    std::vector<Segment> m_skyline;
+    int64_t m_usedArea { 0 };
+};
+
+struct TextureAtlasSettings {
+    glm::ivec2 pageSize { 2048, 2048 };
+    // Mip levels of the pages in which (bi)linear filtering never picks up a neighbouring texture. A texel of mip level
+    // i covers 2^i pixels, so images start at multiples of 2^(numMipLevels - 1) pixels and have a gutter of that many
+    // replicated edge pixels; the textures of the pages must not have more levels than this.
+    int numMipLevels { 5 };
+};
+
+struct TextureAtlasStatistics {
+    int numImages { 0 }; // Number of distinct textures that were packed.
+    int numPages { 0 };
+    int numSkippedMeshes { 0 }; // Meshes that keep their own texture (tiling texture coordinates or oversized textures).
+    float efficiency { 0.0f }; // Texel area of the packed textures divided by the total page area.
+    double buildTimeMs { 0.0 };
+};
+
+struct TextureAtlas {
+    std::vector<std::shared_ptr<Image>> pages; // RGBA pages.
+    int numMipLevels { 1 }; // Maximum number of mip levels of the textures of the pages.
+    TextureAtlasStatistics statistics;
+};
+
+// Pack the diffuse textures of the meshes into a few shared RGBA pages. The materials of all packed meshes are
+// updated to point to their page and their texture coordinates are rewritten into page space, such that meshes
+// sharing a page can be drawn with the same texture binding. Packing statistics are printed to std::cout.
+TextureAtlas buildTextureAtlas(std::span<Mesh> meshes, const TextureAtlasSettings& settings = {});
@@ -0,0 +1,79 @@
+#include "texture_registry.h"
+#include <framework/disable_all_warnings.h>
+#include <framework/hash.h>
+DISABLE_WARNINGS_PUSH()
+#include <fmt/format.h>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <array>
+
+uint64_t hashImage(const Image& image)
+{
+    const std::array<int, 3> dimensions { image.width, image.height, image.channels };
+    const uint64_t hash = fnv1aWords(std::as_bytes(std::span(dimensions)));
+    const size_t sizeInBytes = size_t(image.width) * size_t(image.height) * size_t(image.channels);
+    return fnv1aWords(std::as_bytes(std::span(image.get_data(), sizeInBytes)), hash);
+}
+
+std::shared_ptr<Texture> TextureRegistry::findOrCreate(const std::string& key, auto&& createTexture)
+{
+    auto iter = m_textures.find(key);
+    if (iter != std::end(m_textures)) {
+        if (auto pTexture = iter->second.lock())
+            return pTexture;
+    }
+
+    std::shared_ptr<Texture> pTexture = createTexture();
+    m_textures[key] = pTexture;
+    return pTexture;
+}
+
+std::shared_ptr<Texture> TextureRegistry::load(const std::filesystem::path& filePath)
+{
+    // Different paths may refer to the same file (relative paths, "..", symbolic links).
+    const std::filesystem::path canonicalPath = std::filesystem::weakly_canonical(filePath);
+    return findOrCreate(canonicalPath.string(), [&]() { return std::make_shared<Texture>(canonicalPath); });
+}
+
+std::shared_ptr<Texture> TextureRegistry::loadAsync(const std::filesystem::path& filePath, TextureUploader& uploader)
+{
+    const std::filesystem::path canonicalPath = std::filesystem::weakly_canonical(filePath);
+    return findOrCreate(canonicalPath.string(), [&]() { return uploader.loadAsync(canonicalPath); });
+}
+
+std::shared_ptr<Texture> TextureRegistry::get(const Image& image, int numLevels)
+{
+    return findOrCreate(fmt::format("image:{:016x}", hashImage(image)), [&]() { return std::make_shared<Texture>(image, numLevels); });
+}
+
+std::vector<TextureRegistry::TextureInfo> TextureRegistry::getTextures() const
+{
+    std::vector<TextureInfo> out;
+    for (const auto& [key, pWeakTexture] : m_textures) {
+        // Query the size on every call: textures that are streamed in grow once they have finished loading.
+        if (const auto pTexture = pWeakTexture.lock())
+            out.push_back({ key, pTexture->getSizeInBytes(), pTexture.use_count() - 1 });
+    }
+    std::sort(std::begin(out), std::end(out), [](const TextureInfo& lhs, const TextureInfo& rhs) { return lhs.sizeInBytes > rhs.sizeInBytes; });
+    return out;
+}
+
+size_t TextureRegistry::getNumTextures() const
+{
+    return size_t(std::count_if(std::begin(m_textures), std::end(m_textures), [](const auto& keyValue) { return !keyValue.second.expired(); }));
+}
+
+size_t TextureRegistry::getTotalSizeInBytes() const
+{
+    size_t out = 0;
+    for (const auto& [key, pWeakTexture] : m_textures) {
+        if (const auto pTexture = pWeakTexture.lock())
+            out += pTexture->getSizeInBytes();
+    }
+    return out;
+}
+
+void TextureRegistry::collectGarbage()
+{
+    std::erase_if(m_textures, [](const auto& keyValue) { return keyValue.second.expired(); });
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include "texture.h"
+#include "texture_uploader.h"
+#include <framework/image.h>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Keeps track of all textures on the GPU such that every distinct image is uploaded exactly once. Textures are
+// identified either by their (canonical) file path or by a hash of their contents, and are shared between users
+// through reference counting: the GPU memory is released as soon as the last std::shared_ptr goes out of scope.
+class TextureRegistry {
+public:
+    TextureRegistry() = default;
+    TextureRegistry(const TextureRegistry&) = delete;
+
+    TextureRegistry& operator=(const TextureRegistry&) = delete;
+
+    // Load a texture from disk, or return the existing texture if this file was loaded before.
+    std::shared_ptr<Texture> load(const std::filesystem::path& filePath);
+    // Same as load() but streams the texture in through the uploader (see TextureUploader::loadAsync()).
+    std::shared_ptr<Texture> loadAsync(const std::filesystem::path& filePath, TextureUploader& uploader);
+    // Return the texture containing exactly this image, uploading it if no such texture exists yet. The number of mip
+    // levels (0: a full chain) only applies when the texture is created.
+    std::shared_ptr<Texture> get(const Image& image, int numLevels = 0);
+
+    struct TextureInfo {
+        std::string name; // File path or content hash.
+        size_t sizeInBytes;
+        long useCount; // Number of std::shared_ptr's (outside of the registry) referring to this texture.
+    };
+    // Information about all textures that are currently alive.
+    [[nodiscard]] std::vector<TextureInfo> getTextures() const;
+    [[nodiscard]] size_t getNumTextures() const;
+    // Total GPU memory of all textures that are currently alive.
+    [[nodiscard]] size_t getTotalSizeInBytes() const;
+
+    // Remove the bookkeeping of textures that have been freed.
+    void collectGarbage();
+
+private:
+    std::shared_ptr<Texture> findOrCreate(const std::string& key, auto&& createTexture);
+
+private:
+    std::unordered_map<std::string, std::weak_ptr<Texture>> m_textures;
+};
+
+[[nodiscard]] uint64_t hashImage(const Image& image);
@@ -0,0 +1,220 @@
+#include "texture_uploader.h"
+#include <framework/image_kernels.h>
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstring>
+#include <exception>
+#include <iostream>
+
+TextureUploader::TextureUploader(const TextureUploaderSettings& settings)
+    : m_settings(settings)
+{
+    // The staging buffers are allocated once and reused for every upload; they are kept mapped while the loader thread may write to them.
+    m_stagingBuffers.resize(size_t(settings.numStagingBuffers));
+    for (size_t i = 0; i < m_stagingBuffers.size(); i++) {
+        StagingBuffer& buffer = m_stagingBuffers[i];
+        glGenBuffers(1, &buffer.pbo);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.pbo);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, static_cast<GLsizeiptr>(settings.stagingBufferSize), nullptr, GL_STREAM_DRAW);
+        buffer.pMapped = static_cast<uint8_t*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, static_cast<GLsizeiptr>(settings.stagingBufferSize), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+        m_mappedBuffers.push_back(i);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    m_loaderThread = std::thread(&TextureUploader::loaderLoop, this);
+}
+
+TextureUploader::~TextureUploader()
+{
+    {
+        std::scoped_lock lock { m_mutex };
+        m_stop = true;
+    }
+    m_condition.notify_all();
+    m_loaderThread.join();
+
+    for (StagingBuffer& buffer : m_stagingBuffers) {
+        if (buffer.pMapped) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.pbo);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+        if (buffer.fence)
+            glDeleteSync(buffer.fence);
+        glDeleteBuffers(1, &buffer.pbo);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+std::shared_ptr<Texture> TextureUploader::loadAsync(const std::filesystem::path& filePath)
+{
+    Image placeholder { 1, 1, 4 };
+    // Mid grey, opaque.
+    const std::array<uint8_t, 4> grey { 127, 127, 127, 255 };
+    std::copy(std::begin(grey), std::end(grey), placeholder.get_data());
+
+    auto pJob = std::make_shared<Job>();
+    pJob->filePath = filePath;
+    pJob->pTexture = std::make_shared<Texture>(placeholder);
+    {
+        std::scoped_lock lock { m_mutex };
+        m_loadRequests.push_back(pJob);
+        m_numPendingTextures++;
+    }
+    m_condition.notify_all();
+    return pJob->pTexture;
+}
+
+void TextureUploader::update()
+{
+    m_bytesUploadedLastFrame = 0;
+
+    // Staging buffers whose copies have completed can be mapped and handed back to the loader thread.
+    std::vector<size_t> recycledBuffers;
+    while (!m_inFlightBuffers.empty()) {
+        StagingBuffer& buffer = m_stagingBuffers[m_inFlightBuffers.front()];
+        if (glClientWaitSync(buffer.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+            break;
+        glDeleteSync(buffer.fence);
+        buffer.fence = nullptr;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.pbo);
+        buffer.pMapped = static_cast<uint8_t*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, static_cast<GLsizeiptr>(m_settings.stagingBufferSize), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+        recycledBuffers.push_back(m_inFlightBuffers.front());
+        m_inFlightBuffers.pop_front();
+    }
+
+    // Take as many filled chunks as the budget allows (but always at least one so that large textures make progress).
+    std::vector<Chunk> chunks;
+    {
+        std::scoped_lock lock { m_mutex };
+        m_mappedBuffers.insert(std::end(m_mappedBuffers), std::begin(recycledBuffers), std::end(recycledBuffers));
+        while (!m_filledChunks.empty()) {
+            const Chunk& chunk = m_filledChunks.front();
+            const size_t sizeInBytes = size_t(chunk.size.x) * size_t(chunk.size.y) * size_t(chunk.pJob->channels);
+            if (m_bytesUploadedLastFrame > 0 && m_bytesUploadedLastFrame + sizeInBytes > m_settings.maxBytesPerFrame)
+                break;
+            m_bytesUploadedLastFrame += sizeInBytes;
+            chunks.push_back(std::move(m_filledChunks.front()));
+            m_filledChunks.pop_front();
+        }
+    }
+    if (!recycledBuffers.empty())
+        m_condition.notify_all();
+
+    // Issue the copies from the staging buffers into the textures.
+    size_t numFinishedTextures = 0;
+    for (Chunk& chunk : chunks) {
+        StagingBuffer& buffer = m_stagingBuffers[chunk.stagingBuffer];
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.pbo);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        buffer.pMapped = nullptr;
+
+        Job& job = *chunk.pJob;
+        if (!job.pStorage)
+            job.pStorage = std::make_unique<Texture>(job.size, job.channels, job.numLevels);
+        job.pStorage->setSubImage(chunk.level, glm::ivec2(0, chunk.firstRow), chunk.size, nullptr);
+        buffer.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        m_inFlightBuffers.push_back(chunk.stagingBuffer);
+
+        // Swap the finished texture into the object that the user holds (this deletes the placeholder).
+        if (++job.numChunksUploaded == job.numChunks) {
+            *job.pTexture = std::move(*job.pStorage);
+            job.pStorage.reset();
+            numFinishedTextures++;
+        }
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if (numFinishedTextures > 0) {
+        std::scoped_lock lock { m_mutex };
+        m_numPendingTextures -= numFinishedTextures;
+    }
+}
+
+size_t TextureUploader::getNumPendingTextures() const
+{
+    std::scoped_lock lock { m_mutex };
+    return m_numPendingTextures;
+}
+
+size_t TextureUploader::getBytesUploadedLastFrame() const
+{
+    return m_bytesUploadedLastFrame;
+}
+
+void TextureUploader::loaderLoop()
+{
+    while (true) {
+        std::shared_ptr<Job> pJob;
+        {
+            std::unique_lock lock { m_mutex };
+            m_condition.wait(lock, [&]() { return m_stop || !m_loadRequests.empty(); });
+            if (m_stop)
+                return;
+            pJob = std::move(m_loadRequests.front());
+            m_loadRequests.pop_front();
+        }
+
+        std::vector<Image> mipChain;
+        try {
+            Image image { pJob->filePath };
+            // RGB rows are generally not 4-byte aligned which forces the driver to unpack them one by one; upload as RGBA instead.
+            if (image.channels == 3)
+                image = convertImageChannels(image, 4);
+            if (image.channels != 1 && image.channels != 4)
+                throw ImageLoadingException("Number of channels read for texture is not supported");
+
+            // Build the mip chain on the CPU such that the GL thread does not have to call glGenerateMipmap.
+            mipChain.push_back(std::move(image));
+            while (mipChain.back().width > 1 || mipChain.back().height > 1) {
+                const glm::ivec2 size { mipChain.back().width, mipChain.back().height };
+                mipChain.push_back(resizeImage(mipChain.back(), glm::max(size / 2, 1), ResizeFilter::Box));
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Failed to load texture " << pJob->filePath << ": " << e.what() << std::endl;
+            std::scoped_lock lock { m_mutex };
+            m_numPendingTextures--;
+            continue;
+        }
+
+        stageImage(pJob, mipChain);
+    }
+}
+
+void TextureUploader::stageImage(const std::shared_ptr<Job>& pJob, const std::vector<Image>& mipChain)
+{
+    const Image& baseLevel = mipChain.front();
+    pJob->size = glm::ivec2(baseLevel.width, baseLevel.height);
+    pJob->channels = baseLevel.channels;
+    pJob->numLevels = static_cast<int>(mipChain.size());
+
+    // Split each level into chunks of rows that fit in a single staging buffer.
+    const size_t rowSize = size_t(baseLevel.width) * size_t(baseLevel.channels);
+    assert(rowSize <= m_settings.stagingBufferSize);
+    const int rowsPerChunk = static_cast<int>(m_settings.stagingBufferSize / rowSize);
+    for (const Image& level : mipChain)
+        pJob->numChunks += size_t((level.height + rowsPerChunk - 1) / rowsPerChunk);
+
+    for (int level = 0; level < pJob->numLevels; level++) {
+        const Image& image = mipChain[size_t(level)];
+        const size_t levelRowSize = size_t(image.width) * size_t(image.channels);
+        for (int firstRow = 0; firstRow < image.height; firstRow += rowsPerChunk) {
+            const int numRows = std::min(rowsPerChunk, image.height - firstRow);
+
+            size_t stagingBuffer;
+            {
+                std::unique_lock lock { m_mutex };
+                m_condition.wait(lock, [&]() { return m_stop || !m_mappedBuffers.empty(); });
+                if (m_stop)
+                    return;
+                stagingBuffer = m_mappedBuffers.back();
+                m_mappedBuffers.pop_back();
+            }
+
+            std::memcpy(m_stagingBuffers[stagingBuffer].pMapped, image.get_data() + size_t(firstRow) * levelRowSize, size_t(numRows) * levelRowSize);
+
+            std::scoped_lock lock { m_mutex };
+            m_filledChunks.push_back(Chunk { pJob, stagingBuffer, level, firstRow, glm::ivec2(image.width, numRows) });
+        }
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include "texture.h"
+#include <framework/image.h>
+#include <framework/opengl_includes.h>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct TextureUploaderSettings {
+    size_t stagingBufferSize { 4 * 1024 * 1024 }; // Size of each pixel buffer object; also the maximum size of one copy.
+    int numStagingBuffers { 8 };
+    size_t maxBytesPerFrame { 16 * 1024 * 1024 }; // Upload budget of update(); at least one copy is issued per frame.
+};
+
+// Loads textures from disk without stalling the render loop. A loader thread decodes the image, builds the mip chain
+// and writes it into a pool of pixel buffer objects (mapped by the GL thread). The GL thread only issues the copies
+// from those buffers into immutable texture storage, within a per-frame budget, and recycles a buffer once a fence
+// signals that the copy out of it has completed.
+//
+// loadAsync() immediately returns a 1x1 placeholder texture which is replaced (in place) by the real texture once all
+// of its mip levels have been uploaded.
+class TextureUploader {
+public:
+    TextureUploader(const TextureUploaderSettings& settings = {});
+    TextureUploader(const TextureUploader&) = delete;
+    ~TextureUploader();
+
+    TextureUploader& operator=(const TextureUploader&) = delete;
+
+    std::shared_ptr<Texture> loadAsync(const std::filesystem::path& filePath);
+    // Call once per frame from the GL thread.
+    void update();
+
+    // Number of textures that have not finished uploading yet.
+    [[nodiscard]] size_t getNumPendingTextures() const;
+    [[nodiscard]] size_t getBytesUploadedLastFrame() const;
+
+private:
+    struct Job {
+        std::filesystem::path filePath;
+        std::shared_ptr<Texture> pTexture; // Placeholder that is handed out to the user.
+        std::unique_ptr<Texture> pStorage; // Allocated by the GL thread when the first copy is issued.
+        glm::ivec2 size;
+        int channels;
+        int numLevels;
+        size_t numChunks { 0 };
+        size_t numChunksUploaded { 0 };
+    };
+    struct StagingBuffer {
+        GLuint pbo;
+        uint8_t* pMapped { nullptr };
+        GLsync fence { nullptr };
+    };
+    // A part (a range of rows) of one mip level that has been written to a staging buffer.
+    struct Chunk {
+        std::shared_ptr<Job> pJob;
+        size_t stagingBuffer;
+        int level;
+        int firstRow;
+        glm::ivec2 size;
+    };
+
+    void loaderLoop();
+    void stageImage(const std::shared_ptr<Job>& pJob, const std::vector<Image>& mipChain);
+
+private:
+    TextureUploaderSettings m_settings;
+    std::vector<StagingBuffer> m_stagingBuffers;
+    std::deque<size_t> m_inFlightBuffers; // Copies have been issued; waiting for their fences (GL thread only).
+    size_t m_bytesUploadedLastFrame { 0 };
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::deque<std::shared_ptr<Job>> m_loadRequests;
+    std::vector<size_t> m_mappedBuffers; // Mapped and free to be filled by the loader thread.
+    std::deque<Chunk> m_filledChunks;
+    size_t m_numPendingTextures { 0 };
+    bool m_stop { false };
+    std::thread m_loaderThread;
+};
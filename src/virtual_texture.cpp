@@ -0,0 +1,447 @@
+#include "virtual_texture.h"
+#include <framework/gl_state.h>
+#include <framework/image_kernels.h>
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+VirtualTextureLayout::VirtualTextureLayout(const glm::ivec2& sourceSize, int payloadSize, int borderSize)
+    : imageSize(sourceSize)
+    , pageSize(payloadSize)
+    , border(borderSize)
+{
+    const glm::ivec2 numPages = (imageSize + pageSize - 1) / pageSize;
+    pagesMip0 = glm::ivec2(std::bit_ceil(unsigned(numPages.x)), std::bit_ceil(unsigned(numPages.y)));
+    numMips = static_cast<int>(std::bit_width(unsigned(std::max(pagesMip0.x, pagesMip0.y))));
+    uvScale = glm::vec2(imageSize) / glm::vec2(pagesMip0 * pageSize);
+    // Page coordinates are packed into 12 bits each.
+    assert(pagesMip0.x <= 4096 && pagesMip0.y <= 4096);
+}
+
+glm::ivec2 VirtualTextureLayout::pagesAtMip(int mip) const
+{
+    return glm::max(pagesMip0 >> mip, glm::ivec2(1));
+}
+
+glm::ivec2 VirtualTextureLayout::imageSizeAtMip(int mip) const
+{
+    const glm::vec2 scale = glm::vec2(pagesAtMip(mip)) / glm::vec2(pagesMip0);
+    return glm::max(glm::ivec2(glm::round(glm::vec2(imageSize) * scale)), glm::ivec2(1));
+}
+
+VirtualPageId VirtualTextureLayout::parent(VirtualPageId page) const
+{
+    assert(virtualPageMip(page) + 1 < numMips);
+    return makeVirtualPageId(virtualPageMip(page) + 1, virtualPageCoords(page) >> 1);
+}
+
+int VirtualTextureLayout::paddedPageSize() const
+{
+    return pageSize + 2 * border;
+}
+
+VirtualTexturePageTable::VirtualTexturePageTable(const VirtualTextureLayout& layout, const glm::ivec2& cacheSizeInPages)
+    : m_layout(layout)
+{
+    // Indirection entries store slots in 8 bits per axis.
+    assert(cacheSizeInPages.x <= 256 && cacheSizeInPages.y <= 256);
+    for (int y = cacheSizeInPages.y - 1; y >= 0; y--) {
+        for (int x = cacheSizeInPages.x - 1; x >= 0; x--)
+            m_freeSlots.emplace_back(x, y);
+    }
+}
+
+std::optional<glm::ivec2> VirtualTexturePageTable::findSlot(VirtualPageId page) const
+{
+    if (const auto iter = m_entries.find(page); iter != std::end(m_entries))
+        return iter->second.slot;
+    return {};
+}
+
+bool VirtualTexturePageTable::isResident(VirtualPageId page) const
+{
+    return m_entries.contains(page);
+}
+
+void VirtualTexturePageTable::touch(VirtualPageId page)
+{
+    const auto iter = m_entries.find(page);
+    if (iter == std::end(m_entries) || m_pinned.contains(page))
+        return;
+    m_lru.splice(std::begin(m_lru), m_lru, iter->second.lruPosition);
+}
+
+std::optional<glm::ivec2> VirtualTexturePageTable::insert(VirtualPageId page)
+{
+    if (const auto iter = m_entries.find(page); iter != std::end(m_entries)) {
+        touch(page);
+        return iter->second.slot;
+    }
+
+    glm::ivec2 slot;
+    if (!m_freeSlots.empty()) {
+        slot = m_freeSlots.back();
+        m_freeSlots.pop_back();
+    } else if (!m_lru.empty()) {
+        const VirtualPageId evicted = m_lru.back();
+        m_lru.pop_back();
+        slot = m_entries[evicted].slot;
+        m_entries.erase(evicted);
+    } else {
+        return {};
+    }
+
+    m_lru.push_front(page);
+    m_entries[page] = Entry { slot, std::begin(m_lru) };
+    m_indirectionDirty = true;
+    return slot;
+}
+
+void VirtualTexturePageTable::pin(VirtualPageId page)
+{
+    const auto iter = m_entries.find(page);
+    assert(iter != std::end(m_entries));
+    if (m_pinned.insert(page).second)
+        m_lru.erase(iter->second.lruPosition);
+}
+
+size_t VirtualTexturePageTable::numResidentPages() const
+{
+    return m_entries.size();
+}
+
+bool VirtualTexturePageTable::isIndirectionDirty() const
+{
+    return m_indirectionDirty;
+}
+
+void VirtualTexturePageTable::clearIndirectionDirty()
+{
+    m_indirectionDirty = false;
+}
+
+std::vector<glm::u8vec4> VirtualTexturePageTable::buildIndirection(int mip) const
+{
+    const glm::ivec2 numPages = m_layout.pagesAtMip(mip);
+    std::vector<glm::u8vec4> entries(size_t(numPages.x) * size_t(numPages.y), glm::u8vec4(0));
+    for (int y = 0; y < numPages.y; y++) {
+        for (int x = 0; x < numPages.x; x++) {
+            // Walk up the mip chain until a resident page is found; the coarsest level is pinned and thus always resident.
+            VirtualPageId page = makeVirtualPageId(mip, { x, y });
+            auto iter = m_entries.find(page);
+            while (iter == std::end(m_entries) && virtualPageMip(page) + 1 < m_layout.numMips) {
+                page = m_layout.parent(page);
+                iter = m_entries.find(page);
+            }
+            if (iter != std::end(m_entries))
+                entries[size_t(y) * size_t(numPages.x) + size_t(x)] = glm::u8vec4(iter->second.slot, virtualPageMip(page), 255);
+        }
+    }
+    return entries;
+}
+
+std::vector<VirtualPageRequest> analyzeVirtualTextureFeedback(std::span<const uint8_t> feedbackRGBA, const VirtualTextureLayout& layout)
+{
+    std::unordered_map<VirtualPageId, uint32_t> histogram;
+    for (size_t i = 0; i + 3 < feedbackRGBA.size(); i += 4) {
+        // Encoding: r/g = low 8 bits of x/y, b = high 4 bits of x (low nibble) and y (high nibble), a = mip (255: no virtual texture sample).
+        const int mip = feedbackRGBA[i + 3];
+        if (mip >= layout.numMips)
+            continue;
+        const glm::ivec2 page {
+            feedbackRGBA[i + 0] | ((feedbackRGBA[i + 2] & 0x0F) << 8),
+            feedbackRGBA[i + 1] | ((feedbackRGBA[i + 2] & 0xF0) << 4)
+        };
+        if (glm::any(glm::greaterThanEqual(page, layout.pagesAtMip(mip))))
+            continue;
+        histogram[makeVirtualPageId(mip, page)]++;
+    }
+
+    std::vector<VirtualPageRequest> requests;
+    requests.reserve(histogram.size());
+    for (const auto& [page, numSamples] : histogram)
+        requests.push_back({ page, numSamples });
+    // Coarse pages first: they are cheap, cover a large area and serve as fallback for the finer ones.
+    std::sort(std::begin(requests), std::end(requests), [](const VirtualPageRequest& lhs, const VirtualPageRequest& rhs) {
+        if (virtualPageMip(lhs.page) != virtualPageMip(rhs.page))
+            return virtualPageMip(lhs.page) > virtualPageMip(rhs.page);
+        if (lhs.numSamples != rhs.numSamples)
+            return lhs.numSamples > rhs.numSamples;
+        return lhs.page < rhs.page;
+    });
+    return requests;
+}
+
+VirtualTexturePageStreamer::VirtualTexturePageStreamer(const Image& source, const VirtualTextureLayout& layout, int numThreads)
+    : m_layout(layout)
+{
+    m_mipChain.push_back(convertImageChannels(source, 4));
+    for (int mip = 1; mip < layout.numMips; mip++)
+        m_mipChain.push_back(resizeImage(m_mipChain.back(), layout.imageSizeAtMip(mip), ResizeFilter::Box));
+
+    for (int i = 0; i < std::max(numThreads, 1); i++)
+        m_workers.emplace_back(&VirtualTexturePageStreamer::workerLoop, this);
+}
+
+VirtualTexturePageStreamer::~VirtualTexturePageStreamer()
+{
+    {
+        std::lock_guard lock { m_mutex };
+        m_stop = true;
+    }
+    m_requestAvailable.notify_all();
+    for (std::thread& worker : m_workers)
+        worker.join();
+}
+
+void VirtualTexturePageStreamer::request(VirtualPageId page)
+{
+    {
+        std::lock_guard lock { m_mutex };
+        if (!m_inFlight.insert(page).second)
+            return;
+        m_requests.push_back(page);
+    }
+    m_requestAvailable.notify_one();
+}
+
+std::vector<VirtualTexturePageStreamer::LoadedPage> VirtualTexturePageStreamer::collect()
+{
+    std::lock_guard lock { m_mutex };
+    return std::exchange(m_loaded, {});
+}
+
+void VirtualTexturePageStreamer::complete(VirtualPageId page)
+{
+    std::lock_guard lock { m_mutex };
+    m_inFlight.erase(page);
+}
+
+size_t VirtualTexturePageStreamer::numPendingRequests() const
+{
+    std::lock_guard lock { m_mutex };
+    return m_inFlight.size();
+}
+
+std::vector<uint8_t> VirtualTexturePageStreamer::loadPage(VirtualPageId page) const
+{
+    const Image& image = m_mipChain[size_t(virtualPageMip(page))];
+    const int paddedSize = m_layout.paddedPageSize();
+    const glm::ivec2 origin = virtualPageCoords(page) * m_layout.pageSize - m_layout.border;
+
+    // Texels outside of the image (borders at the edges and the padding of the page grid) are clamped to the edge.
+    std::vector<uint8_t> texels(size_t(paddedSize) * size_t(paddedSize) * 4);
+    for (int y = 0; y < paddedSize; y++) {
+        const int sourceY = std::clamp(origin.y + y, 0, image.height - 1);
+        const uint8_t* pSourceRow = image.get_data() + size_t(sourceY) * size_t(image.width) * 4;
+        uint8_t* pTargetRow = texels.data() + size_t(y) * size_t(paddedSize) * 4;
+        for (int x = 0; x < paddedSize; x++) {
+            const int sourceX = std::clamp(origin.x + x, 0, image.width - 1);
+            std::memcpy(pTargetRow + 4 * x, pSourceRow + 4 * sourceX, 4);
+        }
+    }
+    return texels;
+}
+
+void VirtualTexturePageStreamer::workerLoop()
+{
+    while (true) {
+        std::unique_lock lock { m_mutex };
+        m_requestAvailable.wait(lock, [&]() { return m_stop || !m_requests.empty(); });
+        if (m_stop)
+            return;
+        const VirtualPageId page = m_requests.front();
+        m_requests.pop_front();
+        lock.unlock();
+
+        std::vector<uint8_t> texels = loadPage(page);
+
+        lock.lock();
+        // The page stays in flight until it is completed, so it is not loaded again while it waits for its upload.
+        m_loaded.push_back({ page, std::move(texels) });
+    }
+}
+
+VirtualTexture::VirtualTexture(const Image& source, const VirtualTextureSettings& settings)
+    : m_settings(settings)
+    , m_layout({ source.width, source.height }, settings.pageSize, settings.border)
+    , m_pageTable(m_layout, settings.cacheSizeInPages)
+    , m_streamer(source, m_layout, settings.numStreamingThreads)
+{
+    // Physical page cache.
+    const glm::ivec2 cacheSize = settings.cacheSizeInPages * m_layout.paddedPageSize();
+    glGenTextures(1, &m_cacheTexture);
+    GLStateCache::get().bindTextureToActiveUnit(GL_TEXTURE_2D, m_cacheTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, cacheSize.x, cacheSize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    // Indirection texture: one texel per page, one mip level per virtual mip level. Only accessed through texelFetch.
+    glGenTextures(1, &m_indirectionTexture);
+    GLStateCache::get().bindTextureToActiveUnit(GL_TEXTURE_2D, m_indirectionTexture);
+    for (int mip = 0; mip < m_layout.numMips; mip++) {
+        const glm::ivec2 numPages = m_layout.pagesAtMip(mip);
+        glTexImage2D(GL_TEXTURE_2D, mip, GL_RGBA8, numPages.x, numPages.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, m_layout.numMips - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    // The single page of the coarsest mip level is always resident such that every lookup has a fallback.
+    const VirtualPageId rootPage = makeVirtualPageId(m_layout.numMips - 1, { 0, 0 });
+    const glm::ivec2 rootSlot = *m_pageTable.insert(rootPage);
+    m_pageTable.pin(rootPage);
+    uploadPage(rootSlot, m_streamer.loadPage(rootPage));
+    uploadIndirection();
+}
+
+VirtualTexture::~VirtualTexture()
+{
+    GLStateCache::get().forgetTexture(m_cacheTexture);
+    GLStateCache::get().forgetTexture(m_indirectionTexture);
+    glDeleteTextures(1, &m_cacheTexture);
+    glDeleteTextures(1, &m_indirectionTexture);
+    if (m_feedbackFramebuffer != INVALID) {
+        glDeleteFramebuffers(1, &m_feedbackFramebuffer);
+        glDeleteRenderbuffers(1, &m_feedbackColor);
+        glDeleteRenderbuffers(1, &m_feedbackDepth);
+        glDeleteBuffers(static_cast<GLsizei>(m_feedbackReadback.size()), m_feedbackReadback.data());
+    }
+}
+
+void VirtualTexture::beginFeedbackPass(const glm::ivec2& viewportSize)
+{
+    const glm::ivec2 feedbackSize = glm::max(viewportSize / m_settings.feedbackDownscale, glm::ivec2(1));
+    if (feedbackSize != m_feedbackSize) {
+        if (m_feedbackFramebuffer == INVALID) {
+            glGenFramebuffers(1, &m_feedbackFramebuffer);
+            glGenRenderbuffers(1, &m_feedbackColor);
+            glGenRenderbuffers(1, &m_feedbackDepth);
+            glGenBuffers(static_cast<GLsizei>(m_feedbackReadback.size()), m_feedbackReadback.data());
+        }
+        glBindRenderbuffer(GL_RENDERBUFFER, m_feedbackColor);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, feedbackSize.x, feedbackSize.y);
+        glBindRenderbuffer(GL_RENDERBUFFER, m_feedbackDepth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, feedbackSize.x, feedbackSize.y);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_feedbackFramebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_feedbackColor);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_feedbackDepth);
+
+        for (GLuint readbackBuffer : m_feedbackReadback) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffer);
+            glBufferData(GL_PIXEL_PACK_BUFFER, GLsizeiptr(4) * feedbackSize.x * feedbackSize.y, nullptr, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        m_feedbackSize = feedbackSize;
+        m_feedbackFrame = 0; // Contents of the readback buffers are no longer valid.
+    }
+
+    glGetIntegerv(GL_VIEWPORT, m_previousViewport);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_feedbackFramebuffer);
+    glViewport(0, 0, m_feedbackSize.x, m_feedbackSize.y);
+    // Alpha = 255 marks pixels without virtual texture samples.
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void VirtualTexture::endFeedbackPass()
+{
+    // Asynchronous readback; the result is consumed by update() one frame later.
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_feedbackReadback[m_feedbackFrame % m_feedbackReadback.size()]);
+    glReadPixels(0, 0, m_feedbackSize.x, m_feedbackSize.y, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    m_feedbackFrame++;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(m_previousViewport[0], m_previousViewport[1], m_previousViewport[2], m_previousViewport[3]);
+}
+
+void VirtualTexture::update()
+{
+    // Feedback of the previous frame (the readback of the current frame is most likely still in flight).
+    if (m_feedbackFrame >= 2) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, m_feedbackReadback[(m_feedbackFrame - 2) % m_feedbackReadback.size()]);
+        const auto* pFeedback = static_cast<const uint8_t*>(glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY));
+        if (pFeedback) {
+            const auto requests = analyzeVirtualTextureFeedback({ pFeedback, size_t(4) * size_t(m_feedbackSize.x) * size_t(m_feedbackSize.y) }, m_layout);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+
+            for (const VirtualPageRequest& request : requests) {
+                if (m_pageTable.isResident(request.page))
+                    m_pageTable.touch(request.page);
+                else
+                    m_streamer.request(request.page);
+            }
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    // Upload finished pages within the per frame budget.
+    for (auto& loadedPage : m_streamer.collect())
+        m_pendingUploads.push_back(std::move(loadedPage));
+    m_uploadsLastFrame = 0;
+    while (!m_pendingUploads.empty() && m_uploadsLastFrame < size_t(m_settings.maxUploadsPerFrame)) {
+        const auto loadedPage = std::move(m_pendingUploads.front());
+        m_pendingUploads.pop_front();
+        m_streamer.complete(loadedPage.page);
+        if (m_pageTable.isResident(loadedPage.page))
+            continue;
+        if (const auto slot = m_pageTable.insert(loadedPage.page)) {
+            uploadPage(*slot, loadedPage.texels);
+            m_uploadsLastFrame++;
+        }
+    }
+
+    if (m_pageTable.isIndirectionDirty())
+        uploadIndirection();
+}
+
+void VirtualTexture::setUniforms(const Shader& shader) const
+{
+    GLStateCache::get().bindTexture(cacheTextureUnit, GL_TEXTURE_2D, m_cacheTexture);
+    GLStateCache::get().bindTexture(indirectionTextureUnit, GL_TEXTURE_2D, m_indirectionTexture);
+
+    shader.setUniform("vtCache", int(cacheTextureUnit));
+    shader.setUniform("vtIndirection", int(indirectionTextureUnit));
+    shader.setUniform("vtPagesMip0", glm::vec2(m_layout.pagesMip0));
+    shader.setUniform("vtUvScale", m_layout.uvScale);
+    shader.setUniform("vtNumMips", m_layout.numMips);
+    shader.setUniform("vtPageSize", float(m_layout.pageSize));
+    shader.setUniform("vtBorder", float(m_layout.border));
+    shader.setUniform("vtCacheSize", glm::vec2(m_settings.cacheSizeInPages * m_layout.paddedPageSize()));
+    // The feedback buffer has a lower resolution, so its screen space derivatives are larger.
+    shader.setUniform("vtFeedbackBias", -std::log2(float(m_settings.feedbackDownscale)));
+}
+
+VirtualTexture::Statistics VirtualTexture::getStatistics() const
+{
+    // Pages waiting for their upload are still in flight in the streamer.
+    return { m_pageTable.numResidentPages(), m_streamer.numPendingRequests(), m_uploadsLastFrame };
+}
+
+void VirtualTexture::uploadPage(const glm::ivec2& slot, std::span<const uint8_t> texels)
+{
+    const int paddedSize = m_layout.paddedPageSize();
+    GLStateCache::get().bindTextureToActiveUnit(GL_TEXTURE_2D, m_cacheTexture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, slot.x * paddedSize, slot.y * paddedSize, paddedSize, paddedSize, GL_RGBA, GL_UNSIGNED_BYTE, texels.data());
+}
+
+void VirtualTexture::uploadIndirection()
+{
+    GLStateCache::get().bindTextureToActiveUnit(GL_TEXTURE_2D, m_indirectionTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int mip = 0; mip < m_layout.numMips; mip++) {
+        const glm::ivec2 numPages = m_layout.pagesAtMip(mip);
+        const std::vector<glm::u8vec4> entries = m_pageTable.buildIndirection(mip);
+        glTexSubImage2D(GL_TEXTURE_2D, mip, 0, 0, numPages.x, numPages.y, GL_RGBA, GL_UNSIGNED_BYTE, entries.data());
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    m_pageTable.clearIndirectionDirty();
+}
@@ -0,0 +1,208 @@
+#pragma once
+#include <framework/disable_all_warnings.h>
+#include <framework/image.h>
+#include <framework/opengl_includes.h>
+#include <framework/shader.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec2.hpp>
+#include <glm/vec4.hpp>
+DISABLE_WARNINGS_POP()
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Virtual texturing: a (very) large texture is split into fixed size pages per mip level, of which only the pages
+// that are actually visible are kept in a physical page cache texture on the GPU. An indirection texture (one texel
+// per page, with a full mip chain) maps virtual pages to cache slots. Which pages are visible is determined by a
+// low resolution feedback pass that writes the page id of every fragment.
+//
+// Everything except VirtualTexture itself is independent of OpenGL.
+
+struct VirtualTextureSettings {
+    int pageSize { 128 }; // Payload texels per page side.
+    int border { 4 }; // Texels copied from neighbouring pages on each side (for filtering across page boundaries).
+    glm::ivec2 cacheSizeInPages { 16, 16 }; // Number of physical page slots; each axis must be <= 256.
+    int feedbackDownscale { 8 }; // Feedback buffer resolution divisor relative to the viewport.
+    int numStreamingThreads { 2 };
+    int maxUploadsPerFrame { 8 };
+};
+
+// Identifies one page of the virtual texture. Packed into 32 bits: mip (8 bits), y (12 bits) and x (12 bits).
+using VirtualPageId = uint32_t;
+[[nodiscard]] constexpr VirtualPageId makeVirtualPageId(int mip, const glm::ivec2& page) { return (uint32_t(mip) << 24) | (uint32_t(page.y) << 12) | uint32_t(page.x); }
+[[nodiscard]] constexpr int virtualPageMip(VirtualPageId id) { return int(id >> 24); }
+[[nodiscard]] constexpr glm::ivec2 virtualPageCoords(VirtualPageId id) { return { int(id & 0xFFF), int((id >> 12) & 0xFFF) }; }
+
+// Describes how an image of a certain size is divided into pages. The page grid at mip 0 is rounded up to a power
+// of two (in each axis) such that the page grid of mip level i is exactly the page grid of mip 0 shifted right by i.
+struct VirtualTextureLayout {
+    VirtualTextureLayout(const glm::ivec2& sourceSize, int payloadSize, int borderSize);
+
+    [[nodiscard]] glm::ivec2 pagesAtMip(int mip) const;
+    // The image covers the same part (uvScale) of the page grid at every mip level, so it only shrinks along the axes
+    // in which the page grid shrinks (the grid stops at one page per axis).
+    [[nodiscard]] glm::ivec2 imageSizeAtMip(int mip) const;
+    [[nodiscard]] VirtualPageId parent(VirtualPageId page) const; // Page covering the same area one mip level up.
+    [[nodiscard]] int paddedPageSize() const;
+
+    glm::ivec2 imageSize;
+    int pageSize;
+    int border;
+    glm::ivec2 pagesMip0; // Power of two.
+    int numMips; // Mip numMips - 1 consists of a single page.
+    glm::vec2 uvScale; // Part of the (padded) virtual texture that is covered by the image.
+};
+
+// CPU side residency management: which virtual page lives in which cache slot, with least recently used eviction.
+class VirtualTexturePageTable {
+public:
+    VirtualTexturePageTable(const VirtualTextureLayout& layout, const glm::ivec2& cacheSizeInPages);
+
+    [[nodiscard]] std::optional<glm::ivec2> findSlot(VirtualPageId page) const;
+    [[nodiscard]] bool isResident(VirtualPageId page) const;
+    // Mark a resident page as used in the current frame (moves it to the front of the LRU list).
+    void touch(VirtualPageId page);
+    // Assign a slot to a page, evicting the least recently used unpinned page when the cache is full.
+    // Returns nothing if all slots are pinned.
+    std::optional<glm::ivec2> insert(VirtualPageId page);
+    // Pinned pages are never evicted (used for the coarsest mip level, which serves as the fallback for everything).
+    void pin(VirtualPageId page);
+
+    [[nodiscard]] size_t numResidentPages() const;
+    [[nodiscard]] bool isIndirectionDirty() const;
+    // Indirection entries for one mip level: (slot.x, slot.y, mip of the resident page, 255) for every page,
+    // falling back to the closest resident ancestor for pages that are not resident themselves.
+    [[nodiscard]] std::vector<glm::u8vec4> buildIndirection(int mip) const;
+    void clearIndirectionDirty();
+
+private:
+    struct Entry {
+        glm::ivec2 slot;
+        std::list<VirtualPageId>::iterator lruPosition;
+    };
+    const VirtualTextureLayout& m_layout;
+    std::vector<glm::ivec2> m_freeSlots;
+    std::unordered_map<VirtualPageId, Entry> m_entries;
+    std::list<VirtualPageId> m_lru; // Most recently used at the front; only unpinned pages.
+    std::unordered_set<VirtualPageId> m_pinned;
+    bool m_indirectionDirty { true };
+};
+
+struct VirtualPageRequest {
+    VirtualPageId page;
+    uint32_t numSamples; // Number of feedback pixels that referenced this page.
+};
+
+// Decode a feedback buffer (RGBA8, see shaders/vt_feedback_frag.glsl) into the distinct pages that it references,
+// ordered from coarse to fine mip levels and then by how often they were referenced.
+[[nodiscard]] std::vector<VirtualPageRequest> analyzeVirtualTextureFeedback(std::span<const uint8_t> feedbackRGBA, const VirtualTextureLayout& layout);
+
+// Produces padded page contents (RGBA8, paddedPageSize^2 texels) from a mip chain of the source image on worker threads.
+class VirtualTexturePageStreamer {
+public:
+    struct LoadedPage {
+        VirtualPageId page;
+        std::vector<uint8_t> texels;
+    };
+
+    VirtualTexturePageStreamer(const Image& source, const VirtualTextureLayout& layout, int numThreads);
+    VirtualTexturePageStreamer(const VirtualTexturePageStreamer&) = delete;
+    ~VirtualTexturePageStreamer();
+
+    // Queue a page for loading; requests for pages that are already in flight are ignored. A page stays in flight from
+    // its request until complete() is called for it, so pages that were collected but not uploaded yet are not loaded
+    // again.
+    void request(VirtualPageId page);
+    // Pages that finished loading since the last call.
+    [[nodiscard]] std::vector<LoadedPage> collect();
+    // The collected page was uploaded or discarded; it can be requested again.
+    void complete(VirtualPageId page);
+    // Pages that are in flight: queued, being loaded, or loaded but not completed.
+    [[nodiscard]] size_t numPendingRequests() const;
+
+    // Synchronously extract a page (called by the worker threads).
+    [[nodiscard]] std::vector<uint8_t> loadPage(VirtualPageId page) const;
+
+private:
+    void workerLoop();
+
+private:
+    const VirtualTextureLayout& m_layout;
+    std::vector<Image> m_mipChain; // RGBA8, with the sizes of VirtualTextureLayout::imageSizeAtMip().
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_requestAvailable;
+    std::deque<VirtualPageId> m_requests;
+    std::unordered_set<VirtualPageId> m_inFlight; // From request() until complete().
+    std::vector<LoadedPage> m_loaded;
+    bool m_stop { false };
+    std::vector<std::thread> m_workers;
+};
+
+// GPU side: physical page cache, indirection texture and feedback pass.
+//
+// Per frame:
+//   beginFeedbackPass(); <draw with vt_feedback_frag.glsl and setUniforms(...)>; endFeedbackPass();
+//   update();
+//   <draw with vt_frag.glsl and setUniforms(...)>
+class VirtualTexture {
+public:
+    VirtualTexture(const Image& source, const VirtualTextureSettings& settings = {});
+    VirtualTexture(const VirtualTexture&) = delete;
+    ~VirtualTexture();
+
+    VirtualTexture& operator=(const VirtualTexture&) = delete;
+
+    void beginFeedbackPass(const glm::ivec2& viewportSize);
+    void endFeedbackPass();
+    // Processes the feedback of the previous frame, requests missing pages and uploads pages that finished loading.
+    void update();
+
+    static constexpr GLuint cacheTextureUnit = 9;
+    static constexpr GLuint indirectionTextureUnit = 10;
+
+    // Set the uniforms that both the feedback and the sampling shader need, and bind the cache and indirection textures.
+    void setUniforms(const Shader& shader) const;
+
+    struct Statistics {
+        size_t residentPages;
+        size_t pendingRequests; // Pages that are queued for loading, being loaded or waiting to be uploaded.
+        size_t uploadsLastFrame;
+    };
+    [[nodiscard]] Statistics getStatistics() const;
+
+private:
+    void uploadPage(const glm::ivec2& slot, std::span<const uint8_t> texels);
+    void uploadIndirection();
+
+private:
+    static constexpr GLuint INVALID = 0xFFFFFFFF;
+
+    VirtualTextureSettings m_settings;
+    VirtualTextureLayout m_layout;
+    VirtualTexturePageTable m_pageTable;
+    VirtualTexturePageStreamer m_streamer;
+
+    GLuint m_cacheTexture { INVALID };
+    GLuint m_indirectionTexture { INVALID };
+
+    glm::ivec2 m_feedbackSize { 0 };
+    GLuint m_feedbackFramebuffer { INVALID };
+    GLuint m_feedbackColor { INVALID };
+    GLuint m_feedbackDepth { INVALID };
+    std::array<GLuint, 2> m_feedbackReadback { INVALID, INVALID };
+    size_t m_feedbackFrame { 0 };
+    GLint m_previousViewport[4] {};
+
+    std::deque<VirtualTexturePageStreamer::LoadedPage> m_pendingUploads;
+    size_t m_uploadsLastFrame { 0 };
+};
@@ -0,0 +1,93 @@
+#include "draw_data.h"
+#include <catch2/catch_test_macros.hpp>
+#include <framework/cpu_features.h>
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/matrix.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Rigid (rotation and translation), non-uniformly scaled and mirrored model matrices, in turns.
+static void makeModelMatrices(size_t count, std::vector<glm::mat4>& modelMatrices, std::vector<uint8_t>& rigid)
+{
+    for (size_t i = 0; i < count; i++) {
+        const float t = float(i);
+        glm::mat4 matrix = glm::translate(glm::mat4(1.0f), glm::vec3(std::sin(t) * 10.0f, t * 0.01f, std::cos(t) * 5.0f));
+        matrix = glm::rotate(matrix, t * 0.37f, glm::normalize(glm::vec3(1.0f, std::sin(t * 0.5f), 2.0f)));
+        if (i % 3 == 1)
+            matrix = glm::scale(matrix, glm::vec3(0.5f, 2.0f, 3.0f + std::sin(t)));
+        else if (i % 3 == 2)
+            matrix = glm::scale(matrix, glm::vec3(-1.5f, 1.0f, 0.75f));
+        modelMatrices.push_back(matrix);
+        rigid.push_back(i % 3 == 0);
+    }
+}
+
+static const DrawData& getDrawData(const std::vector<std::byte>& buffer, size_t stride, size_t index)
+{
+    return *reinterpret_cast<const DrawData*>(buffer.data() + index * stride);
+}
+
+static bool approxEqual(const DrawData& lhs, const DrawData& rhs)
+{
+    std::array<float, sizeof(DrawData) / sizeof(float)> lhsFloats, rhsFloats;
+    std::memcpy(lhsFloats.data(), &lhs, sizeof(DrawData));
+    std::memcpy(rhsFloats.data(), &rhs, sizeof(DrawData));
+    for (size_t i = 0; i < lhsFloats.size(); i++) {
+        if (std::abs(lhsFloats[i] - rhsFloats[i]) > 1e-5f * std::max(1.0f, std::abs(rhsFloats[i])))
+            return false;
+    }
+    return true;
+}
+
+TEST_CASE("computeDrawDataScalar computes the normal matrix as the inverse transpose")
+{
+    std::vector<glm::mat4> modelMatrices;
+    std::vector<uint8_t> rigid;
+    makeModelMatrices(3, modelMatrices, rigid);
+    std::vector<std::byte> drawData(3 * sizeof(DrawData));
+    const glm::mat4 viewProjection = glm::perspective(glm::radians(60.0f), 1.5f, 0.1f, 100.0f);
+    computeDrawDataScalar(viewProjection, modelMatrices, rigid, drawData.data(), sizeof(DrawData));
+
+    for (size_t i = 0; i < 3; i++) {
+        const glm::mat3 expected = glm::transpose(glm::inverse(glm::mat3(modelMatrices[i])));
+        const DrawData expectedDrawData { viewProjection * modelMatrices[i], modelMatrices[i], expected };
+        REQUIRE(approxEqual(getDrawData(drawData, sizeof(DrawData), i), expectedDrawData));
+    }
+}
+
+TEST_CASE("computeDrawData kernels match the scalar reference")
+{
+    // More than one block (of 1024 objects), so some of it runs on other threads.
+    constexpr size_t count = 1500;
+    std::vector<glm::mat4> modelMatrices;
+    std::vector<uint8_t> rigid;
+    makeModelMatrices(count, modelMatrices, rigid);
+    const glm::mat4 viewProjection = glm::perspective(glm::radians(60.0f), 1.5f, 0.1f, 100.0f)
+        * glm::lookAt(glm::vec3(3, 4, 20), glm::vec3(0), glm::vec3(0, 1, 0));
+    // Padded like DrawData elements that start at aligned uniform buffer offsets.
+    constexpr size_t stride = 256;
+    std::vector<std::byte> reference(count * stride);
+    computeDrawDataScalar(viewProjection, modelMatrices, rigid, reference.data(), stride);
+
+    const CPUFeatures detected = getCPUFeatures();
+    // AVX2 (if available), then the SSE fallback.
+    for (const bool avx2 : { true, false }) {
+        if (avx2 && !detected.avx2)
+            continue;
+        setCPUFeatures({ .sse41 = detected.sse41, .avx2 = avx2 });
+        std::vector<std::byte> drawData(count * stride);
+        computeDrawData(viewProjection, modelMatrices, rigid, drawData.data(), stride);
+        setCPUFeatures(detected);
+
+        for (size_t i = 0; i < count; i++)
+            REQUIRE(approxEqual(getDrawData(drawData, stride, i), getDrawData(reference, stride, i)));
+    }
+}
@@ -0,0 +1,96 @@
+#include "frustum_culler.h"
+#include <catch2/catch_test_macros.hpp>
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/gtc/matrix_transform.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <vector>
+
+struct ReferenceCull {
+    std::vector<uint32_t> certain; // Boxes that are clearly inside every plane.
+    std::vector<uint32_t> possible; // Also the boxes that touch a plane, for which rounding decides.
+};
+
+// A box is outside a plane if all of its corners are.
+static ReferenceCull bruteForceCull(const Frustum& frustum, const std::vector<AxisAlignedBox>& boxes)
+{
+    constexpr double tolerance = 1e-4;
+    ReferenceCull result;
+    for (uint32_t object = 0; object < uint32_t(boxes.size()); object++) {
+        bool certain = true, possible = true;
+        for (const glm::vec4& plane : frustum.planes) {
+            double maxDistance = std::numeric_limits<double>::lowest();
+            for (int corner = 0; corner < 8; corner++) {
+                const glm::dvec3 position {
+                    (corner & 1) ? boxes[object].upper.x : boxes[object].lower.x,
+                    (corner & 2) ? boxes[object].upper.y : boxes[object].lower.y,
+                    (corner & 4) ? boxes[object].upper.z : boxes[object].lower.z
+                };
+                maxDistance = std::max(maxDistance, glm::dot(glm::dvec3(plane), position) + double(plane.w));
+            }
+            certain &= maxDistance > tolerance;
+            possible &= maxDistance > -tolerance;
+        }
+        if (certain)
+            result.certain.push_back(object);
+        if (possible)
+            result.possible.push_back(object);
+    }
+    return result;
+}
+
+// Boxes of all sizes scattered around the frustum of a camera at (2, 1, 10) looking at the origin.
+static std::vector<AxisAlignedBox> makeBoxes(size_t count)
+{
+    std::mt19937 random { 42 };
+    std::uniform_real_distribution<float> position { -60.0f, 60.0f }, size { 0.01f, 5.0f };
+    std::vector<AxisAlignedBox> boxes;
+    for (size_t i = 0; i < count; i++) {
+        const glm::vec3 center { position(random), position(random), position(random) };
+        const glm::vec3 extent { size(random), size(random), size(random) };
+        boxes.push_back({ center - extent, center + extent });
+    }
+    return boxes;
+}
+
+TEST_CASE("FrustumCuller matches a brute force test of the box corners against every plane")
+{
+    const Frustum frustum = Frustum::fromMatrix(glm::perspective(glm::radians(70.0f), 1.5f, 0.5f, 50.0f)
+        * glm::lookAt(glm::vec3(2, 1, 10), glm::vec3(0), glm::vec3(0, 1, 0)));
+    // Only the scalar tail, full AVX2 blocks plus a tail, and (more than cullBlockSize objects) multiple threads.
+    for (const size_t numObjects : { size_t(5), size_t(1003), size_t(10003) }) {
+        const std::vector<AxisAlignedBox> boxes = makeBoxes(numObjects);
+        FrustumCuller culler;
+        for (const AxisAlignedBox& box : boxes)
+            culler.add(box);
+        std::vector<uint32_t> visibleObjects { 1234 }; // Replaced by the result.
+        culler.cull(frustum, visibleObjects);
+
+        const ReferenceCull reference = bruteForceCull(frustum, boxes);
+        REQUIRE(std::is_sorted(std::begin(visibleObjects), std::end(visibleObjects)));
+        REQUIRE(std::includes(std::begin(visibleObjects), std::end(visibleObjects), std::begin(reference.certain), std::end(reference.certain)));
+        REQUIRE(std::includes(std::begin(reference.possible), std::end(reference.possible), std::begin(visibleObjects), std::end(visibleObjects)));
+        if (numObjects > 5) {
+            // Make sure that both outcomes are covered.
+            REQUIRE(!reference.certain.empty());
+            REQUIRE(reference.possible.size() < numObjects);
+        }
+    }
+}
+
+TEST_CASE("FrustumCuller culls updated bounds")
+{
+    const Frustum frustum = Frustum::fromMatrix(glm::ortho(-1.0f, 1.0f, -1.0f, 1.0f, -1.0f, 1.0f));
+    FrustumCuller culler;
+    for (int i = 0; i < 9; i++)
+        culler.add({ glm::vec3(-0.1f), glm::vec3(0.1f) });
+    culler.update(8, { glm::vec3(1.5f), glm::vec3(2.0f) });
+    culler.update(3, { glm::vec3(-3.0f), glm::vec3(-1.5f) });
+    std::vector<uint32_t> visibleObjects;
+    culler.cull(frustum, visibleObjects);
+    REQUIRE(visibleObjects == std::vector<uint32_t> { 0, 1, 2, 4, 5, 6, 7 });
+}
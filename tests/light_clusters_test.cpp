@@ -0,0 +1,154 @@
+#include "light_clusters.h"
+#include <catch2/catch_test_macros.hpp>
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/matrix.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <vector>
+
+static constexpr float nearPlane = 0.1f, farPlane = 100.0f;
+
+static glm::mat4 makeProjection()
+{
+    return glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, nearPlane, farPlane);
+}
+
+// Lights scattered around the view frustum of a camera at (1, 2, 3) looking at the origin, from small lights that touch
+// a single cluster to large lights that span many.
+static std::vector<glm::vec4> makeLights(size_t count)
+{
+    std::mt19937 random { 1234 };
+    std::uniform_real_distribution<float> position { -40.0f, 40.0f }, radius { 0.05f, 8.0f };
+    std::vector<glm::vec4> lights;
+    for (size_t i = 0; i < count; i++)
+        lights.emplace_back(position(random), position(random) * 0.5f, position(random), radius(random));
+    return lights;
+}
+
+struct ReferenceCluster {
+    std::vector<uint16_t> certain; // Lights that clearly reach the cluster.
+    std::vector<uint16_t> possible; // Also the lights that only graze it, for which rounding decides.
+};
+
+// The cluster bounds computed in the same way as LightClusterGrid, with every light tested against every cluster.
+static std::vector<ReferenceCluster> bruteForceClusters(const glm::ivec3& gridSize, const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix, const std::vector<glm::vec4>& lights)
+{
+    const glm::mat4 inverseProjection = glm::inverse(projectionMatrix);
+    const auto cornerRay = [&](int x, int y) {
+        const glm::vec2 ndc = 2.0f * glm::vec2(x, y) / glm::vec2(gridSize.x, gridSize.y) - 1.0f;
+        const glm::vec4 nearPoint = inverseProjection * glm::vec4(ndc, -1.0f, 1.0f);
+        const glm::vec3 ray = glm::vec3(nearPoint) / nearPoint.w;
+        return ray / -ray.z;
+    };
+    const auto sliceDepth = [&](int slice) {
+        return nearPlane * std::pow(farPlane / nearPlane, float(slice) / float(gridSize.z));
+    };
+
+    std::vector<ReferenceCluster> clusters;
+    for (int slice = 0; slice < gridSize.z; slice++) {
+        for (int y = 0; y < gridSize.y; y++) {
+            for (int x = 0; x < gridSize.x; x++) {
+                glm::vec3 lower { std::numeric_limits<float>::max() }, upper { std::numeric_limits<float>::lowest() };
+                for (int corner = 0; corner < 4; corner++) {
+                    for (const float depth : { sliceDepth(slice), sliceDepth(slice + 1) }) {
+                        lower = glm::min(lower, cornerRay(x + (corner & 1), y + (corner >> 1)) * depth);
+                        upper = glm::max(upper, cornerRay(x + (corner & 1), y + (corner >> 1)) * depth);
+                    }
+                }
+
+                ReferenceCluster& cluster = clusters.emplace_back();
+                for (size_t light = 0; light < lights.size(); light++) {
+                    const glm::dvec3 center = glm::dvec3(viewMatrix * glm::vec4(glm::vec3(lights[light]), 1.0f));
+                    const glm::dvec3 distance = glm::max(glm::max(glm::dvec3(lower) - center, center - glm::dvec3(upper)), 0.0);
+                    const double distanceSquared = glm::dot(distance, distance);
+                    const double radiusSquared = double(lights[light].w) * double(lights[light].w);
+                    if (distanceSquared <= radiusSquared * (1.0 + 1e-4))
+                        cluster.possible.push_back(uint16_t(light));
+                    if (distanceSquared <= radiusSquared * (1.0 - 1e-4))
+                        cluster.certain.push_back(uint16_t(light));
+                }
+            }
+        }
+    }
+    return clusters;
+}
+
+static std::vector<uint16_t> getClusterLights(const LightClusterGrid& grid, size_t cluster)
+{
+    const glm::uvec2 range = grid.getClusters()[cluster];
+    const auto lightIndices = grid.getLightIndices().subspan(range.x, range.y);
+    return { std::begin(lightIndices), std::end(lightIndices) };
+}
+
+TEST_CASE("LightClusterGrid assigns the same lights as a brute force test of every cluster")
+{
+    const LightClusterSettings settings { .gridSize = { 8, 6, 12 }, .maxLightsPerCluster = 1024 };
+    LightClusterGrid grid { settings };
+    const glm::mat4 viewMatrix = glm::lookAt(glm::vec3(1, 2, 3), glm::vec3(0), glm::vec3(0, 1, 0));
+    // Not a multiple of 8, so the padding of the light lists is exercised too.
+    const std::vector<glm::vec4> lights = makeLights(203);
+    grid.build(viewMatrix, makeProjection(), nearPlane, farPlane, lights);
+
+    const std::vector<ReferenceCluster> reference = bruteForceClusters(settings.gridSize, viewMatrix, makeProjection(), lights);
+    REQUIRE(grid.getClusters().size() == reference.size());
+    size_t numCertain = 0;
+    for (size_t cluster = 0; cluster < reference.size(); cluster++) {
+        const std::vector<uint16_t> clusterLights = getClusterLights(grid, cluster);
+        REQUIRE(std::is_sorted(std::begin(clusterLights), std::end(clusterLights)));
+        REQUIRE(std::includes(std::begin(clusterLights), std::end(clusterLights), std::begin(reference[cluster].certain), std::end(reference[cluster].certain)));
+        REQUIRE(std::includes(std::begin(reference[cluster].possible), std::end(reference[cluster].possible), std::begin(clusterLights), std::end(clusterLights)));
+        numCertain += reference[cluster].certain.size();
+    }
+    // Make sure that the lights actually reach the view frustum.
+    REQUIRE(numCertain > reference.size());
+    REQUIRE(grid.getStatistics().numLights == lights.size());
+    REQUIRE(grid.getStatistics().numFullClusters == 0);
+
+    // The clusters are reused by the next build, with another view.
+    const glm::mat4 otherViewMatrix = glm::lookAt(glm::vec3(-5, 0, -5), glm::vec3(10, 0, 0), glm::vec3(0, 1, 0));
+    grid.build(otherViewMatrix, makeProjection(), nearPlane, farPlane, lights);
+    const std::vector<ReferenceCluster> otherReference = bruteForceClusters(settings.gridSize, otherViewMatrix, makeProjection(), lights);
+    for (size_t cluster = 0; cluster < otherReference.size(); cluster++) {
+        const std::vector<uint16_t> clusterLights = getClusterLights(grid, cluster);
+        REQUIRE(std::includes(std::begin(clusterLights), std::end(clusterLights), std::begin(otherReference[cluster].certain), std::end(otherReference[cluster].certain)));
+        REQUIRE(std::includes(std::begin(otherReference[cluster].possible), std::end(otherReference[cluster].possible), std::begin(clusterLights), std::end(clusterLights)));
+    }
+}
+
+TEST_CASE("LightClusterGrid keeps the first lights of full clusters")
+{
+    const LightClusterSettings settings { .gridSize = { 4, 4, 4 }, .maxLightsPerCluster = 3 };
+    LightClusterGrid grid { settings };
+    // Five lights that cover the whole frustum.
+    const std::vector<glm::vec4> lights(5, glm::vec4(0, 0, -10, 1000));
+    grid.build(glm::mat4(1.0f), makeProjection(), nearPlane, farPlane, lights);
+
+    const size_t numClusters = size_t(4 * 4 * 4);
+    for (size_t cluster = 0; cluster < numClusters; cluster++)
+        REQUIRE(getClusterLights(grid, cluster) == std::vector<uint16_t> { 0, 1, 2 });
+    REQUIRE(grid.getLightIndices().size() == 3 * numClusters);
+    REQUIRE(grid.getStatistics().maxLightsInCluster == 5);
+    REQUIRE(grid.getStatistics().numFullClusters == int(numClusters));
+}
+
+TEST_CASE("LightClusterGrid depth slices match the cluster bounds")
+{
+    const LightClusterSettings settings { .gridSize = { 4, 4, 16 }, .maxLightsPerCluster = 8 };
+    LightClusterGrid grid { settings };
+    grid.build(glm::mat4(1.0f), makeProjection(), nearPlane, farPlane, {});
+    REQUIRE(grid.getLightIndices().empty());
+
+    const glm::vec2 scaleBias = grid.getDepthSliceScaleBias();
+    const auto getSlice = [&](float depth) { return int(std::floor(std::log(depth) * scaleBias.x + scaleBias.y)); };
+    REQUIRE(getSlice(nearPlane * 1.001f) == 0);
+    REQUIRE(getSlice(farPlane * 0.999f) == settings.gridSize.z - 1);
+    // The slices grow exponentially, so the geometric mean of the planes lies halfway.
+    REQUIRE(getSlice(std::sqrt(nearPlane * farPlane) * 1.001f) == settings.gridSize.z / 2);
+}
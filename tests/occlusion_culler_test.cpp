@@ -0,0 +1,106 @@
+#include "occlusion_culler.h"
+#include <catch2/catch_approx.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/gtc/matrix_transform.hpp>
+DISABLE_WARNINGS_POP()
+#include <cstdint>
+#include <vector>
+
+// Camera at (0, 0, 5) looking down -z with the aspect ratio of the default depth buffer resolution (256x128).
+static glm::mat4 makeViewProjection()
+{
+    return glm::perspective(glm::radians(90.0f), 2.0f, 0.1f, 100.0f) * glm::lookAt(glm::vec3(0, 0, 5), glm::vec3(0), glm::vec3(0, 1, 0));
+}
+
+// Two triangles spanning the quad with the given corners (in order around the quad).
+static Mesh makeQuad(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, const glm::vec3& d)
+{
+    Mesh quad;
+    for (const glm::vec3& position : { a, b, c, d })
+        quad.vertices.push_back({ position, glm::vec3(0), glm::vec2(0) });
+    quad.triangles = { { 0, 1, 2 }, { 0, 2, 3 } };
+    return quad;
+}
+
+static AxisAlignedBox makeBox(const glm::vec3& center, float halfSize)
+{
+    return { center - halfSize, center + halfSize };
+}
+
+TEST_CASE("OcclusionCuller rounds the width up to a multiple of 8")
+{
+    const OcclusionCuller culler { { { 100, 50 }, 8 } };
+    REQUIRE(culler.getResolution() == glm::ivec2(104, 50));
+    REQUIRE(culler.getDepthLevel(0).size() == 104 * 50);
+    // 104x50 -> 52x25 -> 26x13 -> 13x7 -> 7x4 -> 4x2 -> 2x1 -> 1x1
+    REQUIRE(culler.getNumLevels() == 8);
+}
+
+TEST_CASE("OcclusionCuller keeps everything without occluders")
+{
+    OcclusionCuller culler;
+    culler.beginFrame(makeViewProjection());
+    culler.rasterize();
+
+    const std::vector<AxisAlignedBox> bounds { makeBox({ 0, 0, -3 }, 0.5f), makeBox({ 0, 0, 2 }, 0.5f) };
+    std::vector<uint32_t> objects { 0, 1 };
+    culler.removeOccluded(bounds, objects);
+    REQUIRE(objects == std::vector<uint32_t> { 0, 1 });
+    REQUIRE(culler.getStatistics().numOccluded == 0);
+}
+
+TEST_CASE("OcclusionCuller removes the objects behind a wall")
+{
+    OcclusionCuller culler;
+    const glm::mat4 viewProjection = makeViewProjection();
+    culler.beginFrame(viewProjection);
+    // Wall at z = 0 that covers the center of the screen (up to 1/5 of the width and 2/5 of the height).
+    culler.addOccluder(makeQuad({ -2, -2, 0 }, { 2, -2, 0 }, { 2, 2, 0 }, { -2, 2, 0 }), glm::mat4(1.0f));
+    culler.rasterize();
+    REQUIRE(culler.getStatistics().numOccluderTriangles == 2);
+
+    // The wall faces the camera, so its window space depth is the same at every pixel it covers.
+    const glm::vec4 clip = viewProjection * glm::vec4(0, 0, 0, 1);
+    const float wallDepth = 0.5f * clip.z / clip.w + 0.5f;
+    const glm::ivec2 resolution = culler.getResolution();
+    const std::span<const float> depths = culler.getDepthLevel(0);
+    REQUIRE(depths[size_t(resolution.y / 2 * resolution.x + resolution.x / 2)] == Catch::Approx(wallDepth).margin(1e-5));
+    REQUIRE(depths[0] == 1.0f);
+    // The last level contains the furthest depth of the whole screen, which is not covered by the wall.
+    REQUIRE(culler.getDepthLevel(culler.getNumLevels() - 1)[0] == 1.0f);
+
+    const std::vector<AxisAlignedBox> bounds {
+        makeBox({ 0, 0, -3 }, 0.5f), // Behind the center of the wall.
+        makeBox({ 0, 0, 2 }, 0.5f), // In front of the wall.
+        makeBox({ 6.5f, 0, -3 }, 0.5f), // Behind the wall, but next to it on the screen.
+        makeBox({ 2.0f, 0, -3 }, 1.0f), // Partially behind the wall.
+        makeBox({ 0, 0, 5 }, 1.0f), // Intersects the near plane.
+        makeBox({ 1.0f, -1.0f, -10 }, 1.0f), // Far behind the wall.
+    };
+    std::vector<uint32_t> objects { 0, 1, 2, 3, 4, 5 };
+    culler.removeOccluded(bounds, objects);
+    REQUIRE(objects == std::vector<uint32_t> { 1, 2, 3, 4 });
+    REQUIRE(culler.getStatistics().numTested == 6);
+    REQUIRE(culler.getStatistics().numOccluded == 2);
+}
+
+TEST_CASE("OcclusionCuller clips occluders against the near plane")
+{
+    OcclusionCuller culler;
+    culler.beginFrame(makeViewProjection());
+    // Floor at y = -1 that extends behind the camera, so both triangles have to be clipped.
+    culler.addOccluder(makeQuad({ -100, -1, 20 }, { 100, -1, 20 }, { 100, -1, -50 }, { -100, -1, -50 }), glm::mat4(1.0f));
+    culler.rasterize();
+    // Clipping a triangle with one vertex in front of the near plane results in a triangle, with two in a quad.
+    REQUIRE(culler.getStatistics().numOccluderTriangles == 3);
+
+    const std::vector<AxisAlignedBox> bounds {
+        makeBox({ 0, -3, -5 }, 0.5f), // Below the floor.
+        makeBox({ 0, 0, -5 }, 0.5f), // Above the floor.
+    };
+    std::vector<uint32_t> objects { 0, 1 };
+    culler.removeOccluded(bounds, objects);
+    REQUIRE(objects == std::vector<uint32_t> { 1 });
+}
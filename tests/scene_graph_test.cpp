@@ -0,0 +1,211 @@
+#include "scene_graph.h"
+#include <catch2/catch_test_macros.hpp>
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/geometric.hpp>
+#include <glm/gtc/quaternion.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <set>
+#include <vector>
+
+using NodeHandle = SceneGraph::NodeHandle;
+
+// What the scene graph should contain, indexed by handle.
+struct ReferenceGraph {
+    std::vector<NodeHandle> parents;
+    std::vector<Transform> localTransforms;
+
+    NodeHandle addNode(SceneGraph& graph, const Transform& localTransform, NodeHandle parent)
+    {
+        parents.push_back(parent);
+        localTransforms.push_back(localTransform);
+        return graph.addNode(localTransform, parent);
+    }
+    void setLocalTransform(SceneGraph& graph, NodeHandle node, const Transform& localTransform)
+    {
+        localTransforms[node] = localTransform;
+        graph.setLocalTransform(node, localTransform);
+    }
+
+    [[nodiscard]] glm::mat4 worldMatrix(NodeHandle node) const
+    {
+        const glm::mat4 local = localTransforms[node].toMatrix();
+        return parents[node] == SceneGraph::invalidNode ? local : worldMatrix(parents[node]) * local;
+    }
+    [[nodiscard]] bool isRigid(NodeHandle node) const
+    {
+        const bool rigidLocal = localTransforms[node].scale == glm::vec3(1.0f);
+        return rigidLocal && (parents[node] == SceneGraph::invalidNode || isRigid(parents[node]));
+    }
+    [[nodiscard]] bool isDescendantOf(NodeHandle node, const std::set<NodeHandle>& ancestors) const
+    {
+        for (; node != SceneGraph::invalidNode; node = parents[node]) {
+            if (ancestors.contains(node))
+                return true;
+        }
+        return false;
+    }
+};
+
+static Transform makeTransform(std::mt19937& random, bool scaled)
+{
+    std::uniform_real_distribution<float> distribution { -1.0f, 1.0f };
+    Transform transform;
+    transform.translation = 2.0f * glm::vec3(distribution(random), distribution(random), distribution(random));
+    const glm::vec3 axis { distribution(random), distribution(random), distribution(random) + 2.0f };
+    transform.rotation = glm::angleAxis(3.0f * distribution(random), glm::normalize(axis));
+    if (scaled)
+        transform.scale = glm::vec3(1.25f + 0.75f * distribution(random), 1.0f, 1.25f - 0.5f * distribution(random));
+    return transform;
+}
+
+static bool approxEqual(const glm::mat4& lhs, const glm::mat4& rhs)
+{
+    for (int column = 0; column < 4; column++) {
+        for (int row = 0; row < 4; row++) {
+            if (std::abs(lhs[column][row] - rhs[column][row]) > 1e-4f * std::max(1.0f, std::abs(rhs[column][row])))
+                return false;
+        }
+    }
+    return true;
+}
+
+static void requireMatchesReference(const SceneGraph& graph, const ReferenceGraph& reference)
+{
+    REQUIRE(graph.getNumNodes() == reference.parents.size());
+    for (NodeHandle node = 0; node < NodeHandle(reference.parents.size()); node++) {
+        REQUIRE(graph.getParent(node) == reference.parents[node]);
+        REQUIRE(approxEqual(graph.getWorldMatrix(node), reference.worldMatrix(node)));
+        REQUIRE(graph.isRigid(node) == reference.isRigid(node));
+    }
+}
+
+// Every updated node comes after its parent if that was updated too.
+static void requireDepthFirstOrder(const SceneGraph& graph)
+{
+    const auto updatedNodes = graph.getUpdatedNodes();
+    const std::set<NodeHandle> updated(std::begin(updatedNodes), std::end(updatedNodes));
+    REQUIRE(updated.size() == updatedNodes.size());
+    std::set<NodeHandle> seen;
+    for (const NodeHandle node : updatedNodes) {
+        const NodeHandle parent = graph.getParent(node);
+        if (updated.contains(parent))
+            REQUIRE(seen.contains(parent));
+        seen.insert(node);
+    }
+}
+
+TEST_CASE("SceneGraph matches a recursive reference when nodes are inserted in random order")
+{
+    std::mt19937 random { 7 };
+    SceneGraph graph;
+    ReferenceGraph reference;
+    // Parents are picked among all existing nodes, so most nodes are inserted in the middle of the arrays.
+    for (int i = 0; i < 3000; i++) {
+        NodeHandle parent = SceneGraph::invalidNode;
+        if (i > 0 && random() % 20 != 0)
+            parent = NodeHandle(random() % uint32_t(i));
+        reference.addNode(graph, makeTransform(random, random() % 8 == 0), parent);
+    }
+    graph.updateWorldMatrices();
+    requireMatchesReference(graph, reference);
+    REQUIRE(graph.getUpdatedNodes().size() == 3000);
+    requireDepthFirstOrder(graph);
+
+    // Only the changed nodes and their descendants are updated.
+    std::set<NodeHandle> changed;
+    for (int i = 0; i < 40; i++) {
+        const auto node = NodeHandle(random() % 3000);
+        reference.setLocalTransform(graph, node, makeTransform(random, random() % 8 == 0));
+        changed.insert(node);
+    }
+    graph.updateWorldMatrices();
+    requireMatchesReference(graph, reference);
+    std::set<NodeHandle> expectedUpdates;
+    for (NodeHandle node = 0; node < 3000; node++) {
+        if (reference.isDescendantOf(node, changed))
+            expectedUpdates.insert(node);
+    }
+    const auto updatedNodes = graph.getUpdatedNodes();
+    REQUIRE(std::set<NodeHandle>(std::begin(updatedNodes), std::end(updatedNodes)) == expectedUpdates);
+    REQUIRE(graph.getStatistics().numUpdatedNodes == expectedUpdates.size());
+    requireDepthFirstOrder(graph);
+
+    // Nothing changed.
+    graph.updateWorldMatrices();
+    REQUIRE(graph.getUpdatedNodes().empty());
+    REQUIRE(graph.getStatistics().numSkippedNodes == 3000);
+}
+
+TEST_CASE("SceneGraph skips clean subtrees")
+{
+    SceneGraph graph;
+    const NodeHandle root = graph.addNode({});
+    const NodeHandle arm = graph.addNode({ .translation = { 1, 0, 0 } }, root);
+    const NodeHandle hand = graph.addNode({ .translation = { 0, 1, 0 } }, arm);
+    const NodeHandle otherArm = graph.addNode({ .translation = { -1, 0, 0 } }, root);
+    graph.addNode({}, otherArm);
+    graph.addNode({}, otherArm);
+    graph.updateWorldMatrices();
+    REQUIRE(graph.getStatistics().numUpdatedNodes == 6);
+
+    graph.setLocalTransform(hand, { .translation = { 0, 2, 0 } });
+    graph.updateWorldMatrices();
+    REQUIRE(std::vector<NodeHandle>(std::begin(graph.getUpdatedNodes()), std::end(graph.getUpdatedNodes())) == std::vector<NodeHandle> { hand });
+    // The other arm is skipped as a whole; the root and the first arm are visited, but not updated.
+    REQUIRE(graph.getStatistics().numSkippedNodes == 3);
+    REQUIRE(graph.getWorldMatrix(hand)[3] == glm::vec4(1, 2, 0, 1));
+
+    graph.setLocalTransform(arm, { .translation = { 3, 0, 0 }, .scale = glm::vec3(2.0f) });
+    graph.updateWorldMatrices();
+    REQUIRE(std::vector<NodeHandle>(std::begin(graph.getUpdatedNodes()), std::end(graph.getUpdatedNodes())) == std::vector<NodeHandle> { arm, hand });
+    REQUIRE(graph.getWorldMatrix(hand)[3] == glm::vec4(3, 4, 0, 1));
+    REQUIRE(!graph.isRigid(hand));
+    REQUIRE(graph.isRigid(otherArm));
+
+    graph.setLocalTransform(root, { .translation = { 0, 0, 1 } });
+    graph.updateWorldMatrices();
+    REQUIRE(graph.getStatistics().numUpdatedNodes == 6);
+    REQUIRE(graph.getStatistics().numSkippedNodes == 0);
+}
+
+TEST_CASE("SceneGraph splits large subtrees across threads")
+{
+    std::mt19937 random { 11 };
+    SceneGraph graph;
+    ReferenceGraph reference;
+    // A single root whose subtree is too large for one block; the subtrees of its children fit.
+    const NodeHandle root = reference.addNode(graph, makeTransform(random, false), SceneGraph::invalidNode);
+    std::vector<NodeHandle> limbs;
+    for (int limb = 0; limb < 8; limb++) {
+        limbs.push_back(reference.addNode(graph, makeTransform(random, limb == 3), root));
+        for (int leaf = 0; leaf < 1000; leaf++)
+            reference.addNode(graph, makeTransform(random, false), limbs.back());
+    }
+    graph.updateWorldMatrices();
+    requireMatchesReference(graph, reference);
+    REQUIRE(graph.getStatistics().numUpdatedNodes == graph.getNumNodes());
+    requireDepthFirstOrder(graph);
+
+    // Moving the root updates everything, in depth first order.
+    reference.setLocalTransform(graph, root, makeTransform(random, false));
+    graph.updateWorldMatrices();
+    requireMatchesReference(graph, reference);
+    const auto updatedNodes = graph.getUpdatedNodes();
+    REQUIRE(updatedNodes.size() == graph.getNumNodes());
+    REQUIRE(updatedNodes[0] == root);
+    requireDepthFirstOrder(graph);
+
+    // Moving two limbs skips the others.
+    reference.setLocalTransform(graph, limbs[2], makeTransform(random, false));
+    reference.setLocalTransform(graph, limbs[6], makeTransform(random, true));
+    graph.updateWorldMatrices();
+    requireMatchesReference(graph, reference);
+    REQUIRE(graph.getStatistics().numUpdatedNodes == 2 * 1001);
+    REQUIRE(graph.getStatistics().numSkippedNodes == 6 * 1001);
+    requireDepthFirstOrder(graph);
+}
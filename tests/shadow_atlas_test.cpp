@@ -0,0 +1,147 @@
+#include "shadow_atlas.h"
+#include <catch2/catch_test_macros.hpp>
+#include <cstdint>
+#include <set>
+#include <vector>
+
+static ShadowRequest makeRequest(uint32_t lightId, float importance, bool changed = false)
+{
+    return { .lightId = lightId, .importance = importance, .lightChanged = changed, .castersChanged = false };
+}
+
+static bool overlap(const AtlasTile& lhs, const AtlasTile& rhs)
+{
+    return lhs.offset.x < rhs.offset.x + rhs.size && rhs.offset.x < lhs.offset.x + lhs.size
+        && lhs.offset.y < rhs.offset.y + rhs.size && rhs.offset.y < lhs.offset.y + lhs.size;
+}
+
+TEST_CASE("QuadtreeAllocator splits and merges tiles")
+{
+    QuadtreeAllocator allocator { 256, 32 };
+    const auto large = allocator.allocate(100);
+    REQUIRE(large == AtlasTile { { 0, 0 }, 128 });
+    const auto small = allocator.allocate(1);
+    REQUIRE(small == AtlasTile { { 128, 0 }, 32 });
+    REQUIRE(allocator.getLargestFreeTile() == 128);
+    REQUIRE(!allocator.allocate(512));
+
+    allocator.free(*large);
+    allocator.free(*small);
+    REQUIRE(allocator.getUsage() == 0.0f);
+    REQUIRE(allocator.getLargestFreeTile() == 256);
+}
+
+TEST_CASE("ShadowAtlas sizes tiles by importance")
+{
+    ShadowAtlas atlas { { .atlasSize = 512, .minTileSize = 32, .maxTileSize = 128, .maxUpdatesPerFrame = 16 } };
+    const std::vector<ShadowRequest> requests {
+        makeRequest(1, 1.0f), // Whole screen: the largest tile.
+        makeRequest(2, 4.0f), // Clamped to the largest tile.
+        makeRequest(3, 0.5f),
+        makeRequest(4, 0.3f), // 38.4 pixels, rounded up to a power of two.
+        makeRequest(5, 0.01f), // Clamped to the smallest tile.
+        makeRequest(6, 0.0f), // No shadows needed.
+    };
+    atlas.update(requests);
+
+    REQUIRE(atlas.getTile(1)->size == 128);
+    REQUIRE(atlas.getTile(2)->size == 128);
+    REQUIRE(atlas.getTile(3)->size == 64);
+    REQUIRE(atlas.getTile(4)->size == 64);
+    REQUIRE(atlas.getTile(5)->size == 32);
+    REQUIRE(!atlas.getTile(6));
+    REQUIRE(atlas.getStatistics().numTiles == 5);
+    REQUIRE(atlas.getStatistics().numAllocations == 5);
+
+    for (uint32_t lhs = 1; lhs <= 5; lhs++) {
+        const AtlasTile tile = *atlas.getTile(lhs);
+        REQUIRE(tile.offset.x % tile.size == 0);
+        REQUIRE(tile.offset.y % tile.size == 0);
+        for (uint32_t rhs = lhs + 1; rhs <= 5; rhs++)
+            REQUIRE(!overlap(tile, *atlas.getTile(rhs)));
+    }
+}
+
+TEST_CASE("ShadowAtlas only resizes a tile when it is too small or much too large")
+{
+    ShadowAtlas atlas { { .atlasSize = 512, .minTileSize = 32, .maxTileSize = 256, .maxUpdatesPerFrame = 16 } };
+    const auto updateImportance = [&](float importance) {
+        const ShadowRequest request = makeRequest(1, importance);
+        atlas.update({ &request, 1 });
+        return atlas.getTile(1)->size;
+    };
+
+    REQUIRE(updateImportance(0.5f) == 128);
+    // 64 pixels would be enough, but the tile is kept until it is more than twice as large as needed.
+    REQUIRE(updateImportance(0.2f) == 128);
+    REQUIRE(atlas.getStatistics().numAllocations == 0);
+    REQUIRE(atlas.getScheduledLights().empty());
+    REQUIRE(updateImportance(0.1f) == 32);
+    REQUIRE(atlas.getStatistics().numAllocations == 1);
+    REQUIRE(updateImportance(0.3f) == 128);
+    // The new tile has no valid contents, so it is rendered.
+    REQUIRE(atlas.getScheduledLights().size() == 1);
+}
+
+TEST_CASE("ShadowAtlas evicts the least important lights when the atlas is full")
+{
+    ShadowAtlas atlas { { .atlasSize = 256, .minTileSize = 32, .maxTileSize = 128, .maxUpdatesPerFrame = 16 } };
+    std::vector<ShadowRequest> requests { makeRequest(1, 1.0f), makeRequest(2, 1.0f), makeRequest(3, 1.0f), makeRequest(4, 0.3f) };
+    atlas.update(requests);
+    REQUIRE(atlas.getStatistics().numTiles == 4);
+    REQUIRE(atlas.getTile(4)->size == 64);
+
+    // Light 5 needs a whole quadrant, which is only available when light 4 gives up its tile.
+    requests.push_back(makeRequest(5, 0.9f));
+    atlas.update(requests);
+    REQUIRE(atlas.getStatistics().numEvictions == 1);
+    REQUIRE(atlas.getStatistics().numTiles == 4);
+    REQUIRE(atlas.getTile(5)->size == 128);
+    REQUIRE(!atlas.getTile(4));
+    for (uint32_t lightId = 1; lightId <= 3; lightId++)
+        REQUIRE(atlas.getTile(lightId));
+
+    // Lights that are no longer requested free their tile.
+    requests = { makeRequest(4, 0.3f) };
+    atlas.update(requests);
+    REQUIRE(atlas.getStatistics().numTiles == 1);
+    REQUIRE(atlas.getAllocator().getUsage() == 1.0f / 16.0f);
+}
+
+TEST_CASE("ShadowAtlas renders at most maxUpdatesPerFrame tiles per update")
+{
+    ShadowAtlas atlas { { .atlasSize = 1024, .minTileSize = 32, .maxTileSize = 128, .maxUpdatesPerFrame = 2 } };
+    std::vector<ShadowRequest> requests;
+    for (uint32_t lightId = 1; lightId <= 5; lightId++)
+        requests.push_back(makeRequest(lightId, 0.1f * float(6 - lightId)));
+
+    // New tiles are rendered in order of importance; the others are not available until they have been rendered.
+    atlas.update(requests);
+    REQUIRE(std::vector<uint32_t>(atlas.getScheduledLights().begin(), atlas.getScheduledLights().end()) == std::vector<uint32_t> { 1, 2 });
+    REQUIRE(atlas.getStatistics().numPending == 3);
+    REQUIRE(atlas.getTile(1));
+    REQUIRE(!atlas.getTile(3));
+    atlas.update(requests);
+    REQUIRE(std::vector<uint32_t>(atlas.getScheduledLights().begin(), atlas.getScheduledLights().end()) == std::vector<uint32_t> { 3, 4 });
+    atlas.update(requests);
+    REQUIRE(std::vector<uint32_t>(atlas.getScheduledLights().begin(), atlas.getScheduledLights().end()) == std::vector<uint32_t> { 5 });
+    REQUIRE(atlas.getStatistics().numPending == 0);
+    // Nothing changed, so nothing is rendered.
+    atlas.update(requests);
+    REQUIRE(atlas.getScheduledLights().empty());
+
+    // When every light changes every frame, the waiting time eventually outweighs the importance.
+    for (ShadowRequest& request : requests)
+        request.castersChanged = true;
+    std::set<uint32_t> rendered;
+    for (int update = 0; update < 10; update++) {
+        atlas.update(requests);
+        REQUIRE(atlas.getScheduledLights().size() == 2);
+        REQUIRE(atlas.getStatistics().numPending == 3);
+        rendered.insert(atlas.getScheduledLights().begin(), atlas.getScheduledLights().end());
+        // Tiles that wait keep their previous (valid) contents.
+        for (uint32_t lightId = 1; lightId <= 5; lightId++)
+            REQUIRE(atlas.getTile(lightId));
+    }
+    REQUIRE(rendered.size() == 5);
+}
@@ -0,0 +1,199 @@
+#include "virtual_texture.h"
+#include <catch2/catch_test_macros.hpp>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+// Feedback pixel as written by shaders/vt_feedback_frag.glsl.
+static std::array<uint8_t, 4> encodeFeedback(int mip, const glm::ivec2& page)
+{
+    return { uint8_t(page.x & 255), uint8_t(page.y & 255), uint8_t((page.x >> 8) | ((page.y >> 8) << 4)), uint8_t(mip) };
+}
+
+TEST_CASE("VirtualTextureLayout rounds the page grid up to powers of two")
+{
+    const VirtualTextureLayout layout { { 1000, 300 }, 128, 4 };
+    REQUIRE(layout.pagesMip0 == glm::ivec2(8, 4));
+    REQUIRE(layout.numMips == 4);
+    REQUIRE(layout.pagesAtMip(2) == glm::ivec2(2, 1));
+    REQUIRE(layout.pagesAtMip(3) == glm::ivec2(1, 1));
+    REQUIRE(layout.parent(makeVirtualPageId(0, { 5, 3 })) == makeVirtualPageId(1, { 2, 1 }));
+}
+
+TEST_CASE("VirtualTextureLayout mip images cover the same part of the page grid at every level")
+{
+    // The page grid stops shrinking vertically after mip 1, so the image must stop shrinking vertically as well.
+    const VirtualTextureLayout layout { { 1024, 256 }, 128, 4 };
+    REQUIRE(layout.imageSizeAtMip(0) == glm::ivec2(1024, 256));
+    REQUIRE(layout.imageSizeAtMip(1) == glm::ivec2(512, 128));
+    REQUIRE(layout.imageSizeAtMip(2) == glm::ivec2(256, 128));
+    REQUIRE(layout.imageSizeAtMip(3) == glm::ivec2(128, 128));
+    for (int mip = 0; mip < layout.numMips; mip++) {
+        const glm::vec2 coverage = glm::vec2(layout.imageSizeAtMip(mip)) / glm::vec2(layout.pagesAtMip(mip) * layout.pageSize);
+        REQUIRE(coverage == layout.uvScale);
+    }
+}
+
+TEST_CASE("VirtualTexturePageTable evicts the least recently used page")
+{
+    const VirtualTextureLayout layout { { 1024, 1024 }, 128, 4 };
+    VirtualTexturePageTable pageTable { layout, { 2, 2 } };
+    const VirtualPageId root = makeVirtualPageId(3, { 0, 0 });
+    REQUIRE(pageTable.insert(root));
+    pageTable.pin(root);
+
+    const VirtualPageId a = makeVirtualPageId(0, { 0, 0 }), b = makeVirtualPageId(0, { 1, 0 }), c = makeVirtualPageId(0, { 2, 0 });
+    const auto slotA = pageTable.insert(a);
+    REQUIRE(slotA);
+    REQUIRE(pageTable.insert(b));
+    REQUIRE(pageTable.insert(c));
+    REQUIRE(pageTable.numResidentPages() == 4);
+
+    // a is the least recently used page until it is touched; then b is.
+    pageTable.touch(a);
+    const VirtualPageId d = makeVirtualPageId(0, { 3, 0 });
+    const auto slotD = pageTable.insert(d);
+    REQUIRE(slotD);
+    REQUIRE(!pageTable.isResident(b));
+    REQUIRE(pageTable.isResident(a));
+    REQUIRE(pageTable.isResident(root));
+    REQUIRE(pageTable.numResidentPages() == 4);
+    REQUIRE(pageTable.findSlot(a) == slotA);
+
+    // Inserting a resident page keeps its slot.
+    REQUIRE(pageTable.insert(d) == slotD);
+}
+
+TEST_CASE("VirtualTexturePageTable never evicts pinned pages")
+{
+    const VirtualTextureLayout layout { { 256, 256 }, 128, 4 };
+    VirtualTexturePageTable pageTable { layout, { 1, 2 } };
+    const VirtualPageId a = makeVirtualPageId(0, { 0, 0 }), b = makeVirtualPageId(0, { 1, 0 });
+    REQUIRE(pageTable.insert(a));
+    REQUIRE(pageTable.insert(b));
+    pageTable.pin(a);
+    pageTable.pin(b);
+    REQUIRE(!pageTable.insert(makeVirtualPageId(0, { 0, 1 })));
+    REQUIRE(pageTable.isResident(a));
+    REQUIRE(pageTable.isResident(b));
+}
+
+TEST_CASE("VirtualTexturePageTable indirection falls back to the closest resident ancestor")
+{
+    const VirtualTextureLayout layout { { 512, 512 }, 128, 4 };
+    VirtualTexturePageTable pageTable { layout, { 4, 4 } };
+    const VirtualPageId root = makeVirtualPageId(2, { 0, 0 });
+    const auto rootSlot = pageTable.insert(root);
+    pageTable.pin(root);
+    const VirtualPageId mip1 = makeVirtualPageId(1, { 1, 0 });
+    const auto mip1Slot = pageTable.insert(mip1);
+    const VirtualPageId mip0 = makeVirtualPageId(0, { 0, 0 });
+    const auto mip0Slot = pageTable.insert(mip0);
+    REQUIRE(pageTable.isIndirectionDirty());
+
+    const std::vector<glm::u8vec4> indirection = pageTable.buildIndirection(0);
+    REQUIRE(indirection.size() == 16);
+    const auto entry = [&](int x, int y) { return indirection[size_t(y * 4 + x)]; };
+    REQUIRE(entry(0, 0) == glm::u8vec4(*mip0Slot, 0, 255));
+    REQUIRE(entry(1, 0) == glm::u8vec4(*rootSlot, 2, 255));
+    REQUIRE(entry(2, 1) == glm::u8vec4(*mip1Slot, 1, 255));
+    REQUIRE(entry(3, 3) == glm::u8vec4(*rootSlot, 2, 255));
+
+    pageTable.clearIndirectionDirty();
+    pageTable.touch(mip0);
+    REQUIRE(!pageTable.isIndirectionDirty());
+}
+
+TEST_CASE("analyzeVirtualTextureFeedback decodes, filters and orders the requested pages")
+{
+    const VirtualTextureLayout layout { { 1 << 16, 1 << 16 }, 128, 4 }; // 512x512 pages at mip 0.
+    std::vector<uint8_t> feedback;
+    const auto add = [&](const std::array<uint8_t, 4>& pixel, int count) {
+        for (int i = 0; i < count; i++)
+            feedback.insert(std::end(feedback), std::begin(pixel), std::end(pixel));
+    };
+    add(encodeFeedback(0, { 300, 5 }), 3); // Page coordinates beyond 8 bits.
+    add(encodeFeedback(0, { 7, 260 }), 5);
+    add(encodeFeedback(2, { 1, 1 }), 1);
+    add({ 0, 0, 0, 255 }, 10); // No virtual texture sample.
+    add(encodeFeedback(1, { 300, 0 }), 2); // Outside of the 256x256 pages of mip 1.
+
+    const std::vector<VirtualPageRequest> requests = analyzeVirtualTextureFeedback(feedback, layout);
+    REQUIRE(requests.size() == 3);
+    // Coarse pages first, then by the number of samples.
+    REQUIRE(requests[0].page == makeVirtualPageId(2, { 1, 1 }));
+    REQUIRE(requests[0].numSamples == 1);
+    REQUIRE(requests[1].page == makeVirtualPageId(0, { 7, 260 }));
+    REQUIRE(requests[1].numSamples == 5);
+    REQUIRE(requests[2].page == makeVirtualPageId(0, { 300, 5 }));
+    REQUIRE(requests[2].numSamples == 3);
+}
+
+TEST_CASE("VirtualTexturePageStreamer copies the page with clamped borders")
+{
+    Image source { 256, 128, 4 };
+    for (int i = 0; i < source.width * source.height; i++) {
+        uint8_t* pPixel = source.get_data() + 4 * i;
+        pPixel[0] = uint8_t(i % source.width);
+        pPixel[1] = uint8_t(i / source.width);
+    }
+    const VirtualTextureLayout layout { { source.width, source.height }, 64, 2 };
+    VirtualTexturePageStreamer streamer { source, layout, 1 };
+
+    const std::vector<uint8_t> texels = streamer.loadPage(makeVirtualPageId(0, { 1, 0 }));
+    const int paddedSize = layout.paddedPageSize();
+    REQUIRE(texels.size() == size_t(paddedSize * paddedSize * 4));
+    const auto texel = [&](int x, int y) { return glm::ivec2(texels[size_t(4 * (y * paddedSize + x))], texels[size_t(4 * (y * paddedSize + x) + 1)]); };
+    // The payload starts after the border; the border to the left comes from the neighbouring page, the one above is
+    // clamped to the edge of the image.
+    REQUIRE(texel(2, 2) == glm::ivec2(64, 0));
+    REQUIRE(texel(0, 2) == glm::ivec2(62, 0));
+    REQUIRE(texel(2, 0) == glm::ivec2(64, 0));
+    REQUIRE(texel(67, 67) == glm::ivec2(129, 65));
+}
+
+TEST_CASE("VirtualTexturePageStreamer loads every page once until it is completed")
+{
+    const Image source { 256, 256, 4 };
+    const VirtualTextureLayout layout { { source.width, source.height }, 64, 2 };
+    VirtualTexturePageStreamer streamer { source, layout, 2 };
+    // Wait for the workers (with a generous timeout in case the machine is busy).
+    const auto collectLoaded = [&](size_t count) {
+        std::vector<VirtualPageId> pages;
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (pages.size() < count && std::chrono::steady_clock::now() < deadline) {
+            for (const auto& loadedPage : streamer.collect())
+                pages.push_back(loadedPage.page);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        std::sort(std::begin(pages), std::end(pages));
+        return pages;
+    };
+
+    const VirtualPageId first = makeVirtualPageId(0, { 1, 2 }), second = makeVirtualPageId(1, { 0, 1 });
+    streamer.request(first);
+    streamer.request(second);
+    streamer.request(first);
+    REQUIRE(streamer.numPendingRequests() == 2);
+    REQUIRE(collectLoaded(2) == std::vector<VirtualPageId> { std::min(first, second), std::max(first, second) });
+
+    // Loaded pages wait for their upload (as with the per frame upload budget), so requests for them are ignored.
+    REQUIRE(streamer.numPendingRequests() == 2);
+    streamer.request(first);
+    streamer.request(second);
+    streamer.complete(second);
+    REQUIRE(streamer.numPendingRequests() == 1);
+
+    // Once completed (e.g. evicted again), a page can be requested and loaded again.
+    streamer.request(second);
+    streamer.request(first);
+    REQUIRE(collectLoaded(1) == std::vector<VirtualPageId> { second });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    REQUIRE(streamer.collect().empty());
+    streamer.complete(first);
+    streamer.complete(second);
+    REQUIRE(streamer.numPendingRequests() == 0);
+}